@@ -56,10 +56,10 @@ choose_backend (const char* filename)
 
 
 /*
- *  Opening will fill WfDecoder.info which the caller must free using ad_free_nfo()
+ *  Open a single file, without checking for a split stereo pair.
  */
 bool
-ad_open (WfDecoder* d, const char* fname)
+ad_open_file (WfDecoder* d, const char* fname)
 {
 	ad_clear_nfo(&d->info);
 
@@ -75,6 +75,28 @@ ad_open (WfDecoder* d, const char* fname)
 }
 
 
+/*
+ *  Opening will fill WfDecoder.info which the caller must free using ad_free_nfo()
+ *
+ *  If the file is the lhs of a split stereo pair ("%L") and the rhs is present,
+ *  both halves are opened together as a stereo file.
+ */
+bool
+ad_open (WfDecoder* d, const char* fname)
+{
+	char* split = g_strrstr(fname, "%L");
+	if (split) {
+		g_autofree char* rhs = g_strdup(fname);
+		rhs[split - fname + 1] = 'R';
+		if (g_file_test(rhs, G_FILE_TEST_EXISTS) && ad_open_pair(d, fname, rhs)) {
+			return true;
+		}
+	}
+
+	return ad_open_file(d, fname);
+}
+
+
 /*
  *  Metadata must be freed with ad_free_nfo
  */
@@ -153,7 +175,8 @@ ad_read_peak (WfDecoder* d, WfBuf16* out)
 
 /*
  *  For fftw clients that prefer data as double.
- *  side-effects: allocates buffer
+ *  side-effects: allocates buffer. The buffer is per thread so that
+ *  files can be read concurrently by worker threads.
  */
 ssize_t
 ad_read_mono_dbl (WfDecoder* d, double* data, size_t len)
@@ -162,8 +185,8 @@ ad_read_mono_dbl (WfDecoder* d, double* data, size_t len)
 	int chn = d->info.channels;
 	if (len < 1) return 0;
 
-	static float *buf = NULL;
-	static size_t bufsiz = 0;
+	static __thread float *buf = NULL;
+	static __thread size_t bufsiz = 0;
 	if (!buf || bufsiz != len * chn) {
 		bufsiz = len * chn;
 		buf = (float*) realloc((void*)buf, bufsiz * sizeof(float));
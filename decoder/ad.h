@@ -62,6 +62,7 @@ typedef struct
 
 /* low level API */
 bool     ad_open          (WfDecoder*, const char*);
+bool     ad_open_pair     (WfDecoder*, const char* left, const char* right);
 int      ad_close         (WfDecoder*);
 void     ad_clear         (WfDecoder*);
 int64_t  ad_seek          (WfDecoder*, int64_t);
@@ -81,6 +82,7 @@ void     ad_thumbnail_free(WfDecoder*, AdPicture*);
 ssize_t  ad_read_mono_dbl (WfDecoder*, double*, size_t);
 
 /* hardcoded backends */
+const AdPlugin* get_pair    ();
 #ifdef USE_SNDFILE
 const AdPlugin* get_sndfile ();
 #endif
@@ -90,6 +92,10 @@ const AdPlugin* get_ffmpeg  ();
 
 #define ad_is_open(D) (D.d != NULL)
 
+#ifdef __ad_plugin_c__
+bool     ad_open_file     (WfDecoder*, const char*);
+#endif
+
 #define AD_FLOAT_TO_SHORT(A) round(A * 32767.f); // SHRT_MAX
 
 G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(WfDecoder, ad_clear)
@@ -0,0 +1,308 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of the Ayyi project. https://www.ayyi.org          |
+ | copyright (C) 2011-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Decoder for split stereo files, where each channel is stored in its  |
+ | own mono file, eg "name%L.wav" and "name%R.wav".                     |
+ |                                                                      |
+ | Both halves are held open and the pair is presented as a single      |
+ | stereo decoder, so it can be used anywhere a WfDecoder is used.      |
+ | For large reads the rhs is decoded by a pool thread while the        |
+ | calling thread decodes the lhs.                                      |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define __ad_plugin_c__
+
+#include "config.h"
+#include <string.h>
+#include <glib.h>
+#include "decoder/debug.h"
+#include "decoder/ad.h"
+
+#define MIN_CONCURRENT_READ 16384 // frames. For smaller reads the hand-off costs more than it saves
+#define MAX_READERS 4
+
+struct _WfBuf16 // also defined in waveform.h
+{
+    short*     buf[WF_STEREO];
+    guint      size;
+    uint32_t   stamp;
+#ifdef DEBUG
+    uint64_t   start_frame;
+#endif
+};
+
+typedef struct {
+    WfDecoder  half[WF_STEREO];
+    GMutex     lock;
+    GCond      cond;
+    struct {
+        WfBuf16  buf;
+        ssize_t  n_read;
+        bool     done;
+    }          rhs;     // an rhs read in progress in a pool thread
+} PairDecoder;
+
+static GThreadPool* readers = NULL;
+
+
+static int
+ad_eval_pair (const char* filename)
+{
+	return 0; // only used via ad_open_pair()
+}
+
+
+static int
+ad_info_pair (WfDecoder* d)
+{
+	PairDecoder* pair = d->d;
+	if (!pair) return -1;
+
+	WfAudioInfo* lhs = &pair->half[WF_LEFT].info;
+	WfAudioInfo* rhs = &pair->half[WF_RIGHT].info;
+
+	d->info = (WfAudioInfo){
+		.channels    = WF_STEREO,
+		.frames      = MAX(lhs->frames, rhs->frames),
+		.sample_rate = lhs->sample_rate,
+		.length      = MAX(lhs->length, rhs->length),
+		.bit_depth   = lhs->bit_depth,
+		.bit_rate    = lhs->bit_rate + rhs->bit_rate,
+		.meta_data   = g_steal_pointer(&lhs->meta_data),
+	};
+
+	return 0;
+}
+
+
+/*
+ *  Open the halves of a split stereo file as a single stereo decoder.
+ *  Fails if either half cannot be opened or is not mono.
+ */
+bool
+ad_open_pair (WfDecoder* d, const char* left, const char* right)
+{
+	ad_clear_nfo(&d->info);
+
+	PairDecoder* pair = g_new0(PairDecoder, 1);
+	const char* filenames[] = {left, right};
+
+	for (int c=0;c<WF_STEREO;c++) {
+		if (!ad_open_file(&pair->half[c], filenames[c])) {
+			dbg(1, "cannot open %s", filenames[c]);
+			goto fail;
+		}
+		if (pair->half[c].info.channels != 1) {
+			dbg(1, "not mono: %s", filenames[c]);
+			goto fail;
+		}
+	}
+
+	if (pair->half[WF_LEFT].info.sample_rate != pair->half[WF_RIGHT].info.sample_rate) {
+		pwarn("sample rates differ: %s", left);
+		goto fail;
+	}
+
+	g_mutex_init(&pair->lock);
+	g_cond_init(&pair->cond);
+
+	d->b = get_pair();
+	d->d = pair;
+	ad_info_pair(d);
+
+	return true;
+
+  fail:
+	for (int c=0;c<WF_STEREO;c++) {
+		if (ad_is_open(pair->half[c])) ad_clear(&pair->half[c]);
+	}
+	g_free(pair);
+
+	return false;
+}
+
+
+static bool
+ad_open_pair_ (WfDecoder* d, const char* left)
+{
+	char* split = g_strrstr(left, "%L");
+	if (!split) return false;
+
+	g_autofree char* right = g_strdup(left);
+	right[split - left + 1] = 'R';
+
+	return ad_open_pair(d, left, right);
+}
+
+
+static int
+ad_close_pair (WfDecoder* d)
+{
+	PairDecoder* pair = d->d;
+	if (!pair) return -1;
+
+	for (int c=0;c<WF_STEREO;c++) {
+		ad_clear(&pair->half[c]);
+	}
+	g_mutex_clear(&pair->lock);
+	g_cond_clear(&pair->cond);
+	g_clear_pointer(&d->d, g_free);
+
+	return 0;
+}
+
+
+static int64_t
+ad_seek_pair (WfDecoder* d, int64_t pos)
+{
+	PairDecoder* pair = d->d;
+	if (!pair) return -1;
+
+	int64_t l = ad_seek(&pair->half[WF_LEFT], pos);
+	int64_t r = ad_seek(&pair->half[WF_RIGHT], pos);
+
+	return (l < 0 || r < 0) ? -1 : l;
+}
+
+
+static void
+read_rhs (gpointer _pair, gpointer _)
+{
+	PairDecoder* pair = _pair;
+
+	ssize_t n = ad_read_short(&pair->half[WF_RIGHT], &pair->rhs.buf);
+
+	g_mutex_lock(&pair->lock);
+	pair->rhs.n_read = n;
+	pair->rhs.done = true;
+	g_cond_signal(&pair->cond);
+	g_mutex_unlock(&pair->lock);
+}
+
+
+/*
+ *  If the halves are not the same length, the shorter one is padded with silence.
+ */
+static ssize_t
+ad_read_short_pair (WfDecoder* d, WfBuf16* out)
+{
+	PairDecoder* pair = d->d;
+	if (!pair) return -1;
+
+	WfBuf16 lhs = {.buf = {out->buf[WF_LEFT]}, .size = out->size};
+	WfBuf16 rhs = {.buf = {out->buf[WF_RIGHT]}, .size = out->size};
+
+	ssize_t n[WF_STEREO];
+
+	if (out->size >= MIN_CONCURRENT_READ) {
+		static gsize once = 0;
+		if (g_once_init_enter(&once)) {
+			readers = g_thread_pool_new(read_rhs, NULL, MAX_READERS, false, NULL);
+			g_once_init_leave(&once, 1);
+		}
+
+		pair->rhs.buf = rhs;
+		pair->rhs.done = false;
+		g_thread_pool_push(readers, pair, NULL);
+
+		n[WF_LEFT] = ad_read_short(&pair->half[WF_LEFT], &lhs);
+
+		g_mutex_lock(&pair->lock);
+		while (!pair->rhs.done) g_cond_wait(&pair->cond, &pair->lock);
+		n[WF_RIGHT] = pair->rhs.n_read;
+		g_mutex_unlock(&pair->lock);
+	} else {
+		n[WF_LEFT] = ad_read_short(&pair->half[WF_LEFT], &lhs);
+		n[WF_RIGHT] = ad_read_short(&pair->half[WF_RIGHT], &rhs);
+	}
+
+	ssize_t n_frames = MAX(n[WF_LEFT], n[WF_RIGHT]);
+	for (int c=0;c<WF_STEREO;c++) {
+		if (n[c] < n_frames) {
+			int start = MAX(0, n[c]);
+			memset(out->buf[c] + start, 0, (n_frames - start) * sizeof(short));
+		}
+	}
+
+	return n_frames;
+}
+
+
+/*
+ *  Output is interleaved. @len is n_frames * 2
+ */
+static ssize_t
+ad_read_pair (WfDecoder* d, float* out, size_t len)
+{
+	PairDecoder* pair = d->d;
+	if (!pair) return -1;
+
+	size_t n_frames = len / WF_STEREO;
+	float* buf = g_malloc0(n_frames * sizeof(float));
+
+	ssize_t n_read = 0;
+	for (int c=0;c<WF_STEREO;c++) {
+		ssize_t n = ad_read(&pair->half[c], buf, n_frames);
+		for (int i=0;i<n_frames;i++) {
+			out[i * WF_STEREO + c] = i < n ? buf[i] : 0.f;
+		}
+		n_read = MAX(n_read, n);
+	}
+
+	g_free(buf);
+
+	return n_read;
+}
+
+
+static ssize_t
+ad_read_s32_pair (WfDecoder* d, int32_t* out, size_t len)
+{
+	PairDecoder* pair = d->d;
+	if (!pair) return -1;
+
+	size_t n_frames = len / WF_STEREO;
+	int32_t* buf = g_malloc0(n_frames * sizeof(int32_t));
+
+	ssize_t n_read = 0;
+	for (int c=0;c<WF_STEREO;c++) {
+		ssize_t n = ad_read_s32(&pair->half[c], buf, n_frames);
+		for (int i=0;i<n_frames;i++) {
+			out[i * WF_STEREO + c] = i < n ? buf[i] : 0;
+		}
+		n_read = MAX(n_read, n);
+	}
+
+	g_free(buf);
+
+	return n_read;
+}
+
+
+const static AdPlugin ad_pair = {
+	&ad_eval_pair,
+	&ad_open_pair_,
+	&ad_close_pair,
+	&ad_info_pair,
+	&ad_seek_pair,
+	&ad_read_pair,
+	&ad_read_short_pair,
+	&ad_read_s32_pair
+};
+
+
+const AdPlugin*
+get_pair ()
+{
+	return &ad_pair;
+}
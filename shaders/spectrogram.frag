@@ -0,0 +1,35 @@
+/**
+* +----------------------------------------------------------------------+
+* | This file is part of the Ayyi project. https://www.ayyi.org          |
+* | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+* +----------------------------------------------------------------------+
+* | This program is free software; you can redistribute it and/or modify |
+* | it under the terms of the GNU General Public License version 3       |
+* | as published by the Free Software Foundation.                        |
+* +----------------------------------------------------------------------+
+*
+*/
+
+uniform sampler2D tex2d;
+uniform float opacity;
+
+varying vec2 tex_coords;
+
+/*
+ *  The texture contains log magnitudes in the alpha channel.
+ *  They are mapped to black -> blue -> red -> yellow -> white
+ */
+void main ()
+{
+	float m = texture2D(tex2d, tex_coords.xy).a;
+
+	vec3 colour = m < 0.25
+		? mix(vec3(0.0, 0.0, 0.0), vec3(0.0, 0.0, 0.6), m * 4.0)
+		: m < 0.5
+			? mix(vec3(0.0, 0.0, 0.6), vec3(0.8, 0.0, 0.2), (m - 0.25) * 4.0)
+			: m < 0.75
+				? mix(vec3(0.8, 0.0, 0.2), vec3(1.0, 0.9, 0.0), (m - 0.5) * 4.0)
+				: mix(vec3(1.0, 0.9, 0.0), vec3(1.0, 1.0, 1.0), (m - 0.75) * 4.0);
+
+	gl_FragColor = vec4(colour, opacity);
+}
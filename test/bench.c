@@ -0,0 +1,643 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ | libwaveform benchmarks
+ |
+ | This is a non-interactive test that does not need a display.
+ | Rendering is done using the cpu (pixbuf) renderer.
+ |
+ | The results are written as json. If a baseline file is present, each
+ | result is compared against it and the test fails if any result has
+ | regressed by more than the tolerance. If no baseline is present, the
+ | results are saved as the new baseline.
+ |
+ | Timings are compared using the median as single samples are too noisy.
+ | The maximums are included in the results for information only. Counts,
+ | such as the number of slow frames, are compared using an absolute
+ | threshold so that an increase from a zero baseline is detected.
+ |
+ | usage: bench [--baseline FILE] [--output FILE] [--tolerance PERCENT] [--update] [--audio FILE]... [--trace FILE]
+ |
+ | --audio can be given several times to measure the compressed audio
+ | cache against real material such as music and dialogue.
+ |
+ | --trace replays an interaction trace recorded with wf_trace_start()
+ | instead of the built in zoom and scrub gesture.
+ |
+ */
+
+#define __wf_private__
+
+#include "config.h"
+#include <getopt.h>
+#include <math.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "decoder/ad.h"
+#include "wf/waveform.h"
+#include "wf/peakgen.h"
+#include "wf/audio.h"
+#include "wf/compressed.h"
+#include "wf/profile.h"
+#include "waveform/pixbuf.h"
+#include "waveform/context.h"
+#include "waveform/actor.h"
+#include "waveform/trace.h"
+#include "test/runner.h"
+#include "test/common.h"
+#include "test/bench.h"
+
+#define WAV_SHORT "stereo_0:10.wav"
+#define WAV_LONG  "mono_10:00.wav"
+#define PEAKFILE  "bench.peak"
+#define WAV_PIANO "piano.wav"
+
+#define N_PEAKGEN_RUNS  3
+#define MAX_LOAD_BLOCKS 64
+#define N_RENDER_FRAMES 64
+#define RENDER_WIDTH    512
+#define RENDER_HEIGHT   64
+#define N_TIERS         3
+#define FRAME_INTERVAL  16000 // usecs
+#define COUNT_THRESHOLD 2     // the increase allowed for counts, in addition to the tolerance
+
+typedef enum {
+	METRIC_VALUE = 0,  // compared relative to the baseline
+	METRIC_COUNT,      // compared with an absolute threshold
+	METRIC_INFO,       // not compared
+} MetricKind;
+
+typedef struct {
+	char       name[64];
+	double     value;
+	bool       higher_is_better;
+	MetricKind kind;
+} Metric;
+
+static struct {
+	char*  baseline;
+	char*  output;
+	double tolerance; // percent
+	bool   update;
+	char*  audio[8];
+	int    n_audio;
+	char*  trace;
+	Metric metrics[64];
+	int    n_metrics;
+} bench = {
+	.baseline = "bench-baseline.json",
+	.output = "bench-results.json",
+	.tolerance = 25.0,
+};
+
+// samples per pixel for each Mode, taken from the centre of each zoom range in ui/actor.c
+static const struct {
+	char*  name;
+	double samples_per_px;
+} modes[] = {
+	{"V_LOW", 131072.0},
+	{"LOW",   16384.0},
+	{"MED",   1024.0},
+	{"HI",    64.0},
+	{"V_HI",  4.0},
+};
+
+
+static void
+add_metric_full (const char* name, double value, bool higher_is_better, MetricKind kind)
+{
+	g_return_if_fail(bench.n_metrics < G_N_ELEMENTS(bench.metrics));
+
+	Metric* m = &bench.metrics[bench.n_metrics++];
+	g_strlcpy(m->name, name, sizeof(m->name));
+	m->value = value;
+	m->higher_is_better = higher_is_better;
+	m->kind = kind;
+
+	printf("  %-28s %12.2f%s\n", name, value, kind == METRIC_INFO ? " (info)" : "");
+}
+
+
+static void
+add_metric (const char* name, double value, bool higher_is_better)
+{
+	add_metric_full(name, value, higher_is_better, METRIC_VALUE);
+}
+
+
+static int
+compare_times (gconstpointer a, gconstpointer b)
+{
+	int64_t d = *(int64_t*)a - *(int64_t*)b;
+	return d < 0 ? -1 : d > 0;
+}
+
+
+/*
+ *  Add the median and the maximum of the timings in @times. Only the median is compared with the baseline.
+ */
+static void
+add_timings (const char* prefix, GArray* times)
+{
+	g_return_if_fail(times->len);
+
+	g_array_sort(times, compare_times);
+
+	char name[64];
+	snprintf(name, 64, "%s.median_us", prefix);
+	add_metric(name, g_array_index(times, int64_t, times->len / 2), false);
+	snprintf(name, 64, "%s.max_us", prefix);
+	add_metric_full(name, g_array_index(times, int64_t, times->len - 1), false, METRIC_INFO);
+}
+
+
+int
+setup (int argc, char* argv[])
+{
+	static const struct option long_options[] = {
+		{ "baseline",         1, NULL, 'b' },
+		{ "output",           1, NULL, 'o' },
+		{ "tolerance",        1, NULL, 't' },
+		{ "update",           0, NULL, 'u' },
+		{ "audio",            1, NULL, 'a' },
+		{ "trace",            1, NULL, 'r' },
+		{ "non-interactive",  0, NULL, 'n' },
+		{ NULL }
+	};
+
+	int opt;
+	while ((opt = getopt_long (argc, argv, "b:o:t:ua:r:n", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'b':
+				bench.baseline = optarg;
+				break;
+			case 'o':
+				bench.output = optarg;
+				break;
+			case 't':
+				bench.tolerance = g_ascii_strtod(optarg, NULL);
+				break;
+			case 'u':
+				bench.update = true;
+				break;
+			case 'a':
+				if (bench.n_audio < G_N_ELEMENTS(bench.audio)) bench.audio[bench.n_audio++] = optarg;
+				break;
+			case 'r':
+				bench.trace = optarg;
+				break;
+			case 'n':
+				break;
+			default:
+				printf("Usage: bench [--baseline FILE] [--output FILE] [--tolerance PERCENT] [--update] [--audio FILE]... [--trace FILE]\n");
+				return EXIT_FAILURE;
+		}
+	}
+
+	return 0;
+}
+
+
+void
+test_peakgen ()
+{
+	START_TEST;
+	test_reset_timeout(120000);
+
+	char* wavs[] = {WAV_SHORT, WAV_LONG};
+
+	for (int i=0;i<G_N_ELEMENTS(wavs);i++) {
+		g_autofree char* filename = find_wav(wavs[i]);
+		assert(filename, "cannot find file %s", wavs[i]);
+
+		GStatBuf info;
+		assert(!g_stat(filename, &info), "stat failed");
+
+		// use the best of several runs to reduce the effect of other system activity
+		int64_t best = G_MAXINT64;
+		for (int r=0;r<N_PEAKGEN_RUNS;r++) {
+			int64_t t0 = g_get_monotonic_time();
+			assert(wf_peakgen__sync(filename, PEAKFILE, NULL), "peakgen failed");
+			best = MIN(best, g_get_monotonic_time() - t0);
+		}
+		g_unlink(PEAKFILE);
+
+		g_autofree char* name = g_strdup_printf("peakgen.%s.mb_per_sec", i ? "long" : "short");
+		add_metric(name, (info.st_size / (1024.0 * 1024.0)) / (MAX(best, 1) / 1000000.0), true);
+	}
+
+	FINISH_TEST;
+}
+
+
+void
+test_block_load ()
+{
+	// time the loading of uncached audio blocks, then scroll across the
+	// whole file and back again to measure how much the audio cache churns.
+
+	START_TEST;
+	test_reset_timeout(120000);
+
+	g_autofree char* filename = find_wav(WAV_LONG);
+	assert(filename, "cannot find file %s", WAV_LONG);
+
+	Waveform* w = waveform_new(filename);
+	assert(waveform_load_sync(w), "failed to load %s", WAV_LONG);
+
+	int n_blocks = waveform_get_n_audio_blocks(w);
+	int n = MIN(n_blocks, MAX_LOAD_BLOCKS);
+	assert(n, "no blocks");
+
+	g_autoptr(GArray) times = g_array_sized_new(false, false, sizeof(int64_t), n);
+	int64_t total = 0;
+	for (int b=0;b<n;b++) {
+		int64_t t0 = g_get_monotonic_time();
+		waveform_load_audio_sync(w, b, N_TIERS);
+		int64_t t = g_get_monotonic_time() - t0;
+		total += t;
+		g_array_append_val(times, t);
+	}
+	add_metric("block_load.mean_us", total / (double)n, false);
+	add_timings("block_load", times);
+
+	wf_profile_enable(true);
+	for (int b=0;b<n_blocks;b++) waveform_load_audio_sync(w, b, N_TIERS);
+	for (int b=n_blocks-1;b>=0;b--) waveform_load_audio_sync(w, b, N_TIERS);
+	wf_profile_frame_end();
+	const WfFrameStats* stats = wf_profile_get_frame(0);
+	int accesses = stats->audio_cache_hits + stats->audio_cache_misses;
+	assert(accesses == 2 * n_blocks, "unexpected number of cache accesses %i", accesses);
+	wf_profile_enable(false);
+
+	add_metric("audio_cache.miss_percent", 100.0 * stats->audio_cache_misses / accesses, false);
+
+	g_object_unref(w);
+
+	FINISH_TEST;
+}
+
+
+void
+test_render ()
+{
+	// scroll across the file at the zoom level of each mode,
+	// rendering a frame at each step.
+
+	START_TEST;
+	test_reset_timeout(120000);
+
+	g_autofree char* filename = find_wav(WAV_LONG);
+	assert(filename, "cannot find file %s", WAV_LONG);
+
+	Waveform* w = waveform_new(filename);
+	assert(waveform_load_sync(w), "failed to load %s", WAV_LONG);
+
+	uint64_t n_frames = waveform_get_n_frames(w);
+	WfPixbufScratch* scratch = wf_pixbuf_scratch_new();
+
+	for (int m=0;m<G_N_ELEMENTS(modes);m++) {
+		double spp = modes[m].samples_per_px;
+		bool hires = spp < WF_PEAK_RATIO;
+		int width = MIN(RENDER_WIDTH, n_frames / spp);
+		assert(width > 0, "file too short");
+		uint64_t frames_per_view = width * spp;
+		uint64_t step = frames_per_view / 8;
+
+		GdkPixbuf* pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, width, RENDER_HEIGHT);
+
+		g_autoptr(GArray) times = g_array_sized_new(false, false, sizeof(int64_t), N_RENDER_FRAMES);
+		int64_t total = 0;
+		uint64_t start = 0;
+		for (int f=0;f<N_RENDER_FRAMES;f++) {
+			if (start + frames_per_view > n_frames) start = 0;
+
+			int64_t t0 = g_get_monotonic_time();
+			if (hires) {
+				int b1 = start / WF_SAMPLES_PER_TEXTURE;
+				int b2 = MIN((start + frames_per_view) / WF_SAMPLES_PER_TEXTURE, waveform_get_n_audio_blocks(w) - 1);
+				for (int b=b1;b<=b2;b++) waveform_load_audio_sync(w, b, N_TIERS);
+			}
+			waveform_peak_to_pixbuf_full_r(w, scratch, pixbuf, start, NULL, NULL, spp, 0xffffffff, 0x000000ff, 1.0, false);
+			int64_t t = g_get_monotonic_time() - t0;
+
+			total += t;
+			g_array_append_val(times, t);
+			start += step;
+		}
+
+		g_object_unref(pixbuf);
+
+		char name[64];
+		snprintf(name, 64, "render.%s.mean_us", modes[m].name);
+		add_metric(name, total / (double)N_RENDER_FRAMES, false);
+		snprintf(name, 64, "render.%s", modes[m].name);
+		add_timings(name, times);
+	}
+
+	wf_pixbuf_scratch_free(scratch);
+	g_object_unref(w);
+
+	FINISH_TEST;
+}
+
+
+void
+test_compressed_cache ()
+{
+	// For each file, compress every block to find how many more blocks the
+	// compressed cache can hold than the uncompressed one, and compare the
+	// time to restore a block with the time to decode it from the file.
+
+	START_TEST;
+	test_reset_timeout(120000);
+
+	char* defaults[] = {WAV_PIANO, WAV_SHORT};
+	char** files = bench.n_audio ? bench.audio : defaults;
+	int n_files = bench.n_audio ? bench.n_audio : G_N_ELEMENTS(defaults);
+
+	short* data[WF_STEREO] = {g_malloc(WF_PEAK_BLOCK_SIZE * sizeof(short)), g_malloc(WF_PEAK_BLOCK_SIZE * sizeof(short))};
+	short* restored = g_malloc(WF_PEAK_BLOCK_SIZE * sizeof(short));
+	guchar* packed = g_malloc(WF_COMPRESSED_MAX_SIZE(WF_PEAK_BLOCK_SIZE));
+
+	for (int i=0;i<n_files;i++) {
+		g_autofree char* filename = find_wav(files[i]);
+		assert(filename, "cannot find file %s", files[i]);
+
+		WfDecoder d = {{0,}};
+		assert(ad_open(&d, filename), "failed to open %s", files[i]);
+		int n_chans = MIN(d.info.channels, WF_STEREO);
+
+		size_t raw = 0, compressed = 0;
+		int64_t decode_time = 0, decompress_time = 0;
+		WfBuf16 buf = {.buf = {data[0], data[1]}, .size = WF_PEAK_BLOCK_SIZE};
+
+		while (true) {
+			int64_t t0 = g_get_monotonic_time();
+			ssize_t n = ad_read_short(&d, &buf);
+			decode_time += g_get_monotonic_time() - t0;
+			if (n <= 0) break;
+
+			for (int c=0;c<n_chans;c++) {
+				size_t len = wf_compress_block(data[c], n, packed);
+
+				t0 = g_get_monotonic_time();
+				bool ok = wf_decompress_block(packed, len, restored, n);
+				decompress_time += g_get_monotonic_time() - t0;
+				assert(ok && !memcmp(restored, data[c], n * sizeof(short)), "%s: compression is not lossless", files[i]);
+
+				raw += n * sizeof(short);
+				compressed += len;
+			}
+		}
+		ad_close(&d);
+		assert(raw, "%s: no audio", files[i]);
+
+		g_autofree char* base = g_path_get_basename(files[i]);
+		for (char* c=base;*c;c++) if (!g_ascii_isalnum(*c)) *c = '_';
+
+		char name[64];
+		snprintf(name, 64, "compressed.%s.ratio", base);
+		add_metric(name, (double)raw / compressed, true);
+		snprintf(name, 64, "compressed.%s.speedup", base);
+		add_metric(name, (double)MAX(decode_time, 1) / MAX(decompress_time, 1), true);
+	}
+
+	g_free(data[0]);
+	g_free(data[1]);
+	g_free(restored);
+	g_free(packed);
+
+	FINISH_TEST;
+}
+
+
+	typedef struct {
+		WaveformActor**  actors;
+		int              n_actors;
+		WfPixbufScratch* scratch;
+		GdkPixbuf*       pixbuf;
+	} Replay;
+
+	static WfTrace* zoom_and_scrub (const char* filename, uint64_t n_frames)
+	{
+		// zoom quickly from V_LOW into HI while panning, then scrub across
+		// block boundaries in V_HI. One event per frame.
+
+		WfTrace* trace = wf_trace_new();
+		g_ptr_array_add(trace->actors, g_strdup(filename));
+
+		int64_t t = 0;
+		void add (WfTraceEvent event)
+		{
+			event.time = t;
+			g_array_append_val(trace->events, event);
+			t += FRAME_INTERVAL;
+		}
+
+		add((WfTraceEvent){.type = WF_TRACE_REGION, .actor = 0, .region = {0, n_frames}});
+		add((WfTraceEvent){.type = WF_TRACE_RECT, .actor = 0, .rect = {0.0, 0.0, RENDER_WIDTH, RENDER_HEIGHT}});
+		add((WfTraceEvent){.type = WF_TRACE_SCALE, .actor = -1, .f = modes[0].samples_per_px});
+
+		#define N_ZOOM_STEPS 60
+		double ratio = modes[0].samples_per_px / modes[3].samples_per_px;
+		int64_t start = 0;
+		for (int i=1;i<=N_ZOOM_STEPS;i++) {
+			double zoom = pow(ratio, (double)i / N_ZOOM_STEPS);
+			start += (modes[0].samples_per_px / zoom) * RENDER_WIDTH / 16;
+			add((WfTraceEvent){.type = WF_TRACE_ZOOM, .actor = -1, .f = zoom});
+			add((WfTraceEvent){.type = WF_TRACE_START, .actor = -1, .frame = start});
+		}
+
+		add((WfTraceEvent){.type = WF_TRACE_ZOOM, .actor = -1, .f = modes[0].samples_per_px / modes[4].samples_per_px});
+		for (int i=0;i<N_RENDER_FRAMES;i++) {
+			start += WF_SAMPLES_PER_TEXTURE / 3;
+			add((WfTraceEvent){.type = WF_TRACE_START, .actor = -1, .frame = start});
+		}
+
+		return trace;
+	}
+
+	static void paint_headless (WaveformContext* wfc, gpointer _replay)
+	{
+		// do the same work as the actors, using the cpu renderer
+
+		Replay* replay = _replay;
+
+		for (int i=0;i<replay->n_actors;i++) {
+			WaveformActor* a = replay->actors[i];
+			Waveform* w = a->waveform;
+			float width = agl_actor__width((AGlActor*)a);
+			if (!a->region.len || width < 1.0) continue;
+
+			double spp = wfc->scaled ? wfc->samples_per_pixel / wfc->zoom->value.f : a->region.len / width;
+			uint64_t start = a->region.start + (wfc->scaled ? wfc->start_time->value.b : 0);
+			uint64_t end = MIN(a->region.start + a->region.len, start + (uint64_t)(RENDER_WIDTH * spp));
+			if (start >= end) continue;
+
+			if (spp < WF_PEAK_RATIO) {
+				int b2 = MIN((end - 1) / WF_SAMPLES_PER_TEXTURE, waveform_get_n_audio_blocks(w) - 1);
+				for (int b=start/WF_SAMPLES_PER_TEXTURE;b<=b2;b++) waveform_load_audio_sync(w, b, N_TIERS);
+			}
+			waveform_peak_to_pixbuf_full_r(w, replay->scratch, replay->pixbuf, start, NULL, NULL, spp, 0xffffffff, 0x000000ff, a->vzoom, false);
+		}
+	}
+
+void
+test_replay ()
+{
+	// replay a recorded interaction, or the built in gesture, without a display.
+	// The timings include the loading of audio that is needed for each frame.
+
+	START_TEST;
+	test_reset_timeout(120000);
+
+	g_autoptr(WfTrace) trace = NULL;
+	if (bench.trace) {
+		GError* error = NULL;
+		trace = wf_trace_load(bench.trace, &error);
+		assert(trace, "%s", error->message);
+	} else {
+		g_autofree char* filename = find_wav(WAV_LONG);
+		assert(filename, "cannot find file %s", WAV_LONG);
+		Waveform* w = waveform_new(filename);
+		trace = zoom_and_scrub(filename, waveform_get_n_frames(w));
+		g_object_unref(w);
+	}
+
+	static AGlScene scene = {.enable_animations = false};
+	WaveformContext* context = wf_context_new(NULL);
+	context->root = (AGlActor*)&scene;
+	context->root->root = &scene;
+
+	Replay replay = {
+		.actors = g_new0(WaveformActor*, trace->actors->len),
+		.n_actors = trace->actors->len,
+		.scratch = wf_pixbuf_scratch_new(),
+		.pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, RENDER_WIDTH, RENDER_HEIGHT),
+	};
+	for (int i=0;i<replay.n_actors;i++) {
+		char* filename = g_ptr_array_index(trace->actors, i);
+		Waveform* w = waveform_new(filename);
+		assert(waveform_load_sync(w), "failed to load %s", filename);
+
+		WaveformActor* a = replay.actors[i] = wf_context_add_new_actor(context, w);
+		((AGlActor*)a)->root = &scene;
+		((AGlActor*)a)->parent = (AGlActor*)&scene;
+		g_object_unref(w);
+	}
+
+	g_autoptr(GArray) frames = wf_trace_replay(trace, context, replay.actors, replay.n_actors, FRAME_INTERVAL, paint_headless, &replay);
+	assert(frames && frames->len, "no frames");
+
+	g_autoptr(GArray) times = g_array_sized_new(false, false, sizeof(int64_t), frames->len);
+	int64_t total = 0;
+	int n_slow = 0;
+	for (int i=0;i<frames->len;i++) {
+		WfTraceFrame* frame = &g_array_index(frames, WfTraceFrame, i);
+		int64_t t = frame->duration;
+		total += t;
+		g_array_append_val(times, t);
+		if (frame->duration > FRAME_INTERVAL) n_slow++;
+	}
+	add_metric("replay.mean_us", total / (double)frames->len, false);
+	add_timings("replay", times);
+	add_metric_full("replay.slow_frames", n_slow, false, METRIC_COUNT);
+
+	// the actors are not in the scenegraph so are not freed
+	g_free(replay.actors);
+	g_object_unref(replay.pixbuf);
+	wf_pixbuf_scratch_free(replay.scratch);
+	wf_context_free(context);
+
+	FINISH_TEST;
+}
+
+
+static char*
+results_to_json ()
+{
+	GString* s = g_string_new("{\n");
+	for (int i=0;i<bench.n_metrics;i++) {
+		char value[G_ASCII_DTOSTR_BUF_SIZE];
+		g_string_append_printf(s, "  \"%s\": %s%s\n", bench.metrics[i].name, g_ascii_formatd(value, sizeof(value), "%.3f", bench.metrics[i].value), i < bench.n_metrics - 1 ? "," : "");
+	}
+	g_string_append(s, "}\n");
+
+	return g_string_free(s, false);
+}
+
+
+/*
+ *  Only the flat single-level format written by results_to_json is supported.
+ */
+static bool
+baseline_lookup (const char* json, const char* name, double* value)
+{
+	g_autofree char* key = g_strdup_printf("\"%s\":", name);
+	const char* p = strstr(json, key);
+	if (!p) return false;
+
+	char* end;
+	*value = g_ascii_strtod(p + strlen(key), &end);
+
+	return end != p + strlen(key);
+}
+
+
+void
+test_compare ()
+{
+	START_TEST;
+
+	assert(bench.n_metrics, "no results");
+
+	g_autofree char* json = results_to_json();
+	assert(g_file_set_contents(bench.output, json, -1, NULL), "failed to write %s", bench.output);
+	printf("  results written to %s\n", bench.output);
+
+	g_autofree char* baseline = NULL;
+	if (bench.update || !g_file_get_contents(bench.baseline, &baseline, NULL, NULL)) {
+		assert(g_file_set_contents(bench.baseline, json, -1, NULL), "failed to write %s", bench.baseline);
+		printf("  baseline saved to %s\n", bench.baseline);
+		FINISH_TEST;
+	}
+
+	int n_regressions = 0;
+	for (int i=0;i<bench.n_metrics;i++) {
+		Metric* m = &bench.metrics[i];
+		if (m->kind == METRIC_INFO) continue;
+
+		double expected;
+		if (!baseline_lookup(baseline, m->name, &expected)) {
+			pwarn("no baseline for %s", m->name);
+			continue;
+		}
+
+		// a zero baseline cannot be compared as a percentage
+		double change = expected > 0.0 ? 100.0 * (m->value - expected) / expected : (m->value > expected ? INFINITY : 0.0);
+		bool regressed;
+		if (m->kind == METRIC_COUNT) {
+			regressed = m->value > expected + MAX(COUNT_THRESHOLD, expected * bench.tolerance / 100.0);
+		} else if (expected <= 0.0) {
+			regressed = !m->higher_is_better && m->value > expected;
+		} else {
+			regressed = m->higher_is_better ? (-change > bench.tolerance) : (change > bench.tolerance);
+		}
+		if (regressed) {
+			printf("  %s%-28s %12.2f (baseline %.2f, %+.1f%%)%s\n", RED, m->name, m->value, expected, change, ayyi_white);
+			n_regressions++;
+		}
+	}
+
+	assert(!n_regressions, "%i results regressed by more than %.0f%%", n_regressions, bench.tolerance);
+
+	FINISH_TEST;
+}
@@ -44,6 +44,7 @@
 #pragma GCC diagnostic warning "-Wdeprecated-declarations"
 #include <gdk/gdkkeysyms.h>
 #include "waveform/view_plus.h"
+#include "waveform/profile.h"
 #include "test/common2.h"
 
 //#define WAV "mono_0:10.wav"
@@ -53,9 +54,27 @@ static uint64_t get_time ();
 
 static const struct option long_options[] = {
 	{ "non-interactive",  0, NULL, 'n' },
+	{ "trace",            1, NULL, 't' },
+	{ NULL,               0, NULL, 0 },
 };
 
-static const char* const short_options = "n";
+static const char* const short_options = "nt:";
+
+static char* trace_file = NULL;
+
+
+static void
+quit ()
+{
+	if(trace_file){
+		GError* error = NULL;
+		if(!wf_profile_write_chrome_trace(trace_file, &error)){
+			perr("%s", error->message);
+			g_error_free(error);
+		}
+	}
+	exit(EXIT_SUCCESS);
+}
 
 
 int
@@ -69,11 +88,16 @@ main (int argc, char* argv[])
 	while((opt = getopt_long (argc, argv, short_options, long_options, NULL)) != -1) {
 		switch(opt) {
 			case 'n':
-				g_timeout_add(3000, (gpointer)exit, NULL);
+				g_timeout_add(3000, (gpointer)quit, NULL);
+				break;
+			case 't':
+				trace_file = optarg;
 				break;
 		}
 	}
 
+	wf_profile_enable(true);
+
 	gtk_init(&argc, &argv);
 	GtkWidget* window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
 
@@ -125,7 +149,7 @@ main (int argc, char* argv[])
 			case GDK_KP_Enter:
 				break;
 			case 113:
-				exit(EXIT_SUCCESS);
+				quit();
 				break;
 			case GDK_Delete:
 				break;
@@ -137,7 +161,7 @@ main (int argc, char* argv[])
 	}
 
 	g_signal_connect(window, "key-press-event", G_CALLBACK(key_press), waveform);
-	g_signal_connect(window, "delete-event", G_CALLBACK(gtk_main_quit), NULL);
+	g_signal_connect(window, "delete-event", G_CALLBACK(quit), NULL);
 
 	gboolean on_timeout(gpointer _waveform)
 	{
@@ -148,9 +172,13 @@ main (int argc, char* argv[])
 		if(!frame) t0 = get_time();
 		else{
 			uint64_t time = get_time();
-			if(!(frame % 200))
+			if(!(frame % 200)){
 				printf("rate=%.1f fps\n", ((float)frame / ((float)(time - t0))) * 1000.0);
 
+				const WfFrameStats* stats = wf_profile_get_frame(0);
+				if(stats) printf("  draw_calls=%i uploaded=%zuk fall_throughs=%i invalidations=%i\n", stats->draw_calls, stats->bytes_uploaded / 1024, stats->fall_throughs, stats->render_info_invalidations);
+			}
+
 			if(!(frame % 8)){
 				float v = (frame % 16) ? 1.5 : 2.0/3.0;
 				if(v > 16.0) v = 1.0;
@@ -158,6 +186,7 @@ main (int argc, char* argv[])
 			}
 			gtk_widget_queue_draw((GtkWidget*)waveform);
 		}
+		wf_profile_frame_end();
 		frame++;
 		return G_SOURCE_CONTINUE;
 	}
@@ -74,11 +74,13 @@ gpointer tests[] = {};
 uint32_t _time = 1000 + 321;
 Waveform* waveform = NULL;
 GtkWidget* images[2] = {0,};
+GtkWidget* thumbnails[G_N_ELEMENTS(wavs)] = {0,};
 WfSampleRegion regions[2];
 float zoom = 1.0;
 int x = 0.0;
 
 void image_async (GtkAllocation*);
+void image_batch ();
 
 
 bool
@@ -123,6 +125,15 @@ setup (int argc, char* argv[])
 	image_async(&size);
 	gtk_box_pack_start((GtkBox*)box, images[1], false, false, 0);
 
+	// batch
+
+	GtkWidget* hbox = gtk_hbox_new(TRUE, 0);
+	for(int i=0;i<G_N_ELEMENTS(wavs);i++){
+		gtk_box_pack_start((GtkBox*)hbox, thumbnails[i] = gtk_image_new(), false, false, 0);
+	}
+	gtk_box_pack_start((GtkBox*)box, hbox, false, false, 0);
+	image_batch();
+
 	gtk_widget_show_all(window);
 
 	add_key_handlers_gtk((GtkWindow*)window, NULL, (Key*)&keys);
@@ -166,6 +177,48 @@ image_async (GtkAllocation* size)
 	waveform_peak_to_pixbuf_async(waveform, pixbuf, &regions[1], 0xeeeeeebb, 0x000066ff, pixbuf_loaded, NULL);
 }
 
+
+/*
+ *  Render a thumbnail of each test wav using the thread pool
+ */
+void
+image_batch ()
+{
+	WfPixbufJob jobs[G_N_ELEMENTS(wavs)];
+	int n_jobs = 0;
+
+	for(int i=0;i<G_N_ELEMENTS(wavs);i++){
+		char* filename = find_wav(wavs[i]);
+		if(filename){
+			jobs[n_jobs++] = (WfPixbufJob){
+				.waveform = waveform_new(filename),
+				.width = 80,
+				.height = 40,
+				.user_data = thumbnails[i]
+			};
+			g_free(filename);
+		}
+	}
+
+	void thumbnail_ready (Waveform* w, GdkPixbuf* pixbuf, gpointer image)
+	{
+		if(pixbuf) gtk_image_set_from_pixbuf((GtkImage*)image, pixbuf);
+	}
+
+	void batch_done (gpointer _)
+	{
+		dbg(0, "all thumbnails done");
+	}
+
+	if(n_jobs){
+		waveform_peak_to_pixbuf_batch(jobs, n_jobs, 0xeeeeeebb, 0x000066ff, thumbnail_ready, batch_done, NULL);
+
+		// the batch holds its own references
+		for(int i=0;i<n_jobs;i++) g_object_unref(jobs[i].waveform);
+	}
+}
+
+
 void
 quit (gpointer _)
 {
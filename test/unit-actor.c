@@ -15,8 +15,13 @@
  */
 
 #include "config.h"
+#include <glib/gstdio.h>
 
 #include "ui/actor.c"
+#include "waveform/interval_tree.h"
+#include "waveform/text_atlas.h"
+#include "waveform/trace.h"
+#include "agl/behaviours/cache.h"
 
 #include "test/common.h"
 #include "test/unit-actor.h"
@@ -575,3 +580,289 @@ test_frames_2_px ()
 
 	FINISH_TEST;
 }
+
+
+void
+test_interval_tree ()
+{
+	START_TEST;
+
+	#define N_ITEMS 1000
+	#define SPACING 2000
+
+	WfIntervalTree* tree = wf_interval_tree_new();
+
+	// items of 1000 frames separated by gaps of 1000
+	static int items[N_ITEMS];
+	for (int i=0;i<N_ITEMS;i++) {
+		wf_interval_tree_set(tree, &items[i], i * SPACING, i * SPACING + 1000);
+	}
+	assert(wf_interval_tree_size(tree) == N_ITEMS, "size %i", wf_interval_tree_size(tree));
+
+	int n = wf_interval_tree_query(tree, 0, 1000, NULL, NULL);
+	assert(n == 1, "expected 1 got %i", n);
+	n = wf_interval_tree_query(tree, 999, 2001, NULL, NULL);
+	assert(n == 2, "expected 2 got %i", n);
+	n = wf_interval_tree_query(tree, 1000, 2000, NULL, NULL);
+	assert(n == 0, "gap: expected 0 got %i", n);
+	n = wf_interval_tree_query(tree, 0, N_ITEMS * SPACING, NULL, NULL);
+	assert(n == N_ITEMS, "all: expected %i got %i", N_ITEMS, n);
+
+	int64_t last = -1;
+	bool ordered = true;
+	void check_order (WfInterval* interval, gpointer _)
+	{
+		ordered &= interval->start > last;
+		last = interval->start;
+	}
+	wf_interval_tree_query(tree, 0, N_ITEMS * SPACING, check_order, NULL);
+	assert(ordered, "not in start order");
+
+	// move
+	wf_interval_tree_set(tree, &items[0], 2 * SPACING + 100, 2 * SPACING + 200);
+	n = wf_interval_tree_query(tree, 2 * SPACING, 3 * SPACING, NULL, NULL);
+	assert(n == 2, "move: expected 2 got %i", n);
+	n = wf_interval_tree_query(tree, 0, SPACING, NULL, NULL);
+	assert(n == 0, "move: expected 0 got %i", n);
+
+	// remove
+	assert(wf_interval_tree_remove(tree, &items[2]), "remove");
+	assert(!wf_interval_tree_remove(tree, &items[2]), "removed twice");
+	n = wf_interval_tree_query(tree, 2 * SPACING, 3 * SPACING, NULL, NULL);
+	assert(n == 1, "remove: expected 1 got %i", n);
+
+	// move all items, with one long item that overlaps all the items after it
+	WfInterval* intervals = g_new(WfInterval, N_ITEMS);
+	for (int i=0;i<N_ITEMS;i++) {
+		intervals[i] = (WfInterval){i * SPACING + 1, i * SPACING + 1001, &items[i]};
+	}
+	intervals[10].end = N_ITEMS * SPACING;
+	wf_interval_tree_set_all(tree, intervals, N_ITEMS);
+	assert(wf_interval_tree_size(tree) == N_ITEMS, "size %i", wf_interval_tree_size(tree));
+
+	n = wf_interval_tree_query(tree, 0, 1, NULL, NULL);
+	assert(n == 0, "bulk: expected 0 got %i", n);
+	n = wf_interval_tree_query(tree, N_ITEMS * SPACING - 10, N_ITEMS * SPACING, NULL, NULL);
+	assert(n == 2, "bulk: expected 2 got %i", n);
+
+	// compare with a linear search
+	for (int j=0;j<100;j++) {
+		int64_t start = g_random_int_range(0, N_ITEMS * SPACING);
+		int64_t end = start + g_random_int_range(1, 10 * SPACING);
+		int expected = 0;
+		for (int i=0;i<N_ITEMS;i++) {
+			if (intervals[i].start < end && intervals[i].end > start) expected++;
+		}
+		n = wf_interval_tree_query(tree, start, end, NULL, NULL);
+		assert(n == expected, "%"PRIi64"-->%"PRIi64": expected %i got %i", start, end, expected, n);
+	}
+
+	g_free(intervals);
+	wf_interval_tree_free(tree);
+
+	FINISH_TEST;
+}
+
+
+void
+test_context_actor_positions ()
+{
+	START_TEST;
+
+	wf_actor_set_region(wf_actor, &(WfSampleRegion){0, 1000});
+
+	wf_context_set_actor_position(context, wf_actor, 5000);
+	assert(wf_context_foreach_actor_in_range(context, 0, 5000, NULL, NULL) == 0, "expected no actors");
+	assert(wf_context_foreach_actor_in_range(context, 5500, 5600, NULL, NULL) == 1, "expected actor");
+
+	// the index follows changes to the region length
+	wf_actor_set_region(wf_actor, &(WfSampleRegion){0, 2000});
+	assert(wf_context_foreach_actor_in_range(context, 6500, 6600, NULL, NULL) == 1, "expected actor after region change");
+
+	wf_context_set_actor_positions(context, &wf_actor, (int64_t[]){0}, 1);
+	assert(wf_context_foreach_actor_in_range(context, 5500, 5600, NULL, NULL) == 0, "expected actor to have moved");
+	assert(wf_context_foreach_actor_in_range(context, 0, 1, NULL, NULL) == 1, "expected actor");
+
+	wf_context_remove_actor(context, wf_actor);
+	assert(wf_context_foreach_actor_in_range(context, 0, 1, NULL, NULL) == 0, "expected actor to be removed");
+
+	FINISH_TEST;
+}
+
+
+void
+test_compositing ()
+{
+	START_TEST;
+
+	AGlActor* actor = (AGlActor*)wf_actor;
+	assert(!agl_actor__find_behaviour(actor, cache_get_class()), "not expected to be cached");
+
+	wf_actor_set_cached(wf_actor, true);
+	AGlBehaviour* cache = agl_actor__find_behaviour(actor, cache_get_class());
+	assert(cache, "expected cache");
+	wf_actor_set_cached(wf_actor, true);
+	assert(agl_actor__find_behaviour(actor, cache_get_class()) == cache, "cache added twice");
+
+	// the other behaviours are not affected
+	wf_actor_set_cached(wf_actor, false);
+	assert(!agl_actor__find_behaviour(actor, cache_get_class()), "cache not removed");
+	assert(agl_actor__find_behaviour(actor, invalidator_get_class()), "invalidator removed");
+
+	// actors added in compositing mode are cached
+	wf_context_set_compositing(context, true);
+	WaveformActor* a2 = wf_context_add_new_actor(context, waveform);
+	assert(agl_actor__find_behaviour((AGlActor*)a2, cache_get_class()), "new actor not cached");
+	wf_context_set_compositing(context, false);
+	wf_actor_set_cached(a2, false);
+
+	// a zoom with animations disabled invalidates cached actors
+	assert(!scene.enable_animations, "expected animations to be disabled");
+	wf_actor_set_cached(wf_actor, true);
+	wf_context_set_start(context, 0);
+	float zoom = context->zoom->value.f;
+	actor->cache.valid = true;
+	wf_context_set_zoom(context, zoom * 2.);
+	assert(!actor->cache.valid, "cached actor not invalidated by zoom");
+	wf_context_set_zoom(context, zoom);
+	wf_actor_set_cached(wf_actor, false);
+
+	FINISH_TEST;
+}
+
+
+void
+test_text_atlas ()
+{
+	START_TEST;
+
+	text_atlas_clear();
+	TextAtlasStats stats0 = text_atlas_get_stats();
+
+	// repeated strings are only rasterised once
+	const TextAtlasItem* item = text_atlas_lookup("Sans 7", "0:01.0");
+	assert(item && item->width && item->height, "no item");
+	assert(text_atlas_lookup("Sans 7", "0:01.0") == item, "expected same item");
+	assert(text_atlas_lookup("Sans 9", "0:01.0") != item, "expected different item for different font");
+
+	TextAtlasStats stats = text_atlas_get_stats();
+	assert(stats.n_misses - stats0.n_misses == 2, "misses: %"PRIu64, stats.n_misses - stats0.n_misses);
+	assert(stats.n_hits - stats0.n_hits == 1, "hits: %"PRIu64, stats.n_hits - stats0.n_hits);
+
+	// items do not overlap
+	#define N_STRINGS 100
+	const TextAtlasItem* items[N_STRINGS];
+	for (int i=0;i<N_STRINGS;i++) {
+		char s[16];
+		snprintf(s, 15, "%i:%02i", i / 60, i % 60);
+		items[i] = text_atlas_lookup("Sans 7", s);
+		assert(items[i], "no item");
+	}
+	for (int i=0;i<N_STRINGS;i++) {
+		for (int j=i+1;j<N_STRINGS;j++) {
+			const TextAtlasItem* a = items[i];
+			const TextAtlasItem* b = items[j];
+			bool overlap = a->x < b->x + b->width && b->x < a->x + a->width && a->y < b->y + b->height && b->y < a->y + a->height;
+			assert(!overlap, "overlap: %i %i", i, j);
+		}
+	}
+
+	// when full, the least recently used items are evicted
+	int i = 0;
+	for (; i < 100000 && text_atlas_get_stats().n_evictions == stats0.n_evictions; i++) {
+		char s[16];
+		snprintf(s, 15, "%i", i);
+		text_atlas_lookup("Sans 7", s);
+		text_atlas_lookup("Sans 7", "hot");
+	}
+	assert(text_atlas_get_stats().n_evictions > stats0.n_evictions, "no eviction after %i strings", i);
+
+	stats = text_atlas_get_stats();
+	text_atlas_lookup("Sans 7", "hot");
+	assert(text_atlas_get_stats().n_misses == stats.n_misses, "recently used item was evicted");
+	text_atlas_lookup("Sans 9", "0:01.0");
+	assert(text_atlas_get_stats().n_misses == stats.n_misses + 1, "least recently used item was not evicted");
+
+	text_atlas_clear();
+	assert(!text_atlas_get_stats().n_items, "not cleared");
+
+	FINISH_TEST;
+}
+
+
+	static void count_frames (WaveformContext* wfc, gpointer _n_frames)
+	{
+		(*(int*)_n_frames)++;
+	}
+
+void
+test_trace ()
+{
+	START_TEST;
+
+	assert(waveform_load_sync(waveform), "not loaded");
+	WfSampleRegion region = {.start = 1000, .len = waveform_get_n_frames(waveform) / 2};
+
+	// only calls to the recorded context are logged
+	WaveformContext* other = wf_context_new(NULL);
+	other->root = (AGlActor*)&scene;
+	wf_trace_start(context);
+	wf_context_set_scale(context, 512.0);
+	wf_context_set_scale(other, 256.0);
+	wf_context_set_start(context, 4000);
+	wf_actor_set_region(wf_actor, &(WfSampleRegion){region.start, region.len});
+	wf_actor_set_rect(wf_actor, &(WfRectangle){10.0, 0.0, 100.0, 50.0});
+	wf_actor_set_vzoom(wf_actor, 2.5);
+	g_autoptr(WfTrace) recorded = wf_trace_stop();
+	wf_context_free(other);
+
+	assert(recorded->events->len == 5, "events: %i", recorded->events->len);
+	assert(recorded->actors->len == 1 && !strcmp(g_ptr_array_index(recorded->actors, 0), waveform->filename), "actors");
+
+	// save and load
+	const char* filename = "test.trace";
+	assert(wf_trace_save(recorded, filename, NULL), "save failed");
+	g_autoptr(WfTrace) trace = wf_trace_load(filename, NULL);
+	g_unlink(filename);
+	assert(trace, "load failed");
+	assert(trace->events->len == recorded->events->len, "loaded events: %i", trace->events->len);
+	for (int i=0;i<trace->events->len;i++) {
+		WfTraceEvent* a = &g_array_index(recorded->events, WfTraceEvent, i);
+		WfTraceEvent* b = &g_array_index(trace->events, WfTraceEvent, i);
+		assert(a->time == b->time && a->type == b->type && a->actor == b->actor, "event %i differs", i);
+	}
+	WfTraceEvent* event = &g_array_index(trace->events, WfTraceEvent, 3);
+	assert(event->type == WF_TRACE_RECT && event->rect.left == 10.0 && event->rect.len == 100.0, "rect");
+
+	// replay from the default state, one event every 10ms and one frame every 16ms
+	wf_context_set_scale(context, WF_CONTEXT_DEFAULT_SPPX);
+	wf_context_set_start(context, 0);
+	wf_actor_set_vzoom(wf_actor, 1.0);
+	wf_actor_set_region(wf_actor, &(WfSampleRegion){.len = waveform_get_n_frames(waveform)});
+	wf_actor_set_rect(wf_actor, &(WfRectangle){0.0, 0.0, 50.0, 50.0});
+	for (int i=0;i<trace->events->len;i++) {
+		g_array_index(trace->events, WfTraceEvent, i).time = i * 10000;
+	}
+
+	int n_painted = 0;
+	g_autoptr(GArray) frames = wf_trace_replay(trace, context, &wf_actor, 1, 16000, count_frames, &n_painted);
+
+	assert(frames->len == 4 && n_painted == 4, "frames: %i", frames->len);
+	int expected[] = {1, 1, 2, 1};
+	for (int i=0;i<frames->len;i++) {
+		WfTraceFrame* frame = &g_array_index(frames, WfTraceFrame, i);
+		assert(frame->time == i * 16000 && frame->n_events == expected[i], "frame %i: events=%i", i, frame->n_events);
+	}
+
+	assert(context->samples_per_pixel == 512.0, "scale: %.2f", context->samples_per_pixel);
+	assert(context->start_time->value.b == 4000, "start: %"PRIi64, context->start_time->value.b);
+	assert(wf_actor->region.start == region.start && wf_actor->region.len == region.len, "region");
+	assert(((AGlActor*)wf_actor)->region.x1 == 10.0 && agl_actor__width((AGlActor*)wf_actor) == 100.0, "rect");
+	assert(wf_actor->vzoom == 2.5, "vzoom: %.2f", wf_actor->vzoom);
+
+	wf_context_set_scale(context, WF_CONTEXT_DEFAULT_SPPX);
+	wf_context_set_start(context, 0);
+	wf_actor_set_vzoom(wf_actor, 1.0);
+
+	FINISH_TEST;
+}
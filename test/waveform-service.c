@@ -0,0 +1,49 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2025-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ | Standalone peak service
+ |
+ | usage: waveform-service [socket-path]
+ |
+ | Prints "ready" once the socket is listening, then serves until stdin
+ | is closed. The stats are printed on exit as:
+ |   n_requests n_peak_loads n_blocks_decoded n_hits
+ |
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <glib.h>
+#include "wf/waveform.h"
+#include "wf/service.h"
+
+
+int
+main (int argc, char* argv[])
+{
+	WfService* service = wf_service_start(argc > 1 ? argv[1] : NULL);
+	if(!service) return EXIT_FAILURE;
+
+	printf("ready\n");
+	fflush(stdout);
+
+	// the service runs in its own threads. The parent stops it by closing stdin.
+	char buf[64];
+	while(fread(buf, 1, sizeof(buf), stdin) > 0);
+
+	WfServiceStats stats = wf_service_get_stats(service);
+	wf_service_stop(service);
+
+	printf("%"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64"\n", stats.n_requests, stats.n_peak_loads, stats.n_blocks_decoded, stats.n_hits);
+
+	return EXIT_SUCCESS;
+}
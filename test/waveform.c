@@ -15,11 +15,23 @@
 #define __wf_private__
 
 #include "config.h"
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include "decoder/ad.h"
 #include "transition/transition.h"
 #include "wf/waveform.h"
 #include "wf/peakgen.h"
+#include "wf/pool.h"
+#include "wf/audiomap.h"
+#include "wf/compressed.h"
+#include "wf/diskcache.h"
+#include "wf/live.h"
+#include "wf/spectrogram.h"
+#include "wf/service.h"
+#include "wf/profile.h"
 #include "wf/worker.h"
 #include "ui/utils.h"
 #include "waveform/pixbuf.h"
@@ -66,6 +78,144 @@ test_decoder ()
 }
 
 
+void
+test_split_stereo ()
+{
+	// A split pair of mono files is decoded as a single stereo file
+
+	START_TEST;
+
+	g_autofree char* mono = find_wav(WAV);
+
+	g_autofree char* lhs = g_build_filename(g_get_tmp_dir(), "split%L.wav", NULL);
+	g_autofree char* rhs = g_build_filename(g_get_tmp_dir(), "split%R.wav", NULL);
+	{
+		gsize length;
+		g_autofree gchar* contents = NULL;
+		assert(g_file_get_contents(mono, &contents, &length, NULL), "cannot read %s", WAV);
+		assert(g_file_set_contents(lhs, contents, length, NULL), "cannot write %s", lhs);
+
+		// the rhs has the same audio at half the amplitude so that the channels can be told apart.
+		// The file is 16 bit, little endian.
+		gsize pos = 12;
+		uint32_t chunk_size;
+		while (pos + 8 <= length && memcmp(contents + pos, "data", 4)) {
+			memcpy(&chunk_size, contents + pos + 4, 4);
+			pos += 8 + chunk_size + (chunk_size & 1);
+		}
+		assert(pos + 8 <= length, "no data chunk in %s", WAV);
+		memcpy(&chunk_size, contents + pos + 4, 4);
+		for (gsize i=pos+8;i+2<=MIN(length, pos + 8 + chunk_size);i+=2) {
+			short s;
+			memcpy(&s, contents + i, 2);
+			s /= 2;
+			memcpy(contents + i, &s, 2);
+		}
+		assert(g_file_set_contents(rhs, contents, length, NULL), "cannot write %s", rhs);
+	}
+
+	g_auto(WfDecoder) d = {{0,}};
+	assert(ad_open(&d, lhs), "failed to open pair");
+	assert(d.info.channels == 2, "channels: %i", d.info.channels);
+
+	g_auto(WfDecoder) m = {{0,}};
+	assert(ad_open(&m, mono), "failed to open %s", WAV);
+	assert(d.info.frames == m.info.frames, "frames: %"PRIi64" %"PRIi64, d.info.frames, m.info.frames);
+
+	// large reads decode the halves concurrently, small reads serially
+	int sizes[] = {WF_PEAK_BLOCK_SIZE, 9};
+	for (int i=0;i<G_N_ELEMENTS(sizes);i++) {
+		assert(ad_seek(&d, 0) >= 0 && ad_seek(&m, 0) >= 0, "seek failed");
+
+		short data[2][WF_PEAK_BLOCK_SIZE];
+		WfBuf16 buf = {.buf = {data[0], data[1]}, .size = sizes[i]};
+		short expected_data[WF_PEAK_BLOCK_SIZE];
+		WfBuf16 expected = {.buf = {expected_data}, .size = sizes[i]};
+
+		assert(ad_read_short(&d, &buf) == sizes[i], "pair read failed");
+		assert(ad_read_short(&m, &expected) == sizes[i], "mono read failed");
+
+		for (int f=0;f<sizes[i];f++) {
+			assert(data[WF_LEFT][f] == expected_data[f], "left: mismatch at %i: %i %i", f, data[WF_LEFT][f], expected_data[f]);
+			assert(data[WF_RIGHT][f] == expected_data[f] / 2, "right: mismatch at %i: %i %i", f, data[WF_RIGHT][f], expected_data[f] / 2);
+		}
+	}
+
+	assert(wf_peakgen__sync(lhs, "split.peak", NULL), "peakgen failed");
+	WfAudioInfo info = {0};
+	ad_finfo("split.peak", &info);
+	assert(info.channels == 2, "peakfile: expected %i channels, got %i", 2, info.channels);
+	ad_free_nfo(&info);
+
+	// each channel of the Waveform has the peaks and audio of its own half
+	{
+		Waveform* w = waveform_new(lhs);
+		Waveform* expected = waveform_new(mono);
+		assert(waveform_load_sync(w) && waveform_load_sync(expected), "load failed");
+		assert(w->n_channels == 2, "channels: %i", w->n_channels);
+		assert(w->priv->num_peaks == expected->priv->num_peaks, "num_peaks: %i %i", w->priv->num_peaks, expected->priv->num_peaks);
+
+		short max[WF_STEREO] = {0,};
+		for (int i=0;i<w->priv->num_peaks * WF_PEAK_VALUES_PER_SAMPLE;i++) {
+			short e = expected->priv->peak.buf[WF_LEFT][i];
+			short l = w->priv->peak.buf[WF_LEFT][i];
+			short r = w->priv->peak.buf[WF_RIGHT][i];
+			assert(ABS(l - e) <= 1, "left peak %i: %i %i", i, l, e);
+			assert(ABS(r - e / 2) <= 1, "right peak %i: %i %i", i, r, e / 2);
+			max[WF_LEFT] = MAX(max[WF_LEFT], l);
+			max[WF_RIGHT] = MAX(max[WF_RIGHT], r);
+		}
+		assert(max[WF_RIGHT] < max[WF_LEFT], "right peaks not distinct: %i %i", max[WF_LEFT], max[WF_RIGHT]);
+
+		waveform_load_audio_sync(w, 0, 3);
+		waveform_load_audio_sync(expected, 0, 3);
+		WfAudioBlock* block = waveform_get_audio_block(w, 0);
+		WfAudioBlock* e = waveform_get_audio_block(expected, 0);
+		assert(block && e, "audio block not loaded");
+		assert(block->buf[WF_LEFT] && block->buf[WF_RIGHT], "audio block: missing channel");
+		assert(block->size == e->size, "audio block size: %u %u", block->size, e->size);
+		for (int f=0;f<block->size;f++) {
+			assert(block->buf[WF_LEFT][f] == e->buf[WF_LEFT][f], "audio block left: mismatch at %i: %i %i", f, block->buf[WF_LEFT][f], e->buf[WF_LEFT][f]);
+			assert(block->buf[WF_RIGHT][f] == e->buf[WF_LEFT][f] / 2, "audio block right: mismatch at %i: %i %i", f, block->buf[WF_RIGHT][f], e->buf[WF_LEFT][f] / 2);
+		}
+
+		wf_audio_block_unref(block);
+		wf_audio_block_unref(e);
+		g_object_unref(expected);
+		g_object_unref(w);
+	}
+
+	// the peakfile identifies the source by both halves of the pair
+	{
+		GStatBuf l, r;
+		assert(!g_stat(lhs, &l) && !g_stat(rhs, &r), "stat failed");
+
+		WfPeakMeta meta;
+		assert(wf_peakfile_read_meta("split.peak", &meta), "no metadata");
+		assert(meta.size == l.st_size + r.st_size, "metadata: size %"PRIu64, meta.size);
+
+		assert(wf_create_cache_dir(), "cache dir");
+		g_autofree char* peakfile = wf_peakfile_ensure__sync(lhs, &meta);
+		assert(peakfile, "no peakfile");
+		g_autofree char* current = wf_peakfile_lookup(lhs, &meta);
+		assert(current, "peakfile is not current after creation");
+
+		// changing only the rhs invalidates the peakfile
+		assert(g_file_set_contents(rhs, "RIFF", 4, NULL), "cannot write %s", rhs);
+		g_autofree char* stale = wf_peakfile_lookup(lhs, &meta);
+		assert(!stale, "peakfile is current after the rhs was changed");
+
+		g_unlink(peakfile);
+	}
+
+	g_unlink("split.peak");
+	g_unlink(lhs);
+	g_unlink(rhs);
+
+	FINISH_TEST;
+}
+
+
 void
 test_decoder_snapshot ()
 {
@@ -164,7 +314,17 @@ test_peakgen ()
 		gsize length;
 		g_autofree gchar* contents;
 		g_file_get_contents (WAV ".peak", &contents, &length, NULL);
-		assert(length == 6970, "peakfile size %i", (int)length);
+		assert(length == 7130, "peakfile size %i", (int)length);
+
+		WfPeakMeta meta;
+		assert(wf_peakfile_read_meta(WAV ".peak", &meta), "no metadata");
+		assert(meta.n_channels == 1, "metadata: expected %i channels, got %i", 1, meta.n_channels);
+		assert(meta.n_frames, "metadata: n_frames");
+
+		int n_blocks = 0;
+		g_autofree WfBlockSummary* summary = wf_peakfile_read_summary(WAV ".peak", &n_blocks);
+		assert(summary, "no summary");
+		assert(n_blocks == 7, "summary: expected %i blocks, got %i", 7, n_blocks);
 
 		WfAudioInfo info = {0};
 		ad_finfo(WAV ".peak", &info);
@@ -182,7 +342,7 @@ test_peakgen ()
 		gsize length;
 		g_autofree gchar* contents;
 		g_file_get_contents (WAV ".peak", &contents, &length, NULL);
-		assert(length == 13862, "peakfile size %zu", length);
+		assert(length == 14022, "peakfile size %zu", length);
 
 		WfAudioInfo info = {0};
 		ad_finfo(WAV ".peak", &info);
@@ -196,6 +356,16 @@ test_peakgen ()
 
 		char* p = waveform_ensure_peakfile__sync(w);
 		assert(p, "cache dir peakgen failed");
+		g_free(p);
+
+		// a second Waveform is initialised from the peakfile metadata
+		Waveform* w2 = waveform_new(filename);
+		p = waveform_ensure_peakfile__sync(w2);
+		assert(p, "cache dir peakgen failed");
+		assert(w2->n_frames && w2->n_frames == waveform_get_n_frames(w), "n_frames not set from peakfile: %"PRIi64, w2->n_frames);
+		assert(w2->samplerate, "samplerate not set from peakfile");
+
+		g_object_unref(w2);
 		g_object_unref(w);
 		g_free(p);
 	}
@@ -204,6 +374,58 @@ test_peakgen ()
 }
 
 
+void
+test_block_summary ()
+{
+	START_TEST;
+
+	g_autofree char* filename = find_wav(WAV2);
+	assert(filename, "cannot find file %s", WAV2);
+
+	Waveform* w = waveform_load_new(filename);
+	assert(waveform_peak_is_loaded(w, 0), "peak not loaded");
+
+	// compare with a scan of the peak data
+	short max = 0;
+	short level[w->priv->n_blocks];
+	memset(level, 0, sizeof(short) * w->priv->n_blocks);
+	for (int c=0;c<w->n_channels;c++) {
+		short* buf = w->priv->peak.buf[c];
+		for (int i=0;i<w->priv->num_peaks;i++) {
+			int b = i / WF_TEXTURE_VISIBLE_SIZE;
+			max = MAX(max, buf[2 * i]);
+			level[b] = MAX(level[b], MAX(buf[2 * i], -MAX(buf[2 * i + 1], -G_MAXINT16)));
+		}
+	}
+
+	short max_level = waveform_find_max_audio_level(w);
+	assert(max_level == max, "max level: expected %i, got %i", max, max_level);
+
+	const WfBlockSummary* total = waveform_get_block_summary(w, -1);
+	assert(total, "no summary");
+	assert(total->max == max, "summary max: expected %i, got %i", max, total->max);
+	assert(!total->silent, "summary silent");
+	assert(total->rms > 0 && total->rms <= MAX(total->max, -total->min), "summary rms %i", total->rms);
+
+	for (int b=0;b<w->priv->n_blocks;b++) {
+		const WfBlockSummary* summary = waveform_get_block_summary(w, b);
+		assert(summary, "no summary for block %i", b);
+		assert(summary->silent == (level[b] < WF_SILENCE_LEVEL), "block %i: silent", b);
+		short l = waveform_get_block_level(w, b, b);
+		assert(l == level[b], "block %i: expected level %i, got %i", b, level[b], l);
+	}
+
+	short all = 0;
+	for (int b=0;b<w->priv->n_blocks;b++) all = MAX(all, level[b]);
+	assert(!waveform_get_block_summary(w, w->priv->n_blocks), "expected NULL for out of range block");
+	assert(waveform_get_block_level(w, -10, 10000) == all, "clamped range");
+
+	g_object_unref(w);
+
+	FINISH_TEST;
+}
+
+
 void
 test_m4a ()
 {
@@ -241,6 +463,68 @@ typedef struct {
 } C1;
 
 
+/*
+ *  Waveforms loaded together have the same peaks as when loaded individually.
+ */
+void
+test_load_many ()
+{
+	START_TEST;
+	if (__test_idx);
+
+	#define N_BULK 6
+
+	typedef struct {
+		WfTest    test;
+		int       n;
+		Waveform* w[N_BULK];
+	} C3;
+
+	void on_loaded (Waveform* w, GError* error, gpointer _c)
+	{
+		WfTest* c = _c;
+		C3* c3 = _c;
+
+		assert(!error, "%s", error->message);
+		assert(w->priv->num_peaks, "no peaks");
+		assert(!(w->priv->state & WAVEFORM_LOADING), "still loading");
+
+		if (++c3->n < N_BULK) return;
+
+		for (int i=0;i<N_BULK;i++) {
+			Waveform* w = c3->w[i];
+			Waveform* single = waveform_load_new(w->filename);
+
+			assert(single->priv->num_peaks == w->priv->num_peaks, "num_peaks: %i %i", single->priv->num_peaks, w->priv->num_peaks);
+			assert(w->n_frames == single->n_frames, "n_frames");
+			assert(!!w->priv->summary == !!single->priv->summary, "summary");
+			for (int ch=0;ch<waveform_get_n_channels(w);ch++) {
+				assert(!memcmp(single->priv->peak.buf[ch], w->priv->peak.buf[ch], w->priv->num_peaks * WF_PEAK_VALUES_PER_SAMPLE * sizeof(short)), "peaks differ");
+			}
+
+			g_object_unref(single);
+			g_object_unref(w);
+		}
+
+		WF_TEST_FINISH;
+	}
+
+	C3* c = WF_NEW(C3,
+		.test = {
+			.test_idx = TEST.current.test,
+		}
+	);
+
+	const char* files[] = {WAV, WAV2};
+	for (int i=0;i<N_BULK;i++) {
+		g_autofree char* filename = find_wav(files[i % 2]);
+		c->w[i] = waveform_new(filename);
+	}
+
+	waveform_load_many(c->w, N_BULK, on_loaded, c);
+}
+
+
 /*
  *  Check the load callback gets called if loading fails
  */
@@ -468,6 +752,82 @@ test_audiodata_slow ()
 }
 
 
+/*
+ *  Blocks that complete together are reported in a single "blocks-ready" signal
+ */
+void
+test_blocks_ready ()
+{
+	START_TEST;
+	if (__test_idx);
+
+	typedef struct {
+		C1    c1;
+		int   n_signals;
+		int   n_hires;
+		bool* seen;
+	} C2;
+
+	void _on_hires_ready (Waveform* waveform, int block, gpointer _c)
+	{
+		((C2*)_c)->n_hires++;
+	}
+
+	void _on_blocks_ready (Waveform* waveform, GArray* blocks, gpointer _c)
+	{
+		WfTest* c = _c;
+		C2* c2 = _c;
+
+		dbg(1, "n_blocks=%i", blocks->len);
+		test_reset_timeout(5000);
+
+		assert(blocks->len, "empty notification");
+		c2->n_signals++;
+
+		for (int i=0;i<blocks->len;i++) {
+			int b = g_array_index(blocks, int, i);
+			assert(b >= 0 && b < c2->c1.tot_blocks, "block out of range: %i", b);
+			assert(!c2->seen[b], "block %i reported twice", b);
+			c2->seen[b] = true;
+			c2->c1.n++;
+		}
+
+		// every block is also reported individually before the batch
+		assert(c2->n_hires >= c2->c1.n, "hires-ready: %i blocks: %i", c2->n_hires, c2->c1.n);
+
+		if (c2->c1.n >= c2->c1.tot_blocks) {
+			assert(c2->n_signals <= c2->c1.tot_blocks, "n_signals=%i", c2->n_signals);
+			g_signal_handlers_disconnect_matched((gpointer)waveform, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, c2);
+			g_object_unref(waveform);
+			g_free(c2->seen);
+			WF_TEST_FINISH;
+		}
+	}
+
+	g_autofree char* filename = find_wav(WAV);
+	Waveform* w = waveform_new(filename);
+
+	int tot_blocks = waveform_get_n_audio_blocks(w);
+
+	C2* c = WF_NEW(C2,
+		.c1 = {
+			.test = {
+				.test_idx = TEST.current.test,
+			},
+			.tot_blocks = tot_blocks,
+		},
+		.seen = g_new0(bool, tot_blocks)
+	);
+
+	g_signal_connect (w, "hires-ready", (GCallback)_on_hires_ready, c);
+	g_signal_connect (w, "blocks-ready", (GCallback)_on_blocks_ready, c);
+
+	for (int b=0;b<tot_blocks;b++) {
+		waveform_load_audio(w, b, 3, NULL, NULL);
+	}
+}
+
+
 static gboolean
 _test_audio_cache__after_unref (gpointer _c)
 {
@@ -534,29 +894,1074 @@ test_audio_cache ()
 
 
 void
-test_alphabuf ()
+test_pool ()
 {
 	START_TEST;
 
-	g_autofree char* filename = find_wav(WAV);
-	Waveform* w = waveform_load_new(filename);
+	#define BLOCK_BYTES (WF_PEAK_BLOCK_SIZE * sizeof(short))
 
-	int scale[] = {1, WF_PEAK_STD_TO_LO};
-	for (int b=0;b<2;b++) {
-		for (int s=0;s<G_N_ELEMENTS(scale);s++) {
-			AlphaBuf* alphabuf = wf_alphabuf_new(w, b, scale[s], false, 0);
-			assert(alphabuf, "alphabuf create failed");
-			assert(alphabuf->buf, "alphabuf has no buf");
-			assert(alphabuf->buf_size, "alphabuf size not set");
-			wf_alphabuf_free(alphabuf);
+	WfPoolStats stats0 = wf_pool_get_stats();
+
+	void* a = wf_pool_alloc(BLOCK_BYTES);
+	wf_pool_free(a, BLOCK_BYTES);
+	void* b = wf_pool_alloc(BLOCK_BYTES);
+	assert(b == a, "freed block not reused");
+
+	WfPoolStats stats = wf_pool_get_stats();
+	assert(stats.n_reused == stats0.n_reused + 1, "n_reused=%"PRIu64, stats.n_reused);
+	assert(stats.in_use == stats0.in_use + BLOCK_BYTES, "in_use=%zu", stats.in_use);
+
+	short* z = wf_pool_alloc0(BLOCK_BYTES);
+	for (int i=0;i<WF_PEAK_BLOCK_SIZE;i++) {
+		assert(!z[i], "not zeroed at %i", i);
+	}
+	wf_pool_free(z, BLOCK_BYTES);
+	wf_pool_free(b, BLOCK_BYTES);
+
+	wf_pool_trim();
+	assert(wf_pool_get_stats().free == 0, "pool not trimmed");
+
+	wf_pool_set_huge_pages(true);
+	void* h = wf_pool_alloc(BLOCK_BYTES);
+	assert(wf_pool_get_stats().slab, "no slab allocated");
+	wf_pool_free(h, BLOCK_BYTES);
+	wf_pool_trim();
+	assert(wf_pool_get_stats().free == BLOCK_BYTES, "slab memory should be retained");
+	wf_pool_set_huge_pages(false);
+
+	FINISH_TEST;
+}
+
+
+void
+test_audio_map ()
+{
+	// Blocks read from the file mapping must match those from the decoder.
+
+	START_TEST;
+
+	char* wavs[] = {WAV, WAV2};
+
+	for (int i=0;i<G_N_ELEMENTS(wavs);i++) {
+		g_autofree char* filename = find_wav(wavs[i]);
+
+		WfAudioMap* map = wf_audio_map_new(filename);
+		assert(map, "%s: not mapped", wavs[i]);
+
+		WfDecoder d = {{0,}};
+		assert(ad_open(&d, filename), "%s: failed to open", wavs[i]);
+		int n_chans = MIN(d.info.channels, WF_STEREO);
+
+		const uint64_t start = WF_PEAK_BLOCK_SIZE;
+		assert(ad_seek(&d, start) >= 0, "seek failed");
+
+		short data[2][WF_PEAK_BLOCK_SIZE];
+		WfBuf16 expected = {
+			.buf = {data[0], data[1]},
+			.size = WF_PEAK_BLOCK_SIZE
+		};
+		assert(ad_read_short(&d, &expected) == WF_PEAK_BLOCK_SIZE, "%s: decoder read failed", wavs[i]);
+		ad_close(&d);
+
+		WfBuf16 buf = {.size = WF_PEAK_BLOCK_SIZE};
+		bool zero_copy;
+		assert(wf_audio_map_load_block(map, &buf, start, n_chans, &zero_copy), "%s: mapped read failed", wavs[i]);
+		assert(zero_copy == (n_chans == 1), "%s: zero_copy=%i", wavs[i], zero_copy);
+
+		for (int c=0;c<n_chans;c++) {
+			for (int f=0;f<WF_PEAK_BLOCK_SIZE;f++) {
+				assert(ABS(buf.buf[c][f] - expected.buf[c][f]) <= 1, "%s: mismatch at %i.%i: %i %i", wavs[i], c, f, buf.buf[c][f], expected.buf[c][f]);
+			}
+			if (!zero_copy) wf_pool_free(buf.buf[c], sizeof(short) * buf.size);
 		}
+
+		wf_audio_map_unref(map);
+	}
+
+	FINISH_TEST;
+}
+
+
+void
+test_set_file ()
+{
+	// After changing the file, blocks must be read from the new file, not the old mapping.
+
+	START_TEST;
+
+	g_autofree char* filename1 = find_wav(WAV);
+	g_autofree char* filename2 = find_wav("mono_10:00.wav");
+
+	Waveform* w = waveform_new(filename1);
+	assert(waveform_load_sync(w), "load failed");
+	waveform_load_audio_sync(w, 1, 3);
+	assert(w->priv->audio.map, "%s: not mapped", WAV);
+
+	waveform_set_file(w, filename2);
+	assert(waveform_load_sync(w), "load failed");
+	assert(waveform_get_n_frames(w) > 60 * 44100, "n_frames not updated: %"PRIu64, waveform_get_n_frames(w));
+
+	Waveform* expected = waveform_new(filename2);
+	assert(waveform_load_sync(expected), "load failed");
+
+	int n_blocks = waveform_get_n_audio_blocks(w);
+	assert(n_blocks == waveform_get_n_audio_blocks(expected), "n_blocks: %i", n_blocks);
+
+	for (int b=1;b<n_blocks;b+=n_blocks/3) {
+		waveform_load_audio_sync(w, b, 3);
+		waveform_load_audio_sync(expected, b, 3);
+
+		WfBuf16* buf = w->priv->audio.buf16[b];
+		WfBuf16* buf2 = expected->priv->audio.buf16[b];
+		assert(buf && buf2 && buf->size == buf2->size, "block %i: size", b);
+		assert(!memcmp(buf->buf[WF_LEFT], buf2->buf[WF_LEFT], buf->size * sizeof(short)), "block %i: audio is not from the new file", b);
 	}
 
+	g_object_unref(expected);
 	g_object_unref(w);
+
 	FINISH_TEST;
 }
 
 
+/*
+ *  Audio requests that are pending when the file is changed must complete
+ *  without their results being used for the new file.
+ */
+void
+test_set_file_pending ()
+{
+	START_TEST;
+	if (__test_idx);
+
+	typedef struct {
+		WfTest    test;
+		int       n_old;
+		int       n_new;
+		int       tot_old;
+		Waveform* expected;
+	} C4;
+
+	void _on_old_done (Waveform* w, int block, gpointer _c)
+	{
+		C4* c4 = _c;
+		test_reset_timeout(5000);
+		c4->n_old++;
+	}
+
+	void _on_new_done (Waveform* w, int block, gpointer _c)
+	{
+		WfTest* c = _c;
+		C4* c4 = _c;
+		test_reset_timeout(5000);
+		c4->n_new++;
+
+		// the requests for the old file were queued first so must be complete
+		assert(c4->n_old == c4->tot_old, "old requests not completed: %i/%i", c4->n_old, c4->tot_old);
+
+		WfAudioBlock* block1 = waveform_get_audio_block(w, block);
+		assert(block1, "block %i not published", block);
+
+		waveform_load_audio_sync(c4->expected, block, 3);
+		WfBuf16* buf2 = c4->expected->priv->audio.buf16[block];
+		assert(buf2 && block1->size == buf2->size, "block %i: size", block);
+		assert(!memcmp(block1->buf[WF_LEFT], buf2->buf[WF_LEFT], buf2->size * sizeof(short)), "block %i: audio is not from the new file", block);
+		wf_audio_block_unref(block1);
+
+		// blocks loaded after the change are also from the new file
+		int b = waveform_get_n_audio_blocks(w) - 2;
+		waveform_load_audio_sync(w, b, 3);
+		waveform_load_audio_sync(c4->expected, b, 3);
+		assert(!memcmp(w->priv->audio.buf16[b]->buf[WF_LEFT], c4->expected->priv->audio.buf16[b]->buf[WF_LEFT], buf2->size * sizeof(short)), "block %i: audio is not from the new file", b);
+
+		g_object_unref(c4->expected);
+		g_object_unref(w);
+		WF_TEST_FINISH;
+	}
+
+	g_autofree char* filename1 = find_wav(WAV);
+	g_autofree char* filename2 = find_wav("mono_10:00.wav");
+
+	Waveform* w = waveform_new(filename1);
+	int tot_blocks = waveform_get_n_audio_blocks(w);
+
+	Waveform* expected = waveform_new(filename2);
+	assert(waveform_load_sync(expected), "load failed");
+
+	C4* c = WF_NEW(C4,
+		.test = {
+			.test_idx = TEST.current.test,
+		},
+		.tot_old = tot_blocks,
+		.expected = expected
+	);
+
+	for (int b=0;b<tot_blocks;b++) {
+		waveform_load_audio(w, b, 3, _on_old_done, c);
+	}
+
+	waveform_set_file(w, filename2);
+	assert(waveform_get_n_audio_blocks(w) > tot_blocks, "n_blocks not updated");
+
+	// the same block as a pending request for the old file. it must not be merged with it.
+	waveform_load_audio(w, 1, 3, _on_new_done, c);
+}
+
+
+	typedef struct {
+		Waveform* waveform;
+		int       n_blocks;
+		uint64_t  n_frames;
+		int       n_reads;
+		int64_t   sum;
+		bool      have_peaks;
+	} Reader;
+
+	static gpointer read_properties (gpointer _reader)
+	{
+		Reader* r = _reader;
+		r->n_frames = waveform_get_n_frames(r->waveform);
+		return NULL;
+	}
+
+	static gpointer read_blocks (gpointer _reader)
+	{
+		// runs while the main thread is loading the blocks
+
+		Reader* r = _reader;
+
+		for (int i=0;i<10000;i++) {
+			WfAudioBlock* block = waveform_get_audio_block(r->waveform, i % r->n_blocks);
+			if (block) {
+				for (int j=0;j<block->size;j+=64) r->sum += block->buf[WF_LEFT][j];
+				r->n_reads++;
+				wf_audio_block_unref(block);
+			}
+		}
+
+		WfPeakView peaks;
+		r->have_peaks = waveform_get_peaks(r->waveform, &peaks) && peaks.n_peaks && peaks.buf[WF_LEFT];
+
+		return NULL;
+	}
+
+void
+test_threads ()
+{
+	START_TEST;
+
+	#define N_READERS 4
+
+	g_autofree char* filename = find_wav(WAV);
+	Waveform* w = waveform_new(filename);
+
+	Reader readers[N_READERS];
+	GThread* threads[N_READERS];
+
+	// the properties are read from the file by whichever thread asks first
+	for (int i=0;i<N_READERS;i++) {
+		readers[i] = (Reader){.waveform = w};
+		threads[i] = g_thread_new("reader", read_properties, &readers[i]);
+	}
+	for (int i=0;i<N_READERS;i++) {
+		g_thread_join(threads[i]);
+		assert(readers[i].n_frames && readers[i].n_frames == waveform_get_n_frames(w), "reader %i: n_frames=%"PRIu64, i, readers[i].n_frames);
+	}
+
+	assert(waveform_load_sync(w), "load failed");
+
+	int n_blocks = waveform_get_n_audio_blocks(w);
+	for (int i=0;i<N_READERS;i++) {
+		readers[i] = (Reader){.waveform = w, .n_blocks = n_blocks};
+		threads[i] = g_thread_new("reader", read_blocks, &readers[i]);
+	}
+	for (int b=0;b<n_blocks;b++) {
+		waveform_load_audio_sync(w, b, 3);
+	}
+	for (int i=0;i<N_READERS;i++) {
+		g_thread_join(threads[i]);
+		assert(readers[i].have_peaks, "reader %i: no peaks", i);
+	}
+
+	// a snapshot remains valid after the block is freed
+	WfAudioBlock* block = waveform_get_audio_block(w, 1);
+	assert(block, "block not published");
+	size_t size = block->size * sizeof(short);
+	short* copy = memcpy(g_malloc(size), block->buf[WF_LEFT], size);
+
+	waveform_audio_free(w);
+	assert(!waveform_get_audio_block(w, 1), "block still published");
+	assert(!memcmp(copy, block->buf[WF_LEFT], size), "snapshot modified");
+
+	wf_audio_block_unref(block);
+	g_free(copy);
+	g_object_unref(w);
+
+	FINISH_TEST;
+}
+
+
+/*
+ *  The frame stats are only counted in the thread that enabled profiling.
+ */
+void
+test_profile_threads ()
+{
+	START_TEST;
+
+	gpointer load_block (gpointer w)
+	{
+		waveform_load_audio_sync(w, 1, 3);
+		return NULL;
+	}
+
+	g_autofree char* filename = find_wav(M4A);
+	Waveform* w = waveform_new(filename);
+	assert(waveform_load_sync(w), "load failed");
+
+	wf_profile_enable(true);
+
+	g_thread_join(g_thread_new("profile test", load_block, w));
+	wf_profile_frame_end();
+	const WfFrameStats* stats = wf_profile_get_frame(0);
+	assert(!stats->audio_cache_misses && !stats->audio_cache_hits, "counted in another thread: %i %i", stats->audio_cache_misses, stats->audio_cache_hits);
+
+	waveform_load_audio_sync(w, 2, 3);
+	wf_profile_frame_end();
+	stats = wf_profile_get_frame(0);
+	assert(stats->audio_cache_misses == 1, "audio_cache_misses: %i", stats->audio_cache_misses);
+
+	wf_profile_enable(false);
+	g_object_unref(w);
+
+	FINISH_TEST;
+}
+
+
+void
+test_compressed ()
+{
+	START_TEST;
+
+	#define N 1000 // not a multiple of the chunk size
+
+	static short in[N], out[N];
+	static guchar packed[WF_COMPRESSED_MAX_SIZE(N)];
+
+	// silence, a slow ramp, and full scale alternation which can not be compressed
+	for (int t=0;t<3;t++) {
+		for (int i=0;i<N;i++) {
+			in[i] = t == 0 ? 0 : t == 1 ? i * 16 - 8000 : (i & 1 ? 32767 : -32768);
+		}
+		size_t len = wf_compress_block(in, N, packed);
+		assert(len <= N * sizeof(short) + 1, "%i: too big: %zu", t, len);
+		if (t < 2) assert(len < N, "%i: not compressed: %zu", t, len);
+
+		memset(out, 0xff, sizeof(out));
+		assert(wf_decompress_block(packed, len, out, N), "%i: decompress failed", t);
+		assert(!memcmp(in, out, sizeof(in)), "%i: data differs after decompression", t);
+	}
+
+	// the cache
+
+	g_autofree char* filename = find_wav(WAV2);
+	Waveform* w = waveform_new(filename);
+	wf_compressed_cache_set_max_size(1 << 20);
+
+	WfBuf16 buf = {.size = N, .buf = {in, in}};
+	wf_compressed_cache_add(w, 3, &buf, 0);
+
+	WfCompressedCacheStats stats = wf_compressed_cache_get_stats();
+	assert(stats.n_blocks == 1, "n_blocks=%i", stats.n_blocks);
+	assert(stats.raw_size == 2 * N * sizeof(short), "raw_size=%zu", stats.raw_size);
+
+	WfBuf16 restored = {.size = N};
+	assert(!wf_compressed_cache_take(w, 2, &restored, WF_STEREO, 0), "unexpected block");
+	assert(wf_compressed_cache_take(w, 3, &restored, WF_STEREO, 0), "block not restored");
+	for (int c=0;c<WF_STEREO;c++) {
+		assert(!memcmp(restored.buf[c], in, sizeof(in)), "restored block differs");
+		wf_pool_free(restored.buf[c], sizeof(short) * N);
+	}
+	assert(wf_compressed_cache_get_stats().n_blocks == 0, "block not removed after take");
+
+	// a block of a previous file is not restored
+	wf_compressed_cache_add(w, 3, &buf, 0);
+	assert(!wf_compressed_cache_take(w, 3, &restored, WF_STEREO, 1), "block of old file restored");
+	assert(wf_compressed_cache_get_stats().n_blocks == 0, "stale block not removed");
+
+	wf_compressed_cache_add(w, 3, &buf, 0);
+	g_object_unref(w);
+	assert(wf_compressed_cache_get_stats().size == 0, "blocks not removed with waveform");
+
+	wf_compressed_cache_set_max_size(0);
+
+	#undef N
+
+	FINISH_TEST;
+}
+
+
+void
+test_disk_cache ()
+{
+	START_TEST;
+
+	g_autofree char* tmp = g_dir_make_tmp("wf-XXXXXX", NULL);
+	g_autofree char* cache_home = g_strdup(g_getenv("XDG_CACHE_HOME"));
+	g_setenv("XDG_CACHE_HOME", tmp, true);
+
+	static short data[2][WF_PEAK_BLOCK_SIZE];
+	for (int i=0;i<WF_PEAK_BLOCK_SIZE;i++) {
+		data[0][i] = i;
+		data[1][i] = -i;
+	}
+	WfBuf16 buf = {.buf = {data[0], data[1]}, .size = WF_PEAK_BLOCK_SIZE};
+
+	g_autofree char* filename = find_wav(WAV2);
+	g_autofree char* key = wf_disk_cache_key(filename);
+	assert(key, "no key");
+
+	WfBuf16 restored = {.size = WF_PEAK_BLOCK_SIZE};
+	wf_disk_cache_write(key, 0, &buf, WF_STEREO);
+	assert(!wf_disk_cache_read(key, 0, &restored, WF_STEREO), "read while disabled");
+
+	wf_disk_cache_set_max_size(1 << 20);
+	wf_disk_cache_write(key, 0, &buf, WF_STEREO);
+	assert(wf_disk_cache_get_stats().n_writes == 1, "not written");
+
+	assert(!wf_disk_cache_read(key, 1, &restored, WF_STEREO), "unexpected block");
+	assert(wf_disk_cache_read(key, 0, &restored, WF_STEREO), "block not read");
+	for (int c=0;c<WF_STEREO;c++) {
+		assert(!memcmp(restored.buf[c], data[c], sizeof(data[c])), "data differs. c=%i", c);
+		wf_pool_free(restored.buf[c], sizeof(short) * WF_PEAK_BLOCK_SIZE);
+		restored.buf[c] = NULL;
+	}
+
+	// each block is 256kB so the oldest must be deleted
+	for (int b=1;b<6;b++) wf_disk_cache_write(key, b, &buf, WF_STEREO);
+	WfDiskCacheStats stats = wf_disk_cache_get_stats();
+	assert(stats.size <= stats.max_size, "over budget: %zu", stats.size);
+	assert(stats.n_deleted, "nothing deleted");
+
+	// after changing the file, blocks are cached under the key of the new file
+	{
+		g_autofree char* m4a = find_wav("mono_0:10.m4a");
+		g_autofree char* mp3 = find_wav("mono_10:00.mp3");
+		g_autofree char* mp3_key = wf_disk_cache_key(mp3);
+
+		Waveform* w = waveform_new(m4a);
+		assert(waveform_load_sync(w), "load failed");
+		waveform_load_audio_sync(w, 1, 3);
+
+		waveform_set_file(w, mp3);
+		assert(waveform_load_sync(w), "load failed");
+		waveform_load_audio_sync(w, 1, 3);
+		assert(w->priv->audio.disk_key && !strcmp(w->priv->audio.disk_key, mp3_key), "wrong key: %s", w->priv->audio.disk_key);
+
+		Waveform* expected = waveform_new(mp3);
+		waveform_load_audio_sync(expected, 1, 3);
+		WfBuf16* buf = w->priv->audio.buf16[1];
+		assert(!memcmp(buf->buf[WF_LEFT], expected->priv->audio.buf16[1]->buf[WF_LEFT], buf->size * sizeof(short)), "audio is not from the new file");
+
+		g_object_unref(expected);
+		g_object_unref(w);
+	}
+
+	wf_disk_cache_clear();
+	assert(!wf_disk_cache_read(key, 5, &restored, WF_STEREO), "not cleared");
+	wf_disk_cache_set_max_size(0);
+
+	g_autofree char* blocks = g_build_filename(tmp, "blocks", NULL);
+	g_rmdir(blocks);
+	g_rmdir(tmp);
+	if (cache_home) g_setenv("XDG_CACHE_HOME", cache_home, true); else g_unsetenv("XDG_CACHE_HOME");
+
+	FINISH_TEST;
+}
+
+
+void
+test_shared ()
+{
+	START_TEST;
+
+	g_autofree char* filename = find_wav(WAV);
+
+	Waveform* w1 = waveform_new_shared(filename);
+	Waveform* w2 = waveform_new_shared(filename);
+	assert(w1 == w2, "waveform not shared");
+
+	Waveform* w3 = waveform_new(filename);
+	assert(w3 != w1, "unshared waveform should be independent");
+	g_object_unref(w3);
+
+	g_object_unref(w2);
+	g_object_add_weak_pointer((GObject*)w1, (gpointer*)&w1);
+	g_object_unref(w1);
+	assert(!w1, "shared waveform not finalized");
+
+	Waveform* w4 = waveform_new_shared(filename);
+	assert(w4, "failed to create new shared waveform after finalize");
+	g_object_unref(w4);
+
+	FINISH_TEST;
+}
+
+
+/*
+ *  A live Waveform is extended as audio is written
+ */
+void
+test_live ()
+{
+	START_TEST;
+
+	Waveform* w = waveform_new_live(WF_STEREO, 44100);
+	assert(w, "not created");
+	assert(!w->n_frames, "not empty");
+
+	typedef struct {
+		int       n_signals;
+		WfFrRange range;
+	} C;
+
+	C c = {0,};
+
+	void on_frames_appended (Waveform* w, WfFrRange* range, gpointer _c)
+	{
+		C* c = _c;
+		c->n_signals++;
+		c->range = *range;
+	}
+	g_signal_connect(w, "frames-appended", (GCallback)on_frames_appended, &c);
+
+	// long enough to extend into the second block
+	#define N_LIVE_FRAMES (WF_SAMPLES_PER_TEXTURE + 1000)
+	static short data[WF_STEREO][N_LIVE_FRAMES];
+	for (int i=0;i<N_LIVE_FRAMES;i++) {
+		data[0][i] = i % 10000;
+		data[1][i] = -(i % 10000);
+	}
+
+	// the first peak is only completed by the second write
+	const short* part1[] = {data[0], data[1]};
+	assert(waveform_live_write(w, part1, 100), "write failed");
+	waveform_live_flush(w);
+	assert(c.n_signals == 1, "expected signal");
+	assert(c.range.start == 0 && c.range.end == 100, "range: %"PRIi64"-%"PRIi64, c.range.start, c.range.end);
+	assert(w->priv->num_peaks == 1, "num_peaks: %i", w->priv->num_peaks);
+
+	const short* part2[] = {data[0] + 100, data[1] + 100};
+	assert(waveform_live_write(w, part2, N_LIVE_FRAMES - 100), "write failed");
+	assert(waveform_live_get_stats(w).n_pending == N_LIVE_FRAMES - 100, "pending: %i", waveform_live_get_stats(w).n_pending);
+	waveform_live_flush(w);
+	assert(c.n_signals == 2, "expected signal");
+	assert(c.range.start == 100 && c.range.end == N_LIVE_FRAMES, "range: %"PRIi64"-%"PRIi64, c.range.start, c.range.end);
+	assert(w->n_frames == N_LIVE_FRAMES, "n_frames: %"PRIi64, w->n_frames);
+	assert(!waveform_live_get_stats(w).n_pending, "not drained");
+
+	// peaks
+	WfPeakBuf* peak = &w->priv->peak;
+	assert(w->priv->num_peaks == N_LIVE_FRAMES / WF_PEAK_RATIO + 1, "num_peaks: %i", w->priv->num_peaks);
+	assert(peak->buf[WF_LEFT][0] == WF_PEAK_RATIO - 1 && !peak->buf[WF_LEFT][1], "peak 0: %i %i", peak->buf[WF_LEFT][0], peak->buf[WF_LEFT][1]);
+	assert(peak->buf[WF_LEFT][78] == 9999 && !peak->buf[WF_LEFT][79], "peak 39: %i %i", peak->buf[WF_LEFT][78], peak->buf[WF_LEFT][79]);
+	assert(!peak->buf[WF_RIGHT][78] && peak->buf[WF_RIGHT][79] == -9999, "peak 39 (rhs): %i %i", peak->buf[WF_RIGHT][78], peak->buf[WF_RIGHT][79]);
+
+	// hi-res audio. The start of the second block is also in the first block
+	WfAudioData* audio = &w->priv->audio;
+	assert(audio->n_blocks == 2, "n_blocks: %i", audio->n_blocks);
+	int f = WF_SAMPLES_PER_TEXTURE + 10;
+	assert(audio->buf16[0]->buf[WF_LEFT][f] == data[WF_LEFT][f], "block 0");
+	assert(audio->buf16[1]->buf[WF_LEFT][10] == data[WF_LEFT][f], "block 1");
+	assert(!audio->buf16[1]->buf[WF_RIGHT][1000], "end of block not silent");
+
+	// summary
+	const WfBlockSummary* summary = waveform_get_block_summary(w, -1);
+	assert(summary, "no summary");
+	assert(summary->max == 9999 && summary->min == -9999, "summary: %i %i", summary->max, summary->min);
+	summary = waveform_get_block_summary(w, 1);
+	assert(summary->max == 5511 && summary->min == -5511, "block summary: %i %i", summary->max, summary->min);
+
+	// a write that does not fit is dropped
+	static short big[WF_STEREO][1 << 19];
+	const short* part3[] = {big[0], big[1]};
+	assert(!waveform_live_write(w, part3, G_N_ELEMENTS(big[0])), "oversized write accepted");
+	assert(waveform_live_get_stats(w).n_dropped == G_N_ELEMENTS(big[0]), "not counted");
+
+	// save the peakfile for an audio file with the same content
+	g_autofree char* tmp = g_dir_make_tmp("wf-XXXXXX", NULL);
+	g_autofree char* audio_file = g_build_filename(tmp, "live.wav", NULL);
+	g_file_set_contents(audio_file, "", 0, NULL);
+
+	assert(waveform_live_finish(w, audio_file), "finish failed");
+	assert(!waveform_live_write(w, part1, 100), "write after finish");
+
+	Waveform* w2 = waveform_new(audio_file);
+	g_autofree char* peakfile = waveform_ensure_peakfile__sync(w2);
+	assert(peakfile, "no peakfile");
+
+	WfPeakMeta meta;
+	assert(wf_peakfile_read_meta(peakfile, &meta), "no metadata");
+	assert(meta.n_channels == WF_STEREO, "metadata: n_channels %i", meta.n_channels);
+	assert(meta.n_frames == N_LIVE_FRAMES, "metadata: n_frames %"PRIi64, (int64_t)meta.n_frames);
+
+	int n_blocks = 0;
+	g_autofree WfBlockSummary* blocks = wf_peakfile_read_summary(peakfile, &n_blocks);
+	assert(blocks && n_blocks == 2, "summary: %i blocks", n_blocks);
+
+	g_object_unref(w2);
+	g_unlink(peakfile);
+	g_unlink(audio_file);
+	g_rmdir(tmp);
+
+	g_object_unref(w);
+
+	FINISH_TEST;
+}
+
+
+/*
+ *  Spectrogram tiles are created from the audio file and cached in memory
+ */
+void
+test_spectrogram ()
+{
+	START_TEST;
+
+	// a full scale sine at the centre of a bin has its peak in that bin at close to 0dB
+	int level = 1;
+	int fft_size = 2 * 512;
+	double frames[fft_size];
+	for (int i=0;i<fft_size;i++) {
+		frames[i] = sin(2.0 * M_PI * 100 * i / fft_size);
+	}
+	guchar column[512];
+	wf_spectrogram_column(level, frames, column, 1);
+	int peak = 0;
+	for (int k=0;k<512;k++) {
+		if (column[k] > column[peak]) peak = k;
+	}
+	assert(peak == 100, "peak in wrong bin: %i", peak);
+	assert(column[peak] > 250, "peak level: %i", column[peak]);
+	assert(column[300] < 10, "expected silence: %i", column[300]);
+
+	// tiles from a file
+	g_autofree char* filename = find_wav(WAV);
+	Waveform* w = waveform_new(filename);
+
+	assert(wf_spectrogram_get_n_tiles(w, 1) == waveform_get_n_audio_blocks(w), "n_tiles: %i", wf_spectrogram_get_n_tiles(w, 1));
+	assert(wf_spectrogram_get_n_tiles(w, 3) == 1, "n_tiles: %i", wf_spectrogram_get_n_tiles(w, 3));
+
+	WfSpectrogramStats stats0 = wf_spectrogram_get_stats();
+
+	assert(!waveform_get_spectrogram_tile(w, level, 0), "tile already loaded");
+	WfSpectrogramTile* tile = waveform_load_spectrogram_sync(w, level, 0);
+	assert(tile, "no tile");
+	assert(tile->width == wf_spectrogram_get_tile_frames(level) / WF_PEAK_RATIO, "width: %i", tile->width);
+	assert(tile->height == 512, "height: %i", tile->height);
+
+	int n_nonzero = 0;
+	for (int i=0;i<tile->width * tile->height;i++) {
+		if (tile->buf[i]) n_nonzero++;
+	}
+	assert(n_nonzero, "tile is empty");
+
+	assert(waveform_get_spectrogram_tile(w, level, 0) == tile, "tile not cached");
+	WfSpectrogramStats stats = wf_spectrogram_get_stats();
+	assert(stats.n_computed == stats0.n_computed + 1, "n_computed: %"PRIu64, stats.n_computed);
+	assert(stats.size == stats0.size + tile->width * tile->height, "size: %zu", stats.size);
+
+	// when the limit is exceeded the least recently used tile is removed
+	wf_spectrogram_set_max_size(tile->width * tile->height);
+	assert(waveform_load_spectrogram_sync(w, level, 1), "no tile");
+	assert(!waveform_get_spectrogram_tile(w, level, 0), "tile not evicted");
+	assert(wf_spectrogram_get_stats().n_evicted == stats0.n_evicted + 1, "n_evicted");
+	wf_spectrogram_set_max_size(stats0.max_size);
+
+	g_object_unref(w);
+	assert(wf_spectrogram_get_stats().size == stats0.size, "memory not freed");
+
+	FINISH_TEST;
+}
+
+
+/*
+ *  Two Waveforms for the same file are loaded via a service started by the test.
+ *  The peaks and audio are only loaded once, and match those loaded in-process.
+ */
+void
+test_service ()
+{
+	START_TEST;
+	if (__test_idx);
+
+	typedef struct {
+		WfTest     test;
+		WfService* service;
+		Waveform*  w[2];
+		char*      dir;
+	} C2;
+
+	void on_loaded_1 (Waveform* w, GError* error, gpointer _c)
+	{
+		WfTest* c = _c;
+		C2* c2 = _c;
+
+		assert(!error, "%s", error->message);
+
+		WfServiceStats stats = wf_service_get_stats(c2->service);
+		assert(stats.n_peak_loads == 1, "n_peak_loads: %"PRIu64, stats.n_peak_loads);
+		assert(stats.n_hits == 1, "n_hits: %"PRIu64, stats.n_hits);
+
+		WaveformPrivate* p[] = {c2->w[0]->priv, c2->w[1]->priv};
+		assert(p[0]->num_peaks && p[1]->num_peaks == p[0]->num_peaks, "num_peaks: %i %i", p[0]->num_peaks, p[1]->num_peaks);
+		assert(p[1]->n_blocks == waveform_get_n_audio_blocks(c2->w[1]), "n_blocks: %i", p[1]->n_blocks);
+
+		// hi-res blocks are decoded once
+		waveform_load_audio_sync(c2->w[0], 0, 3);
+		waveform_load_audio_sync(c2->w[1], 0, 3);
+		stats = wf_service_get_stats(c2->service);
+		assert(stats.n_blocks_decoded == 1, "n_blocks_decoded: %"PRIu64, stats.n_blocks_decoded);
+		assert(stats.n_hits == 2, "n_hits: %"PRIu64, stats.n_hits);
+		assert(p[0]->audio.buf16[0] && p[0]->audio.buf16[0]->buf[WF_LEFT], "no audio");
+
+		// compare with the in-process path
+		wf_service_disconnect();
+		assert(!wf_service_is_connected(), "still connected");
+
+		Waveform* local = waveform_new(w->filename);
+		assert(waveform_load_sync(local), "local load failed");
+		assert(local->priv->num_peaks == p[0]->num_peaks, "num_peaks: %i", local->priv->num_peaks);
+		assert(!memcmp(local->priv->peak.buf[WF_LEFT], p[0]->peak.buf[WF_LEFT], p[0]->num_peaks * WF_PEAK_VALUES_PER_SAMPLE * sizeof(short)), "peaks differ");
+
+		waveform_load_audio_sync(local, 0, 3);
+		assert(!memcmp(local->priv->audio.buf16[0]->buf[WF_LEFT], p[0]->audio.buf16[0]->buf[WF_LEFT], WF_PEAK_BLOCK_SIZE * sizeof(short)), "audio differs");
+		assert(wf_service_get_stats(c2->service).n_blocks_decoded == 1, "block requested after disconnecting");
+
+		g_object_unref(local);
+		g_object_unref(c2->w[0]);
+		g_object_unref(c2->w[1]);
+
+		wf_service_stop(c2->service);
+		g_rmdir(c2->dir);
+		g_free(c2->dir);
+
+		WF_TEST_FINISH;
+	}
+
+	void on_loaded_0 (Waveform* w, GError* error, gpointer _c)
+	{
+		C2* c2 = _c;
+
+		assert(!error, "%s", error->message);
+		assert(w->priv->peak.buf[WF_LEFT], "no peaks");
+
+		waveform_load(c2->w[1], on_loaded_1, c2);
+	}
+
+	char* dir = g_dir_make_tmp("wf-service-XXXXXX", NULL);
+	g_autofree char* path = g_build_filename(dir, "peaks.sock", NULL);
+
+	WfService* service = wf_service_start(path);
+	assert(service, "failed to start service");
+	assert(wf_service_connect(path), "failed to connect");
+	assert(wf_service_is_connected(), "not connected");
+
+	// uncompressed files are not decoded by the service as they are mapped directly
+	g_autofree char* filename = find_wav(M4A);
+
+	C2* c = WF_NEW(C2,
+		.test = {
+			.test_idx = TEST.current.test,
+		},
+		.service = service,
+		.w = {waveform_new(filename), waveform_new(filename)},
+		.dir = dir
+	);
+
+	waveform_load(c->w[0], on_loaded_0, c);
+}
+
+
+/*
+ *  The service is run as a separate process, as it would be in normal use.
+ */
+void
+test_service_process ()
+{
+	START_TEST;
+	if (__test_idx);
+
+	typedef struct {
+		WfTest     test;
+		Waveform*  w;
+		GPid       pid;
+		int        in;
+		FILE*      out;
+		char*      dir;
+	} C2;
+
+	void on_loaded (Waveform* w, GError* error, gpointer _c)
+	{
+		WfTest* c = _c;
+		C2* c2 = _c;
+
+		assert(!error, "%s", error->message);
+		assert(w->priv->peak.buf[WF_LEFT], "no peaks");
+
+		waveform_load_audio_sync(w, 0, 3);
+		WfBuf16* buf = w->priv->audio.buf16[0];
+		assert(buf && buf->buf[WF_LEFT], "no audio");
+
+		wf_service_disconnect();
+
+		// the results are the same as for the in-process path
+		Waveform* local = waveform_new(w->filename);
+		assert(waveform_load_sync(local), "local load failed");
+		assert(local->priv->num_peaks == w->priv->num_peaks, "num_peaks: %i %i", local->priv->num_peaks, w->priv->num_peaks);
+		assert(!memcmp(local->priv->peak.buf[WF_LEFT], w->priv->peak.buf[WF_LEFT], w->priv->num_peaks * WF_PEAK_VALUES_PER_SAMPLE * sizeof(short)), "peaks differ");
+		waveform_load_audio_sync(local, 0, 3);
+		assert(!memcmp(local->priv->audio.buf16[0]->buf[WF_LEFT], buf->buf[WF_LEFT], WF_PEAK_BLOCK_SIZE * sizeof(short)), "audio differs");
+
+		g_object_unref(local);
+		g_object_unref(w);
+
+		// closing stdin stops the service, which then prints its stats
+		close(c2->in);
+		uint64_t n_requests = 0, n_peak_loads = 0, n_blocks_decoded = 0, n_hits = 0;
+		char line[256];
+		assert(fgets(line, sizeof(line), c2->out), "no stats from service");
+		assert(sscanf(line, "%"SCNu64" %"SCNu64" %"SCNu64" %"SCNu64, &n_requests, &n_peak_loads, &n_blocks_decoded, &n_hits) == 4, "stats: %s", line);
+		assert(n_requests == 2, "n_requests: %"PRIu64, n_requests);
+		assert(n_peak_loads == 1, "n_peak_loads: %"PRIu64, n_peak_loads);
+		assert(n_blocks_decoded == 1, "n_blocks_decoded: %"PRIu64, n_blocks_decoded);
+
+		fclose(c2->out);
+		int status;
+		waitpid(c2->pid, &status, 0);
+		g_spawn_close_pid(c2->pid);
+		assert(WIFEXITED(status) && !WEXITSTATUS(status), "service exit status: %i", status);
+
+		g_rmdir(c2->dir);
+		g_free(c2->dir);
+
+		WF_TEST_FINISH;
+	}
+
+	// the service executable is built alongside the tests
+	g_autofree char* exe = g_file_read_link("/proc/self/exe", NULL);
+	assert(exe, "cannot find test executable");
+	g_autofree char* exe_dir = g_path_get_dirname(exe);
+	g_autofree char* service_exe = g_build_filename(exe_dir, "waveform-service", NULL);
+
+	char* dir = g_dir_make_tmp("wf-service-XXXXXX", NULL);
+	g_autofree char* path = g_build_filename(dir, "peaks.sock", NULL);
+
+	char* argv[] = {service_exe, path, NULL};
+	GPid pid;
+	int in, out;
+	GError* error = NULL;
+	if (!g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &in, &out, NULL, &error)) {
+		FAIL_TEST("cannot start %s: %s", service_exe, error->message);
+	}
+
+	FILE* fp = fdopen(out, "r");
+	char line[64];
+	assert(fgets(line, sizeof(line), fp) && g_str_has_prefix(line, "ready"), "service did not start");
+
+	assert(wf_service_connect(path), "failed to connect");
+
+	g_autofree char* filename = find_wav(M4A);
+
+	C2* c = WF_NEW(C2,
+		.test = {
+			.test_idx = TEST.current.test,
+		},
+		.w = waveform_new(filename),
+		.pid = pid,
+		.in = in,
+		.out = fp,
+		.dir = dir
+	);
+
+	waveform_load(c->w, on_loaded, c);
+}
+
+
+void
+test_alphabuf ()
+{
+	START_TEST;
+
+	g_autofree char* filename = find_wav(WAV);
+	Waveform* w = waveform_load_new(filename);
+
+	int scale[] = {1, WF_PEAK_STD_TO_LO};
+	for (int b=0;b<2;b++) {
+		for (int s=0;s<G_N_ELEMENTS(scale);s++) {
+			AlphaBuf* alphabuf = wf_alphabuf_new(w, b, scale[s], false, 0);
+			assert(alphabuf, "alphabuf create failed");
+			assert(alphabuf->buf, "alphabuf has no buf");
+			assert(alphabuf->buf_size, "alphabuf size not set");
+			wf_alphabuf_free(alphabuf);
+		}
+	}
+
+	g_object_unref(w);
+	FINISH_TEST;
+}
+
+
+	typedef struct {
+		GdkPixbuf* expected;
+		int        n_rows;
+		int        n_different;
+	} ExportCheck;
+
+	static bool export_check_row (const guchar* row, int y, int width, gpointer _c)
+	{
+		ExportCheck* c = _c;
+
+		const guchar* expected = gdk_pixbuf_get_pixels(c->expected) + y * gdk_pixbuf_get_rowstride(c->expected);
+		if (y != c->n_rows || memcmp(row, expected, width * 3)) c->n_different++;
+		c->n_rows++;
+
+		return true;
+	}
+
+void
+test_export ()
+{
+	START_TEST;
+
+	g_autofree char* filename = find_wav(WAV2);
+	Waveform* w = waveform_load_new(filename);
+
+	WfExport export = {
+		.waveform    = w,
+		.width       = 800,
+		.height      = 100,
+		.colour      = 0xffffffff,
+		.bg_colour   = 0x000066ff,
+		.tile_width  = 37, // the tiles and bands do not divide the image exactly
+		.band_height = 23,
+	};
+
+	// the single-shot render
+	GdkPixbuf* expected = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, export.width, export.height);
+	gdk_pixbuf_fill(expected, export.bg_colour);
+	double samples_per_px = waveform_get_n_frames(w) / (double)export.width;
+	waveform_peak_to_pixbuf_full(w, expected, 0, NULL, NULL, samples_per_px, export.colour, export.bg_colour, 1.0, false);
+
+	ExportCheck c = {.expected = expected};
+	GError* error = NULL;
+	assert(waveform_export_scanlines(&export, export_check_row, &c, &error), "export failed: %s", error ? error->message : "");
+	assert(c.n_rows == export.height, "rows=%i", c.n_rows);
+	assert(!c.n_different, "%i rows differ from the single render", c.n_different);
+
+#ifdef HAVE_ZLIB
+	const char* png = "export.png";
+	assert(waveform_export_png(&export, png, &error), "png export failed: %s", error ? error->message : "");
+
+	GdkPixbuf* pixbuf = gdk_pixbuf_new_from_file(png, &error);
+	assert(pixbuf, "cannot read png: %s", error ? error->message : "");
+	assert(gdk_pixbuf_get_width(pixbuf) == export.width && gdk_pixbuf_get_height(pixbuf) == export.height, "png size");
+	for (int y=0;y<export.height;y++) {
+		assert(!memcmp(gdk_pixbuf_get_pixels(pixbuf) + y * gdk_pixbuf_get_rowstride(pixbuf), gdk_pixbuf_get_pixels(expected) + y * gdk_pixbuf_get_rowstride(expected), export.width * 3), "png row %i differs", y);
+	}
+	g_object_unref(pixbuf);
+	g_unlink(png);
+#endif
+	g_object_unref(expected);
+
+	// hires. The tiles at x=256 and x=768 start on a block boundary
+	export.region = (WfSampleRegion){WF_SAMPLES_PER_TEXTURE / 2, 2 * WF_SAMPLES_PER_TEXTURE};
+	export.width = 1024;
+	export.tile_width = 128;
+	samples_per_px = export.region.len / (double)export.width;
+	assert(samples_per_px < WF_PEAK_RATIO, "not hires");
+
+	for (int b=0;b<=3;b++) {
+		waveform_load_audio_sync(w, b, 3);
+	}
+	expected = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, export.width, export.height);
+	gdk_pixbuf_fill(expected, export.bg_colour);
+	waveform_peak_to_pixbuf_full(w, expected, export.region.start, NULL, NULL, samples_per_px, export.colour, export.bg_colour, 1.0, false);
+
+	c = (ExportCheck){.expected = expected};
+	assert(waveform_export_scanlines(&export, export_check_row, &c, &error), "hires export failed: %s", error ? error->message : "");
+	assert(c.n_rows == export.height, "rows=%i", c.n_rows);
+	assert(!c.n_different, "hires: %i rows differ from the single render", c.n_different);
+
+	g_object_unref(expected);
+	g_object_unref(w);
+	FINISH_TEST;
+}
+
+
+void
+test_batch ()
+{
+	START_TEST;
+
+	g_autofree char* filename = find_wav(WAV);
+	Waveform* w = waveform_new(filename);
+
+	static WfSampleRegion regions[] = {
+		{0, 0},                                            // the whole file
+		{0, 2 * WF_SAMPLES_PER_TEXTURE},                   // hires. The region ends on a block boundary
+	};
+	static int n_rendered;
+	n_rendered = 0;
+
+	WfPixbufJob jobs[G_N_ELEMENTS(regions)];
+	for (int i=0;i<G_N_ELEMENTS(regions);i++) {
+		jobs[i] = (WfPixbufJob){
+			.waveform  = w,
+			.region    = regions[i],
+			.width     = 1024,
+			.height    = 64,
+			.user_data = &regions[i]
+		};
+	}
+
+	void on_pixbuf (Waveform* w, GdkPixbuf* pixbuf, gpointer _region)
+	{
+		WfSampleRegion* region = _region;
+		assert(pixbuf, "no pixbuf");
+
+		int width = gdk_pixbuf_get_width(pixbuf);
+		int height = gdk_pixbuf_get_height(pixbuf);
+		uint64_t len = region->len ? region->len : waveform_get_n_frames(w) - region->start;
+
+		// the single-shot render. The audio needed for it has been loaded by the batch
+		GdkPixbuf* expected = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+		gdk_pixbuf_fill(expected, 0x000066ff);
+		waveform_peak_to_pixbuf_full(w, expected, region->start, NULL, NULL, len / (double)width, 0xffffffff, 0x000066ff, 1.0, false);
+
+		int n_different = 0;
+		for (int y=0;y<height;y++) {
+			if (memcmp(gdk_pixbuf_get_pixels(pixbuf) + y * gdk_pixbuf_get_rowstride(pixbuf), gdk_pixbuf_get_pixels(expected) + y * gdk_pixbuf_get_rowstride(expected), width * 3)) n_different++;
+		}
+		g_object_unref(expected);
+
+		assert(!n_different, "region %"PRIi64": %i rows differ from the single render", region->start, n_different);
+		n_rendered++;
+	}
+
+	void done (gpointer _)
+	{
+		assert(n_rendered == G_N_ELEMENTS(regions), "rendered=%i", n_rendered);
+		FINISH_TEST;
+	}
+
+	waveform_peak_to_pixbuf_batch(jobs, G_N_ELEMENTS(jobs), 0xffffffff, 0x000066ff, on_pixbuf, done, NULL);
+
+	// the batch holds its own reference
+	g_object_unref(w);
+}
+
+
 void
 test_int2db ()
 {
@@ -47,6 +47,9 @@
 #include "wf/debug.h"
 #include "wf/waveform.h"
 #include "wf/audio.h"
+#include "wf/worker.h"
+#include "wf/profile.h"
+#include "wf/spectrogram.h"
 #include "waveform/texture_cache.h"
 #include "waveform/pixbuf.h"
 #include "waveform/actor.h"
@@ -54,6 +57,8 @@
 #include "waveform/ui-private.h"
 #include "waveform/transition_behaviour.h"
 #include "waveform/invalidator.h"
+#include "waveform/trace.h"
+#include "agl/behaviours/cache.h"
 
 #define _g_signal_handler_disconnect0(A, H) (H = (g_signal_handler_disconnect((gpointer)A, H), 0))
 
@@ -130,9 +135,12 @@ typedef enum {
 struct _WfActorPriv
 {
 	float           opacity;     // derived from background colour
+	bool            spectrogram; // render using the spectrogram renderer instead of the mode renderers
 
 	struct {
 		gulong      peakdata_ready;
+		gulong      frames_appended;
+		gulong      spectrogram_ready;
 		gulong      dimensions_changed;
 		gulong      zoom_changed;
 	}               handlers;
@@ -162,6 +170,13 @@ struct _WfActorPriv
 		BlockRange     viewport_blocks;
 		bool           cropped;
 	}               render_info;
+
+	struct {
+		int64_t     last_paint;    // usecs. zero when not animating
+		int64_t     zoom_changed;  // usecs. the start of the most recent context zoom animation
+		bool        overrun;       // the previous animation frame exceeded the budget
+		guint       timer;         // set while there are loads waiting for the animation to settle
+	}               lod;
 };
 
 
@@ -171,6 +186,7 @@ typedef void    (*WaveformActorBlockFn)     (Renderer*, WaveformActor*, int b);
 typedef bool    (*WaveformActorRenderFn)    (Renderer*, WaveformActor*, int b, bool is_first, bool is_last, double x);
 typedef void    (*WaveformActorPostRender)  (Renderer*, WaveformActor*);
 typedef void    (*WaveformActorFreeFn)      (Renderer*, Waveform*);
+typedef void    (*WaveformActorExtendFn)    (Renderer*, Waveform*);
 #ifdef USE_TEST
 typedef bool    (*WaveformActorTestFn)      (Renderer*, WaveformActor*);
 #endif
@@ -185,6 +201,8 @@ struct _Renderer
 	WaveformActorRenderFn    render_block;
 	WaveformActorPostRender  post_render;
 	WaveformActorFreeFn      free;
+	WaveformActorBlockFn     invalidate_block; // optional. the source data for the block has changed
+	WaveformActorExtendFn    extend;           // optional. the Waveform has grown. the existing render data is kept
 #ifdef USE_TEST
 	WaveformActorTestFn      is_not_blank;
 #endif
@@ -236,6 +254,24 @@ struct _draw_mode
 typedef struct { Mode lower, upper; } ModeRange;
 #define HI_MIN_TIERS 4 // equivalent to resolution of 1:16
 
+/*
+ *  Frame budget
+ *
+ *  While an animation is running, hi-res audio that is not already resident
+ *  is not requested, and after a frame that overran the budget no new blocks
+ *  are loaded at all. Rendering falls through to the best lower mode that is
+ *  available. The deferred loads are made once the animation has settled.
+ */
+#define WF_LOD_DEFAULT_BUDGET 33.0 // msecs. two frames at 60Hz
+#define WF_LOD_SETTLE_TIME    100  // msecs between checks for the end of an animation
+#define WF_LOD_MAX_ANIMATION  1000 // msecs. context animatables are only checked for this long after a zoom change
+
+static struct {
+	WfLodStats stats;
+} lod = {
+	.stats = {.budget = WF_LOD_DEFAULT_BUDGET}
+};
+
 static inline Mode get_mode                  (double zoom);
 static ModeRange   mode_range                (WaveformActor*);
 
@@ -265,6 +301,7 @@ static void   waveform_free_render_data      (Waveform*);
 #include "ui/renderer/res_hi.c"
 #include "ui/renderer/res_v_hi.c"
 #include "ui/renderer/res_v_low.c"
+#include "ui/renderer/spectrogram.c"
 
 static void  wf_actor_waveform_finalize_notify (gpointer, GObject*);
 static void  wf_actor_on_size_transition_start (WaveformActor*, WfAnimatable*);
@@ -325,6 +362,7 @@ wf_actor_class_init ()
 
 	static void wf_actor_on_zoom_changed (WaveformContext* wfc, gpointer _actor)
 	{
+		((WaveformActor*)_actor)->priv->lod.zoom_changed = g_get_monotonic_time(); // the signal is only emitted for animated changes
 		invalidator_invalidate_item(((Invalidator*)((AGlActor*)_actor)->behaviours[INVALIDATOR]), INVALIDATOR_DATA);
 	}
 
@@ -611,6 +649,8 @@ wf_actor_new (Waveform* w, WaveformContext* wfc)
 
 	if(w) wf_actor_connect_waveform(a);
 
+	if(wfc->compositing) agl_actor__add_behaviour(actor, cache_behaviour());
+
 	_a->handlers.dimensions_changed = g_signal_connect((gpointer)a->context, "dimensions-changed", (GCallback)wf_actor_on_dimensions_changed, a);
 	_a->handlers.zoom_changed = g_signal_connect((gpointer)a->context, "zoom-changed", (GCallback)wf_actor_on_zoom_changed, a);
 
@@ -619,7 +659,7 @@ wf_actor_new (Waveform* w, WaveformContext* wfc)
 
 
 static void
-_wf_actor_on_peakdata_available (Waveform* waveform, int block, gpointer _actor)
+_wf_actor_on_peakdata_available (Waveform* waveform, GArray* blocks, gpointer _actor)
 {
 	// because there can be many actors showing the same waveform
 	// this can be called multiple times, but the texture must only
@@ -629,19 +669,96 @@ _wf_actor_on_peakdata_available (Waveform* waveform, int block, gpointer _actor)
 	// Even though low res renderers do not use the audio directly, they must handle this signal
 	// in case that the audio has changed (old textures must have previously been cleared).
 	// TODO file changes need better testing.
+	//
+	// All the blocks that completed since the last notification are handled together
+	// so that each texture is uploaded once and only a single redraw is queued.
 
 	WaveformActor* a = _actor;
-	dbg(1, "block=%i", block);
+	dbg(1, "n_blocks=%i", blocks->len);
 
 	agl_actor__invalidate((AGlActor*)a);
 
 	ModeRange mode = mode_range(a);
 	int upper = MAX(mode.lower, mode.upper);
 	int lower = MIN(mode.lower, mode.upper);
-	int m; for(m=lower; m<=upper; m+=MAX(1, upper - lower)){
-		Renderer* renderer = modes[m].renderer;
-		call(renderer->load_block, renderer, a, m == MODE_LOW ? (block / WF_PEAK_STD_TO_LO) : block);
+
+	ng_gl2_begin_batch();
+	for(int i=0;i<blocks->len;i++){
+		int block = g_array_index(blocks, int, i);
+		int m; for(m=lower; m<=upper; m+=MAX(1, upper - lower)){
+			Renderer* renderer = modes[m].renderer;
+			call(renderer->load_block, renderer, a, m == MODE_LOW ? (block / WF_PEAK_STD_TO_LO) : block);
+		}
 	}
+	ng_gl2_end_batch();
+
+	if(((AGlActor*)a)->root && ((AGlActor*)a)->root->draw) wf_context_queue_redraw(a->context);
+}
+
+
+/*
+ *  Audio has been added to a live Waveform. See waveform_new_live()
+ */
+static void
+_wf_actor_on_frames_appended (Waveform* waveform, WfFrRange* range, gpointer _actor)
+{
+	WaveformActor* a = _actor;
+	AGlActor* actor = (AGlActor*)a;
+
+	// the render data is shared by all the actors for the waveform, so is only invalidated once for each change
+	static struct { Waveform* waveform; int64_t end; } done = {0,};
+
+	if(waveform != done.waveform || range->end != done.end){
+		done.waveform = waveform;
+		done.end = range->end;
+
+		#define n_blocks_for(FRAMES) ((FRAMES) / WF_SAMPLES_PER_TEXTURE + ((FRAMES) % WF_SAMPLES_PER_TEXTURE ? 1 : 0))
+
+		// the render data is sized for the number of blocks at the time it was created
+		bool grown = n_blocks_for(range->start) != n_blocks_for(range->end);
+
+		// only the new blocks, and the previous block because its border overlaps the new frames, are invalidated
+		int first = MAX(0, range->start / WF_SAMPLES_PER_TEXTURE - 1);
+		int last = (range->end - 1) / WF_SAMPLES_PER_TEXTURE;
+
+		for(int m=0;m<N_MODES;m++){
+			if(!waveform->priv->render_data[m]) continue;
+
+			Renderer* renderer = modes[m].renderer;
+			if(grown) call(renderer->extend, renderer, waveform);
+
+			if(renderer->invalidate_block && (!grown || renderer->extend)){
+				int ratio = m == MODE_V_LOW ? WF_MED_TO_V_LOW : m == MODE_LOW ? WF_PEAK_STD_TO_LO : 1;
+				for(int b=first/ratio;b<=last/ratio;b++){
+					renderer->invalidate_block(renderer, a, b);
+				}
+			}else{
+				call(renderer->free, renderer, waveform);
+				waveform->priv->render_data[m] = NULL;
+			}
+		}
+	}
+
+	// an actor showing all of the previous audio is extended to include the new frames
+	if(a->region.start + LEN(actor).target_val.b >= range->start){
+		wf_actor_set_region(a, &(WfSampleRegion){a->region.start, range->end - a->region.start});
+	}
+
+	invalidator_invalidate_item((Invalidator*)actor->behaviours[INVALIDATOR], INVALIDATOR_DATA);
+}
+
+
+/*
+ *  A spectrogram tile requested by the spectrogram renderer is available
+ */
+static void
+_wf_actor_on_spectrogram_ready (Waveform* waveform, WfSpectrogramTile* tile, gpointer _actor)
+{
+	WaveformActor* a = _actor;
+
+	if(!a->priv->spectrogram) return;
+
+	agl_actor__invalidate((AGlActor*)a);
 	if(((AGlActor*)a)->root && ((AGlActor*)a)->root->draw) wf_context_queue_redraw(a->context);
 }
 
@@ -652,7 +769,9 @@ wf_actor_connect_waveform (WaveformActor* a)
 	WfActorPriv* _a = a->priv;
 	g_return_if_fail(!_a->handlers.peakdata_ready);
 
-	_a->handlers.peakdata_ready = g_signal_connect (a->waveform, "hires-ready", (GCallback)_wf_actor_on_peakdata_available, a);
+	_a->handlers.peakdata_ready = g_signal_connect (a->waveform, "blocks-ready", (GCallback)_wf_actor_on_peakdata_available, a);
+	_a->handlers.frames_appended = g_signal_connect (a->waveform, "frames-appended", (GCallback)_wf_actor_on_frames_appended, a);
+	_a->handlers.spectrogram_ready = g_signal_connect (a->waveform, "spectrogram-ready", (GCallback)_wf_actor_on_spectrogram_ready, a);
 
 	g_object_weak_ref((GObject*)a->waveform, wf_actor_waveform_finalize_notify, a);
 }
@@ -665,6 +784,8 @@ wf_actor_disconnect_waveform (WaveformActor* a)
 	g_return_if_fail(_a->handlers.peakdata_ready);
 
 	_g_signal_handler_disconnect0(a->waveform, _a->handlers.peakdata_ready);
+	_g_signal_handler_disconnect0(a->waveform, _a->handlers.frames_appended);
+	_g_signal_handler_disconnect0(a->waveform, _a->handlers.spectrogram_ready);
 
 	g_object_weak_unref((GObject*)a->waveform, wf_actor_waveform_finalize_notify, a);
 }
@@ -689,6 +810,12 @@ wf_actor_free (AGlActor* actor)
 	for (;l;l=l->next) wf_animation_remove((WfAnimation*)l->data);
 	g_list_free0(actor->transitions);
 
+	ng_lod_forget_actor(a);
+
+	if (_a->lod.timer) g_source_remove(_a->lod.timer);
+
+	if (a->context) wf_context_remove_actor(a->context, a);
+
 	if (a->waveform) {
 		wf_actor_disconnect_waveform(a);
 		_g_signal_handler_disconnect0(a->context, _a->handlers.dimensions_changed);
@@ -730,6 +857,8 @@ waveform_free_render_data (Waveform* waveform)
 			waveform->priv->render_data[m] = NULL;
 		}
 	}
+
+	spectrogram_renderer.free(&spectrogram_renderer, waveform);
 }
 
 
@@ -839,6 +968,8 @@ wf_actor_set_region (WaveformActor* a, WfSampleRegion* region)
 	WfActorPriv* _a = a->priv;
 	AGlScene* scene = actor->root;
 
+	WF_TRACE(a->context, a, .type = WF_TRACE_REGION, .region = *region);
+
 	IF_WF_DEBUG dbg(1, "region_start=%"PRIi64" (%"PRIi64"%%) region_end=%"PRIi64" wave_end=%"PRIi64, region->start, (waveform_get_n_frames(a->waveform) ? (100 * region->start / a->waveform->n_frames) : 0), region->start + region->len, waveform_get_n_frames(a->waveform));
 	if(!region->len && a->waveform->n_channels){ pwarn("invalid region: len not set"); return; }
 	if(region->start > waveform_get_n_frames(a->waveform)){ pwarn("invalid region: start out of range: %"PRIi64" > %"PRIi64"", region->start, waveform_get_n_frames(a->waveform)); return; }
@@ -855,6 +986,8 @@ wf_actor_set_region (WaveformActor* a, WfSampleRegion* region)
 
 	if(!start && !end) return;
 
+	if(end) wf_context_update_actor_len(a->context, a, region->len);
+
 	if(agl_actor__width(actor) > 0.00001)
 		invalidator_invalidate_item((Invalidator*)actor->behaviours[INVALIDATOR], INVALIDATOR_DATA);
 
@@ -951,6 +1084,9 @@ wf_actor_set_full (WaveformActor* a, WfSampleRegion* region, WfRectangle* rect,
 	//FIXME this definition is different to below
 	bool animate = scene->draw && scene->enable_animations && !is_new;
 
+	if(region) WF_TRACE(a->context, a, .type = WF_TRACE_REGION, .region = *region);
+	if(rect) WF_TRACE(a->context, a, .type = WF_TRACE_RECT, .rect = *rect);
+
 	if(region){
 		dbg(1, "region_start=%"PRIi64" region_end=%"PRIi64" wave_end=%"PRIu64, region->start, (uint64_t)(region->start + region->len), waveform_get_n_frames(a->waveform));
 		if(!region->len){ pwarn("invalid region: len not set"); return; }
@@ -969,6 +1105,8 @@ wf_actor_set_full (WaveformActor* a, WfSampleRegion* region, WfRectangle* rect,
 		bool end   = (region->len   != a->region.len);
 
 		if(start || end){
+			if(end) wf_context_update_actor_len(a->context, a, region->len);
+
 						// TODO too early - set rect first.
 			if(agl_actor__width(actor) > 0.00001) _wf_actor_load_missing_blocks(a); // this loads _current_ values, future values are loaded by the animator preview
 
@@ -1321,6 +1459,79 @@ mode_range (WaveformActor* a)
 }
 
 
+/*
+ *  Set the maximum time in msecs between animation frames before loading
+ *  is reduced. A value of zero disables the adaptive level of detail.
+ */
+void
+wf_actor_set_frame_budget (float msecs)
+{
+	lod.stats.budget = MAX(0.0, msecs);
+}
+
+
+WfLodStats
+wf_actor_get_lod_stats ()
+{
+	return lod.stats;
+}
+
+
+static bool
+wf_actor_is_animating (WaveformActor* a)
+{
+	if (((AGlActor*)a)->transitions) return true;
+
+	// the context zoom is animated independently of the actor.
+	// The targets are not updated by all setters so are only used shortly after a zoom-changed signal.
+	WaveformContext* wfc = a->context;
+	WfContextPriv* p = wfc->priv;
+	return wfc->scaled
+		&& a->priv->lod.zoom_changed
+		&& g_get_monotonic_time() - a->priv->lod.zoom_changed < WF_LOD_MAX_ANIMATION * 1000
+		&& (*p->zoom.val.f != p->zoom.target_val.f || *p->samples_per_pixel.val.f != p->samples_per_pixel.target_val.f);
+}
+
+
+static gboolean
+wf_actor_lod_refine (gpointer _actor)
+{
+	WaveformActor* a = _actor;
+	WfActorPriv* _a = a->priv;
+
+	if (wf_actor_is_animating(a)) return G_SOURCE_CONTINUE;
+
+	dbg(1, "animation settled. loading deferred blocks");
+	_a->lod = (typeof(_a->lod)){0,};
+	lod.stats.n_refined++;
+
+	_wf_actor_load_missing_blocks(a);
+	agl_actor__invalidate((AGlActor*)a);
+	if (((AGlActor*)a)->root && ((AGlActor*)a)->root->draw) wf_context_queue_redraw(a->context);
+
+	return G_SOURCE_REMOVE;
+}
+
+
+/*
+ *  Returns true if loading of blocks that are not resident should be postponed.
+ */
+static bool
+wf_actor_lod_defer (WaveformActor* a, bool overrun_only)
+{
+	WfActorPriv* _a = a->priv;
+
+	if (!lod.stats.budget || !wf_actor_is_animating(a)) return false;
+	if (overrun_only && !_a->lod.overrun) return false;
+
+	lod.stats.n_deferred++;
+
+	if (!_a->lod.timer) _a->lod.timer = g_timeout_add(WF_LOD_SETTLE_TIME, wf_actor_lod_refine, a);
+
+	return true;
+}
+
+
 static void
 _wf_actor_allocate_hi (WaveformActor* a)
 {
@@ -1384,6 +1595,10 @@ _wf_actor_allocate_hi (WaveformActor* a)
 	BlockRange blocks = wf_actor_get_visible_block_range (&region, &rect, zoom, &viewport, w->priv->n_blocks);
 
 	for (int b=blocks.first;b<=blocks.last;b++) {
+		if (!hi_block_is_resident(w, b) && wf_actor_lod_defer(a, false)) {
+			dbg(2, "deferred: %i", b);
+			continue;
+		}
 		hi_request_block(a, b);
 	}
 
@@ -1428,7 +1643,9 @@ set_renderer (WaveformActor* actor)
 {
 	RenderInfo* r = &actor->priv->render_info;
 
-	Renderer* renderer = modes[r->mode].renderer;
+	Renderer* renderer = actor->priv->spectrogram && agl->use_shaders
+		? &spectrogram_renderer
+		: modes[r->mode].renderer;
 	dbg(2, "%s", modes[r->mode].name);
 
 	((AGlActor*)actor)->program = renderer->shader;
@@ -1494,10 +1711,49 @@ _wf_actor_load_missing_blocks (WaveformActor* a)
 		MAX(mode1, mode2)
 	};
 
+	RenderInfo* r = &a->priv->render_info;
+
+	if (a->priv->spectrogram && agl->use_shaders) {
+		// tiles are loaded for the target zoom only. Missing tiles are requested again when rendered.
+		Renderer* renderer = &spectrogram_renderer;
+		renderer->new(a);
+
+		r->mode = mode2;
+
+		uint64_t start_max = MAX(a->region.start, START(actor).target_val.b) + wf_context_x_to_frame(a->context, -actor->scrollable.x1);
+		uint64_t start_min = MIN(a->region.start, START(actor).target_val.b) + wf_context_x_to_frame(a->context, -actor->scrollable.x1);
+		int len_max = start_max - start_min + MAX(a->region.len, LEN(actor).target_val.b);
+		WfSampleRegion region = {start_min, len_max};
+
+		WfRectangle rect_ = {actor->region.x1, actor->region.y1, agl_actor__width(actor), agl_actor__height(actor)};
+
+		WfViewPort clippingport = get_clipping_port(a);
+
+		crop_to_parent(a, &rect_, &region);
+
+		BlockRange viewport_blocks = wf_actor_get_visible_block_range (&region, &rect_, _zoom.end, &clippingport, wf_actor_get_n_blocks(w, mode2));
+
+		for (int b=viewport_blocks.first;b<=viewport_blocks.last;b++) {
+			renderer->load_block(renderer, a, b);
+		}
+
+		r->mode = mode1;
+		set_renderer(a);
+		return;
+	}
+
 	for (int i=mode[0];i<=mode[1];i++)
 		if (!_w->render_data[i])
 			call(modes[i].renderer->new, a);
 
+	if (mode[1] > MODE_V_LOW && wf_actor_lod_defer(a, true)) {
+		// the previous frame overran. only blocks that are already loaded will be used.
+		dbg(2, "frame overrun. deferring %s-->%s", modes[MAX(mode[0], MODE_LOW)].name, modes[mode[1]].name);
+		if (mode[0] > MODE_V_LOW) return;
+		mode[1] = MODE_V_LOW;
+		zoom_max = zoom;
+	}
+
 	if (zoom_max >= ZOOM_MED) {
 		dbg(2, "HI-RES");
 		if (!a->waveform->offline) {
@@ -1582,7 +1838,6 @@ _wf_actor_load_missing_blocks (WaveformActor* a)
 		}
 	}
 
-	RenderInfo* r = &a->priv->render_info;
 	r->mode = mode1;
 	set_renderer(a);
 
@@ -1598,6 +1853,7 @@ wf_actor_set_rect (WaveformActor* a, WfRectangle* rect)
 {
 	g_return_if_fail(a);
 	g_return_if_fail(rect);
+	WF_TRACE(a->context, a, .type = WF_TRACE_RECT, .rect = *rect);
 	rect->len = MAX(1.0, rect->len);
 
 	WfActorPriv* _a = a->priv;
@@ -1752,6 +2008,8 @@ wf_actor_set_vzoom (WaveformActor* a, float vzoom)
 {
 	dbg(1, "vzoom=%.2f", vzoom);
 
+	WF_TRACE(a->context, a, .type = WF_TRACE_VZOOM, .f = vzoom);
+
 	#define MAX_VZOOM 100.0
 	a->vzoom = CLAMP(vzoom, 1.0, MAX_VZOOM);
 
@@ -1761,6 +2019,58 @@ wf_actor_set_vzoom (WaveformActor* a, float vzoom)
 }
 
 
+/*
+ *  Show a spectrogram instead of the waveform. Requires shaders.
+ *  The resolution of the spectrogram follows the zoom level.
+ */
+void
+wf_actor_set_spectrogram (WaveformActor* a, bool enable)
+{
+	g_return_if_fail(a);
+
+	if(enable == a->priv->spectrogram) return;
+	if(enable && !agl->use_shaders) pwarn("spectrogram requires shaders");
+
+	a->priv->spectrogram = enable;
+	a->priv->render_info.valid = false;
+
+	AGlActor* actor = (AGlActor*)a;
+	agl_actor__invalidate(actor);
+	invalidator_invalidate_item(((Invalidator*)actor->behaviours[INVALIDATOR]), INVALIDATOR_DATA);
+}
+
+
+/*
+ *  A cached actor is rendered into an fbo which is reused until the actor
+ *  is invalidated by a change of zoom, scroll, size or data. Normally set
+ *  for all actors using wf_context_set_compositing().
+ */
+void
+wf_actor_set_cached (WaveformActor* a, bool cached)
+{
+	g_return_if_fail(a);
+
+	AGlActor* actor = (AGlActor*)a;
+	AGlBehaviour* cache = agl_actor__find_behaviour(actor, cache_get_class());
+	if(cached == !!cache) return;
+
+	if(cached){
+		agl_actor__add_behaviour(actor, cache_behaviour());
+	}else{
+		int n = G_N_ELEMENTS(actor->behaviours);
+		for(int i=0;i<n;i++){
+			if(actor->behaviours[i] == cache){
+				for(;i<n-1;i++) actor->behaviours[i] = actor->behaviours[i + 1];
+				actor->behaviours[n - 1] = NULL;
+			}
+		}
+		if(cache->klass->free) cache->klass->free(cache); else g_free(cache);
+	}
+
+	agl_actor__invalidate(actor);
+}
+
+
 void
 wf_actor_scroll_to (WaveformActor* a, int i)
 {
@@ -1883,13 +2193,18 @@ calc_render_info (WaveformActor* actor)
 		: r->rect.len / r->region.len;
 	r->mode = get_mode(r->zoom);
 
-	if(!_w->render_data[r->mode]){
+	if(actor->priv->spectrogram && agl->use_shaders){
+		// the spectrogram renderer does not use the render_data
+		r->n_blocks = wf_actor_get_n_blocks(w, r->mode);
+	}else{
+		if(!_w->render_data[r->mode]){
 #ifdef DEBUG
-		actor->render_result = RENDER_RESULT_LOADING;
+			actor->render_result = RENDER_RESULT_LOADING;
 #endif
-		return false;
+			return false;
+		}
+		r->n_blocks = _w->render_data[r->mode]->n_blocks;
 	}
-	r->n_blocks = _w->render_data[r->mode]->n_blocks;
 	if(!r->n_blocks){
 #ifdef DEBUG
 		actor->render_result = RENDER_RESULT_NO_BLOCKS;
@@ -2038,16 +2353,30 @@ wf_actor_paint (AGlActor* _actor)
 
 	if(!_actor->root || !_actor->root->draw) r->valid = false;
 
-#ifdef RENDER_CACHE_HIT_STATS
-	static int hits = 0;
-	static int misses = 0;
-	if(r->valid) hits++; else misses++;
-	if(!((hits + misses) % 100)) dbg(1, "hit ratio: %.2f", ((float)hits) / ((float)misses));
-#endif
+	bool animating = lod.stats.budget && wf_actor_is_animating(actor);
+	if (animating) {
+		int64_t now = g_get_monotonic_time();
+		if (_a->lod.last_paint) {
+			lod.stats.frame_time = (now - _a->lod.last_paint) / 1000.0;
+			lod.stats.n_frames++;
+			_a->lod.overrun = lod.stats.frame_time > lod.stats.budget;
+			if (_a->lod.overrun) lod.stats.n_overruns++;
+		}
+		_a->lod.last_paint = now;
+	} else {
+		_a->lod.last_paint = 0;
+		_a->lod.overrun = false;
+	}
+
+	WF_PROFILE_ADD(actor_paints, 1);
+	if (r->valid) WF_PROFILE_ADD(render_info_hits, 1); else WF_PROFILE_ADD(render_info_invalidations, 1);
 
 	if (!r->valid) {
 		AGlShader* shader = _actor->program;
-		if (!calc_render_info(actor)) return false;
+		WF_PROFILE_PHASE_START(WF_PHASE_CALC_RENDER_INFO);
+		bool ok = calc_render_info(actor);
+		WF_PROFILE_PHASE_END(WF_PHASE_CALC_RENDER_INFO);
+		if (!ok) return false;
 		if (!_actor->program) {
 #ifdef WF_DEBUG
 			actor->render_result = RENDER_RESULT_NO_PROGRAM;
@@ -2097,7 +2426,12 @@ wf_actor_paint (AGlActor* _actor)
 				return false;
 			*m_active = m;
 		}
-		return renderer->render_block(renderer, actor, b, is_first, is_last, x);
+		if (!renderer->render_block(renderer, actor, b, is_first, is_last, x))
+			return false;
+
+		WF_PROFILE_ADD(draw_calls, 1);
+		WF_PROFILE_ADD(blocks[m], 1);
+		return true;
 	}
 
 	double x = (r->viewport_blocks.first - r->region_start_block) * r->block_wid - r->first_offset_px; // x is now the start of the first block (can be before part start when inset is present)
@@ -2117,12 +2451,23 @@ wf_actor_paint (AGlActor* _actor)
 	glTranslatef(0, 0, actor->priv->animatable.z.val.f);
 #endif
 
+	WF_PROFILE_PHASE_START(WF_PHASE_RENDER);
+
 	bool render_ok = true;
 	Mode m_active = N_MODES;
 	bool is_first = true;
 	for (int b=r->viewport_blocks.first;b<=r->viewport_blocks.last;b++) {
 		bool is_last = (b == r->viewport_blocks.last) || (b == r->n_blocks - 1); //2nd test is unneccesary?
 
+		if (r->renderer == &spectrogram_renderer) {
+			// there is no fall through. blocks without a tile are left empty until the tile is ready.
+			Mode m = r->mode;
+			render_block(r->renderer, actor, b, is_first, is_last, x, m, &m_active);
+			x += r->block_wid;
+			is_first = false;
+			continue;
+		}
+
 		Mode m = r->mode;
 		// I think there is an optimisation to do here.
 		// Pre-render should not be done for each block
@@ -2133,6 +2478,7 @@ wf_actor_paint (AGlActor* _actor)
 			// TODO pre_render not being set propery for MODE_HI due to use_shader settings.
 			// TODO render_info not correct when falling through. Is set for the higher mode.
 			m--;
+			WF_PROFILE_ADD(fall_throughs, 1);
 			if (m > N_MODES) {
 				render_ok = false;
 				if (wf_debug) pwarn("render failed. no modes succeeded. mode=%i", r->mode); // not neccesarily an error. may simply be not ready.
@@ -2142,6 +2488,7 @@ wf_actor_paint (AGlActor* _actor)
 				call(modes[m].renderer->new, actor);
 			if(!w->priv->render_data[m]) break;
 		}
+		if (animating && m < r->mode) lod.stats.n_degraded++;
 #ifdef RECT_ROUNDING
 		i++;
 		x = round(x0 + i * block_wid0);
@@ -2152,7 +2499,10 @@ wf_actor_paint (AGlActor* _actor)
 		is_first = false;
 	}
 
-	if(modes[r->mode].renderer->post_render) modes[r->mode].renderer->post_render(modes[r->mode].renderer, actor);
+	if(r->renderer == &spectrogram_renderer) r->renderer->post_render(r->renderer, actor);
+	else if(modes[r->mode].renderer->post_render) modes[r->mode].renderer->post_render(modes[r->mode].renderer, actor);
+
+	WF_PROFILE_PHASE_END(WF_PHASE_RENDER);
 
 #if 0
 	glTranslatef(0, 0, -actor->priv->animatable.z.val.f);
@@ -2333,6 +2683,8 @@ glEnable(GL_TEXTURE_1D);
 		glTexImage1D(GL_TEXTURE_1D, 0, GL_ALPHA8, modes[mode].texture_size, 0, GL_ALPHA, GL_UNSIGNED_BYTE, d->buf);
 
 		gl_warn("unit=%i buf=%p tid=%i", d->tex_unit, d->buf, d->tex_id);
+		WF_PROFILE_ADD(texture_binds, 1);
+		WF_PROFILE_ADD(bytes_uploaded, modes[mode].texture_size);
 	}
 
 	int c;for(c=0;c<waveform_get_n_channels(w);c++){
@@ -2418,6 +2770,7 @@ wf_actor_load_texture2d(WaveformActor* a, Mode mode, int texture_id, int blocknu
 
 					int b;for(b=blocks.first;b<=blocks.last;b++){
 						if(mode >= MODE_HI){
+							if(!hi_block_is_resident(a->waveform, b) && wf_actor_lod_defer(a, false)) continue;
 							hi_request_block(a, b);
 						}else{
 							Renderer* renderer = modes[mode].renderer;
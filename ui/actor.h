@@ -34,6 +34,16 @@ typedef enum {
 } RenderResult;
 #endif
 
+typedef struct {
+	float    budget;        // msecs. zero if adaptive level of detail is disabled
+	float    frame_time;    // msecs. the most recent interval between animation frames
+	uint64_t n_frames;      // animation frames measured
+	uint64_t n_overruns;    // frames that exceeded the budget
+	uint64_t n_deferred;    // loads postponed until the end of the animation
+	uint64_t n_degraded;    // blocks rendered at a lower resolution than the zoom requires
+	uint64_t n_refined;     // settled animations for which the deferred loads were made
+} WfLodStats;
+
 struct _WaveformActor {
 	AGlActor         actor;
 	WaveformContext* context;
@@ -59,12 +69,22 @@ void           wf_actor_set_full             (WaveformActor*, WfSampleRegion*, W
 void           wf_actor_fade_out             (WaveformActor*, WaveformActorFn, gpointer);
 void           wf_actor_fade_in              (WaveformActor*, float, WaveformActorFn, gpointer);
 void           wf_actor_set_vzoom            (WaveformActor*, float);
+void           wf_actor_set_spectrogram      (WaveformActor*, bool);
+void           wf_actor_set_cached           (WaveformActor*, bool);
 void           wf_actor_scroll_to            (WaveformActor*, int);
 WfAnimatable*  wf_actor_get_z                (WaveformActor*);
 void           wf_actor_set_z                (WaveformActor*, float, WaveformActorFn, gpointer);
 float          wf_actor_frame_to_x           (WaveformActor*, uint64_t);
 void           wf_actor_clear                (WaveformActor*);
 
+void           wf_actor_set_frame_budget     (float msecs);
+WfLodStats     wf_actor_get_lod_stats        ();
+
+void           wf_ng_cache_set_budget        (size_t bytes);
+void           wf_ng_cache_set_keep_buffers  (bool);
+size_t         wf_ng_cache_get_size          ();
+void           wf_ng_set_background_lod      (bool);
+
 #define        WF_ACTOR_PX_PER_FRAME(A) (agl_actor__width((AGlActor*)A) / A->region.len)
 
 struct _WfViewPort { double left, top, right, bottom; };
@@ -23,6 +23,7 @@
 #include "agl/behaviours/follow.h"
 #include "waveform/actor.h"
 #include "waveform/grid.h"
+#include "waveform/text_atlas.h"
 
 typedef struct {
     AGlActor         actor;
@@ -181,9 +182,7 @@ grid_actor_paint (AGlActor* actor)
 			}
 		}
 
-		agl_set_font_string("Roboto 7");
 		uint32_t colour = (actor->colour & 0xffffff00) + (actor->colour & 0x000000ff) * 0x88 / 0xff;
-		char s[16] = {0,};
 		int x_ = 0;
 		uint64_t f = ((int64_t)(context->start_time->value.b / interval)) * interval;
 		for (int i = 0; (f < region.end) && (i < 0xff); f += interval, i++) {
@@ -196,15 +195,14 @@ grid_actor_paint (AGlActor* actor)
 				else{
 #endif
 					uint64_t mins = f / (60 * context->sample_rate);
-					snprintf(s, 15, "%"PRIi64":%.1f", mins, ((float)f) / context->sample_rate - 60 * mins);
+					text_atlas_print(x, 0, colour, "Roboto 7", "%"PRIi64":%.1f", mins, ((float)f) / context->sample_rate - 60 * mins);
 #if 0
 				}
 #endif
-				agl_print(x, 0, 0, colour, s);
 				x_ = x;
 			}
 		}
-		agl_set_font_string("Roboto 10");
+		text_atlas_flush();
 	} else {
 		glDisable(GL_TEXTURE_1D);
 		glLineWidth(1);
@@ -19,6 +19,7 @@
 #include "waveform/actor.h"
 #include "waveform/ui-utils.h"
 #include "waveform/hover.h"
+#include "waveform/text_atlas.h"
 
 static AGl* agl;
 
@@ -148,13 +149,11 @@ hover_actor_paint (AGlActor* actor)
 		int pk_height = ch_height / 2;
 		int y = (hover->eventspy.xy.y - (int)((AGlActor*)hover->wf_actor)->region.y1) % ch_height;
 
-		agl_set_font_string("Sans 7.5");
-		agl_print_with_background(0, 0, 0, 0xccccccff, 0x0000005f, "%.2f dB ", wf_int2db((SHRT_MAX * (y - pk_height)) / pk_height));
+		text_atlas_print_with_background(0, 0, 0xccccccff, 0x0000005f, "Sans 7.5", "%.2f dB ", wf_int2db((SHRT_MAX * (y - pk_height)) / pk_height));
 	}
 
 	if (hover->eventspy.xy.x > -1) {
-		agl_set_font_string("Sans 7.5");
-		agl_print_with_background(0, 14, 0, 0xccccccff, 0x0000005f, "%s", wf_context_print_time(hover->context, hover->eventspy.xy.x));
+		text_atlas_print_with_background(0, 14, 0xccccccff, 0x0000005f, "Sans 7.5", "%s", wf_context_print_time(hover->context, hover->eventspy.xy.x));
 	}
 
 	return true;
@@ -18,6 +18,7 @@
 #include "agl/behaviours/cache.h"
 #include "waveform/actor.h"
 #include "waveform/labels.h"
+#include "waveform/text_atlas.h"
 
 typedef struct {
     AGlActor         actor;
@@ -91,19 +92,16 @@ labels_actor_paint (AGlActor* actor)
 	int i = 0;
 	uint64_t f = ((int)(context->start_time->value.b / interval)) * interval;
 
-	agl_set_font_string("Roboto 7");
-	char s[16] = {0,};
 	int x_ = 0;
 	for (; (f < region_end) && (i < 0xff); f += interval, i++) {
 		int x = wf_context_frame_to_x(context, f) + 3;
 		if (x - x_ > 60) {
 			uint64_t mins = f / (60 * context->sample_rate);
-			snprintf(s, 15, "%"PRIi64":%.1f", mins, ((float)f) / context->sample_rate - 60 * mins);
-			agl_print(x, 0, 0, actor->colour, s);
+			text_atlas_print(x, 0, actor->colour, "Roboto 7", "%"PRIi64":%.1f", mins, ((float)f) / context->sample_rate - 60 * mins);
 			x_ = x;
 		}
 	}
-	agl_set_font_string("Roboto 10");
+	text_atlas_flush();
 #endif
 	return true;
 }
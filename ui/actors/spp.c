@@ -24,6 +24,7 @@
 #include "waveform/actor.h"
 #include "waveform/ui-utils.h"
 #include "waveform/shader.h"
+#include "waveform/text_atlas.h"
 #include "ui/actors/spp.h"
 
 static AGl* agl = NULL;
@@ -100,12 +101,8 @@ spp_actor__paint (AGlActor* actor)
 			width, agl_actor__height(actor)
 		);
 
-		agl_set_font_string("Roboto 16");
-		char s[16] = {0,};
-		snprintf(s, 15, "%02i:%02i:%03i", (spp->time / 1000) / 60, (spp->time / 1000) % 60, spp->time % 1000);
-		// FIXME background is not opaque unless bg is ffffff
-		agl_print_with_background(-actor->scrollable.x1, 0, 0, spp->text_colour, 0x000000ff, s);
-		agl_set_font_string("Roboto 10");
+		// the time changes every frame during playback so is drawn from cached glyphs
+		text_atlas_print_with_background(-actor->scrollable.x1, 0, spp->text_colour, 0x000000ff, "Roboto 16", "%02i:%02i:%03i", (spp->time / 1000) / 60, (spp->time / 1000) % 60, spp->time % 1000);
 	}
 
 	return true;
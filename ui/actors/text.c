@@ -21,6 +21,7 @@
 #include "waveform/ui-utils.h"
 #include "waveform/shader.h"
 #include "waveform/text.h"
+#include "waveform/text_atlas.h"
 
 extern AssShader ass;
 
@@ -41,7 +42,6 @@ static void text_actor_init     (AGlActor*);
 static AGlActorClass actor_class = {0, "Text", (AGlActorNew*)text_actor, text_actor_free};
 
 static AGl* agl = NULL;
-static int instance_count = 0;
 
 static void text_actor_render_text (TextActor*);
 static void measure_text           (const char*, int font_size, PangoRectangle*);
@@ -63,8 +63,6 @@ text_actor_get_class ()
 AGlActor*
 text_actor (WaveformActor* _)
 {
-	instance_count++;
-
 	TextActor* ta = agl_actor__new(TextActor,
 		.actor = {
 			.class = &actor_class,
@@ -94,11 +92,9 @@ text_actor_free (AGlActor* actor)
 	g_clear_pointer(&ta->title, g_free);
 	g_clear_pointer(&ta->text, g_free);
 
-	if (!--instance_count) {
-		if (ta->texture.ids[0]) {
-			glDeleteTextures(1, ta->texture.ids);
-			ta->texture.ids[0] = 0;
-		}
+	if (ta->texture.ids[0]) {
+		glDeleteTextures(1, ta->texture.ids);
+		ta->texture.ids[0] = 0;
 	}
 
 	g_free(actor);
@@ -135,18 +131,18 @@ text_actor_set_colour (TextActor* ta, uint32_t title1, uint32_t title2)
 
 /*
  *  The strings are owned by the actor and will be freed later.
+ *  The title is only rendered again if it has changed.
  */
 void
 text_actor_set_text (TextActor* ta, char* title, char* text)
 {
 	if (title) {
+		if (!ta->title || strcmp(title, ta->title)) ta->title_is_rendered = false;
 		wf_set_str(ta->title, title);
 	}
 
 	wf_set_str(ta->text, text);
 
-	ta->title_is_rendered = false;
-
 	agl_actor__invalidate((AGlActor*)ta);
 }
 
@@ -180,7 +176,10 @@ text_actor_paint (AGlActor* actor)
 #endif
 	}
 
-	agl_print(2, agl_actor__height(actor) - 16, 0, ta->text_colour, ta->text);
+	if (ta->text) {
+		text_atlas_print(2, agl_actor__height(actor) - 16, ta->text_colour, "Roboto 10", "%s", ta->text);
+		text_atlas_flush();
+	}
 
 	return true;
 }
@@ -295,14 +294,7 @@ text_actor_render_text (TextActor* ta)
 	PF;
 	if (ta->title_is_rendered) pwarn("title is already rendered");
 
-	GError* error = NULL;
-	GRegexMatchFlags flags = 0;
-	static GRegex* regex = NULL;
-	if (!regex) regex = g_regex_new("[_]", 0, flags, &error);
-	gchar* str = g_regex_replace(regex, ta->title, -1, 0, " ", flags, &error);
-
-	g_autofree char* title = g_strdup_printf("%s", str);
-	g_free(str);
+	g_autofree char* title = g_strdelimit(g_strdup(ta->title), "_", ' ');
 
 	Image image;
 	render_outlined_text_to_a8(title, "Sans", FONT_SIZE, 2.5, &image);
@@ -332,7 +324,7 @@ text_actor_render_text (TextActor* ta)
 #endif
 
 	{
-		if (((TextActor*)actor)->texture.ids[0]) {
+		if (!ta->texture.ids[0]) {
 			glGenTextures(1, ((TextActor*)actor)->texture.ids);
 			if (gl_error) {
 				perr ("couldnt create ass_texture.");
@@ -23,12 +23,16 @@
 #include "agl/debug.h"
 #include "transition/frameclock.h"
 #include "wf/waveform.h"
+#include "wf/profile.h"
 #include "waveform/ui-utils.h"
 #include "waveform/pixbuf.h"
 #include "waveform/shader.h"
 #include "waveform/texture_cache.h"
 #include "waveform/ui-private.h"
 #include "waveform/context.h"
+#include "waveform/actor.h"
+#include "waveform/interval_tree.h"
+#include "waveform/trace.h"
 
 static AGl* agl = NULL;
 
@@ -44,6 +48,7 @@ static AGl* agl = NULL;
 static void wf_context_class_init      (WaveformContextClass*);
 static void wf_context_instance_init   (WaveformContext*);
 static void wf_context_finalize        (GObject*);
+static void wf_context_invalidate_actors (WaveformContext*);
 
 #define TRACK_ACTORS // for debugging only.
 #undef TRACK_ACTORS
@@ -76,7 +81,9 @@ on_steal (WfTexture* tex)
 {
 	WaveformBlock* wb = &tex->wb;
 
-	if(wb->block & WF_TEXTURE_CACHE_HIRES_NG_MASK){
+	if(wb->block & WF_TEXTURE_CACHE_SPECTRO_MASK){
+		// nothing to do. spectrogram textures are only accessed via the cache so will be uploaded again when needed
+	}else if(wb->block & WF_TEXTURE_CACHE_HIRES_NG_MASK){
 		extern void hi_gl2_on_steal(WaveformBlock*, guint);
 		hi_gl2_on_steal(wb, tex->id);
 	}else{
@@ -205,6 +212,7 @@ wf_context_finalize (GObject* obj)
 {
 	WaveformContext* wfc = WAVEFORM_CONTEXT (obj);
 
+	g_clear_pointer(&wfc->priv->actors, wf_interval_tree_free);
 	wf_free(wfc->priv);
 
 	G_OBJECT_CLASS (waveform_context_parent_class)->finalize (obj);
@@ -246,6 +254,156 @@ wf_context_add_new_actor (WaveformContext* wfc, Waveform* w)
 }
 
 
+/*
+ *  Giving actors a position on the timeline allows the context to
+ *  find the actors in a time range without visiting every actor.
+ *  When positions have been set, changes of zoom and start only
+ *  invalidate the actors that are in view. Actors that do not have
+ *  a position are not invalidated in this case so all actors under
+ *  the context root should be given positions.
+ *
+ *  The actor region is used for the length. The position does not
+ *  change the onscreen rect, which is still set by the application.
+ */
+void
+wf_context_set_actor_position (WaveformContext* wfc, WaveformActor* a, int64_t frame)
+{
+	g_return_if_fail(wfc && a);
+	WfContextPriv* p = wfc->priv;
+
+	if (!p->actors) p->actors = wf_interval_tree_new();
+
+	wf_interval_tree_set(p->actors, a, frame, frame + MAX(1, a->region.len));
+}
+
+
+/*
+ *  Set the positions of many actors together, for example
+ *  following an edit that affects the whole arrangement.
+ */
+void
+wf_context_set_actor_positions (WaveformContext* wfc, WaveformActor** actors, int64_t* frames, int n)
+{
+	g_return_if_fail(wfc && actors && frames);
+	WfContextPriv* p = wfc->priv;
+
+	if (!p->actors) p->actors = wf_interval_tree_new();
+
+	WfInterval* intervals = g_new(WfInterval, n);
+	for (int i=0;i<n;i++) {
+		intervals[i] = (WfInterval){frames[i], frames[i] + MAX(1, actors[i]->region.len), actors[i]};
+	}
+	wf_interval_tree_set_all(p->actors, intervals, n);
+	g_free(intervals);
+}
+
+
+void
+wf_context_update_actor_len (WaveformContext* wfc, WaveformActor* a, int64_t len)
+{
+	WfContextPriv* p = wfc->priv;
+
+	WfInterval* interval = p->actors ? wf_interval_tree_get(p->actors, a) : NULL;
+	if (interval) {
+		int64_t start = interval->start;
+		wf_interval_tree_set(p->actors, a, start, start + MAX(1, len));
+	}
+}
+
+
+void
+wf_context_remove_actor (WaveformContext* wfc, WaveformActor* a)
+{
+	if (wfc->priv->actors) wf_interval_tree_remove(wfc->priv->actors, a);
+}
+
+
+typedef struct {
+	GFunc    fn;
+	gpointer user_data;
+} ForeachClosure;
+
+	static void call_actor_fn (WfInterval* interval, gpointer _c)
+	{
+		ForeachClosure* c = _c;
+		c->fn(interval->data, c->user_data);
+	}
+
+/*
+ *  Call @fn for each positioned actor that overlaps the frame range @start to @end.
+ *  Actors must not be moved or removed by @fn.
+ *  Returns the number of actors found.
+ */
+int
+wf_context_foreach_actor_in_range (WaveformContext* wfc, int64_t start, int64_t end, GFunc fn, gpointer user_data)
+{
+	g_return_val_if_fail(wfc, 0);
+	WfContextPriv* p = wfc->priv;
+
+	if (!p->actors) return 0;
+
+	return wf_interval_tree_query(p->actors, start, end, fn ? call_actor_fn : NULL, &(ForeachClosure){fn, user_data});
+}
+
+
+static void
+wf_context_get_visible_range (WaveformContext* wfc, int64_t* start, int64_t* end)
+{
+	float frames_per_px = wfc->samples_per_pixel / wfc->zoom->value.f;
+	float x = -wfc->root->scrollable.x1;
+
+	*start = wfc->start_time->value.b + x * frames_per_px;
+	*end = *start + agl_actor__width(wfc->root) * frames_per_px + 1;
+}
+
+
+int
+wf_context_foreach_visible_actor (WaveformContext* wfc, GFunc fn, gpointer user_data)
+{
+	g_return_val_if_fail(wfc, 0);
+
+	int64_t start, end;
+	wf_context_get_visible_range(wfc, &start, &end);
+
+	return wf_context_foreach_actor_in_range(wfc, start, end, fn, user_data);
+}
+
+
+/*
+ *  Called following a change of zoom or start.
+ *  If actors have positions, only the actors that are visible now, or were visible
+ *  at the previous change, are invalidated.
+ */
+static void
+wf_context_invalidate_actors (WaveformContext* wfc)
+{
+	WfContextPriv* p = wfc->priv;
+
+	if (!p->actors || !wf_interval_tree_size(p->actors)) {
+		agl_actor__invalidate_down(wfc->root);
+		return;
+	}
+
+	void invalidate (gpointer actor, gpointer _)
+	{
+		agl_actor__invalidate((AGlActor*)actor);
+	}
+
+	agl_actor__invalidate(wfc->root);
+
+	int64_t start, end;
+	wf_context_get_visible_range(wfc, &start, &end);
+
+	int n = wf_context_foreach_actor_in_range(wfc, start, end, invalidate, NULL);
+	if (p->invalidated.end > p->invalidated.start && (p->invalidated.start != start || p->invalidated.end != end))
+		n += wf_context_foreach_actor_in_range(wfc, p->invalidated.start, p->invalidated.end, invalidate, NULL);
+	dbg(2, "invalidated %i of %i", n, wf_interval_tree_size(p->actors));
+
+	p->invalidated.start = start;
+	p->invalidated.end = end;
+}
+
+
 #ifndef USE_FRAME_CLOCK
 	static bool wf_canvas_redraw(gpointer _canvas)
 	{
@@ -254,10 +412,40 @@ wf_context_add_new_actor (WaveformContext* wfc, Waveform* w)
 		if (wfc->root->draw) wfc->root->draw(wfc->root, wfc->root->user_data);
 		wfc->priv->_queued = false;
 
+		wf_profile_frame_end();
+
 		return G_SOURCE_REMOVE;
 	}
 #endif
 
+/*
+ *  In compositing mode each WaveformActor is rendered into a cached fbo.
+ *  The caches are only invalidated by changes of zoom, scroll, size or data,
+ *  so a redraw caused by an overlay such as the spp or hover actor is only a
+ *  composite of the cached layers plus the overlay itself.
+ *  For this to work, overlays must not be children of the waveform actors.
+ */
+void
+wf_context_set_compositing (WaveformContext* wfc, bool enable)
+{
+	g_return_if_fail(wfc);
+
+	wfc->compositing = enable;
+
+	void set_cached (AGlActor* actor)
+	{
+		for (GList* l = actor->children; l; l = l->next) {
+			AGlActor* child = l->data;
+			if (child->class == wf_actor_get_class() && ((WaveformActor*)child)->context == wfc) {
+				wf_actor_set_cached((WaveformActor*)child, enable);
+			}
+			set_cached(child);
+		}
+	}
+	if (wfc->root) set_cached(wfc->root);
+}
+
+
 void
 wf_context_queue_redraw (WaveformContext* wfc)
 {
@@ -305,7 +493,7 @@ wf_context_set_zoom_on_frame (WfAnimation* animation, int time)
 
 	// note that everything under the context root is invalidated.
 	// Any non-scalable items should be in a separate sub-graph
-	agl_actor__invalidate_down (wfc->root);
+	wf_context_invalidate_actors(wfc);
 
 	agl_actor__set_size((AGlActor*)wfc->root);
 }
@@ -323,6 +511,8 @@ wf_context_set_zoom_on_frame (WfAnimation* animation, int time)
 void
 wf_context_set_zoom (WaveformContext* wfc, float zoom)
 {
+	WF_TRACE(wfc, NULL, .type = WF_TRACE_ZOOM, .f = zoom);
+
 	wfc->scaled = true;
 
 	dbg(1, "zoom=%.2f-->%.2f spp=%.2f", wfc->zoom->value.f, zoom, wfc->samples_per_pixel);
@@ -333,7 +523,7 @@ wf_context_set_zoom (WaveformContext* wfc, float zoom)
 
 	if(!wfc->root->root->enable_animations){
 		agl_observable_set_float(wfc->zoom, zoom);
-		agl_actor__invalidate(wfc->root);
+		wf_context_invalidate_actors(wfc);
 		return;
 	}
 
@@ -366,6 +556,8 @@ wf_context_set_scale (WaveformContext* wfc, float samples_per_px)
 {
 	#define WF_CONTEXT_MAX_SAMPLES_PER_PIXEL 1000000.0
 
+	WF_TRACE(wfc, NULL, .type = WF_TRACE_SCALE, .f = samples_per_px);
+
 	samples_per_px = CLAMP(samples_per_px, 1.0, WF_CONTEXT_MAX_SAMPLES_PER_PIXEL);
 
 	if (samples_per_px == wfc->samples_per_pixel) {
@@ -374,7 +566,7 @@ wf_context_set_scale (WaveformContext* wfc, float samples_per_px)
 
 	if (!wfc->root->root->enable_animations) {
 		wfc->samples_per_pixel = samples_per_px;
-		agl_actor__invalidate_down (wfc->root);
+		wf_context_invalidate_actors(wfc);
 		if (wfc->root->parent)
 			agl_actor__invalidate(wfc->root->parent);
 		return;
@@ -398,15 +590,24 @@ wf_context_set_start_on_frame (WfAnimation* animation, int time)
 
 	agl_observable_set_float(wfc->start_time, wfc->start_time->value.b);
 
-	agl_actor__invalidate_down (wfc->root);
+	wf_context_invalidate_actors(wfc);
 }
 
 
 void
 wf_context_set_start (WaveformContext* wfc, int64_t start)
 {
+	WF_TRACE(wfc, NULL, .type = WF_TRACE_START, .frame = start);
+
 	if (start == wfc->priv->start.target_val.b) return;
 
+	if (wfc->root && !wfc->root->root->enable_animations) {
+		wfc->priv->start.target_val.b = wfc->start_time->value.b = start;
+		agl_observable_set_float(wfc->start_time, start);
+		wf_context_invalidate_actors(wfc);
+		return;
+	}
+
 	WfAnimation* animation = wf_animation_new(NULL, wfc);
 	animation->on_frame = wf_context_set_start_on_frame;
 
@@ -43,6 +43,7 @@ struct _WaveformContext {
 
 	bool           show_rms;
 	bool           use_1d_textures;
+	bool           compositing;        // waveform actors are cached. see wf_context_set_compositing()
 
 	AGlActor*      root;               // note the context root is not neccesarily the scenegraph root
 
@@ -69,6 +70,11 @@ struct _WfContextPriv {
 #endif
 	guint         _queued;
 	guint         pending_init;
+
+	struct _WfIntervalTree* actors;  // actors that have a timeline position, indexed by frame range
+	struct {
+		int64_t   start, end;
+	}             invalidated;        // the frame range that was visible at the previous zoom or scroll
 };
 #endif
 
@@ -91,9 +97,20 @@ void             wf_context_set_zoom                  (WaveformContext*, float);
 void             wf_context_set_scale                 (WaveformContext*, float samples_per_px);
 void             wf_context_set_start                 (WaveformContext*, int64_t);
 void             wf_context_set_gain                  (WaveformContext*, float);
+void             wf_context_set_compositing           (WaveformContext*, bool);
 void             wf_context_queue_redraw              (WaveformContext*);
 float            wf_context_frame_to_x                (WaveformContext*, uint64_t);
 uint64_t         wf_context_x_to_frame                (WaveformContext*, int);
 const char*      wf_context_print_time                (WaveformContext*, int);
 
+void             wf_context_set_actor_position        (WaveformContext*, WaveformActor*, int64_t frame);
+void             wf_context_set_actor_positions       (WaveformContext*, WaveformActor**, int64_t* frames, int n);
+int              wf_context_foreach_actor_in_range    (WaveformContext*, int64_t start, int64_t end, GFunc, gpointer);
+int              wf_context_foreach_visible_actor     (WaveformContext*, GFunc, gpointer);
+
+#ifdef __wf_canvas_priv__
+void             wf_context_update_actor_len          (WaveformContext*, WaveformActor*, int64_t len);
+void             wf_context_remove_actor              (WaveformContext*, WaveformActor*);
+#endif
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (WaveformContext, wf_context_free)
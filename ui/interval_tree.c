@@ -0,0 +1,331 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of the Ayyi project. https://www.ayyi.org          |
+ | copyright (C) 2025-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Index of items by time range.                                        |
+ |                                                                      |
+ | The tree is a treap ordered by interval start. Each node also holds  |
+ | the largest end of its subtree, so that subtrees that finish before  |
+ | a query range can be skipped. Finding the k items that overlap a     |
+ | range is O(log n + k).                                               |
+ |                                                                      |
+ | Each item can only be present once. Setting an existing item moves   |
+ | it. When many items are set together the tree is rebuilt in a single |
+ | pass instead.                                                        |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define __wf_private__
+#include "config.h"
+#include <stdlib.h>
+#include "wf/debug.h"
+#include "waveform/waveform.h"
+#include "waveform/interval_tree.h"
+
+typedef struct _Node Node;
+
+struct _Node {
+	WfInterval interval;
+	int64_t    max_end;    // the largest end in this subtree
+	guint32    priority;
+	Node*      left;
+	Node*      right;
+};
+
+struct _WfIntervalTree {
+	Node*       root;
+	GHashTable* nodes;     // item -> Node
+};
+
+
+static inline int
+compare (const WfInterval* a, const WfInterval* b)
+{
+	if (a->start != b->start) return a->start < b->start ? -1 : 1;
+	return (uintptr_t)a->data < (uintptr_t)b->data ? -1 : (uintptr_t)a->data > (uintptr_t)b->data;
+}
+
+
+static inline void
+update (Node* n)
+{
+	n->max_end = n->interval.end;
+	if (n->left && n->left->max_end > n->max_end) n->max_end = n->left->max_end;
+	if (n->right && n->right->max_end > n->max_end) n->max_end = n->right->max_end;
+}
+
+
+/*
+ *  Nodes less than @key go to @l, the others to @r
+ */
+static void
+split (Node* t, const WfInterval* key, Node** l, Node** r)
+{
+	if (!t) {
+		*l = *r = NULL;
+		return;
+	}
+
+	if (compare(&t->interval, key) < 0) {
+		split(t->right, key, &t->right, r);
+		*l = t;
+	} else {
+		split(t->left, key, l, &t->left);
+		*r = t;
+	}
+	update(t);
+}
+
+
+static Node*
+merge (Node* l, Node* r)
+{
+	if (!l) return r;
+	if (!r) return l;
+
+	if (l->priority > r->priority) {
+		l->right = merge(l->right, r);
+		update(l);
+		return l;
+	}
+	r->left = merge(l, r->left);
+	update(r);
+	return r;
+}
+
+
+static Node*
+insert (Node* t, Node* n)
+{
+	if (!t) {
+		n->left = n->right = NULL;
+		update(n);
+		return n;
+	}
+
+	if (n->priority > t->priority) {
+		split(t, &n->interval, &n->left, &n->right);
+		update(n);
+		return n;
+	}
+
+	if (compare(&n->interval, &t->interval) < 0)
+		t->left = insert(t->left, n);
+	else
+		t->right = insert(t->right, n);
+	update(t);
+
+	return t;
+}
+
+
+static Node*
+erase (Node* t, Node* n)
+{
+	g_return_val_if_fail(t, NULL);
+
+	if (t == n) return merge(t->left, t->right);
+
+	if (compare(&n->interval, &t->interval) < 0)
+		t->left = erase(t->left, n);
+	else
+		t->right = erase(t->right, n);
+	update(t);
+
+	return t;
+}
+
+
+static void
+update_all (Node* t)
+{
+	if (t) {
+		update_all(t->left);
+		update_all(t->right);
+		update(t);
+	}
+}
+
+
+WfIntervalTree*
+wf_interval_tree_new ()
+{
+	return WF_NEW(WfIntervalTree,
+		.nodes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free)
+	);
+}
+
+
+void
+wf_interval_tree_free (WfIntervalTree* tree)
+{
+	g_return_if_fail(tree);
+
+	g_hash_table_destroy(tree->nodes);
+	g_free(tree);
+}
+
+
+/*
+ *  Add @item, or move it if it is already present
+ */
+void
+wf_interval_tree_set (WfIntervalTree* tree, gpointer item, int64_t start, int64_t end)
+{
+	g_return_if_fail(tree && item);
+
+	Node* n = g_hash_table_lookup(tree->nodes, item);
+	if (n) {
+		if (n->interval.start == start && n->interval.end == end) return;
+		tree->root = erase(tree->root, n);
+	} else {
+		n = WF_NEW(Node, .priority = g_random_int());
+		g_hash_table_insert(tree->nodes, item, n);
+	}
+
+	n->interval = (WfInterval){start, end, item};
+	tree->root = insert(tree->root, n);
+}
+
+
+	static gint
+	compare_nodes (gconstpointer a, gconstpointer b)
+	{
+		return compare(&(*(Node**)a)->interval, &(*(Node**)b)->interval);
+	}
+
+/*
+ *  Add or move many items at once, eg for an edit that affects a whole arrangement.
+ *  If the number of items is large compared with the size of the tree, the tree is
+ *  rebuilt from sorted nodes in linear time rather than making individual insertions.
+ */
+void
+wf_interval_tree_set_all (WfIntervalTree* tree, WfInterval* intervals, int n_intervals)
+{
+	g_return_if_fail(tree);
+	for (int i=0;i<n_intervals;i++) g_return_if_fail(intervals[i].data);
+
+	if (n_intervals < g_hash_table_size(tree->nodes) / 8) {
+		for (int i=0;i<n_intervals;i++) {
+			wf_interval_tree_set(tree, intervals[i].data, intervals[i].start, intervals[i].end);
+		}
+		return;
+	}
+
+	for (int i=0;i<n_intervals;i++) {
+		Node* n = g_hash_table_lookup(tree->nodes, intervals[i].data);
+		if (!n) {
+			n = WF_NEW(Node, .priority = g_random_int());
+			g_hash_table_insert(tree->nodes, intervals[i].data, n);
+		}
+		n->interval = intervals[i];
+	}
+
+	int size = g_hash_table_size(tree->nodes);
+	Node** nodes = g_new(Node*, size);
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, tree->nodes);
+	for (int i=0;g_hash_table_iter_next(&iter, NULL, &value);i++) {
+		nodes[i] = value;
+	}
+	qsort(nodes, size, sizeof(Node*), compare_nodes);
+
+	// build the treap using a stack of the right hand spine
+	Node** stack = g_new(Node*, size);
+	int sp = 0;
+	for (int i=0;i<size;i++) {
+		Node* n = nodes[i];
+		Node* last = NULL;
+		while (sp && stack[sp - 1]->priority < n->priority) {
+			last = stack[--sp];
+		}
+		n->left = last;
+		n->right = NULL;
+		if (sp) stack[sp - 1]->right = n;
+		stack[sp++] = n;
+	}
+	tree->root = sp ? stack[0] : NULL;
+	update_all(tree->root);
+
+	g_free(stack);
+	g_free(nodes);
+}
+
+
+bool
+wf_interval_tree_remove (WfIntervalTree* tree, gpointer item)
+{
+	g_return_val_if_fail(tree, false);
+
+	Node* n = g_hash_table_lookup(tree->nodes, item);
+	if (!n) return false;
+
+	tree->root = erase(tree->root, n);
+	g_hash_table_remove(tree->nodes, item);
+
+	return true;
+}
+
+
+/*
+ *  Returns NULL if the item is not present
+ */
+WfInterval*
+wf_interval_tree_get (WfIntervalTree* tree, gpointer item)
+{
+	g_return_val_if_fail(tree, NULL);
+
+	Node* n = g_hash_table_lookup(tree->nodes, item);
+	return n ? &n->interval : NULL;
+}
+
+
+int
+wf_interval_tree_size (WfIntervalTree* tree)
+{
+	g_return_val_if_fail(tree, 0);
+
+	return g_hash_table_size(tree->nodes);
+}
+
+
+static int
+query (Node* t, int64_t start, int64_t end, WfIntervalFn fn, gpointer user_data)
+{
+	if (!t || t->max_end <= start) return 0;
+
+	int n = query(t->left, start, end, fn, user_data);
+
+	if (t->interval.start < end) {
+		if (t->interval.end > start) {
+			if (fn) fn(&t->interval, user_data);
+			n++;
+		}
+		n += query(t->right, start, end, fn, user_data);
+	}
+
+	return n;
+}
+
+
+/*
+ *  Call @fn in start order for each item that overlaps the range @start to @end (exclusive).
+ *  The tree must not be modified by @fn.
+ *  Returns the number of items found. @fn can be NULL if only the count is needed.
+ */
+int
+wf_interval_tree_query (WfIntervalTree* tree, int64_t start, int64_t end, WfIntervalFn fn, gpointer user_data)
+{
+	g_return_val_if_fail(tree, 0);
+
+	return query(tree->root, start, end, fn, user_data);
+}
@@ -0,0 +1,36 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of the Ayyi project. https://www.ayyi.org          |
+ | copyright (C) 2025-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+
+typedef struct _WfIntervalTree WfIntervalTree;
+
+typedef struct {
+	int64_t  start;
+	int64_t  end;       // exclusive
+	gpointer data;
+} WfInterval;
+
+typedef void (*WfIntervalFn) (WfInterval*, gpointer);
+
+WfIntervalTree* wf_interval_tree_new     ();
+void            wf_interval_tree_free    (WfIntervalTree*);
+void            wf_interval_tree_set     (WfIntervalTree*, gpointer, int64_t start, int64_t end);
+void            wf_interval_tree_set_all (WfIntervalTree*, WfInterval*, int n);
+bool            wf_interval_tree_remove  (WfIntervalTree*, gpointer);
+WfInterval*     wf_interval_tree_get     (WfIntervalTree*, gpointer);
+int             wf_interval_tree_size    (WfIntervalTree*);
+int             wf_interval_tree_query   (WfIntervalTree*, int64_t start, int64_t end, WfIntervalFn, gpointer);
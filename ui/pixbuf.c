@@ -11,8 +11,15 @@
 */
 #define __wf_private__
 #include "config.h"
+#include <errno.h>
+#include <glib/gstdio.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 #include "agl/utils.h"
 #include "wf/waveform.h"
+#include "wf/audio.h"
+#include "wf/pool.h"
 #include "wf/debug.h"
 #include "waveform/pixbuf.h"
 
@@ -33,6 +40,19 @@ typedef struct _buf_info
 
 static inline bool get_buf_info (const Waveform* w, int block_num, BufInfo* b);
 
+/*
+ *  Private copies of the hires peaks needed for a render outside the main thread.
+ *  While set for the current thread they are used instead of the peaks of the
+ *  Waveform, which can be replaced by the main thread at any time.
+ */
+typedef struct {
+	int       b0;
+	int       n_blocks;
+	Peakbuf** peakbufs;
+} PinnedPeaks;
+
+static GPrivate pinned_peaks;
+
 typedef struct _rms_buf_info
 {
     char*  buf;          // source buffer
@@ -42,13 +62,44 @@ typedef struct _rms_buf_info
 
 static inline bool get_rms_buf_info (const char* buf, guint len, RmsBusInfo*, int ch);
 
+/*
+ *  The position of a pixbuf within a larger image that is rendered in parts.
+ */
+typedef struct {
+	int x, y;
+	int width, height;   // size of the whole image
+} Tile;
+
+static void peak_to_tile (Waveform*, WfPixbufScratch*, GdkPixbuf*, const Tile*, uint32_t region_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t colour_bg, float gain, bool single);
+
 
 #define MAX_PART_HEIGHT 1024 //FIXME
 
 typedef struct {
 	guchar a[MAX_PART_HEIGHT]; //alpha level for each pixel in the line.
 } Line;
-static Line line[3];
+
+/*
+ *  Working lines for the renderers. Previously these were statics which
+ *  prevented more than one render from running at a time.
+ */
+struct _WfPixbufScratch {
+	Line line[WF_MAX_CH][3];
+};
+
+
+WfPixbufScratch*
+wf_pixbuf_scratch_new ()
+{
+	return g_new0(WfPixbufScratch, 1);
+}
+
+
+void
+wf_pixbuf_scratch_free (WfPixbufScratch* scratch)
+{
+	g_free(scratch);
+}
 
 
 static void
@@ -234,7 +285,7 @@ waveform_peak_to_pixbuf_async (Waveform* w, GdkPixbuf* pixbuf, WfSampleRegion* r
 	bool hires_mode = ((samples_per_px / WF_PEAK_RATIO) < 1.0);
 	if(hires_mode){
 		int b0 = region->start / WF_SAMPLES_PER_TEXTURE;
-		int b1 = (region->start + region->len) / WF_SAMPLES_PER_TEXTURE;
+		int b1 = MIN((region->start + region->len) / WF_SAMPLES_PER_TEXTURE, waveform_get_n_audio_blocks(w) - 1);
 		c->n_blocks_total = b1 - b0 + 1;
 		int b; for(b=b0;b<=b1;b++){
 			waveform_load_audio(w, b, N_TIERS_NEEDED, _waveform_load_audio_done, c);
@@ -246,6 +297,557 @@ waveform_peak_to_pixbuf_async (Waveform* w, GdkPixbuf* pixbuf, WfSampleRegion* r
 }
 
 
+/*
+ *  Batch rendering
+ *
+ *  Loading of peak and audio data is done in the main thread, then rendering
+ *  of each job is done by a pool of worker threads, each with its own scratch
+ *  area. Results are returned to the main thread as soon as each job completes,
+ *  so the order of the callbacks is not necessarily the order of the jobs.
+ */
+
+typedef struct {
+	WfPixbufJob*      jobs;
+	int               n_jobs;
+	int               n_done;
+	uint32_t          colour;
+	uint32_t          bg_colour;
+	WfPixbufCallback* callback;
+	WfCallback        done;
+	gpointer          user_data;
+} Batch;
+
+typedef struct {
+	Batch*            batch;
+	WfPixbufJob*      job;
+	GdkPixbuf*        pixbuf;
+	int               n_blocks_total;
+	int               n_blocks_done;
+	PinnedPeaks       peaks;        // hires mode only
+} BatchItem;
+
+static GThreadPool* batch_pool = NULL;
+static GPrivate batch_scratch = G_PRIVATE_INIT((GDestroyNotify)wf_pixbuf_scratch_free);
+
+
+static bool
+batch_item_done (gpointer _item)
+{
+	BatchItem* item = _item;
+	Batch* batch = item->batch;
+	WfPixbufJob* job = item->job;
+
+	if (batch->callback) batch->callback(job->waveform, item->pixbuf, job->user_data);
+
+	if (item->pixbuf) g_object_unref(item->pixbuf);
+	g_object_unref(job->waveform);
+	for (int i=0;i<item->peaks.n_blocks;i++) {
+		waveform_peakbuf_free(item->peaks.peakbufs[i]);
+	}
+	g_free(item->peaks.peakbufs);
+	g_free(item);
+
+	if (++batch->n_done == batch->n_jobs) {
+		if (batch->done) batch->done(batch->user_data);
+		g_free(batch->jobs);
+		g_free(batch);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+
+static void
+batch_render (gpointer _item, gpointer _)
+{
+	// this runs in a pool thread
+
+	BatchItem* item = _item;
+	Batch* batch = item->batch;
+	WfPixbufJob* job = item->job;
+
+	WfPixbufScratch* scratch = g_private_get(&batch_scratch);
+	if (!scratch) {
+		g_private_set(&batch_scratch, scratch = wf_pixbuf_scratch_new());
+	}
+
+	if ((item->pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, job->width, job->height))) {
+		gdk_pixbuf_fill(item->pixbuf, batch->bg_colour);
+
+		// in hires mode the render uses the copies of the peaks made by the main thread
+		if (item->peaks.n_blocks) g_private_set(&pinned_peaks, &item->peaks);
+
+		double samples_per_px = job->region.len / (double)job->width;
+		waveform_peak_to_pixbuf_full_r(job->waveform, scratch, item->pixbuf, job->region.start, NULL, NULL, samples_per_px, batch->colour, batch->bg_colour, 1.0, false);
+
+		g_private_set(&pinned_peaks, NULL);
+	}
+
+	g_idle_add(batch_item_done, item);
+}
+
+
+static void
+batch_item_queue (BatchItem* item)
+{
+	g_thread_pool_push(batch_pool, item, NULL);
+}
+
+
+/*
+ *  Returns a copy of the peaks that is owned by the caller.
+ */
+static Peakbuf*
+peakbuf_copy (const Peakbuf* peakbuf)
+{
+	Peakbuf* copy = g_new(Peakbuf, 1);
+	*copy = *peakbuf;
+	for (int c=0;c<WF_STEREO;c++) {
+		if (peakbuf->buf[c]) {
+			copy->buf[c] = wf_pool_alloc(sizeof(short) * peakbuf->size);
+			memcpy(copy->buf[c], peakbuf->buf[c], sizeof(short) * peakbuf->size);
+		}
+	}
+	return copy;
+}
+
+
+static void
+batch_item_on_audio (Waveform* w, int block, gpointer _item)
+{
+	BatchItem* item = _item;
+
+	// the peaks are copied now as the block can be evicted by the loading of the other blocks of the item
+	int i = block - item->peaks.b0;
+	GPtrArray* peaks = w->priv->hires_peaks;
+	if (i >= 0 && i < item->peaks.n_blocks && block < peaks->len && peaks->pdata[block]) {
+		item->peaks.peakbufs[i] = peakbuf_copy(peaks->pdata[block]);
+	}
+
+	if (++item->n_blocks_done >= item->n_blocks_total) {
+		batch_item_queue(item);
+	}
+}
+
+
+static void
+batch_item_on_load (Waveform* w, GError* error, gpointer _item)
+{
+	BatchItem* item = _item;
+	WfPixbufJob* job = item->job;
+
+	if (error || !w->priv->peak.buf[0]) {
+		// the callback is still called so that the caller can account for the job
+		batch_item_done(item);
+		return;
+	}
+
+	if (!job->region.len) {
+		job->region.len = waveform_get_n_frames(w) - job->region.start;
+	}
+
+	double samples_per_px = job->region.len / (double)job->width;
+	bool hires_mode = ((samples_per_px / WF_PEAK_RATIO) < 1.0);
+	if (hires_mode) {
+		// the audio must be loaded before rendering because the pool threads cannot load it
+		int b0 = job->region.start / WF_SAMPLES_PER_TEXTURE;
+		int b1 = MIN((job->region.start + job->region.len) / WF_SAMPLES_PER_TEXTURE, waveform_get_n_audio_blocks(w) - 1);
+		item->n_blocks_total = b1 - b0 + 1;
+		item->peaks = (PinnedPeaks){
+			.b0       = b0,
+			.n_blocks = item->n_blocks_total,
+			.peakbufs = g_new0(Peakbuf*, item->n_blocks_total)
+		};
+		for (int b=b0;b<=b1;b++) {
+			waveform_load_audio(w, b, N_TIERS_NEEDED, batch_item_on_audio, item);
+		}
+		return;
+	}
+
+	batch_item_queue(item);
+}
+
+
+/*
+ *  Render a list of thumbnails using all available cpu cores.
+ *
+ *  @callback is called in the main thread once for each job with a newly
+ *  allocated pixbuf (or NULL on failure) and the job's user_data.
+ *  The pixbuf is unreffed after the callback returns so the callback must
+ *  take a reference if it is to be kept.
+ *
+ *  @done is called with @user_data once all the jobs have completed.
+ *
+ *  The job list is copied and does not need to be kept by the caller.
+ */
+void
+waveform_peak_to_pixbuf_batch (WfPixbufJob* jobs, int n_jobs, uint32_t colour, uint32_t bg_colour, WfPixbufCallback callback, WfCallback done, gpointer user_data)
+{
+	g_return_if_fail(jobs);
+	g_return_if_fail(n_jobs > 0);
+	for (int i=0;i<n_jobs;i++) {
+		g_return_if_fail(jobs[i].waveform && jobs[i].width > 0 && jobs[i].height > 0);
+	}
+
+	if (!batch_pool) {
+		batch_pool = g_thread_pool_new(batch_render, NULL, g_get_num_processors(), false, NULL);
+	}
+
+	Batch* batch = WF_NEW(Batch,
+		.jobs      = memcpy(g_new(WfPixbufJob, n_jobs), jobs, sizeof(WfPixbufJob) * n_jobs),
+		.n_jobs    = n_jobs,
+		.colour    = colour,
+		.bg_colour = bg_colour,
+		.callback  = callback,
+		.done      = done,
+		.user_data = user_data
+	);
+
+	for (int i=0;i<n_jobs;i++) {
+		WfPixbufJob* job = &batch->jobs[i];
+		g_object_ref(job->waveform);
+
+		waveform_load(job->waveform, batch_item_on_load, WF_NEW(BatchItem,
+			.batch = batch,
+			.job   = job
+		));
+	}
+}
+
+
+/*
+ *  The number of lines rendered to the left of a tile so that it is antialiased
+ *  the same as when the image is rendered in one piece. The lines either side of
+ *  the current line are used, so at least 2 lines are needed. When zoomed in, not
+ *  every pixel has a line.
+ */
+static int
+tile_warmup (double xmag)
+{
+	return 2 * (int)ceil(1. / MIN(xmag, 1.)) + 1;
+}
+
+
+/*
+ *  Export
+ *
+ *  Images that are too large to hold in memory are rendered as a series of
+ *  horizontal bands. Each band is divided into tiles which are rendered in
+ *  parallel, then the rows of the band are passed on to the output.
+ *
+ *  The peak data is walked once per band. In hires mode the audio is loaded
+ *  in the calling thread for a group of tiles at a time, and the group is kept
+ *  small enough for its audio to fit in the audio cache.
+ */
+
+#define EXPORT_TILE_WIDTH 256
+#define EXPORT_MAX_BAND_SIZE (1 << 26) // bytes
+
+typedef struct {
+	GMutex            lock;
+	GCond             cond;
+	int               n_pending;
+} ExportGroup;
+
+typedef struct {
+	WfExport*         export;
+	ExportGroup*      group;
+	GdkPixbuf*        pixbuf;       // the part of the band covered by the tile
+	Tile              tile;
+	uint32_t          region_start;
+	double            samples_per_px;
+} ExportTile;
+
+static GThreadPool* export_pool = NULL;
+
+
+static void
+export_render (gpointer _tile, gpointer _)
+{
+	// this runs in a pool thread
+
+	ExportTile* t = _tile;
+	WfExport* e = t->export;
+
+	WfPixbufScratch* scratch = g_private_get(&batch_scratch);
+	if (!scratch) {
+		g_private_set(&batch_scratch, scratch = wf_pixbuf_scratch_new());
+	}
+
+	peak_to_tile(e->waveform, scratch, t->pixbuf, &t->tile, t->region_start, NULL, NULL, t->samples_per_px, e->colour, e->bg_colour, 1.0, e->single);
+
+	g_mutex_lock(&t->group->lock);
+	if (!--t->group->n_pending) g_cond_signal(&t->group->cond);
+	g_mutex_unlock(&t->group->lock);
+}
+
+
+/*
+ *  Render an image of any width, passing each row to @callback in order from the top.
+ *
+ *  The row is packed rgb and is only valid until the callback returns.
+ *  If the callback returns false, the export is stopped. The callback may set
+ *  @error to say why, otherwise a generic error is set.
+ *
+ *  The output is the same as for a single call to waveform_peak_to_pixbuf_full()
+ *  with a pixbuf of the whole size, but the memory used is limited to one band.
+ *  The height of each channel must be less than MAX_PART_HEIGHT.
+ *
+ *  This is synchronous and must be called from the main thread.
+ */
+bool
+waveform_export_scanlines (WfExport* e, WfScanlineCallback callback, gpointer user_data, GError** error)
+{
+	g_return_val_if_fail(e && e->waveform && callback, false);
+	g_return_val_if_fail(e->width > 0 && e->height > 0, false);
+
+	Waveform* w = e->waveform;
+	GQuark domain = g_quark_from_static_string(wf_get_instance()->domain);
+
+	if (!w->priv->peak.buf[WF_LEFT] && !waveform_load_sync(w)) {
+		g_set_error(error, domain, 1, "failed to load peak data: %s", w->filename);
+		return false;
+	}
+
+	int n_chans = waveform_get_n_channels(w);
+	if (e->height / (e->single ? 1 : n_chans) >= MAX_PART_HEIGHT) {
+		g_set_error(error, domain, 1, "image too tall: each channel must be less than %i px", MAX_PART_HEIGHT);
+		return false;
+	}
+
+	WfSampleRegion region = e->region;
+	if (!region.len) {
+		region.len = waveform_get_n_frames(w) - region.start;
+	}
+	double samples_per_px = region.len / (double)e->width;
+	bool hires_mode = ((samples_per_px / WF_PEAK_RATIO) < 1.0);
+
+	int tile_width = e->tile_width > 0 ? MIN(e->tile_width, e->width) : MIN(EXPORT_TILE_WIDTH, e->width);
+	int band_height = e->band_height > 0
+		? MIN(e->band_height, e->height)
+		: CLAMP(EXPORT_MAX_BAND_SIZE / (e->width * 3), 1, e->height);
+	int n_tiles = (e->width + tile_width - 1) / tile_width;
+
+	int group_size = n_tiles;
+	int warmup = 0;
+	if (hires_mode) {
+		// the size of the warmup depends on the resolution of the hires peaks
+		int b = region.start / WF_SAMPLES_PER_TEXTURE;
+		waveform_load_audio_sync(w, b, N_TIERS_NEEDED);
+		BufInfo info;
+		if (get_buf_info(w, b, &info)) warmup = tile_warmup(samples_per_px / (1 << info.n_tiers));
+
+		int blocks_per_tile = (int)(tile_width * samples_per_px) / WF_SAMPLES_PER_TEXTURE + 2;
+		group_size = MIN(g_get_num_processors(), MAX(1, wf_audio_cache_get_size() / (2 * n_chans * blocks_per_tile)));
+	}
+
+	GdkPixbuf* band = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, e->width, band_height);
+	if (!band) {
+		g_set_error(error, domain, 1, "cannot allocate %ix%i band", e->width, band_height);
+		return false;
+	}
+
+	if (!export_pool) {
+		export_pool = g_thread_pool_new(export_render, NULL, g_get_num_processors(), false, NULL);
+	}
+
+	ExportGroup group = {0,};
+	g_mutex_init(&group.lock);
+	g_cond_init(&group.cond);
+
+	ExportTile* tiles = g_new0(ExportTile, n_tiles);
+
+	bool ok = true;
+	for (int y0=0;y0<e->height && ok;y0+=band_height) {
+		int h = MIN(band_height, e->height - y0);
+		gdk_pixbuf_fill(band, e->bg_colour);
+
+		for (int t0=0;t0<n_tiles;t0+=group_size) {
+			int t1 = MIN(t0 + group_size, n_tiles);
+
+			if (hires_mode) {
+				// the pool threads cannot load audio. The first block includes the warmup lines to the left of the tile
+				int64_t s0 = region.start + (int64_t)(MAX(0, t0 * tile_width - warmup) * samples_per_px);
+				int64_t s1 = region.start + (int64_t)(MIN(t1 * tile_width, e->width) * samples_per_px);
+				int b1 = MIN(s1 / WF_SAMPLES_PER_TEXTURE + 1, waveform_get_n_audio_blocks(w) - 1);
+				for (int b=s0/WF_SAMPLES_PER_TEXTURE;b<=b1;b++) {
+					waveform_load_audio_sync(w, b, N_TIERS_NEEDED);
+				}
+			}
+
+			group.n_pending = t1 - t0;
+			for (int t=t0;t<t1;t++) {
+				int x = t * tile_width;
+				tiles[t] = (ExportTile){
+					.export         = e,
+					.group          = &group,
+					.pixbuf         = gdk_pixbuf_new_subpixbuf(band, x, 0, MIN(tile_width, e->width - x), h),
+					.tile           = {x, y0, e->width, e->height},
+					.region_start   = region.start,
+					.samples_per_px = samples_per_px
+				};
+				g_thread_pool_push(export_pool, &tiles[t], NULL);
+			}
+
+			g_mutex_lock(&group.lock);
+			while (group.n_pending) g_cond_wait(&group.cond, &group.lock);
+			g_mutex_unlock(&group.lock);
+
+			for (int t=t0;t<t1;t++) {
+				g_object_unref(tiles[t].pixbuf);
+			}
+		}
+
+		guchar* pixels = gdk_pixbuf_get_pixels(band);
+		int rowstride = gdk_pixbuf_get_rowstride(band);
+		for (int y=0;y<h;y++) {
+			if (!callback(pixels + y * rowstride, y0 + y, e->width, user_data)) {
+				if (error && !*error) g_set_error(error, domain, 1, "export stopped at row %i", y0 + y);
+				ok = false;
+				break;
+			}
+		}
+	}
+
+	g_free(tiles);
+	g_mutex_clear(&group.lock);
+	g_cond_clear(&group.cond);
+	g_object_unref(band);
+
+	return ok;
+}
+
+
+#ifdef HAVE_ZLIB
+/*
+ *  The png is written as it is rendered. The image data is compressed into a
+ *  fixed size buffer which is written out as an IDAT chunk each time it fills.
+ */
+
+#define PNG_CHUNK_SIZE (1 << 16)
+
+typedef struct {
+	FILE*       file;
+	const char* filename;
+	z_stream    z;
+	guchar      out[PNG_CHUNK_SIZE];
+	GError**    error;
+} PngWriter;
+
+
+static bool
+png_write_chunk (PngWriter* png, const char* type, const guchar* data, uint32_t len)
+{
+	guchar header[8] = {len >> 24, len >> 16, len >> 8, len};
+	memcpy(header + 4, type, 4);
+
+	uint32_t crc = crc32(0, header + 4, 4);
+	if (len) crc = crc32(crc, data, len); // crc32() returns zero for a NULL buffer
+	guchar footer[4] = {crc >> 24, crc >> 16, crc >> 8, crc};
+
+	if (
+		fwrite(header, 1, 8, png->file) != 8 ||
+		(len && fwrite(data, 1, len, png->file) != len) ||
+		fwrite(footer, 1, 4, png->file) != 4
+	) {
+		g_set_error(png->error, G_FILE_ERROR, g_file_error_from_errno(errno), "write failed: %s: %s", png->filename, g_strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+
+static bool
+png_deflate (PngWriter* png, const guchar* data, int len, int flush)
+{
+	png->z.next_in = (guchar*)data;
+	png->z.avail_in = len;
+
+	int r;
+	do {
+		if ((r = deflate(&png->z, flush)) == Z_STREAM_ERROR) {
+			g_set_error(png->error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "compression failed: %s", png->filename);
+			return false;
+		}
+		if (!png->z.avail_out || r == Z_STREAM_END) {
+			if (!png_write_chunk(png, "IDAT", png->out, PNG_CHUNK_SIZE - png->z.avail_out)) return false;
+			png->z.next_out = png->out;
+			png->z.avail_out = PNG_CHUNK_SIZE;
+		}
+	} while (png->z.avail_in || (flush == Z_FINISH && r != Z_STREAM_END));
+
+	return true;
+}
+
+
+static bool
+png_write_row (const guchar* row, int y, int width, gpointer _png)
+{
+	PngWriter* png = _png;
+
+	static const guchar filter_none = 0;
+
+	return png_deflate(png, &filter_none, 1, Z_NO_FLUSH) && png_deflate(png, row, width * 3, Z_NO_FLUSH);
+}
+#endif
+
+
+/*
+ *  Export the image as an 8 bit rgb png, using waveform_export_scanlines().
+ */
+bool
+waveform_export_png (WfExport* e, const char* filename, GError** error)
+{
+	g_return_val_if_fail(e && filename, false);
+
+#ifdef HAVE_ZLIB
+	FILE* file = fopen(filename, "wb");
+	if (!file) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "cannot open %s: %s", filename, g_strerror(errno));
+		return false;
+	}
+
+	PngWriter* png = g_new0(PngWriter, 1);
+	png->file = file;
+	png->filename = filename;
+	png->error = error;
+	png->z.next_out = png->out;
+	png->z.avail_out = PNG_CHUNK_SIZE;
+	deflateInit(&png->z, Z_DEFAULT_COMPRESSION);
+
+	static const guchar signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	guchar ihdr[13] = {
+		e->width >> 24, e->width >> 16, e->width >> 8, e->width,
+		e->height >> 24, e->height >> 16, e->height >> 8, e->height,
+		8, // bit depth
+		2, // rgb
+		0, 0, 0
+	};
+
+	bool ok =
+		fwrite(signature, 1, 8, file) == 8 &&
+		png_write_chunk(png, "IHDR", ihdr, 13) &&
+		waveform_export_scanlines(e, png_write_row, png, error) &&
+		png_deflate(png, NULL, 0, Z_FINISH) &&
+		png_write_chunk(png, "IEND", NULL, 0);
+
+	deflateEnd(&png->z);
+	g_free(png);
+
+	ok = !fclose(file) && ok;
+	if (!ok) {
+		if (error && !*error) g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "write failed: %s: %s", filename, g_strerror(errno));
+		g_unlink(filename);
+	}
+
+	return ok;
+#else
+	g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOSYS, "png export needs zlib");
+	return false;
+#endif
+}
+
+
 typedef struct {
     int start, stop;
 } iRange;
@@ -287,11 +889,47 @@ typedef struct {
  */
 void
 waveform_peak_to_pixbuf_full (Waveform* waveform, GdkPixbuf* pixbuf, uint32_t region_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t colour_bg, float gain, bool single)
+{
+	WfPixbufScratch scratch;
+	waveform_peak_to_pixbuf_full_r(waveform, &scratch, pixbuf, region_inset, start, end, samples_per_px, colour, colour_bg, gain, single);
+}
+
+
+/*
+ *  Reentrant version of waveform_peak_to_pixbuf_full.
+ *  The scratch area is owned by the caller and must not be shared with a concurrent render.
+ *
+ *  Note that in hires mode the audio must already be loaded if not called from the main thread.
+ */
+void
+waveform_peak_to_pixbuf_full_r (Waveform* waveform, WfPixbufScratch* scratch, GdkPixbuf* pixbuf, uint32_t region_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t colour_bg, float gain, bool single)
+{
+	g_return_if_fail(pixbuf);
+
+	Tile tile = {
+		.width = gdk_pixbuf_get_width(pixbuf),
+		.height = gdk_pixbuf_get_height(pixbuf)
+	};
+	peak_to_tile(waveform, scratch, pixbuf, &tile, region_inset, start, end, samples_per_px, colour, colour_bg, gain, single);
+}
+
+
+/*
+ *  Render the part of the image given by @tile to @pixbuf, which is the size of the tile.
+ *
+ *  If the tile does not start at the left edge of the image, a few lines to the left
+ *  of it are rendered but not drawn, so that the antialiasing is the same as when the
+ *  image is rendered in one piece.
+ */
+static void
+peak_to_tile (Waveform* waveform, WfPixbufScratch* scratch, GdkPixbuf* pixbuf, const Tile* tile, uint32_t region_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t colour_bg, float gain, bool single)
 {
 	g_return_if_fail(pixbuf);
 	g_return_if_fail(waveform);
+	g_return_if_fail(scratch);
 
-	static Line line[WF_MAX_CH][3] = {0,};
+	memset(scratch, 0, sizeof(WfPixbufScratch));
+	Line (*line)[3] = scratch->line;
 
 	bool hires_mode = ((samples_per_px / WF_PEAK_RATIO) < 1.0);
 
@@ -317,8 +955,10 @@ waveform_peak_to_pixbuf_full (Waveform* waveform, GdkPixbuf* pixbuf, uint32_t re
 	g_return_if_fail(n_chans);
 
 	int n_chans_out  = single ? 1 : n_chans;
-	int width        = gdk_pixbuf_get_width(pixbuf);
-	int height       = gdk_pixbuf_get_height(pixbuf);
+	int width        = tile->width;
+	int height       = tile->height;
+	int tile_width   = gdk_pixbuf_get_width(pixbuf);
+	int tile_height  = gdk_pixbuf_get_height(pixbuf);
 	guchar* pixels   = gdk_pixbuf_get_pixels(pixbuf);
 	int rowstride    = gdk_pixbuf_get_rowstride(pixbuf);
 
@@ -327,12 +967,12 @@ waveform_peak_to_pixbuf_full (Waveform* waveform, GdkPixbuf* pixbuf, uint32_t re
 	cairo_t* cairo = cairo_create(surface);
 #endif
 
-	if (height > MAX_PART_HEIGHT) perr ("part too tall. not enough memory allocated.");
 	int ch_height = height / n_chans_out;
+	if (ch_height >= MAX_PART_HEIGHT) perr ("part too tall. not enough memory allocated.");
 	int vscale = (256 * 128 * 2) / ch_height;
 
-	int px_start = start ? *start : 0;
-	int px_stop  = end   ? MIN(*end, width) : width;
+	int px_start = start ? *start : tile->x;
+	int px_stop  = MIN(end ? MIN(*end, width) : width, tile->x + tile_width);
 	dbg (3, "px_start=%i px_end=%i", px_start, px_stop);
 
 	int hires_block = -1;
@@ -341,10 +981,10 @@ waveform_peak_to_pixbuf_full (Waveform* waveform, GdkPixbuf* pixbuf, uint32_t re
 		//we use the same part of Line for each channel, it is then rendered to the pixbuf with a channel offset.
 
 		if(hires_mode){
-			hires_block = region_inset / WF_PEAK_BLOCK_SIZE;
+			hires_block = (region_inset + (int64_t)(px_start * samples_per_px)) / WF_SAMPLES_PER_TEXTURE;
 			border = TEX_BORDER_HI;
 
-			if(!waveform->priv->audio.buf16){
+			if(!g_private_get(&pinned_peaks) && !waveform->priv->audio.buf16){
 				waveform_load_audio_sync(waveform, hires_block, N_TIERS_NEEDED);
 			}
 		}
@@ -359,6 +999,19 @@ waveform_peak_to_pixbuf_full (Waveform* waveform, GdkPixbuf* pixbuf, uint32_t re
 
 		double xmag = samples_per_px / ((hires_mode ? (1 << b.n_tiers) : WF_PEAK_RATIO));
 
+		if(tile_width < width && px_start == tile->x && px_start > 0){
+			px_start = MAX(0, px_start - tile_warmup(xmag));
+
+			if(hires_mode){
+				// the warmup can start in the previous block. The block change below only moves forward.
+				int block = (region_inset + (int64_t)(px_start * samples_per_px)) / WF_SAMPLES_PER_TEXTURE;
+				if(block != hires_block){
+					hires_block = block;
+					g_return_if_fail(get_buf_info(waveform, hires_block, &b));
+				}
+			}
+		}
+
 		iRange src = {0,};         // frames or peakbuf idx. multiply by 2 to get the index into the source buffer for each sample pt.
 
 		line_clear(&line[WF_LEFT][0]);
@@ -386,8 +1039,6 @@ waveform_peak_to_pixbuf_full (Waveform* waveform, GdkPixbuf* pixbuf, uint32_t re
 			if(src.stop > b.len_frames - border/2){
 				dbg(1, "**** block change needed!");
 				hires_block++;
-				Peakbuf* peakbuf = waveform_get_peakbuf_n(waveform, hires_block);
-				g_return_if_fail(peakbuf);
 				if(!get_buf_info(waveform, hires_block, &b)){ break; }
 				block_offset = hires_block * (b.len_frames - 2 * border);
 
@@ -506,10 +1157,12 @@ waveform_peak_to_pixbuf_full (Waveform* waveform, GdkPixbuf* pixbuf, uint32_t re
 			//draw the lines:
 			#define blur 6 // bigger value gives less blurring.
 			int n = single ? n_chans : 1;
-			for(ch=0;ch<n_chans_out;ch++){
+			int col = px - tile->x; // lines to the left of the tile are only used for antialiasing
+			for(ch=0;ch<n_chans_out && col >= 0;ch++){
 				for(y=0;y<ch_height;y++){
-					int p = rowstride*(ch*ch_height + (ch_height - y -1)) + 3*px;
-					if(p > rowstride*height || p < 0){ perr ("p! %i > %i px=%i y=%i row=%i rowstride=%i=%i", p, 3*width*ch_height, px, y, ch_height-y-1, rowstride,3*width); return; }
+					int row = ch*ch_height + (ch_height - y -1) - tile->y;
+					if(row < 0 || row >= tile_height) continue;
+					int p = rowstride*row + 3*col;
 
 					int a = 0;
 					int c; for(c=0;c<n;c++){
@@ -574,6 +1227,14 @@ waveform_peak_to_pixbuf_full (Waveform* waveform, GdkPixbuf* pixbuf, uint32_t re
 #undef PEAK_ANTIALIAS
 void
 waveform_rms_to_pixbuf (Waveform* w, GdkPixbuf* pixbuf, uint32_t src_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t colour_bg, float gain)
+{
+	WfPixbufScratch scratch;
+	waveform_rms_to_pixbuf_r(w, &scratch, pixbuf, src_inset, start, end, samples_per_px, colour, colour_bg, gain);
+}
+
+
+void
+waveform_rms_to_pixbuf_r (Waveform* w, WfPixbufScratch* scratch, GdkPixbuf* pixbuf, uint32_t src_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t colour_bg, float gain)
 {
 	/*
      this fn is copied from peak_render_to_pixbuf(). It differs in the size of the src data width, and
@@ -599,6 +1260,11 @@ waveform_rms_to_pixbuf (Waveform* w, GdkPixbuf* pixbuf, uint32_t src_inset, int*
 
 	g_return_if_fail(pixbuf);
 	g_return_if_fail(w);
+	g_return_if_fail(scratch);
+
+	memset(scratch->line[0], 0, sizeof(scratch->line[0]));
+	Line* line = scratch->line[0];
+
 	dbg(3, "inset=%i", src_inset);
 
 	gboolean hires_mode = ((samples_per_px / WF_PEAK_RATIO) < 1.0);
@@ -1132,6 +1798,14 @@ alphabuf_draw_line (AlphaBuf* pixbuf, WfDRect* pts, double line_width, GdkColor*
 
 void
 waveform_peak_to_alphabuf (Waveform* w, AlphaBuf* a, int scale, int* start, int* end, GdkColor* colour)
+{
+	WfPixbufScratch scratch;
+	waveform_peak_to_alphabuf_r(w, &scratch, a, scale, start, end, colour);
+}
+
+
+void
+waveform_peak_to_alphabuf_r (Waveform* w, WfPixbufScratch* scratch, AlphaBuf* a, int scale, int* start, int* end, GdkColor* colour)
 {
 	/*
 	 renders a peakfile (pre-loaded into WfPeakBuf* waveform->priv->peak) onto the given 8 bit alpha-map buffer.
@@ -1150,6 +1824,10 @@ waveform_peak_to_alphabuf (Waveform* w, AlphaBuf* a, int scale, int* start, int*
 	g_return_if_fail(a);
 	g_return_if_fail(w);
 	g_return_if_fail(w->priv->peak.buf[0]);
+	g_return_if_fail(scratch);
+
+	memset(scratch->line[0], 0, sizeof(scratch->line[0]));
+	Line* line = scratch->line[0];
 
 #if 0
 	struct timeval time_start, time_stop;
@@ -1428,6 +2106,14 @@ io_ratio = 1;
 
 void
 waveform_rms_to_alphabuf (Waveform* waveform, AlphaBuf* pixbuf, int* start, int* end, double samples_per_px, GdkColor* colour, uint32_t colour_bg)
+{
+	WfPixbufScratch scratch;
+	waveform_rms_to_alphabuf_r(waveform, &scratch, pixbuf, start, end, samples_per_px, colour, colour_bg);
+}
+
+
+void
+waveform_rms_to_alphabuf_r (Waveform* waveform, WfPixbufScratch* scratch, AlphaBuf* pixbuf, int* start, int* end, double samples_per_px, GdkColor* colour, uint32_t colour_bg)
 {
 	/*
 
@@ -1437,6 +2123,10 @@ waveform_rms_to_alphabuf (Waveform* waveform, AlphaBuf* pixbuf, int* start, int*
 
 	g_return_if_fail(pixbuf);
 	g_return_if_fail(waveform);
+	g_return_if_fail(scratch);
+
+	memset(scratch->line[0], 0, sizeof(scratch->line[0]));
+	Line* line = scratch->line[0];
 
 	/*
 	int fg_red = colour->red   >> 8;
@@ -1703,9 +2393,18 @@ get_buf_info (const Waveform* w, int block_num, BufInfo* b)
 	bool hires_mode = (block_num > -1);
 
 	if (hires_mode) {
-		WfAudioData* audio = &w->priv->audio;
-		g_return_val_if_fail(audio->buf16, false);
-		Peakbuf* peakbuf = waveform_get_peakbuf_n((Waveform*)w, block_num);
+		Peakbuf* peakbuf;
+		PinnedPeaks* pinned = g_private_get(&pinned_peaks);
+		if (pinned) {
+			int i = block_num - pinned->b0;
+			peakbuf = (i >= 0 && i < pinned->n_blocks) ? pinned->peakbufs[i] : NULL;
+		} else {
+			WfAudioData* audio = &w->priv->audio;
+			g_return_val_if_fail(audio->buf16, false);
+			peakbuf = waveform_get_peakbuf_n((Waveform*)w, block_num);
+		}
+		if (!peakbuf) return false;
+
 		*b = (BufInfo){
 			.buf[0] = peakbuf->buf[0],
 			.buf[1] = peakbuf->buf[1],
@@ -20,10 +20,43 @@
 
 typedef void (WfPixbufCallback)(Waveform*, GdkPixbuf*, gpointer);
 
-void       waveform_peak_to_pixbuf       (Waveform*, GdkPixbuf*, WfSampleRegion*, uint32_t colour, uint32_t bg_colour, bool single);
-void       waveform_peak_to_pixbuf_async (Waveform*, GdkPixbuf*, WfSampleRegion*, uint32_t colour, uint32_t bg_colour, WfPixbufCallback, gpointer);
-void       waveform_peak_to_pixbuf_full  (Waveform*, GdkPixbuf*, uint32_t src_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t bg_colour, float gain, bool single);
-void       waveform_rms_to_pixbuf        (Waveform*, GdkPixbuf*, uint32_t src_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t bg_colour, float gain);
+typedef struct _WfPixbufScratch WfPixbufScratch;
+
+typedef struct {
+	Waveform*      waveform;
+	WfSampleRegion region;     // if len is zero, the region extends to the end of the waveform
+	int            width;
+	int            height;
+	gpointer       user_data;  // passed to the WfPixbufCallback
+} WfPixbufJob;
+
+typedef bool (WfScanlineCallback)(const guchar* row, int y, int width, gpointer);
+
+typedef struct {
+	Waveform*      waveform;
+	WfSampleRegion region;      // if len is zero, the region extends to the end of the waveform
+	int            width;
+	int            height;      // the height of each channel must be less than 1024
+	uint32_t       colour;
+	uint32_t       bg_colour;
+	bool           single;
+	int            tile_width;  // optional
+	int            band_height; // optional. The number of rows held in memory at once
+} WfExport;
+
+void       waveform_peak_to_pixbuf        (Waveform*, GdkPixbuf*, WfSampleRegion*, uint32_t colour, uint32_t bg_colour, bool single);
+void       waveform_peak_to_pixbuf_async  (Waveform*, GdkPixbuf*, WfSampleRegion*, uint32_t colour, uint32_t bg_colour, WfPixbufCallback, gpointer);
+void       waveform_peak_to_pixbuf_batch  (WfPixbufJob*, int n_jobs, uint32_t colour, uint32_t bg_colour, WfPixbufCallback, WfCallback done, gpointer);
+void       waveform_peak_to_pixbuf_full   (Waveform*, GdkPixbuf*, uint32_t src_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t bg_colour, float gain, bool single);
+void       waveform_peak_to_pixbuf_full_r (Waveform*, WfPixbufScratch*, GdkPixbuf*, uint32_t src_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t bg_colour, float gain, bool single);
+void       waveform_rms_to_pixbuf         (Waveform*, GdkPixbuf*, uint32_t src_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t bg_colour, float gain);
+void       waveform_rms_to_pixbuf_r       (Waveform*, WfPixbufScratch*, GdkPixbuf*, uint32_t src_inset, int* start, int* end, double samples_per_px, uint32_t colour, uint32_t bg_colour, float gain);
+
+bool       waveform_export_scanlines      (WfExport*, WfScanlineCallback, gpointer, GError**);
+bool       waveform_export_png            (WfExport*, const char* filename, GError**);
+
+WfPixbufScratch* wf_pixbuf_scratch_new  ();
+void             wf_pixbuf_scratch_free (WfPixbufScratch*);
 
 struct _alpha_buf {
 	int        width;
@@ -40,7 +73,9 @@ GdkPixbuf* wf_alphabuf_to_pixbuf        (AlphaBuf*);
 #endif
 
 void       waveform_peak_to_alphabuf    (Waveform*, AlphaBuf*, int scale, int* start, int* end, GdkColor*);
+void       waveform_peak_to_alphabuf_r  (Waveform*, WfPixbufScratch*, AlphaBuf*, int scale, int* start, int* end, GdkColor*);
 void       waveform_peak_to_alphabuf_hi (Waveform*, AlphaBuf*, int block, WfSampleRegion, GdkColor*);
 void       waveform_rms_to_alphabuf     (Waveform*, AlphaBuf*, int* start, int* end, double samples_per_px, GdkColor*, uint32_t colour_bg);
+void       waveform_rms_to_alphabuf_r   (Waveform*, WfPixbufScratch*, AlphaBuf*, int* start, int* end, double samples_per_px, GdkColor*, uint32_t colour_bg);
 
 #endif
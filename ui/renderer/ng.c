@@ -15,14 +15,68 @@
 #define ROWS_PER_PEAK_TYPE 2
 #define short_to_char(A) ((guchar)(A / 128))
 
-typedef struct {
+typedef struct _Section Section;
+
+struct _Section {
    guchar*   buffer;
    int       buffer_size;
    guint     texture;
-   int       time_stamp;
+   int       texture_size;     // bytes used on the gpu
    bool      completed;
+   int       lod_pending;      // number of background lod jobs not yet returned
+   bool      upload_pending;   // the buffer has changed during a batch
    bool      ready[MAX_BLOCKS_PER_TEXTURE];
-} Section;
+
+   Section*  prev;             // lru list. Only sections holding a buffer or texture are linked.
+   Section*  next;
+   Renderer* renderer;
+   Waveform* waveform;
+   int       s;
+};
+
+/*
+ *  A single lru list is shared by all the NG renderers so that one memory
+ *  budget covers the cpu buffers and gpu textures of all modes.
+ */
+#define NG_DEFAULT_BUDGET (256 << 20)
+
+static struct {
+   Section*  head;             // most recently used
+   Section*  tail;
+   size_t    cpu_bytes;
+   size_t    gpu_bytes;
+   size_t    max_bytes;
+   bool      keep_buffers;     // retain the cpu copy of completed sections
+} ng_cache = {.max_bytes = NG_DEFAULT_BUDGET};
+
+#define lru_is_linked(S) ((S)->prev || ng_cache.head == (S))
+
+/*
+ *  While a batch is open, texture uploads are deferred until the end of the batch
+ *  so that a section that receives several blocks is only uploaded once.
+ */
+static struct {
+   int       depth;
+   GList*    sections;         // Section* with upload_pending set
+} ng_batch;
+
+/*
+ *  Optionally the reduced resolution levels are built by a background worker
+ *  instead of when each block is loaded. The base level is uploaded immediately
+ *  and the section is re-uploaded once all its pending levels have been returned.
+ */
+static bool ng_background_lod = false;
+static WfWorker lod_worker = {0,};
+static GList* lod_jobs = NULL;
+
+typedef struct {
+   Renderer*      renderer;
+   Section*       section;     // is cleared if the section is freed before the job completes
+   WaveformActor* actor;       // is cleared if the actor is freed before the job completes
+   int            dest;
+   int            len;
+   guchar         buf[];
+} LodJob;
 
 typedef void (*WaveformActorBlockFn) (Renderer*, WaveformActor*, int b);
 
@@ -36,7 +90,6 @@ typedef struct {
 #endif
 	int         mmidx_max[N_LOD];
 	int         mmidx_min[N_LOD];
-	int         time_stamp;
 } NGRenderer;
 
 
@@ -50,6 +103,72 @@ typedef struct {
 static void ng_gl2_queue_clean (Renderer*);
 
 
+static void
+lru_unlink (Section* section)
+{
+	if (!lru_is_linked(section)) return;
+
+	if (section->prev) section->prev->next = section->next; else ng_cache.head = section->next;
+	if (section->next) section->next->prev = section->prev; else ng_cache.tail = section->prev;
+	section->prev = section->next = NULL;
+}
+
+
+/*
+ *  Move the section to the front of the list, adding it if not already present.
+ */
+static void
+lru_touch (Section* section)
+{
+	if (ng_cache.head == section) return;
+
+	lru_unlink(section);
+
+	section->next = ng_cache.head;
+	if (ng_cache.head) ng_cache.head->prev = section; else ng_cache.tail = section;
+	ng_cache.head = section;
+}
+
+
+/*
+ *  Set the total number of bytes that may be used by the NG renderers
+ *  for cpu side section buffers and gpu textures combined.
+ */
+void
+wf_ng_cache_set_budget (size_t bytes)
+{
+	ng_cache.max_bytes = bytes;
+
+	if (ng_cache.head) ng_gl2_queue_clean(ng_cache.head->renderer);
+}
+
+
+/*
+ *  By default the cpu copy of a section is freed once all its blocks have been
+ *  uploaded. Retaining it uses more memory but allows textures that
+ *  are stolen by the texture cache to be re-uploaded without being regenerated.
+ */
+void
+wf_ng_cache_set_keep_buffers (bool keep)
+{
+	ng_cache.keep_buffers = keep;
+}
+
+
+size_t
+wf_ng_cache_get_size ()
+{
+	return ng_cache.cpu_bytes + ng_cache.gpu_bytes;
+}
+
+
+void
+wf_ng_set_background_lod (bool enable)
+{
+	ng_background_lod = enable;
+}
+
+
 static void
 ng_gl2_finalize_notify (gpointer user_data, GObject* was)
 {
@@ -82,8 +201,158 @@ ng_gl2_set_ (Section* section, int pos, char val)
 #endif
 
 
+/*
+ *  Build the reduced resolution levels from the base level for a single channel
+ *  of a single block. @dest is the offset of the channel data in @buf.
+ *
+ *  The inner loop is kept free of bounds checks and aliasing so that it can be vectorised.
+ */
 static void
-ng_gl2_load_block (Renderer* renderer, WaveformActor* actor, int b)
+ng_make_lods (NGRenderer* renderer, guchar* buf, int dest)
+{
+	int* lod_max = renderer->mmidx_max;
+	int* lod_min = renderer->mmidx_min;
+
+	for(int m=1;m<N_LOD;m++){
+		int n = modes[renderer->renderer.mode].texture_size / (1 << (m - 1)) / 2;
+
+		const guchar* restrict src_max = buf + dest + lod_max[m - 1];
+		const guchar* restrict src_min = buf + dest + lod_min[m - 1];
+		guchar* restrict dst_max = buf + dest + lod_max[m];
+		guchar* restrict dst_min = buf + dest + lod_min[m];
+
+		for(int i=0;i<n;i++){
+			dst_max[i] = MAX(src_max[2 * i], src_max[2 * i + 1]);
+			dst_min[i] = MAX(src_min[2 * i], src_min[2 * i + 1]);
+		}
+	}
+}
+
+
+static void
+ng_gl2_upload_section (Renderer* renderer, Waveform* waveform, Section* section)
+{
+	WF_PROFILE_PHASE_START(WF_PHASE_UPLOAD);
+
+	if(!section->texture){
+		// note: for the WaveformBlock we use the first block for the section (WaveformBlock concept is broken in this context)
+		section->texture = texture_cache_assign_new(GL_TEXTURE_2D, (WaveformBlock){waveform, (section->s * MAX_BLOCKS_PER_TEXTURE) | (renderer->mode == MODE_HI ? WF_TEXTURE_CACHE_HIRES_NG_MASK : 0)});
+	}
+
+	int width = modes[renderer->mode].texture_size;
+	int height = section->buffer_size / width;
+	agl_use_texture (section->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	// TODO it is quite common for this to be done several times in quick succession for the same texture with consecutive calls to ng_gl2_load_block
+	dbg(1, "%i: uploading texture: %i x %i", section->s, width, height);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, section->buffer);
+	gl_warn("error binding texture: %u", section->texture);
+
+	if(!section->texture_size){
+		ng_cache.gpu_bytes += section->texture_size = width * height * 4; // GL_RGBA8
+	}
+
+	WF_PROFILE_ADD(texture_binds, 1);
+	WF_PROFILE_ADD(bytes_uploaded, section->buffer_size);
+	WF_PROFILE_PHASE_END(WF_PHASE_UPLOAD);
+}
+
+
+	static void ng_lod_work (Waveform* waveform, gpointer _job)
+	{
+		// worker thread. Only the private copy of the data is accessed.
+
+		LodJob* job = _job;
+		ng_make_lods((NGRenderer*)job->renderer, job->buf, 0);
+	}
+
+	static void ng_lod_done (Waveform* waveform, GError* error, gpointer _job)
+	{
+		LodJob* job = _job;
+		Section* section = job->section;
+
+		if(!waveform || !section || !section->buffer) return;
+
+		memcpy(section->buffer + job->dest, job->buf, job->len);
+
+		if(!--section->lod_pending){
+			ng_gl2_upload_section(job->renderer, waveform, section);
+
+			if(section->completed && !ng_cache.keep_buffers){
+				ng_cache.cpu_bytes -= section->buffer_size;
+				g_free0(section->buffer);
+			}
+
+			if(job->actor){
+				agl_actor__invalidate((AGlActor*)job->actor);
+				wf_context_queue_redraw(job->actor->context);
+			}
+		}
+		job->section = NULL;
+	}
+
+	static void ng_lod_free (gpointer _job)
+	{
+		LodJob* job = _job;
+
+		if(job->section) job->section->lod_pending--;
+		lod_jobs = g_list_remove(lod_jobs, job);
+		g_free(job);
+	}
+
+static void
+ng_lod_queue (Renderer* renderer, WaveformActor* actor, Section* section, int dest)
+{
+	// the job works on a copy of the channel data so that the section can be freed at any time.
+
+	int len = 4 * modes[renderer->mode].texture_size;
+
+	if(!lod_worker.msg_queue) wf_worker_init(&lod_worker);
+
+	LodJob* job = g_malloc(sizeof(LodJob) + len);
+	*job = (LodJob){
+		.renderer = renderer,
+		.section = section,
+		.actor = actor,
+		.dest = dest,
+		.len = len
+	};
+	memcpy(job->buf, section->buffer + dest, len);
+
+	section->lod_pending++;
+	lod_jobs = g_list_prepend(lod_jobs, job);
+
+	wf_worker_push_job(&lod_worker, actor->waveform, ng_lod_work, ng_lod_done, ng_lod_free, job);
+}
+
+
+/*
+ *  Pending jobs must not reference the section after it is freed.
+ */
+static void
+ng_lod_cancel_section (Section* section)
+{
+	for(GList* l=lod_jobs;l;l=l->next){
+		LodJob* job = l->data;
+		if(job->section == section) job->section = NULL;
+	}
+	section->lod_pending = 0;
+}
+
+
+static void
+ng_lod_forget_actor (WaveformActor* actor)
+{
+	for(GList* l=lod_jobs;l;l=l->next){
+		LodJob* job = l->data;
+		if(job->actor == actor) job->actor = NULL;
+	}
+}
+
+
+static void
+_ng_gl2_load_block (Renderer* renderer, WaveformActor* actor, int b)
 {
 	NGRenderer* ng_renderer = (NGRenderer*)renderer;
 	Waveform* waveform = actor->waveform;
@@ -99,8 +368,12 @@ ng_gl2_load_block (Renderer* renderer, WaveformActor* actor, int b)
 
 		Section* section = &data->section[s];
 		section->buffer = g_malloc0(section->buffer_size = buffer_size);
+		section->renderer = renderer;
+		section->waveform = waveform;
+		section->s = s;
 
-		section->time_stamp = ((NGRenderer*)renderer)->time_stamp++;
+		ng_cache.cpu_bytes += buffer_size;
+		lru_touch(section);
 
 		ng_gl2_queue_clean(renderer);
 
@@ -119,25 +392,10 @@ ng_gl2_load_block (Renderer* renderer, WaveformActor* actor, int b)
 
 	void other_lods (Renderer* renderer, Section* section, int dest)
 	{
-		int* lod_max = ((NGRenderer*)renderer)->mmidx_max;
-		int* lod_min = ((NGRenderer*)renderer)->mmidx_min;
-
-		int m; for(m=1;m<N_LOD;m++){
-			int mm_level = m;
-			int mm = 1 << (mm_level - 1);
-			int i,p; for(i=0, p=0; p<modes[renderer->mode].texture_size/mm; i++, p+=2){
-				ng_gl2_set_(section,
-					dest + lod_max[mm_level] + i,
-					MAX(
-						section->buffer[dest + lod_max[mm_level - 1] + i * 2    ],
-						section->buffer[dest + lod_max[mm_level - 1] + i * 2 + 1]
-					)
-				);
-				ng_gl2_set_(section, dest + lod_min[mm_level] + i, MAX(
-					section->buffer[dest + lod_min[mm_level - 1] + i * 2    ],
-					section->buffer[dest + lod_min[mm_level - 1] + i * 2 + 1]
-				));
-			}
+		if(ng_background_lod){
+			ng_lod_queue(renderer, actor, section, dest);
+		}else{
+			ng_make_lods((NGRenderer*)renderer, section->buffer, dest);
 		}
 	}
 
@@ -274,6 +532,17 @@ ng_gl2_load_block (Renderer* renderer, WaveformActor* actor, int b)
 		}
 	}
 
+	/*
+	 *  Levels below 128 are all converted to zero, so if the whole source range is below that,
+	 *  the (zero initialised) section buffer already has the correct content.
+	 *  The range includes the neighbouring blocks that supply the texture borders.
+	 */
+	bool is_blank (int first, int last)
+	{
+		short level = waveform_get_block_level(waveform, first, last);
+		return level > -1 && level < 128;
+	}
+
 	int n_chans = waveform_get_n_channels(waveform);
 
 	HiResNGWaveform** data = (HiResNGWaveform**)&w->render_data[renderer->mode];
@@ -315,22 +584,25 @@ ng_gl2_load_block (Renderer* renderer, WaveformActor* actor, int b)
 		int s  = b / MAX_BLOCKS_PER_TEXTURE;
 		int _b = b % MAX_BLOCKS_PER_TEXTURE;
 		Section* section = &(*data)->section[s];
-															// TODO move timestamp to render
-		section->time_stamp = ((NGRenderer*)renderer)->time_stamp++;
 		if(section->completed) return;
 		if(!section->buffer) section = add_section(renderer, actor, *data, s);
+		lru_touch(section);
+		if(!section->texture) texture_changed[s] = true; // the texture may have been stolen while the buffer was retained
 		if(!section->ready[_b]){
 			texture_changed[s] = true;
 			call(ng_renderer->buf_to_tex, renderer, actor, b);
 			switch(renderer->mode){
 				case MODE_LOW:
-					lo_peakbuf_to_texture(renderer, actor, b, section, n_chans, block_size);
+					if(!is_blank(b * WF_PEAK_STD_TO_LO - 1, (b + 1) * WF_PEAK_STD_TO_LO))
+						lo_peakbuf_to_texture(renderer, actor, b, section, n_chans, block_size);
 					break;
 				case MODE_MED:
-					med_peakbuf_to_texture(renderer, actor, b, section, n_chans, block_size);
+					if(!is_blank(b - 1, b + 1))
+						med_peakbuf_to_texture(renderer, actor, b, section, n_chans, block_size);
 					break;
 				case MODE_HI:
-					hi_audio_to_texture(renderer, actor, b, section, n_chans, block_size);
+					if(!is_blank(b, b + 1))
+						hi_audio_to_texture(renderer, actor, b, section, n_chans, block_size);
 					break;
 				case MODE_V_LOW:
 					//v_low_peakbuf_to_texture(renderer, actor, b, section, n_chans, block_size);
@@ -350,31 +622,64 @@ ng_gl2_load_block (Renderer* renderer, WaveformActor* actor, int b)
 		Section* section = &(*data)->section[s];
 		if(!section->completed){
 			if(texture_changed[s]){
-				if(!section->texture){
-					// note: for the WaveformBlock we use the first block for the section (WaveformBlock concept is broken in this context)
-					section->texture = texture_cache_assign_new(GL_TEXTURE_2D, (WaveformBlock){waveform, (s * MAX_BLOCKS_PER_TEXTURE) | (renderer->mode == MODE_HI ? WF_TEXTURE_CACHE_HIRES_NG_MASK : 0)});
+				if(ng_batch.depth){
+					if(!section->upload_pending){
+						section->upload_pending = true;
+						ng_batch.sections = g_list_prepend(ng_batch.sections, section);
+					}
+				}else{
+					ng_gl2_upload_section(renderer, waveform, section);
 				}
-
-				int width = modes[renderer->mode].texture_size;
-				int height = section->buffer_size / width;
-				#define pixel_format GL_ALPHA
-				agl_use_texture (section->texture);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-				// TODO it is quite common for this to be done several times in quick succession for the same texture with consecutive calls to ng_gl2_load_block
-				dbg(1, "%i: uploading texture: %i x %i", s, width, height);
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, pixel_format, GL_UNSIGNED_BYTE, section->buffer);
-				gl_warn("error binding texture: %u", section->texture);
 			}
 
-			if(section_is_complete(actor, section)){
-				g_free0(section->buffer); // all data has been sent to the gpu so can be freed.
+			if(section_is_complete(actor, section) && !ng_cache.keep_buffers && !section->lod_pending && !section->upload_pending){
+				// all data has been sent to the gpu so can be freed.
+				ng_cache.cpu_bytes -= section->buffer_size;
+				g_free0(section->buffer);
 			}
 		}
 	}
 }
 
 
+static void
+ng_gl2_begin_batch ()
+{
+	ng_batch.depth++;
+}
+
+
+static void
+ng_gl2_end_batch ()
+{
+	g_return_if_fail(ng_batch.depth);
+
+	if(--ng_batch.depth) return;
+
+	for(GList* l=ng_batch.sections;l;l=l->next){
+		Section* section = l->data;
+		section->upload_pending = false;
+
+		ng_gl2_upload_section(section->renderer, section->waveform, section);
+
+		if(section->completed && !ng_cache.keep_buffers && !section->lod_pending){
+			ng_cache.cpu_bytes -= section->buffer_size;
+			g_free0(section->buffer);
+		}
+	}
+	g_list_free0(ng_batch.sections);
+}
+
+
+static void
+ng_gl2_load_block (Renderer* renderer, WaveformActor* actor, int b)
+{
+	WF_PROFILE_PHASE_START(WF_PHASE_LOAD_BLOCK);
+	_ng_gl2_load_block(renderer, actor, b);
+	WF_PROFILE_PHASE_END(WF_PHASE_LOAD_BLOCK);
+}
+
+
 /*
  *  This is done only once per paint, it does not have to be done per block
  */
@@ -450,6 +755,7 @@ ng_gl2_render_block (Renderer* renderer, WaveformActor* actor, int b, bool is_fi
 	HiResNGWaveform* data = (HiResNGWaveform*)waveform->priv->render_data[renderer->mode];
 	if(!data) return false; // this can happen when audio data not yet available.
 	Section* section = &data->section[s];
+	if(section->texture) lru_touch(section);
 
 	if(!_b && b != r->viewport_blocks.first){
 		HiResNGShader* shader = (HiResNGShader*)renderer->shader;
@@ -468,6 +774,7 @@ ng_gl2_render_block (Renderer* renderer, WaveformActor* actor, int b, bool is_fi
 	//dbg(0, "b=%i %u n_rows=%f x=%f-->%f y=%f (%f)", b % MAX_BLOCKS_PER_TEXTURE, section->texture, n_rows, tex.start, tex.end, ty, ((float)(b % MAX_BLOCKS_PER_TEXTURE) * 4.0 * waveform->n_channels));
 
 	agl_textured_rect_fast (section->texture, block.start, r->rect.top, block.len, r->rect.height, &tex_rect);
+	WF_PROFILE_ADD(texture_binds, 1);
 
 	return true;
 }
@@ -499,17 +806,49 @@ static void
 ng_gl2_free_section (Renderer* renderer, Waveform* waveform, Section* section, int s)
 {
 	if(section){
-		if(section->buffer) g_free0(section->buffer);
+		if(section->buffer){
+			ng_cache.cpu_bytes -= section->buffer_size;
+			g_free0(section->buffer);
+		}
 		if(section->texture){
 			texture_cache_remove(GL_TEXTURE_2D, waveform, (s * MAX_BLOCKS_PER_TEXTURE) | (renderer->mode == MODE_HI ? WF_TEXTURE_CACHE_HIRES_NG_MASK : 0));
 			section->texture = 0;
 		}
+		ng_cache.gpu_bytes -= section->texture_size;
+		section->texture_size = 0;
 		section->completed = false;
 		memset(section->ready, 0, sizeof(bool) * MAX_BLOCKS_PER_TEXTURE);
+		if(section->lod_pending) ng_lod_cancel_section(section);
+		if(section->upload_pending){
+			ng_batch.sections = g_list_remove(ng_batch.sections, section);
+			section->upload_pending = false;
+		}
+		lru_unlink(section);
 	}
 }
 
 
+/*
+ *  Called when the texture cache has reused the texture for another purpose.
+ */
+static void
+ng_gl2_section_on_steal (Section* section)
+{
+	section->texture = 0;
+	ng_cache.gpu_bytes -= section->texture_size;
+	section->texture_size = 0;
+	section->completed = false;
+
+	if(section->buffer){
+		// the retained buffer is still valid and will be re-uploaded when next requested
+		return;
+	}
+
+	memset(section->ready, 0, sizeof(bool) * MAX_BLOCKS_PER_TEXTURE);
+	lru_unlink(section);
+}
+
+
 static void
 ng_gl2_free_waveform (Renderer* renderer, Waveform* waveform)
 {
@@ -536,51 +875,94 @@ ng_gl2_free_waveform (Renderer* renderer, Waveform* waveform)
 }
 
 
-	#define MAX_SECTIONS 1024
+/*
+ *  The source data for the block has changed, eg for a Waveform that is being recorded.
+ *  The block will be regenerated when it is next loaded.
+ */
+static void
+ng_gl2_invalidate_block (Renderer* renderer, WaveformActor* actor, int b)
+{
+	HiResNGWaveform* data = (HiResNGWaveform*)actor->waveform->priv->render_data[renderer->mode];
+	if(!data) return;
 
-	static guint idle_id = 0;
+	int s = b / MAX_BLOCKS_PER_TEXTURE;
+	g_return_if_fail(s < data->size);
 
-		static struct _oldest {
-			Waveform*        waveform;
-			HiResNGWaveform* data;
-			int              section;
-			int              time_stamp;
-		} oldest;
-
-		static void __hi_find_oldest(gpointer key, gpointer value, gpointer _)
-		{
-			HiResNGWaveform* data = (HiResNGWaveform*)value;
-			int s; for(s=0;s<data->size;s++){
-				Section* section = &data->section[s];
-				dbg(0, ">  %i", section->time_stamp);
-				if(section->buffer && (section->time_stamp < oldest.time_stamp)){
-					oldest = (struct _oldest){key, data, s, section->time_stamp};
-				}
-			}
-		}
+	Section* section = &data->section[s];
+	section->completed = false;
+	if(section->buffer){
+		section->ready[b % MAX_BLOCKS_PER_TEXTURE] = false;
+	}else{
+		// without the cpu copy, the other blocks in the section must also be regenerated before the next upload
+		memset(section->ready, 0, sizeof(bool) * MAX_BLOCKS_PER_TEXTURE);
+	}
+}
 
-static gboolean
-__clean (gpointer user_data)
+
+/*
+ *  The Waveform has grown, eg while recording. The existing sections are kept.
+ *  If more sections are needed they are moved to a larger array, and the
+ *  references to them held by the lru list, the open batch and the lod jobs
+ *  are updated.
+ */
+static void
+ng_gl2_extend (Renderer* renderer, Waveform* waveform)
 {
-	Renderer* renderer = user_data;
+	HiResNGWaveform** data = (HiResNGWaveform**)&waveform->priv->render_data[renderer->mode];
+	if(!*data) return;
 
-#ifdef NG_HASHTABLE
-	GHashTable* table = ((NGRenderer*)renderer)->ng_data;
-#endif
+	int n_audio_blocks = waveform_get_n_audio_blocks(waveform);
+	int n_sections = n_audio_blocks / MAX_BLOCKS_PER_TEXTURE + (n_audio_blocks % MAX_BLOCKS_PER_TEXTURE ? 1 : 0);
 
-	dbg(1, "size=%i", g_hash_table_size(table));
+	if(n_sections > (*data)->size){
+		HiResNGWaveform* old = *data;
+		HiResNGWaveform* new = g_malloc0(sizeof(HiResNGWaveform) + sizeof(Section) * n_sections);
+		new->size = n_sections;
 
-	if(g_hash_table_size(table) > MAX_SECTIONS){
-		int n_to_remove = g_hash_table_size(table) - MAX_SECTIONS;
-		int i; for(i=0;i<n_to_remove;i++){
-			oldest = (struct _oldest){NULL, 0, INT_MAX};
-			g_hash_table_foreach(table, __hi_find_oldest, NULL);
+		for(int s=0;s<old->size;s++){
+			Section* from = &old->section[s];
+			Section* to = &new->section[s];
+			*to = *from;
 
-			if(oldest.data){
-				dbg(0, "removing: section=%i", oldest.section);
-				ng_gl2_free_section(renderer, oldest.waveform, &oldest.data->section[oldest.section], oldest.section);
+			// the neighbours are updated in place, so a neighbour that is moved later takes the new pointer with it
+			if(from->prev) from->prev->next = to; else if(ng_cache.head == from) ng_cache.head = to;
+			if(from->next) from->next->prev = to; else if(ng_cache.tail == from) ng_cache.tail = to;
+
+			for(GList* l=ng_batch.sections;l;l=l->next){
+				if(l->data == from) l->data = to;
+			}
+			for(GList* l=lod_jobs;l;l=l->next){
+				LodJob* job = l->data;
+				if(job->section == from) job->section = to;
 			}
 		}
+
+#ifdef NG_HASHTABLE
+		g_hash_table_steal(((NGRenderer*)renderer)->ng_data, waveform);
+		g_hash_table_insert(((NGRenderer*)renderer)->ng_data, waveform, new);
+#endif
+		g_free(old);
+		*data = new;
+	}
+
+	(*data)->n_blocks = wf_actor_get_n_blocks(waveform, renderer->mode);
+}
+
+
+	static guint idle_id = 0;
+
+/*
+ *  Evict least recently used sections until the memory budget is satisfied.
+ */
+static gboolean
+__clean (gpointer user_data)
+{
+	dbg(1, "cpu=%zuk gpu=%zuk", ng_cache.cpu_bytes / 1024, ng_cache.gpu_bytes / 1024);
+
+	while(ng_cache.tail && ng_cache.cpu_bytes + ng_cache.gpu_bytes > ng_cache.max_bytes){
+		Section* section = ng_cache.tail;
+		dbg(1, "removing: %s section=%i", modes[section->renderer->mode].name, section->s);
+		ng_gl2_free_section(section->renderer, section->waveform, section, section->s);
 	}
 
 	idle_id = 0;
@@ -89,6 +89,14 @@ hi_free_gl1 (Renderer* renderer, Waveform* w)
 		}
 	}
 
+static inline bool
+hi_block_is_resident (Waveform* w, int b)
+{
+	WfAudioData* audio = &w->priv->audio;
+	return audio->buf16 && b < audio->n_blocks && audio->buf16[b] && audio->buf16[b]->buf[WF_LEFT];
+}
+
+
 static void
 hi_request_block (WaveformActor* a, int b)
 {
@@ -522,6 +530,7 @@ hi_gl1_render_block (Renderer* renderer, WaveformActor* actor, int b, gboolean i
 	}
 	agl_use_texture(texture->t[WF_LEFT].main);
 	gl_warn("texture assign");
+	WF_PROFILE_ADD(texture_binds, 1);
 
 	float texels_per_px = ((float)texture_size) / r->block_wid;
 	#define EXTRA_PASSES 4 // empirically determined for visual effect.
@@ -598,7 +607,7 @@ _wf_actor_print_hires_textures (WaveformActor* a)
 #endif
 
 
-NGRenderer hi_renderer_gl2 = {{MODE_HI, hi_gl2_init, ng_gl2_load_block, ng_pre_render, ng_gl2_render_block, ng_gl2_post_render, ng_gl2_free_waveform}};
+NGRenderer hi_renderer_gl2 = {{MODE_HI, hi_gl2_init, ng_gl2_load_block, ng_pre_render, ng_gl2_render_block, ng_gl2_post_render, ng_gl2_free_waveform, ng_gl2_invalidate_block, ng_gl2_extend}};
 
 HiRenderer hi_renderer_gl1 = {{MODE_HI, hi_new_gl1, hi_gl1_load_block, hi_gl1_pre_render,
 #ifdef HIRES_NONSHADER_TEXTURES
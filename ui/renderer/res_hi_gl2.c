@@ -132,9 +132,7 @@ hi_gl2_on_steal(WaveformBlock* wb, guint tex)
 		Section* section = &data->section[s];
 		if(section){
 			g_return_if_fail(tex == section->texture);
-			section->texture = 0;
-			section->completed = false;
-			memset(section->ready, 0, sizeof(bool) * MAX_BLOCKS_PER_TEXTURE);
+			ng_gl2_section_on_steal(section);
 			dbg(0, "section %i cleared", s);
 		}
 	}
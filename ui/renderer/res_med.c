@@ -180,6 +180,7 @@ _med_lo_set_gl_state_for_block (WaveformContext* wfc, Waveform* w, WfGlBlock* te
 	g_return_if_fail(b < textures->size);
 
 	agl_use_texture(textures->peak_texture[0].main[b]);
+	WF_PROFILE_ADD(texture_binds, 1);
 
 	gl_warn("cannot bind texture: block=%i: %i", b, textures->peak_texture[0].main[b]);
 }
@@ -303,7 +304,7 @@ med_lo_on_steal (WaveformBlock* wb, guint tex)
 
 
 Renderer med_renderer_gl1 = {MODE_MED, NULL, med_allocate_block_gl1, med_lo_pre_render_gl1, med_lo_render_gl1, NULL, med_lo_gl1_free_waveform};
-NGRenderer med_renderer_gl2 = {{MODE_MED, med_renderer_new_gl2, ng_gl2_load_block, ng_pre_render, ng_gl2_render_block, ng_gl2_post_render, ng_gl2_free_waveform}};
+NGRenderer med_renderer_gl2 = {{MODE_MED, med_renderer_new_gl2, ng_gl2_load_block, ng_pre_render, ng_gl2_render_block, ng_gl2_post_render, ng_gl2_free_waveform, ng_gl2_invalidate_block, ng_gl2_extend}};
 
 
 static Renderer*
@@ -144,7 +144,7 @@ draw_wave_buffer_v_hi (Renderer* renderer, WaveformActor* actor, int block, bool
 #endif
 		return false;
 	}
-	buf->stamp = ++wf->audio.access_counter;
+	wf_audio_touch(buf);
 
 	#define MAX_SCREEN_SIZE 8192
 
@@ -403,6 +403,8 @@ _wf_create_lines_texture (guchar* pbuf, int width, int height)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, width, height, 0, pixel_format, GL_UNSIGNED_BYTE, pbuf);
 	gl_warn("error binding lines texture");
+	WF_PROFILE_ADD(texture_binds, 1);
+	WF_PROFILE_ADD(bytes_uploaded, width * height);
 
 	t_idx = (t_idx + 1) % 8;
 
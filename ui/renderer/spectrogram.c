@@ -0,0 +1,161 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of the Ayyi project. https://www.ayyi.org          |
+ | copyright (C) 2025-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Spectrogram renderer. Used in place of the mode renderers when       |
+ | enabled with wf_actor_set_spectrogram().                             |
+ |                                                                      |
+ | Each block is drawn using one tile from wf/spectrogram.c. The level  |
+ | is chosen so that the tiles are the same size as the blocks for the  |
+ | current mode. Tiles are uploaded on demand and the textures are held |
+ | in the texture cache so they can be reclaimed when not in use.       |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+extern SpectrogramShader spectrogram_shader;
+
+static Renderer spectrogram_renderer;
+
+#define SPECTROGRAM_BLOCK(LEVEL, B) ((B) | ((LEVEL) << WF_TEXTURE_CACHE_SPECTRO_LEVEL_SHIFT) | WF_TEXTURE_CACHE_SPECTRO_MASK)
+
+
+static inline int
+spectrogram_level (Mode mode)
+{
+	switch (mode) {
+		case MODE_V_LOW:
+			return 3;
+		case MODE_LOW:
+			return 2;
+		case MODE_MED:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+
+static void
+spectrogram_new (WaveformActor* actor)
+{
+	AGlShader** shader = &spectrogram_renderer.shader;
+	if (!*shader) {
+		*shader = &spectrogram_shader.shader;
+		if (!(*shader)->program) agl_create_program(*shader);
+	}
+}
+
+
+static void
+spectrogram_load_block (Renderer* renderer, WaveformActor* actor, int b)
+{
+	Waveform* waveform = actor->waveform;
+	int level = spectrogram_level(actor->priv->render_info.mode);
+
+	if (!waveform->filename) return; // live waveforms do not have spectrograms until they are saved
+
+	if (b < wf_spectrogram_get_n_tiles(waveform, level)) {
+		waveform_load_spectrogram(waveform, level, b);
+	}
+}
+
+
+static bool
+spectrogram_pre_render (Renderer* renderer, WaveformActor* actor)
+{
+	SpectrogramShader* shader = (SpectrogramShader*)renderer->shader;
+	if (!shader) return false;
+
+	shader->uniform.opacity = actor->priv->opacity;
+
+	agl_scale (&shader->shader, 1., 1.);
+	agl_translate (&shader->shader, -((AGlActor*)actor)->scrollable.x1, 0.);
+	shader->shader.set_uniforms_((AGlShader*)shader);
+
+	glActiveTexture (GL_TEXTURE0);
+	glBindBuffer (GL_ARRAY_BUFFER, agl->vbo);
+
+	glEnableVertexAttribArray (0);
+	glVertexAttribPointer (0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+
+	return true;
+}
+
+
+/*
+ *  Returns false if the tile is not yet available, in which case it is requested.
+ */
+static bool
+spectrogram_render_block (Renderer* renderer, WaveformActor* actor, int b, bool is_first, bool is_last, double x)
+{
+	Waveform* waveform = actor->waveform;
+	RenderInfo* r = &actor->priv->render_info;
+	int level = spectrogram_level(r->mode);
+
+	WaveformBlock wb = {waveform, SPECTROGRAM_BLOCK(level, b)};
+
+	int texture = texture_cache_lookup(GL_TEXTURE_2D, wb);
+	if (texture > -1) {
+		texture_cache_freshen(GL_TEXTURE_2D, wb);
+	} else {
+		WfSpectrogramTile* tile = waveform_get_spectrogram_tile(waveform, level, b);
+		if (!tile) {
+			spectrogram_load_block(renderer, actor, b);
+			return false;
+		}
+
+		texture = texture_cache_assign_new(GL_TEXTURE_2D, wb);
+
+		agl_use_texture (texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // the tile width is not a multiple of 4
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tile->width, tile->height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, tile->buf);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		gl_warn("error binding texture: %u", texture);
+
+		WF_PROFILE_ADD(bytes_uploaded, tile->width * tile->height * 4);
+	}
+
+	TextureRange tex;
+	WfSampleRegionf block;
+	if (!wf_actor_get_quad_dimensions(actor, b, is_first, is_last, x, &tex, &block.start, &block.len, 0, 1)) return false;
+
+	// the first row of the tile is the lowest frequency, which is drawn at the bottom
+	AGlQuad tex_rect = {tex.start, 1.0, tex.end, 0.0};
+
+	agl_textured_rect_fast (texture, block.start, r->rect.top, block.len, r->rect.height, &tex_rect);
+	WF_PROFILE_ADD(texture_binds, 1);
+
+	return true;
+}
+
+
+static void
+spectrogram_post_render (Renderer* renderer, WaveformActor* actor)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+/*
+ *  The tile data itself is owned by the Waveform and is freed with it.
+ */
+static void
+spectrogram_free_waveform (Renderer* renderer, Waveform* waveform)
+{
+	texture_cache_remove_masked(GL_TEXTURE_2D, waveform, WF_TEXTURE_CACHE_SPECTRO_MASK);
+}
+
+
+static Renderer spectrogram_renderer = {MODE_MED, spectrogram_new, spectrogram_load_block, spectrogram_pre_render, spectrogram_render_block, spectrogram_post_render, spectrogram_free_waveform};
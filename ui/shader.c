@@ -35,6 +35,7 @@ static void  _ass_set_uniforms         (AGlShader*);
 static void  _ruler_set_uniforms       (AGlShader*);
 static void  _ruler_frames_set_uniforms(AGlShader*);
 static void  _cursor_set_uniforms      (AGlShader*);
+static void  _spectrogram_set_uniforms (AGlShader*);
 
 #if 0
 static AGlUniformInfo uniforms[] = {
@@ -129,6 +130,17 @@ RulerFramesShader frames_ruler = {{
 }};
 
 
+SpectrogramShader spectrogram_shader = {{
+	.uniforms = (AGlUniformInfo[]){
+		{"tex2d",   1, GL_INT,   -1, { 0,  }}, // 0 corresponds to glActiveTexture(GL_TEXTURE0);
+		{"opacity", 1, GL_FLOAT, -1, { 1., }},
+		END_OF_UNIFORMS
+	},
+	_spectrogram_set_uniforms,
+	&spectrogram_text
+}};
+
+
 CursorShader cursor = {{
 	.uniforms = (AGlUniformInfo[]){
    		{"colour", 4, GL_COLOR_ARRAY, -1,},
@@ -362,6 +374,13 @@ _cursor_set_uniforms (AGlShader* shader)
 }
 
 
+static void
+_spectrogram_set_uniforms (AGlShader* shader)
+{
+	glUniform1f(spectrogram_shader.shader.uniforms[1].location, spectrogram_shader.uniform.opacity);
+}
+
+
 #if 0
 void
 wf_shaders_init()
@@ -103,6 +103,13 @@ struct _ass_shader {
 	}            uniform;
 };
 
+typedef struct {
+	AGlShader    shader;
+	struct {
+		float    opacity;
+	}            uniform;
+} SpectrogramShader;
+
 struct _CursorShader {
 	AGlShader    shader;
 	struct {
@@ -0,0 +1,495 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of the Ayyi project. https://www.ayyi.org          |
+ | copyright (C) 2025-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Text atlas shared by all actors.                                     |
+ |                                                                      |
+ | Strings such as ruler labels and track names are rasterised once     |
+ | into a single alpha texture and are then drawn as textured quads.    |
+ | Strings that change continuously, such as the playhead time, are     |
+ | instead drawn one glyph at a time so that no new rasterisation is    |
+ | needed as they change.                                               |
+ |                                                                      |
+ | Quads of the same colour are batched and drawn with a single call    |
+ | by text_atlas_flush(), which actors call at the end of their paint.  |
+ |                                                                      |
+ | The atlas is divided into horizontal shelves. When it is full, the   |
+ | least recently used shelf is emptied and reused.                     |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define __wf_private__
+
+#include "config.h"
+#include <stdarg.h>
+#include <pango/pangocairo.h>
+#include "wf/debug.h"
+#include "wf/profile.h"
+#include "waveform/actor.h"
+#include "waveform/text_atlas.h"
+
+#define ATLAS_SIZE 1024
+#define PADDING 1              // prevents neighbouring items bleeding in when filtered
+#define SHELF_ROUNDING 4       // shelf heights are rounded so that similar strings can share a shelf
+#define MAX_TEXT 256
+
+typedef struct {
+	int        y;
+	int        height;
+	int        x;               // the start of the free space
+	uint32_t   stamp;           // most recent use of any of its items
+	GPtrArray* items;
+} Shelf;
+
+static struct {
+	cairo_surface_t* surface;   // A8, a copy of the texture contents
+	cairo_t*         cr;
+	PangoLayout*     layout;
+	GHashTable*      items;     // key is font + text
+	GArray*          shelves;   // type Shelf
+	int              top;       // the start of the unallocated area
+	uint32_t         stamp;
+	struct {
+		int          y1, y2;
+	}                dirty;     // rows not yet uploaded
+	guint            texture;
+	guint            vbo;
+	struct {
+		GArray*      quads;     // type AGlTQuad
+		uint32_t     colour;
+	}                batch;
+	TextAtlasStats   stats;
+} atlas = {0,};
+
+
+static void
+text_atlas_init ()
+{
+	if (atlas.surface) return;
+
+	atlas.surface = cairo_image_surface_create(CAIRO_FORMAT_A8, ATLAS_SIZE, ATLAS_SIZE);
+	atlas.cr = cairo_create(atlas.surface);
+	atlas.layout = pango_cairo_create_layout(atlas.cr);
+
+	void item_free (gpointer _item)
+	{
+		TextAtlasItem* item = _item;
+		g_free(item->key);
+		g_free(item);
+	}
+	atlas.items = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, item_free);
+	atlas.shelves = g_array_new(false, true, sizeof(Shelf));
+	atlas.batch.quads = g_array_new(false, false, sizeof(AGlTQuad));
+}
+
+
+static void
+text_atlas_mark_dirty (int y1, int y2)
+{
+	if (atlas.dirty.y2 > atlas.dirty.y1) {
+		atlas.dirty.y1 = MIN(atlas.dirty.y1, y1);
+		atlas.dirty.y2 = MAX(atlas.dirty.y2, y2);
+	} else {
+		atlas.dirty.y1 = y1;
+		atlas.dirty.y2 = y2;
+	}
+}
+
+
+static void
+text_atlas_empty_shelf (Shelf* shelf)
+{
+	// quads already batched may refer to the items
+	text_atlas_flush();
+
+	for (int i=0;i<shelf->items->len;i++) {
+		TextAtlasItem* item = g_ptr_array_index(shelf->items, i);
+		g_hash_table_remove(atlas.items, item->key);
+	}
+	g_ptr_array_set_size(shelf->items, 0);
+	shelf->x = 0;
+
+	atlas.stats.n_evictions++;
+}
+
+
+/*
+ *  Returns the index of a shelf with space for the given size, or -1 if too large.
+ */
+static int
+text_atlas_find_shelf (int width, int height)
+{
+	if (width > ATLAS_SIZE || height > ATLAS_SIZE) return -1;
+
+	for (int i=0;i<atlas.shelves->len;i++) {
+		Shelf* shelf = &g_array_index(atlas.shelves, Shelf, i);
+		if (shelf->height == height && ATLAS_SIZE - shelf->x >= width) return i;
+	}
+
+	if (atlas.top + height <= ATLAS_SIZE) {
+		g_array_append_val(atlas.shelves, ((Shelf){
+			.y = atlas.top,
+			.height = height,
+			.items = g_ptr_array_new()
+		}));
+		atlas.top += height;
+		return atlas.shelves->len - 1;
+	}
+
+	// the atlas is full
+	int lru = -1;
+	for (int i=0;i<atlas.shelves->len;i++) {
+		Shelf* shelf = &g_array_index(atlas.shelves, Shelf, i);
+		if (shelf->height >= height && (lru < 0 || shelf->stamp < g_array_index(atlas.shelves, Shelf, lru).stamp)) lru = i;
+	}
+	if (lru < 0) {
+		// no shelf is tall enough
+		text_atlas_clear();
+		atlas.stats.n_evictions++;
+		text_atlas_init();
+		return text_atlas_find_shelf(width, height);
+	}
+
+	text_atlas_empty_shelf(&g_array_index(atlas.shelves, Shelf, lru));
+
+	return lru;
+}
+
+
+static TextAtlasItem*
+text_atlas_add (const char* key, const char* font, const char* text)
+{
+	PangoFontDescription* font_desc = pango_font_description_from_string(font);
+	pango_layout_set_font_description(atlas.layout, font_desc);
+	pango_font_description_free(font_desc);
+	pango_layout_set_text(atlas.layout, text, -1);
+
+	PangoRectangle logical;
+	pango_layout_get_pixel_extents(atlas.layout, NULL, &logical);
+
+	int width = logical.width + 2 * PADDING;
+	int height = logical.height + 2 * PADDING;
+	height += (SHELF_ROUNDING - height % SHELF_ROUNDING) % SHELF_ROUNDING;
+
+	int s = text_atlas_find_shelf(width, height);
+	if (s < 0) {
+		pwarn("too large for atlas: %s", text);
+		return NULL;
+	}
+	Shelf* shelf = &g_array_index(atlas.shelves, Shelf, s);
+
+	TextAtlasItem* item = WF_NEW(TextAtlasItem,
+		.key = g_strdup(key),
+		.x = shelf->x + PADDING,
+		.y = shelf->y + PADDING,
+		.width = logical.width,
+		.height = logical.height,
+		.shelf = s,
+	);
+
+	cairo_t* cr = atlas.cr;
+	cairo_save(cr);
+	cairo_rectangle(cr, shelf->x, shelf->y, width, shelf->height);
+	cairo_clip(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+	cairo_paint(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	cairo_set_source_rgba(cr, 1., 1., 1., 1.);
+	cairo_move_to(cr, item->x - logical.x, item->y - logical.y);
+	pango_cairo_show_layout(cr, atlas.layout);
+	cairo_restore(cr);
+	cairo_surface_flush(atlas.surface);
+
+	shelf->x += width;
+	g_ptr_array_add(shelf->items, item);
+	g_hash_table_insert(atlas.items, item->key, item);
+	text_atlas_mark_dirty(shelf->y, shelf->y + shelf->height);
+
+	atlas.stats.n_misses++;
+
+	return item;
+}
+
+
+/*
+ *  Return the atlas item for the given string, rasterising it if not already present.
+ *  The item remains valid until it is evicted, which can happen on any subsequent lookup.
+ */
+const TextAtlasItem*
+text_atlas_lookup (const char* font, const char* text)
+{
+	g_return_val_if_fail(font && text, NULL);
+
+	text_atlas_init();
+
+	char key[MAX_TEXT + 64];
+	snprintf(key, sizeof(key), "%s\n%s", font, text);
+
+	TextAtlasItem* item = g_hash_table_lookup(atlas.items, key);
+	if (item) {
+		atlas.stats.n_hits++;
+	} else {
+		if (!(item = text_atlas_add(key, font, text))) return NULL;
+	}
+
+	item->stamp = ++atlas.stamp;
+	g_array_index(atlas.shelves, Shelf, item->shelf).stamp = item->stamp;
+
+	return item;
+}
+
+
+static void
+text_atlas_upload ()
+{
+	if (!atlas.texture) {
+		glGenTextures(1, &atlas.texture);
+		agl_use_texture(atlas.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, ATLAS_SIZE, ATLAS_SIZE, 0, GL_ALPHA, GL_UNSIGNED_BYTE, NULL);
+		gl_warn("failed to create text atlas");
+
+		text_atlas_mark_dirty(0, atlas.top);
+	}
+
+	if (atlas.dirty.y2 > atlas.dirty.y1) {
+		agl_use_texture(atlas.texture);
+		const unsigned char* data = cairo_image_surface_get_data(atlas.surface);
+		int stride = cairo_image_surface_get_stride(atlas.surface);
+
+		// for A8 the stride is the same as the width
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, atlas.dirty.y1, ATLAS_SIZE, atlas.dirty.y2 - atlas.dirty.y1, GL_ALPHA, GL_UNSIGNED_BYTE, data + atlas.dirty.y1 * stride);
+		gl_warn("text atlas upload");
+		WF_PROFILE_ADD(texture_binds, 1);
+		WF_PROFILE_ADD(bytes_uploaded, ATLAS_SIZE * (atlas.dirty.y2 - atlas.dirty.y1));
+
+		atlas.dirty.y1 = atlas.dirty.y2 = 0;
+	}
+}
+
+
+/*
+ *  Draw all batched quads.
+ */
+void
+text_atlas_flush ()
+{
+	if (!atlas.batch.quads || !atlas.batch.quads->len) return;
+
+	AGl* agl = agl_get_instance();
+
+	text_atlas_upload();
+
+	agl->shaders.alphamap->uniform.fg_colour = atlas.batch.colour;
+	agl_use_program((AGlShader*)agl->shaders.alphamap);
+	agl_set_uniforms(agl->shaders.alphamap);
+
+	agl_enable(AGL_ENABLE_BLEND);
+	glActiveTexture(GL_TEXTURE0);
+	agl_use_texture(atlas.texture);
+	WF_PROFILE_ADD(texture_binds, 1);
+
+	if (!atlas.vbo) glGenBuffers(1, &atlas.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, atlas.vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(AGlTQuad) * atlas.batch.quads->len, atlas.batch.quads->data, GL_STREAM_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+	glDrawArrays(GL_TRIANGLES, 0, atlas.batch.quads->len * AGL_V_PER_QUAD);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	g_array_set_size(atlas.batch.quads, 0);
+	atlas.stats.n_draws++;
+}
+
+
+static void
+text_atlas_add_quad (const TextAtlasItem* item, float x, float y, uint32_t colour)
+{
+	if (atlas.batch.quads->len && colour != atlas.batch.colour) text_atlas_flush();
+	atlas.batch.colour = colour;
+
+	float x1 = x + item->width;
+	float y1 = y + item->height;
+	float u0 = ((float)item->x) / ATLAS_SIZE;
+	float v0 = ((float)item->y) / ATLAS_SIZE;
+	float u1 = ((float)(item->x + item->width)) / ATLAS_SIZE;
+	float v1 = ((float)(item->y + item->height)) / ATLAS_SIZE;
+
+	AGlTQuad quad = {
+		{(AGlVertex){x,  y }, (AGlVertex){u0, v0}},
+		{(AGlVertex){x1, y }, (AGlVertex){u1, v0}},
+		{(AGlVertex){x1, y1}, (AGlVertex){u1, v1}},
+		{(AGlVertex){x,  y }, (AGlVertex){u0, v0}},
+		{(AGlVertex){x1, y1}, (AGlVertex){u1, v1}},
+		{(AGlVertex){x,  y1}, (AGlVertex){u0, v1}}
+	};
+	g_array_append_val(atlas.batch.quads, quad);
+}
+
+
+/*
+ *  Returns the width drawn.
+ */
+static float
+text_atlas_print_ (float x, float y, uint32_t colour, uint32_t bg_colour, const char* font, const char* text, bool glyphs)
+{
+	AGl* agl = agl_get_instance();
+
+	if (!agl->use_shaders) {
+		agl_set_font_string(font);
+		if (bg_colour)
+			agl_print_with_background(x, y, 0, colour, bg_colour, "%s", text);
+		else
+			agl_print(x, y, 0, colour, "%s", text);
+		agl_set_font_string("Roboto 10");
+		return 0.;
+	}
+
+	const TextAtlasItem* items[MAX_TEXT];
+	int n_items = 0;
+
+	// an eviction during lookup can invalidate items found earlier, in which case they are looked up again
+	for (int attempt=0;attempt<2;attempt++) {
+		uint64_t n_evictions = atlas.stats.n_evictions;
+		n_items = 0;
+
+		if (glyphs) {
+			for (const char* c = text; *c && n_items < MAX_TEXT; c = g_utf8_next_char(c)) {
+				char glyph[8] = {0,};
+				memcpy(glyph, c, g_utf8_next_char(c) - c);
+				if ((items[n_items] = text_atlas_lookup(font, glyph))) n_items++;
+			}
+		} else {
+			if ((items[n_items] = text_atlas_lookup(font, text))) n_items++;
+		}
+
+		if (atlas.stats.n_evictions == n_evictions) break;
+		if (attempt) return 0.;
+	}
+
+	float width = 0.;
+	float height = 0.;
+	for (int i=0;i<n_items;i++) {
+		width += items[i]->width;
+		height = MAX(height, items[i]->height);
+	}
+
+	if (bg_colour) {
+		text_atlas_flush();
+
+		SET_PLAIN_COLOUR(agl->shaders.plain, bg_colour);
+		agl_use_program((AGlShader*)agl->shaders.plain);
+		agl_rect(x, y, width, height);
+	}
+
+	for (int i=0;i<n_items;i++) {
+		text_atlas_add_quad(items[i], x, y, colour);
+		x += items[i]->width;
+	}
+
+	if (bg_colour) text_atlas_flush();
+
+	return width;
+}
+
+
+/*
+ *  The string is rasterised as a whole the first time it is used.
+ *  Suitable for strings that are repeated, such as ruler labels.
+ */
+void
+text_atlas_print (float x, float y, uint32_t colour, const char* font, const char* fmt, ...)
+{
+	char text[MAX_TEXT];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(text, MAX_TEXT, fmt, args);
+	va_end(args);
+
+	text_atlas_print_(x, y, colour, 0, font, text, false);
+}
+
+
+/*
+ *  The string is drawn one glyph at a time, so that strings that change
+ *  continuously do not fill the atlas. Kerning is not applied.
+ */
+void
+text_atlas_print_glyphs (float x, float y, uint32_t colour, const char* font, const char* fmt, ...)
+{
+	char text[MAX_TEXT];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(text, MAX_TEXT, fmt, args);
+	va_end(args);
+
+	text_atlas_print_(x, y, colour, 0, font, text, true);
+}
+
+
+/*
+ *  Used for readouts that follow the pointer or playhead, so is drawn per glyph.
+ */
+void
+text_atlas_print_with_background (float x, float y, uint32_t colour, uint32_t bg_colour, const char* font, const char* fmt, ...)
+{
+	char text[MAX_TEXT];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(text, MAX_TEXT, fmt, args);
+	va_end(args);
+
+	text_atlas_print_(x, y, colour, bg_colour, font, text, true);
+}
+
+
+/*
+ *  Release all items and the texture.
+ */
+void
+text_atlas_clear ()
+{
+	if (!atlas.surface) return;
+
+	text_atlas_flush();
+
+	for (int i=0;i<atlas.shelves->len;i++) {
+		g_ptr_array_free(g_array_index(atlas.shelves, Shelf, i).items, true);
+	}
+	g_array_free(atlas.shelves, true);
+	g_hash_table_destroy(atlas.items);
+	g_array_free(atlas.batch.quads, true);
+
+	g_object_unref(atlas.layout);
+	cairo_destroy(atlas.cr);
+	cairo_surface_destroy(atlas.surface);
+
+	if (atlas.texture) glDeleteTextures(1, &atlas.texture);
+	if (atlas.vbo) glDeleteBuffers(1, &atlas.vbo);
+
+	TextAtlasStats stats = atlas.stats;
+	atlas = (typeof(atlas)){
+		.stats = stats
+	};
+	atlas.stats.n_items = 0;
+}
+
+
+TextAtlasStats
+text_atlas_get_stats ()
+{
+	atlas.stats.n_items = atlas.items ? g_hash_table_size(atlas.items) : 0;
+
+	return atlas.stats;
+}
@@ -0,0 +1,41 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of the Ayyi project. https://www.ayyi.org          |
+ | copyright (C) 2025-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+	uint64_t n_hits;
+	uint64_t n_misses;       // strings and glyphs rasterised
+	uint64_t n_evictions;    // shelves emptied to make space
+	uint64_t n_draws;
+	int      n_items;
+} TextAtlasStats;
+
+typedef struct {
+	char*    key;
+	int      x, y;           // position in the atlas
+	int      width, height;
+	int      shelf;
+	uint32_t stamp;
+} TextAtlasItem;
+
+void                 text_atlas_print                 (float x, float y, uint32_t colour, const char* font, const char* fmt, ...) __attribute__ ((format (printf, 5, 6)));
+void                 text_atlas_print_glyphs          (float x, float y, uint32_t colour, const char* font, const char* fmt, ...) __attribute__ ((format (printf, 5, 6)));
+void                 text_atlas_print_with_background (float x, float y, uint32_t colour, uint32_t bg_colour, const char* font, const char* fmt, ...) __attribute__ ((format (printf, 6, 7)));
+void                 text_atlas_flush                 ();
+void                 text_atlas_clear                 ();
+TextAtlasStats       text_atlas_get_stats             ();
+
+const TextAtlasItem* text_atlas_lookup                (const char* font, const char* text);
@@ -428,6 +428,26 @@ texture_cache_remove_waveform(Waveform* waveform) //tmp? should probably only be
 }
 
 
+/*
+ *  Remove all the textures for the Waveform that have any of the bits in @mask set
+ */
+void
+texture_cache_remove_masked(int tex_type, Waveform* w, int mask)
+{
+	TextureCache* c = cache_by_type(tex_type);
+
+	int i; for(i=0;i<c->t->len;i++){
+		WfTexture* t = &g_array_index(c->t, WfTexture, i);
+		if(t->wb.waveform == w && (t->wb.block & mask)){
+			t->wb = (WaveformBlock){NULL, 0};
+			t->time_stamp = 0;
+		}
+	}
+
+	texture_cache_queue_clean();
+}
+
+
 #ifdef DEBUG
 int
 texture_cache_count_by_waveform(Waveform* w)
@@ -487,8 +507,10 @@ texture_cache_print()
 								? "h"
 								: (t->wb.block & WF_TEXTURE_CACHE_HIRES_NG_MASK)
 									? "H"
-									: "M";
-				printf("    %3i: %2u %4i %4i %s %4i\n", i, t->id, t->time_stamp, t->wb.block & (~(WF_TEXTURE_CACHE_V_LORES_MASK | WF_TEXTURE_CACHE_LORES_MASK | WF_TEXTURE_CACHE_HIRES_NG_MASK)), mode, g_list_index(waveforms, t->wb.waveform) + 1);
+									: (t->wb.block & WF_TEXTURE_CACHE_SPECTRO_MASK)
+										? "S"
+										: "M";
+				printf("    %3i: %2u %4i %4i %s %4i\n", i, t->id, t->time_stamp, t->wb.block & (~(WF_TEXTURE_CACHE_V_LORES_MASK | WF_TEXTURE_CACHE_LORES_MASK | WF_TEXTURE_CACHE_HIRES_NG_MASK | WF_TEXTURE_CACHE_SPECTRO_MASK)), mode, g_list_index(waveforms, t->wb.waveform) + 1);
 			}
 		}
 		dbg(0, "array_size=%i n_used=%i n_waveforms=%i", c->t->len, n_used, g_list_length(waveforms));
@@ -21,6 +21,8 @@
 #define WF_TEXTURE_CACHE_HIRES_MASK (1 << 22)
 #define WF_TEXTURE_CACHE_HIRES_NG_MASK (1 << 21)
 #define WF_TEXTURE_CACHE_V_LORES_MASK (1 << 20)
+#define WF_TEXTURE_CACHE_SPECTRO_MASK (1 << 19)
+#define WF_TEXTURE_CACHE_SPECTRO_LEVEL_SHIFT 17 // spectrogram blocks also contain the level in bits 17 and 18
 
 typedef void  (*WfOnSteal) (WfTexture*);
 
@@ -37,6 +39,7 @@ guint texture_cache_assign_new      (int tex_type, WaveformBlock);
 void  texture_cache_freshen         (int tex_type, WaveformBlock);
 void  texture_cache_remove          (int tex_type, Waveform*, int);
 void  texture_cache_remove_waveform (Waveform*);
+void  texture_cache_remove_masked   (int tex_type, Waveform*, int mask);
 
 #endif // __wf_private__
 #endif // WF_USE_TEXTURE_CACHE
@@ -0,0 +1,366 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of the Ayyi project. https://www.ayyi.org          |
+ | copyright (C) 2025-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Recording and replay of user interaction.                            |
+ |                                                                      |
+ | While recording, the zoom, start, region, rect and vzoom calls       |
+ | received by a WaveformContext and its actors are logged with the     |
+ | time they were made. A trace can be saved and loaded as text, one    |
+ | event per line.                                                      |
+ |                                                                      |
+ | The replayer does not use the wall clock. Frames are produced at a   |
+ | fixed interval of trace time, and all events up to the time of each  |
+ | frame are applied before it is painted, with animations disabled,    |
+ | so that a replay is the same each time it is run. The time taken by  |
+ | each frame is measured so that a recorded session can be used as a   |
+ | benchmark.                                                           |
+ |                                                                      |
+ | Recording and replay are for the main thread only.                   |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define __wf_private__
+
+#include "config.h"
+#include <string.h>
+#include <glib.h>
+#include "agl/actor.h"
+#include "wf/debug.h"
+#include "wf/waveform.h"
+#include "wf/profile.h"
+#include "waveform/context.h"
+#include "waveform/actor.h"
+#include "waveform/trace.h"
+
+#define TRACE_HEADER "# libwaveform trace 1"
+
+WfTrace* wf_trace_recording = NULL;
+
+static struct {
+	WaveformContext* context;
+	GHashTable*      actors;  // WaveformActor -> index + 1
+} recorder;
+
+static const char* type_names[] = {"zoom", "scale", "start", "region", "rect", "vzoom"};
+static const int n_values[] = {1, 1, 1, 2, 4, 1};
+
+G_STATIC_ASSERT(G_N_ELEMENTS(type_names) == WF_TRACE_N_TYPES);
+
+
+WfTrace*
+wf_trace_new ()
+{
+	return WF_NEW(WfTrace,
+		.events = g_array_new(false, true, sizeof(WfTraceEvent)),
+		.actors = g_ptr_array_new_with_free_func(g_free),
+		.start_time = g_get_monotonic_time()
+	);
+}
+
+
+void
+wf_trace_free (WfTrace* trace)
+{
+	g_return_if_fail(trace);
+
+	g_array_free(trace->events, true);
+	g_ptr_array_free(trace->actors, true);
+	g_free(trace);
+}
+
+
+/*
+ *  Start recording the calls made to the context and to its actors.
+ *  Only one context can be recorded at a time.
+ */
+void
+wf_trace_start (WaveformContext* wfc)
+{
+	g_return_if_fail(wfc);
+
+	if (wf_trace_recording) {
+		pwarn("already recording");
+		wf_trace_free(wf_trace_stop());
+	}
+
+	recorder.context = wfc;
+	recorder.actors = g_hash_table_new(g_direct_hash, g_direct_equal);
+	wf_trace_recording = wf_trace_new();
+}
+
+
+/*
+ *  Returns the recorded trace which the caller must free.
+ */
+WfTrace*
+wf_trace_stop ()
+{
+	g_return_val_if_fail(wf_trace_recording, NULL);
+
+	g_clear_pointer(&recorder.actors, g_hash_table_destroy);
+	recorder.context = NULL;
+
+	return g_steal_pointer(&wf_trace_recording);
+}
+
+
+void
+wf_trace_add (WaveformContext* wfc, WaveformActor* a, WfTraceEvent* event)
+{
+	if (wfc != recorder.context) return;
+
+	event->time = g_get_monotonic_time() - wf_trace_recording->start_time;
+	event->actor = -1;
+
+	if (a) {
+		int index = GPOINTER_TO_INT(g_hash_table_lookup(recorder.actors, a)) - 1;
+		if (index < 0) {
+			index = wf_trace_recording->actors->len;
+			g_ptr_array_add(wf_trace_recording->actors, g_strdup(a->waveform ? a->waveform->filename : ""));
+			g_hash_table_insert(recorder.actors, a, GINT_TO_POINTER(index + 1));
+		}
+		event->actor = index;
+	}
+
+	g_array_append_vals(wf_trace_recording->events, event, 1);
+}
+
+
+bool
+wf_trace_save (WfTrace* trace, const char* filename, GError** error)
+{
+	g_return_val_if_fail(trace && filename, false);
+
+	GString* s = g_string_new(TRACE_HEADER "\n");
+
+	for (int i=0;i<trace->actors->len;i++) {
+		g_string_append_printf(s, "actor %i %s\n", i, (char*)g_ptr_array_index(trace->actors, i));
+	}
+
+	for (int i=0;i<trace->events->len;i++) {
+		WfTraceEvent* event = &g_array_index(trace->events, WfTraceEvent, i);
+
+		g_string_append_printf(s, "%"G_GINT64_FORMAT" %s %i", event->time, type_names[event->type], event->actor);
+
+		char value[G_ASCII_DTOSTR_BUF_SIZE];
+		switch (event->type) {
+			case WF_TRACE_START:
+				g_string_append_printf(s, " %"G_GINT64_FORMAT, event->frame);
+				break;
+			case WF_TRACE_REGION:
+				g_string_append_printf(s, " %"G_GINT64_FORMAT" %"G_GINT64_FORMAT, event->region.start, event->region.len);
+				break;
+			case WF_TRACE_RECT:
+				for (int v=0;v<4;v++) {
+					g_string_append_printf(s, " %s", g_ascii_formatd(value, sizeof(value), "%.9g", ((float*)&event->rect)[v]));
+				}
+				break;
+			default:
+				g_string_append_printf(s, " %s", g_ascii_formatd(value, sizeof(value), "%.9g", event->f));
+				break;
+		}
+		g_string_append_c(s, '\n');
+	}
+
+	bool ok = g_file_set_contents(filename, s->str, s->len, error);
+	g_string_free(s, true);
+
+	return ok;
+}
+
+
+static bool
+parse_event (char** fields, WfTraceEvent* event)
+{
+	int n_fields = g_strv_length(fields);
+	if (n_fields < 3) return false;
+
+	int type = 0;
+	for (;type<WF_TRACE_N_TYPES;type++) {
+		if (!strcmp(fields[1], type_names[type])) break;
+	}
+	if (type == WF_TRACE_N_TYPES || n_fields != 3 + n_values[type]) return false;
+
+	char* end;
+	*event = (WfTraceEvent){
+		.time = g_ascii_strtoll(fields[0], &end, 10),
+		.type = type,
+		.actor = g_ascii_strtoll(fields[2], NULL, 10),
+	};
+	if (*end) return false;
+
+	char** values = fields + 3;
+	switch (type) {
+		case WF_TRACE_START:
+			event->frame = g_ascii_strtoll(values[0], &end, 10);
+			break;
+		case WF_TRACE_REGION:
+			event->region = (WfSampleRegion){
+				.start = g_ascii_strtoll(values[0], NULL, 10),
+				.len = g_ascii_strtoll(values[1], &end, 10)
+			};
+			break;
+		case WF_TRACE_RECT:
+			for (int v=0;v<4;v++) {
+				((float*)&event->rect)[v] = g_ascii_strtod(values[v], &end);
+			}
+			break;
+		default:
+			event->f = g_ascii_strtod(values[0], &end);
+			break;
+	}
+
+	return !*end && (type > WF_TRACE_START) == (event->actor >= 0);
+}
+
+
+WfTrace*
+wf_trace_load (const char* filename, GError** error)
+{
+	g_return_val_if_fail(filename, NULL);
+
+	g_autofree char* contents = NULL;
+	if (!g_file_get_contents(filename, &contents, NULL, error)) return NULL;
+
+	if (!g_str_has_prefix(contents, TRACE_HEADER)) {
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s: not a trace file", filename);
+		return NULL;
+	}
+
+	WfTrace* trace = wf_trace_new();
+	trace->start_time = 0;
+
+	g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+	for (int i=1;lines[i];i++) {
+		char* line = lines[i];
+		if (!*line || *line == '#') continue;
+
+		bool ok;
+		if (g_str_has_prefix(line, "actor ")) {
+			char* name = strchr(line + 6, ' ');
+			ok = name && g_ascii_strtoll(line + 6, NULL, 10) == trace->actors->len;
+			if (ok) g_ptr_array_add(trace->actors, g_strdup(name + 1));
+		} else {
+			g_auto(GStrv) fields = g_strsplit(line, " ", -1);
+			WfTraceEvent event;
+			ok = parse_event(fields, &event) && event.actor < (int)trace->actors->len;
+			if (ok) g_array_append_val(trace->events, event);
+		}
+
+		if (!ok) {
+			g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s:%i: invalid line", filename, i + 1);
+			wf_trace_free(trace);
+			return NULL;
+		}
+	}
+
+	return trace;
+}
+
+
+static void
+trace_apply (WaveformContext* wfc, WaveformActor* a, WfTraceEvent* event)
+{
+	// the setters can modify their arguments so copies are passed
+
+	switch (event->type) {
+		case WF_TRACE_ZOOM:
+			wf_context_set_zoom(wfc, event->f);
+			break;
+		case WF_TRACE_SCALE:
+			wf_context_set_scale(wfc, event->f);
+			break;
+		case WF_TRACE_START:
+			wf_context_set_start(wfc, event->frame);
+			break;
+		case WF_TRACE_REGION:
+			wf_actor_set_region(a, &(WfSampleRegion){event->region.start, event->region.len});
+			break;
+		case WF_TRACE_RECT:
+			wf_actor_set_rect(a, &(WfRectangle){event->rect.left, event->rect.top, event->rect.len, event->rect.height});
+			break;
+		case WF_TRACE_VZOOM:
+			wf_actor_set_vzoom(a, event->f);
+			break;
+		default:
+			break;
+	}
+}
+
+
+/*
+ *  Replay the trace against the context. @actors are the actors of the
+ *  context in the order given by trace->actors. The context must have a root.
+ *
+ *  A frame is produced every @frame_interval usecs of trace time until all the
+ *  events have been applied. For each frame the events are applied and then
+ *  @paint is called, which should draw the scene or do equivalent work.
+ *
+ *  Returns an array of WfTraceFrame which the caller must free. The profile
+ *  stats of each frame are only set if profiling is enabled.
+ */
+GArray*
+wf_trace_replay (WfTrace* trace, WaveformContext* wfc, WaveformActor** actors, int n_actors, int64_t frame_interval, WfTracePaintFn paint, gpointer user_data)
+{
+	g_return_val_if_fail(trace && wfc && wfc->root && frame_interval > 0, NULL);
+
+	AGlScene* scene = wfc->root->root;
+	bool animations = scene->enable_animations;
+	scene->enable_animations = false;
+
+	// the replayed calls are not recorded
+	WfTrace* recording = g_steal_pointer(&wf_trace_recording);
+
+	GArray* frames = g_array_new(false, true, sizeof(WfTraceFrame));
+	int n_skipped = 0;
+
+	wf_profile_frame_end(); // so that the first frame does not include earlier activity
+
+	int e = 0;
+	for (int64_t t=0;e<trace->events->len;t+=frame_interval) {
+		int64_t t0 = g_get_monotonic_time();
+
+		WfTraceFrame frame = {.time = t};
+		for (;e<trace->events->len;e++) {
+			WfTraceEvent* event = &g_array_index(trace->events, WfTraceEvent, e);
+			if (event->time > t) break;
+
+			WaveformActor* a = NULL;
+			if (event->actor >= 0) {
+				if (event->actor >= n_actors || !actors[event->actor]) {
+					n_skipped++;
+					continue;
+				}
+				a = actors[event->actor];
+			}
+			trace_apply(wfc, a, event);
+			frame.n_events++;
+		}
+
+		if (paint) paint(wfc, user_data);
+
+		frame.duration = g_get_monotonic_time() - t0;
+		if (wf_profile_enabled) {
+			wf_profile_frame_end();
+			frame.stats = *wf_profile_get_frame(0);
+		}
+
+		g_array_append_val(frames, frame);
+	}
+
+	if (n_skipped) pwarn("%i events skipped for missing actors", n_skipped);
+
+	wf_trace_recording = recording;
+	scene->enable_animations = animations;
+
+	return frames;
+}
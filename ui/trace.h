@@ -0,0 +1,74 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of the Ayyi project. https://www.ayyi.org          |
+ | copyright (C) 2025-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include "wf/profile.h"
+#include "waveform/actor.h"
+
+typedef enum {
+	WF_TRACE_ZOOM = 0,   // wf_context_set_zoom
+	WF_TRACE_SCALE,      // wf_context_set_scale
+	WF_TRACE_START,      // wf_context_set_start
+	WF_TRACE_REGION,     // wf_actor_set_region
+	WF_TRACE_RECT,       // wf_actor_set_rect
+	WF_TRACE_VZOOM,      // wf_actor_set_vzoom
+	WF_TRACE_N_TYPES
+} WfTraceType;
+
+typedef struct {
+	int64_t          time;       // usecs since the start of the recording
+	WfTraceType      type;
+	int              actor;      // index into WfTrace.actors, or -1 for the context
+	union {
+		double         f;        // zoom, scale, vzoom
+		int64_t        frame;    // start
+		WfSampleRegion region;
+		WfRectangle    rect;
+	};
+} WfTraceEvent;
+
+typedef struct {
+	GArray*          events;     // WfTraceEvent
+	GPtrArray*       actors;     // the filename of the Waveform of each actor, in the order first seen
+	int64_t          start_time;
+} WfTrace;
+
+typedef struct {
+	int64_t          time;       // position in the trace, usecs
+	int              n_events;   // number of events applied before the frame
+	int64_t          duration;   // usecs taken to apply the events and paint the frame
+	WfFrameStats     stats;
+} WfTraceFrame;
+
+typedef void (*WfTracePaintFn) (WaveformContext*, gpointer);
+
+WfTrace*        wf_trace_new           ();
+void            wf_trace_free          (WfTrace*);
+void            wf_trace_start         (WaveformContext*);
+WfTrace*        wf_trace_stop          ();
+bool            wf_trace_save          (WfTrace*, const char* filename, GError**);
+WfTrace*        wf_trace_load          (const char* filename, GError**);
+GArray*         wf_trace_replay        (WfTrace*, WaveformContext*, WaveformActor**, int n_actors, int64_t frame_interval, WfTracePaintFn, gpointer);
+
+#ifdef __wf_private__
+extern WfTrace* wf_trace_recording;
+
+void            wf_trace_add           (WaveformContext*, WaveformActor*, WfTraceEvent*);
+
+#define WF_TRACE(WFC, ACTOR, ...) G_STMT_START{ if (wf_trace_recording) wf_trace_add(WFC, ACTOR, &(WfTraceEvent){__VA_ARGS__}); }G_STMT_END
+#endif
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (WfTrace, wf_trace_free)
@@ -23,6 +23,7 @@
 #include "agl/actor.h"
 #include "wf/debug.h"
 #include "wf/waveform.h"
+#include "wf/profile.h"
 #define __wf_canvas_priv__
 #include "ui/context.h"
 #include "ui/pixbuf.h"
@@ -207,6 +208,8 @@ wf_load_texture_from_alphabuf (WaveformContext* wfc, int texture_name, AlphaBuf*
 		int width = agl->have & AGL_HAVE_NPOT_TEXTURES ? alphabuf->width : alphabuf->height;
 		dbg (2, "copying texture... width=%i texture_id=%u", width, texture_name);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA8, width, alphabuf->height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, alphabuf->buf);
+		WF_PROFILE_ADD(texture_binds, 1);
+		WF_PROFILE_ADD(bytes_uploaded, width * alphabuf->height);
 
 #ifdef USE_MIPMAPPING
 		{
@@ -215,6 +218,7 @@ wf_load_texture_from_alphabuf (WaveformContext* wfc, int texture_name, AlphaBuf*
 				int width = (agl->have & AGL_HAVE_NPOT_TEXTURES ? alphabuf->width : alphabuf->height) / (1<<l);
 				int width = alphabuf->height / (1<<l);
 				glTexImage2D(GL_TEXTURE_2D, l, GL_ALPHA8, width, alphabuf->height/(1<<l), 0, GL_ALPHA, GL_UNSIGNED_BYTE, buf);
+				WF_PROFILE_ADD(bytes_uploaded, width * (alphabuf->height/(1<<l)));
 				wf_free(buf);
 				int w = alphabuf->width / (1<<l);
 				int h = alphabuf->height / (1<<l);
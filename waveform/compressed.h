@@ -0,0 +1 @@
+../wf/compressed.h
\ No newline at end of file
@@ -0,0 +1 @@
+../wf/diskcache.h
\ No newline at end of file
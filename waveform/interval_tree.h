@@ -0,0 +1 @@
+../ui/interval_tree.h
\ No newline at end of file
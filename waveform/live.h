@@ -0,0 +1 @@
+../wf/live.h
\ No newline at end of file
@@ -0,0 +1 @@
+../wf/pool.h
\ No newline at end of file
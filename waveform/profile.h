@@ -0,0 +1 @@
+../wf/profile.h
\ No newline at end of file
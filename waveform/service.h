@@ -0,0 +1 @@
+../wf/service.h
\ No newline at end of file
@@ -0,0 +1 @@
+../wf/spectrogram.h
\ No newline at end of file
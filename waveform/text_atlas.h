@@ -0,0 +1 @@
+../ui/text_atlas.h
\ No newline at end of file
@@ -0,0 +1 @@
+../ui/trace.h
\ No newline at end of file
@@ -26,6 +26,12 @@
 #define __wf_worker_private__
 #include "wf/worker.h"
 #include "wf/audio.h"
+#include "wf/pool.h"
+#include "wf/audiomap.h"
+#include "wf/compressed.h"
+#include "wf/diskcache.h"
+#include "wf/service.h"
+#include "wf/profile.h"
 
 typedef struct {
 	int              block_num;
@@ -34,29 +40,68 @@ typedef struct {
 	    WfBuf16*     buf16;
 	    Peakbuf*     peakbuf;
 	}                out;
+	bool             zero_copy;     // buf16 points into the file mapping
 	WfAudioCallback  done;
 	gpointer         user_data;
+	GArray*          waiters;       // WfAudioWaiter - later requests for the same block
+
+	// the file is copied from the Waveform when the job is queued, as the file can be changed while the job is running
+	int              generation;
+	char*            filename;
+	int              n_channels;
+	bool             is_split;
+	WfAudioMap*      map;
+	char*            disk_key;
 } PeakbufQueueItem;
 
+typedef struct {
+	WfAudioCallback  done;
+	gpointer         user_data;
+} WfAudioWaiter;
+
+typedef struct {
+	WfAudioBlock*    block;         // keeps the audio valid after the block is evicted
+	int              generation;
+} CompressJob;
+
 #define MAX_AUDIO_CACHE_SIZE (1 << 23) // words, NOT bytes.
 
 static void        audio_cache_insert (Waveform*, WfBuf16*, int);
 static void        audio_cache_free   (Waveform*, int block);
+static void        audio_compress_evicted (Waveform*, int block);
+static void        audio_block_publish   (Waveform*, int block, WfBuf16*, bool zero_copy);
+static WfAudioBlock* audio_block_unpublish (Waveform*, int block);
 #if 0
 static void        audio_cache_print  ();
 #endif
 
+/*
+ *  Snapshots of the audio blocks are published for other threads under one of
+ *  a set of locks chosen by Waveform and block, so that readers of different
+ *  blocks do not contend with each other or with the main thread.
+ */
+#define N_BLOCK_LOCKS 16
+static GMutex block_locks[N_BLOCK_LOCKS];
+#define BLOCK_LOCK(W, B) (&block_locks[((guintptr)(W) / sizeof(gpointer) + (B)) % N_BLOCK_LOCKS])
+
+static void block_locks_lock   ();
+static void block_locks_unlock ();
+
 static WF* wf = NULL;
 
 
+/*
+ *  Free the cached blocks of the Waveform.
+ *  The file mapping is kept so that blocks can be reloaded.
+ */
 void
-waveform_audio_free (Waveform* waveform)
+waveform_audio_free_blocks (Waveform* waveform)
 {
-	PF;
 	g_return_if_fail(waveform);
 
 	WfAudioData* audio = &waveform->priv->audio;
-	if(audio && audio->buf16){
+	if(audio->buf16){
+		wf = wf_get_instance(); // a live Waveform can have blocks without having loaded any
 		int b; for(b=0;b<audio->n_blocks;b++){
 			WfBuf16* buf16 = audio->buf16[b];
 			if(buf16){
@@ -65,30 +110,83 @@ waveform_audio_free (Waveform* waveform)
 		}
 		g_free0(audio->buf16);
 	}
+	if(audio->blocks){
+		// readers look up the array while holding a block lock, so it can only be removed while holding all of them
+		block_locks_lock();
+		WfAudioBlock** blocks = audio->blocks;
+		int n_published = audio->n_published;
+		audio->blocks = NULL;
+		audio->n_published = 0;
+		block_locks_unlock();
+
+		for(int b=0;b<n_published;b++) wf_audio_block_unref(blocks[b]);
+		g_free(blocks);
+	}
+	wf_compressed_cache_remove(waveform);
+
+	// the pending notification must not announce blocks that no longer exist
+	if(audio->ready) g_array_set_size(audio->ready, 0);
+}
+
+
+void
+waveform_audio_free (Waveform* waveform)
+{
+	PF;
+	g_return_if_fail(waveform);
+
+	WfAudioData* audio = &waveform->priv->audio;
+
+	waveform_audio_free_blocks(waveform);
+
+	wf_audio_map_unref(audio->map);
+	audio->map = NULL;
+	g_free0(audio->disk_key);
+	audio->map_tried = false;
+}
+
+
+/*
+ *  Uncompressed files are mapped so that blocks can be read without the decoder.
+ *  Other files are identified for use with the disk cache.
+ *  This is done in the main thread as the worker is not permitted to modify the Waveform.
+ */
+static void
+waveform_audio_map_ensure (Waveform* waveform)
+{
+	WfAudioData* audio = &waveform->priv->audio;
+
+	if(!audio->map_tried){
+		audio->map_tried = true;
+		if(waveform->filename && !waveform->is_split && !waveform->offline){
+			audio->map = wf_audio_map_new(waveform->filename);
+		}
+		if(waveform->filename && !audio->map && !waveform->offline){
+			audio->disk_key = wf_disk_cache_key(waveform->filename);
+		}
+	}
 }
 
 
 /*
  *  Load a single audio block for the case where the audio is on a local filesystem.
- *  For thread-safety, the Waveform is not modified.
+ *  For thread-safety, the Waveform is not accessed.
  *  Usually called by a worker. Not intended to be used directly.
  */
 static bool
-waveform_load_audio_block (Waveform* waveform, WfBuf16* buf16, int block_num)
+waveform_load_audio_block (const char* filename, int n_chans, WfBuf16* buf16, int block_num)
 {
-	g_return_val_if_fail(waveform, false);
+	g_return_val_if_fail(filename, false); // live Waveforms hold all their blocks
 	g_return_val_if_fail(buf16 && buf16->buf[WF_LEFT], false);
+	g_return_val_if_fail(n_chans, false);
 
 	uint64_t start_pos = block_num * (WF_PEAK_BLOCK_SIZE - 2.0 * TEX_BORDER * 256.0);
 
-	int n_chans = waveform_get_n_channels(waveform);
-	g_return_val_if_fail(n_chans, false);
-
 	// TODO hold this open for subsequent blocks so we dont have to seek
 	WfDecoder f = {{0,}};
 
-	if(!ad_open(&f, waveform->filename)){
-		pwarn ("not able to open input file %s.", waveform->filename);
+	if(!ad_open(&f, filename)){
+		pwarn ("not able to open input file %s.", filename);
 		return false;
 	}
 
@@ -157,38 +255,10 @@ waveform_load_audio_block (Waveform* waveform, WfBuf16* buf16, int block_num)
 	}
 #endif
 
-	ad_read_short(&f, buf16);
-
-//#warning FIXME split files
-	if(waveform->is_split){
-		switch(n_chans){
-			case WF_MONO:
-				;bool is_float = f.info.bit_depth == 4;//f.codec_context->sample_fmt == AV_SAMPLE_FMT_FLT || f.codec_context->sample_fmt == AV_SAMPLE_FMT_FLTP;
-				if(is_float){
-					dbg(2, "is_split! file=%s", waveform->filename);
-					char rhs[256];
-					if(wf_get_filename_for_other_channel(waveform->filename, rhs, 256)){
-						dbg(3, "  %s", rhs);
-
-						ad_close(&f);
-						if(!ad_open(&f, rhs)){
-							pwarn ("not able to open input file %s.", rhs);
-							return false;
-						}
-						ad_seek(&f, start_pos);
-
-#if 0
-						ff_read_short(f.d, buf16, WF_RIGHT, n_frames);
-#else
-						// we want to write to WF_RIGHT here but are overwriting WF_LEFT
-						ad_read_short(&f, buf16);
-#endif
-					}
-				}
-				break;
-			case WF_STEREO:
-				break;
-		}
+	// the buffer is not initialised so the remainder must be cleared at the end of the file
+	ssize_t n_read = MAX(0, ad_read_short(&f, buf16));
+	for(int c=0;c<n_chans;c++){
+		memset(buf16->buf[c] + n_read, 0, (buf16->size - n_read) * sizeof(short));
 	}
 
 	ad_close(&f);
@@ -217,28 +287,79 @@ static void
 waveform_load_audio_run_job (Waveform* waveform, gpointer _pjob)
 {
 	// Runs in the worker thread.
-	// Does not modify the waveform
-	// (though it does insert into the wf->audio.cache hash table)
+	// The file properties are taken from the job, not the waveform, which the main thread can change
 
 	PeakbufQueueItem* pjob = _pjob;
 	if(!waveform) return;
+	if(pjob->generation != g_atomic_int_get(&waveform->priv->audio.generation)) return; // the file has been changed. the result would be dropped.
 
 	pjob->out.buf16 = WF_NEW(WfBuf16,
 		.size = WF_PEAK_BLOCK_SIZE
 	);
-	for(int c=0;c<waveform_get_n_channels(waveform);c++){
-		pjob->out.buf16->buf[c] = g_malloc0(sizeof(short) * WF_PEAK_BLOCK_SIZE);
-		pjob->out.buf16->stamp = ++wf->audio.access_counter;
-	}
+	wf_audio_touch(pjob->out.buf16);
 	pjob->out.peakbuf = WF_NEW(Peakbuf, .block_num = pjob->block_num);
 	pjob->out.peakbuf->size = pjob->out.buf16->size * WF_PEAK_VALUES_PER_SAMPLE / IO_RATIO;
 
 	dbg(1, "block=%i tot_audio_mem=%ukB", pjob->block_num, wf->audio.mem_size / 1024);
 
-	if(waveform_load_audio_block(waveform, pjob->out.buf16, pjob->block_num)){
+	int n_chans = pjob->n_channels;
 
+	WfAudioMap* map = pjob->map;
+	const char* disk_key = pjob->disk_key;
+	if(map){
+		uint64_t start_pos = pjob->block_num * (WF_PEAK_BLOCK_SIZE - 2.0 * TEX_BORDER * 256.0);
+		if(wf_audio_map_load_block(map, pjob->out.buf16, start_pos, n_chans, &pjob->zero_copy)){
+#ifdef WF_DEBUG
+			pjob->out.buf16->start_frame = start_pos;
+#endif
+			waveform_peakbuf_regen(waveform, pjob->out.buf16, pjob->out.peakbuf, pjob->block_num, pjob->min_output_tiers);
+			return;
+		}
+	}else if(
+		// uncompressed files are already shared between processes by the mapping, other formats are decoded by the service if available
+		(wf_service_is_connected() && !pjob->is_split && wf_service_load_block(pjob->filename, pjob->out.buf16, pjob->block_num)) ||
+		wf_compressed_cache_take(waveform, pjob->block_num, pjob->out.buf16, n_chans, pjob->generation) ||
+		(disk_key && wf_disk_cache_read(disk_key, pjob->block_num, pjob->out.buf16, n_chans))
+	){
 		waveform_peakbuf_regen(waveform, pjob->out.buf16, pjob->out.peakbuf, pjob->block_num, pjob->min_output_tiers);
+		return;
+	}
+
+	for(int c=0;c<n_chans;c++){
+		pjob->out.buf16->buf[c] = wf_pool_alloc(sizeof(short) * WF_PEAK_BLOCK_SIZE);
 	}
+
+	if(waveform_load_audio_block(pjob->filename, n_chans, pjob->out.buf16, pjob->block_num)){
+		if(disk_key) wf_disk_cache_write(disk_key, pjob->block_num, pjob->out.buf16, n_chans);
+
+		waveform_peakbuf_regen(waveform, pjob->out.buf16, pjob->out.peakbuf, pjob->block_num, pjob->min_output_tiers);
+	}else{
+		for(int c=0;c<WF_STEREO;c++){
+			if(pjob->out.buf16->buf[c]) memset(pjob->out.buf16->buf[c], 0, sizeof(short) * pjob->out.buf16->size);
+		}
+	}
+}
+
+
+/*
+ *  Blocks that complete in the same main loop iteration are announced together
+ *  so that the ui can handle them with a single redraw.
+ */
+static gboolean
+waveform_audio_notify_ready (gpointer _waveform)
+{
+	Waveform* waveform = _waveform;
+	WfAudioData* audio = &waveform->priv->audio;
+
+	GArray* blocks = audio->ready;
+	audio->ready = NULL;
+
+	if (blocks->len) g_signal_emit_by_name(waveform, "blocks-ready", blocks);
+
+	g_array_free(blocks, true);
+	g_object_unref(waveform);
+
+	return G_SOURCE_REMOVE;
 }
 
 
@@ -249,10 +370,16 @@ waveform_load_audio_post (Waveform* waveform, GError* error, gpointer _pjob)
 
 	PeakbufQueueItem* pjob = _pjob;
 
-	if (waveform) {
+	if (!waveform) return; // the result is freed with the job
+
+	WfAudioData* audio = &waveform->priv->audio;
+
+	// if the file has been changed the result is dropped, but the callers are still notified
+	if (pjob->generation == audio->generation) {
+		if (!audio->buf16) audio->buf16 = g_malloc0(sizeof(void*) * waveform_get_n_audio_blocks(waveform));
+
 		audio_cache_insert(waveform, pjob->out.buf16, pjob->block_num);
 
-		WfAudioData* audio = &waveform->priv->audio;
 		GPtrArray* peaks = waveform->priv->hires_peaks;
 		if (audio->buf16[pjob->block_num]) {
 			// this is unexpected. If the data is obsolete, it should probably be cleared imediately.
@@ -260,23 +387,81 @@ waveform_load_audio_post (Waveform* waveform, GError* error, gpointer _pjob)
 			audio_cache_free(waveform, pjob->block_num);
 		}
 		audio->buf16[pjob->block_num] = pjob->out.buf16;
+		audio_block_publish(waveform, pjob->block_num, pjob->out.buf16, pjob->zero_copy);
 
 		g_assert(!peaks->pdata || pjob->block_num >= peaks->len || !peaks->pdata[pjob->block_num]);
 		waveform_peakbuf_assign(waveform, pjob->block_num, pjob->out.peakbuf);
 
-		if (pjob->done) pjob->done(waveform, pjob->block_num, pjob->user_data);
+		// the result is now owned by the waveform
+		pjob->out.buf16 = NULL;
+		pjob->out.peakbuf = NULL;
+	}
+
+	if (pjob->done) pjob->done(waveform, pjob->block_num, pjob->user_data);
+	if (pjob->waiters) {
+		for (int i=0;i<pjob->waiters->len;i++) {
+			WfAudioWaiter* waiter = &g_array_index(pjob->waiters, WfAudioWaiter, i);
+			waiter->done(waveform, pjob->block_num, waiter->user_data);
+		}
+	}
+
+	if (pjob->generation == audio->generation) {
 		dbg(2, "--->");
 		g_signal_emit_by_name(waveform, "hires-ready", pjob->block_num);
 
-	} else {
-		if (pjob->out.buf16) {
-			for (int c=0;c<2;c++) {
-				if (pjob->out.buf16->buf[c])
-					wf_free0(pjob->out.buf16->buf[c]);
+		if (!audio->ready) {
+			audio->ready = g_array_new(false, false, sizeof(int));
+			g_idle_add_full(G_PRIORITY_HIGH_IDLE, waveform_audio_notify_ready, g_object_ref(waveform), NULL);
+		}
+		g_array_append_val(audio->ready, pjob->block_num);
+	}
+}
+
+
+static PeakbufQueueItem*
+peakbuf_queue_item_new (Waveform* waveform, int block_num, int min_output_tiers, WfAudioCallback done, gpointer user_data)
+{
+	WfAudioData* audio = &waveform->priv->audio;
+
+	return WF_NEW(PeakbufQueueItem,
+		.block_num = block_num,
+		.min_output_tiers = min_output_tiers,
+		.done = done,
+		.user_data = user_data,
+		.generation = audio->generation,
+		.filename = g_strdup(waveform->filename),
+		.n_channels = waveform_get_n_channels(waveform),
+		.is_split = waveform->is_split,
+		.map = wf_audio_map_ref(audio->map),
+		.disk_key = g_strdup(audio->disk_key)
+	);
+}
+
+
+/*
+ *  A result that was not taken by the Waveform, because it was finalized,
+ *  the file was changed, or the job was cancelled, is freed here.
+ */
+static void
+peakbuf_queue_item_free (gpointer _pjob)
+{
+	PeakbufQueueItem* pjob = _pjob;
+
+	if (pjob->out.buf16) {
+		for (int c=pjob->zero_copy ? WF_RIGHT : WF_LEFT;c<2;c++) {
+			if (pjob->out.buf16->buf[c] && !wf_service_release(pjob->out.buf16->buf[c])) {
+				wf_pool_free(pjob->out.buf16->buf[c], sizeof(short) * pjob->out.buf16->size);
 			}
-			wf_free0(pjob->out.buf16);
 		}
+		wf_free0(pjob->out.buf16);
 	}
+	waveform_peakbuf_free(pjob->out.peakbuf);
+
+	if (pjob->waiters) g_array_free(pjob->waiters, true);
+	wf_audio_map_unref(pjob->map);
+	g_free(pjob->disk_key);
+	g_free(pjob->filename);
+	wf_free(pjob);
 }
 
 
@@ -296,6 +481,9 @@ waveform_load_audio_post (Waveform* waveform, GError* error, gpointer _pjob)
  * -requests should be done sequentially to avoid this so that processing can be
  *  completed before it is purged.
  *
+ * @done is called exactly once for each request, including when the block is
+ * out of range or is already being loaded for another caller.
+ *
  */
 void
 waveform_load_audio (Waveform* waveform, int block_num, int n_tiers_needed, WfAudioCallback done, gpointer user_data)
@@ -306,24 +494,32 @@ waveform_load_audio (Waveform* waveform, int block_num, int n_tiers_needed, WfAu
 	// TODO should use same api as g_file_read_async ? uses GAsyncReadyCallback
 
 	PF2;
-	g_return_if_fail(block_num < waveform_get_n_audio_blocks(waveform));
+	if(block_num < 0 || block_num >= waveform_get_n_audio_blocks(waveform)){
+		pwarn("block out of range: %i", block_num);
+		if(done) done(waveform, block_num, user_data);
+		return;
+	}
 	WfAudioData* audio = &waveform->priv->audio;
 	wf = wf_get_instance();
 
 	if(audio->buf16){
 		WfBuf16* buf = audio->buf16[block_num];
 		if(buf){
-			buf->stamp = ++wf->audio.access_counter;
+			wf_audio_touch(buf);
+			WF_PROFILE_ADD(audio_cache_hits, 1);
 			if(done) done(waveform, block_num, user_data);
 			return;
 		}
 	}
+	WF_PROFILE_ADD(audio_cache_misses, 1);
 
 	audio->n_tiers_present = MAX_TIERS;
 
+	waveform_audio_map_ensure(waveform);
+
 	if(!wf->audio_worker.msg_queue) wf_worker_init(&wf->audio_worker);
 
-	bool is_queued(Waveform* waveform, int block_num)
+	PeakbufQueueItem* is_queued(Waveform* waveform, int block_num)
 	{
 		GList* l = wf->audio_worker.jobs;
 		for(;l;l=l->next){
@@ -332,17 +528,17 @@ waveform_load_audio (Waveform* waveform, int block_num, int n_tiers_needed, WfAu
 			PeakbufQueueItem* item = i->user_data;
 			Waveform* w = g_weak_ref_get(&i->ref);
 			if(w){
-				if(w == waveform && item->block_num == block_num){
+				if(w == waveform && item->block_num == block_num && item->generation == waveform->priv->audio.generation){
 					dbg(2, "already queued");
 					// it is possible to get here while zooming in/out fast
 					// or when there are lots of views of the same waveform
 					g_object_unref(w);
-					return true;
+					return item;
 				}
 				g_object_unref(w);
 			}
 		}
-		return false;
+		return NULL;
 	}
 
 	void wf_peakbuf_queue_for_regen (Waveform* waveform, int block_num, int min_output_tiers, WfAudioCallback done, gpointer user_data)
@@ -350,7 +546,15 @@ waveform_load_audio (Waveform* waveform, int block_num, int n_tiers_needed, WfAu
 		dbg(1, "%i", block_num);
 		g_return_if_fail(block_num >= 0);
 
-		if(is_queued(waveform, block_num)) return;
+		PeakbufQueueItem* queued = is_queued(waveform, block_num);
+		if(queued){
+			// the caller is notified when the existing job completes
+			if(done){
+				if(!queued->waiters) queued->waiters = g_array_new(false, false, sizeof(WfAudioWaiter));
+				g_array_append_val(queued->waiters, ((WfAudioWaiter){done, user_data}));
+			}
+			return;
+		}
 
 		WfAudioData* audio = &waveform->priv->audio;
 		if(!audio->buf16) audio->buf16 = g_malloc0(sizeof(void*) * waveform_get_n_audio_blocks(waveform));
@@ -364,13 +568,8 @@ waveform_load_audio (Waveform* waveform, int block_num, int n_tiers_needed, WfAu
 			waveform,
 			waveform_load_audio_run_job,
 			waveform_load_audio_post,
-			wf_free,
-			WF_NEW(PeakbufQueueItem,
-				.done = done,
-				.user_data = user_data,
-				.block_num = block_num,
-				.min_output_tiers = min_output_tiers
-			)
+			peakbuf_queue_item_free,
+			peakbuf_queue_item_new(waveform, block_num, min_output_tiers, done, user_data)
 		);
 	}
 
@@ -390,21 +589,22 @@ waveform_load_audio_sync (Waveform* waveform, int block_num, int n_tiers_needed)
 	if(audio->buf16){
 		WfBuf16* buf = audio->buf16[block_num];
 		if(buf){
-			buf->stamp = ++wf->audio.access_counter;
+			wf_audio_touch(buf);
+			WF_PROFILE_ADD(audio_cache_hits, 1);
 			return;
 		}
 	}
+	WF_PROFILE_ADD(audio_cache_misses, 1);
 
 	audio->n_tiers_present = MAX_TIERS;
 
+	waveform_audio_map_ensure(waveform);
+
 	dbg(1, "%i", block_num);
 
 	if(!audio->buf16) audio->buf16 = g_malloc0(sizeof(void*) * waveform_get_n_audio_blocks(waveform));
 
-	PeakbufQueueItem* item = WF_NEW(PeakbufQueueItem,
-		.block_num = block_num,
-		.min_output_tiers = n_tiers_needed
-	);
+	PeakbufQueueItem* item = peakbuf_queue_item_new(waveform, block_num, n_tiers_needed, NULL, NULL);
 
 	GPtrArray* peaks = waveform->priv->hires_peaks;
 	if(peaks->pdata && peaks->pdata[block_num]) peaks->pdata[block_num] = NULL; // disconnect until job finished
@@ -413,7 +613,7 @@ waveform_load_audio_sync (Waveform* waveform, int block_num, int n_tiers_needed)
 
 	waveform_load_audio_post(waveform, NULL, item);
 
-	wf_free(item);
+	peakbuf_queue_item_free(item);
 }
 
 
@@ -454,7 +654,9 @@ audio_cache_insert (Waveform* w, WfBuf16* buf16, int b)
 		}
 		if (oldest) {
 			dbg(2, "*** cache full: clearing buf with stamp=%i ...", oldest->stamp);
-			audio_cache_free(oldest_waveform, wf_block_lookup_by_audio_buf(oldest_waveform, oldest));
+			int b = wf_block_lookup_by_audio_buf(oldest_waveform, oldest);
+			if (b >= 0 && !oldest_waveform->priv->audio.map) audio_compress_evicted(oldest_waveform, b);
+			audio_cache_free(oldest_waveform, b);
 		}
 		if (wf->audio.mem_size + buf16->size > MAX_AUDIO_CACHE_SIZE) {
 			perr("cant free space in audio cache");
@@ -474,25 +676,234 @@ audio_cache_free (Waveform* w, int block)
 	WfAudioData* audio = &w->priv->audio;
 	WfBuf16* buf16 = audio->buf16[block];
 	if (buf16) {
-		// the cache may already have been cleared if the cache is full
-		if (!g_hash_table_remove(wf->audio.cache, buf16)) dbg(2, "%i: failed to remove waveform block from audio_cache", block);
+		// the cache may already have been cleared if the cache is full.
+		// The blocks of live Waveforms are not in the cache.
+		bool cached = g_hash_table_remove(wf->audio.cache, buf16);
+		if (!cached) dbg(2, "%i: failed to remove waveform block from audio_cache", block);
+
+		// if the block was published, the snapshot owns the audio, which is freed when the last reader releases it
+		WfAudioBlock* snapshot = audio_block_unpublish(w, block);
+
 		if (buf16->buf[WF_LEFT]) {
-			wf->audio.mem_size -= buf16->size;
-			wf_free0(buf16->buf[WF_LEFT]);
+			if (cached) wf->audio.mem_size -= buf16->size;
+			if (!snapshot && !wf_audio_map_contains(audio->map, buf16->buf[WF_LEFT]) && !wf_service_release(buf16->buf[WF_LEFT]))
+				wf_pool_free(buf16->buf[WF_LEFT], sizeof(short) * buf16->size);
+			buf16->buf[WF_LEFT] = NULL;
 		}
 		else { dbg(2, "%i: left buffer empty", block); }
 
 		if (buf16->buf[WF_RIGHT]) {
-			wf->audio.mem_size -= buf16->size;
+			if (cached) wf->audio.mem_size -= buf16->size;
 			dbg(2, "b=%i clearing right...", block);
-			wf_free0(buf16->buf[WF_RIGHT]);
+			if (!snapshot && !wf_service_release(buf16->buf[WF_RIGHT]))
+				wf_pool_free(buf16->buf[WF_RIGHT], sizeof(short) * buf16->size);
+			buf16->buf[WF_RIGHT] = NULL;
 		}
 		wf_free0(audio->buf16[block]);
+		wf_audio_block_unref(snapshot);
 	}
 	//audio_cache_print();
 }
 
 
+static void
+audio_compress_run_job (Waveform* waveform, gpointer _job)
+{
+	// Runs in the worker thread
+
+	CompressJob* job = _job;
+	WfAudioBlock* block = job->block;
+
+	wf_compressed_cache_add(waveform, block->block_num, &(WfBuf16){
+		.buf = {(short*)block->buf[WF_LEFT], (short*)block->buf[WF_RIGHT]},
+		.size = block->size
+	}, job->generation);
+}
+
+
+static void
+audio_compress_job_free (gpointer _job)
+{
+	CompressJob* job = _job;
+
+	wf_audio_block_unref(job->block);
+	g_free(job);
+}
+
+
+/*
+ *  The evicted block is compressed in the audio worker rather than in the main thread.
+ *  The job holds a reference to the published snapshot, so the audio is only
+ *  released once it has been compressed. As the worker runs jobs in order, a
+ *  later request for the same block finds it in the compressed cache.
+ */
+static void
+audio_compress_evicted (Waveform* w, int b)
+{
+	WfAudioBlock* block = waveform_get_audio_block(w, b);
+	if (!block) return;
+
+	if (!wf->audio_worker.msg_queue) wf_worker_init(&wf->audio_worker);
+
+	wf_worker_push_job(
+		&wf->audio_worker,
+		w,
+		audio_compress_run_job,
+		NULL,
+		audio_compress_job_free,
+		WF_NEW(CompressJob,
+			.block = block,
+			.generation = w->priv->audio.generation
+		)
+	);
+}
+
+
+/*
+ *  Mark the block as recently used. Can be called from any thread.
+ */
+void
+wf_audio_touch (WfBuf16* buf)
+{
+	if (!wf) wf = wf_get_instance();
+
+	g_atomic_int_set((gint*)&buf->stamp, g_atomic_int_add(&wf->audio.access_counter, 1) + 1);
+}
+
+
+static void
+block_locks_lock ()
+{
+	for (int i=0;i<N_BLOCK_LOCKS;i++) g_mutex_lock(&block_locks[i]);
+}
+
+
+static void
+block_locks_unlock ()
+{
+	for (int i=N_BLOCK_LOCKS-1;i>=0;i--) g_mutex_unlock(&block_locks[i]);
+}
+
+
+/*
+ *  Make a newly loaded block available to other threads.
+ *  The snapshot takes ownership of the audio buffers.
+ */
+static void
+audio_block_publish (Waveform* w, int b, WfBuf16* buf16, bool zero_copy)
+{
+	WfAudioData* audio = &w->priv->audio;
+
+	if (b >= audio->n_published) {
+		// the array is only replaced in the main thread, and readers hold a block lock while using it
+		int n_blocks = MAX(b + 1, waveform_get_n_audio_blocks(w));
+		block_locks_lock();
+		audio->blocks = g_renew(WfAudioBlock*, audio->blocks, n_blocks);
+		memset(audio->blocks + audio->n_published, 0, sizeof(WfAudioBlock*) * (n_blocks - audio->n_published));
+		audio->n_published = n_blocks;
+		block_locks_unlock();
+	}
+
+	WfAudioBlock* block = WF_NEW(WfAudioBlock,
+		.block_num = b,
+		.size      = buf16->size,
+		.buf       = {buf16->buf[WF_LEFT], buf16->buf[WF_RIGHT]},
+		.ref_count = 1,
+		.zero_copy = zero_copy,
+		.map       = zero_copy ? wf_audio_map_ref(audio->map) : NULL,
+		.cached    = buf16
+	);
+
+	GMutex* lock = BLOCK_LOCK(w, b);
+	g_mutex_lock(lock);
+	WfAudioBlock* old = audio->blocks[b];
+	audio->blocks[b] = block;
+	g_mutex_unlock(lock);
+
+	wf_audio_block_unref(old);
+}
+
+
+/*
+ *  Returns the published snapshot, if any. The caller takes over its reference.
+ */
+static WfAudioBlock*
+audio_block_unpublish (Waveform* w, int b)
+{
+	WfAudioData* audio = &w->priv->audio;
+	if (b >= audio->n_published) return NULL;
+
+	GMutex* lock = BLOCK_LOCK(w, b);
+	g_mutex_lock(lock);
+	WfAudioBlock* block = audio->blocks[b];
+	audio->blocks[b] = NULL;
+	g_mutex_unlock(lock);
+
+	return block;
+}
+
+
+/*
+ *  Get a block of audio that is already loaded, for reading from any thread.
+ *  Returns NULL if the block is not currently in the cache. To load it, use
+ *  waveform_load_audio() in the main thread.
+ *
+ *  The caller must hold a reference to the Waveform, and must release the
+ *  block with wf_audio_block_unref(). The audio is not modified and remains
+ *  valid until then, even if the block is removed from the cache or the
+ *  file is changed.
+ */
+WfAudioBlock*
+waveform_get_audio_block (Waveform* w, int block_num)
+{
+	g_return_val_if_fail(w, NULL);
+	if (block_num < 0) return NULL;
+
+	WfAudioData* audio = &w->priv->audio;
+
+	GMutex* lock = BLOCK_LOCK(w, block_num);
+	g_mutex_lock(lock);
+	WfAudioBlock* block = block_num < audio->n_published ? audio->blocks[block_num] : NULL;
+	if (block) {
+		wf_audio_block_ref(block);
+		wf_audio_touch(block->cached);
+	}
+	g_mutex_unlock(lock);
+
+	return block;
+}
+
+
+WfAudioBlock*
+wf_audio_block_ref (WfAudioBlock* block)
+{
+	g_return_val_if_fail(block, NULL);
+
+	g_atomic_int_inc(&block->ref_count);
+
+	return block;
+}
+
+
+/*
+ *  Can be called from any thread.
+ */
+void
+wf_audio_block_unref (WfAudioBlock* block)
+{
+	if (block && g_atomic_int_dec_and_test(&block->ref_count)) {
+		for (int c=0;c<WF_STEREO;c++) {
+			short* buf = (short*)block->buf[c];
+			if (!buf || (c == WF_LEFT && block->zero_copy)) continue;
+			if (!wf_service_release(buf))
+				wf_pool_free(buf, sizeof(short) * block->size);
+		}
+		wf_audio_map_unref(block->map);
+		g_free(block);
+	}
+}
+
+
 int
 wf_audio_cache_get_size ()
 {
@@ -17,7 +17,8 @@
 #define MAX_TIERS 8 //this is related to WF_PEAK_RATIO: WF_PEAK_RATIO = 2 ^ MAX_TIERS.
 
 #ifdef __wf_private__
-int wf_audio_cache_get_size();
+int  wf_audio_cache_get_size ();
+void wf_audio_touch          (WfBuf16*);
 #endif
 
 #endif
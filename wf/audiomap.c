@@ -0,0 +1,264 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Memory mapped access to uncompressed PCM files.                      |
+ |                                                                      |
+ | For 16 and 24 bit WAV and AIFF files, hi-res audio blocks are read   |
+ | directly from a mapping of the whole file instead of going through   |
+ | the decoder. Full blocks of mono 16 bit little-endian audio are not  |
+ | copied at all - the block buffer points into the mapping. Other      |
+ | layouts are de-interleaved from the mapping into a pool buffer.      |
+ |                                                                      |
+ | Note that, as with any mapping, truncating the file while it is      |
+ | mapped will cause subsequent reads to fault.                         |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define __wf_private__
+
+#include "config.h"
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "wf/debug.h"
+#include "wf/waveform.h"
+#include "wf/pool.h"
+#include "wf/audiomap.h"
+
+#define MAX_CHUNKS 32
+
+struct _WfAudioMap {
+	gint          ref_count;         // audio block snapshots keep the mapping alive
+	void*         addr;
+	size_t        len;
+	const guchar* data;              // the first sample frame
+	uint64_t      n_frames;
+	int           n_channels;
+	int           bytes_per_sample;  // 2 or 3
+	bool          big_endian;
+};
+
+#define LE16(P) ((uint32_t)(P)[0] | (uint32_t)(P)[1] << 8)
+#define LE32(P) ((uint32_t)(P)[0] | (uint32_t)(P)[1] << 8 | (uint32_t)(P)[2] << 16 | (uint32_t)(P)[3] << 24)
+#define BE16(P) ((uint32_t)(P)[0] << 8 | (uint32_t)(P)[1])
+#define BE32(P) ((uint32_t)(P)[0] << 24 | (uint32_t)(P)[1] << 16 | (uint32_t)(P)[2] << 8 | (uint32_t)(P)[3])
+
+
+static bool
+parse_wav (WfAudioMap* map, const guchar* p, const guchar* end)
+{
+	bool have_fmt = false;
+	int bits = 0;
+
+	p += 12;
+	for (int i=0;i<MAX_CHUNKS && p + 8 <= end;i++) {
+		uint32_t size = LE32(p + 4);
+		const guchar* body = p + 8;
+		if (body + size > end) size = end - body; // allow for a truncated data chunk
+
+		if (!memcmp(p, "fmt ", 4) && size >= 16) {
+			int format = LE16(body);
+			if (format == 0xfffe && size >= 40) format = LE16(body + 24); // WAVE_FORMAT_EXTENSIBLE subformat
+			if (format != 1) return false;
+
+			map->n_channels = LE16(body + 2);
+			bits = LE16(body + 14);
+			have_fmt = true;
+		}
+		else if (!memcmp(p, "data", 4)) {
+			if (!have_fmt || (bits != 16 && bits != 24) || !map->n_channels) return false;
+
+			map->bytes_per_sample = bits / 8;
+			map->data = body;
+			map->n_frames = size / (map->n_channels * map->bytes_per_sample);
+			return true;
+		}
+
+		p = body + size + (size & 1);
+	}
+	return false;
+}
+
+
+static bool
+parse_aiff (WfAudioMap* map, const guchar* p, const guchar* end)
+{
+	bool is_aifc = !memcmp(p + 8, "AIFC", 4);
+	bool have_comm = false;
+	int bits = 0;
+
+	p += 12;
+	for (int i=0;i<MAX_CHUNKS && p + 8 <= end;i++) {
+		uint32_t size = BE32(p + 4);
+		const guchar* body = p + 8;
+		if (body + size > end) size = end - body;
+
+		if (!memcmp(p, "COMM", 4) && size >= 18) {
+			map->n_channels = BE16(body);
+			bits = BE16(body + 6);
+			map->big_endian = true;
+			if (is_aifc) {
+				if (size < 22) return false;
+				if (!memcmp(body + 18, "sowt", 4)) map->big_endian = false;
+				else if (memcmp(body + 18, "NONE", 4)) return false;
+			}
+			have_comm = true;
+		}
+		else if (!memcmp(p, "SSND", 4) && size >= 8) {
+			if (!have_comm || (bits != 16 && bits != 24) || !map->n_channels) return false;
+
+			uint32_t offset = BE32(body);
+			if (8 + offset > size) return false;
+
+			map->bytes_per_sample = bits / 8;
+			map->data = body + 8 + offset;
+			map->n_frames = (size - 8 - offset) / (map->n_channels * map->bytes_per_sample);
+			return true;
+		}
+
+		p = body + size + (size & 1);
+	}
+	return false;
+}
+
+
+/*
+ *  Returns NULL if the file is not uncompressed 16 or 24 bit PCM,
+ *  in which case the decoder must be used.
+ */
+WfAudioMap*
+wf_audio_map_new (const char* filename)
+{
+	g_return_val_if_fail(filename, NULL);
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	struct stat info;
+	if (fstat(fd, &info) || info.st_size < 44) {
+		close(fd);
+		return NULL;
+	}
+
+	void* addr = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) return NULL;
+
+	WfAudioMap* map = WF_NEW(WfAudioMap,
+		.ref_count = 1,
+		.addr = addr,
+		.len = info.st_size
+	);
+
+	const guchar* p = addr;
+	const guchar* end = p + info.st_size;
+	bool ok = (!memcmp(p, "RIFF", 4) && !memcmp(p + 8, "WAVE", 4))
+		? parse_wav(map, p, end)
+		: (!memcmp(p, "FORM", 4) && (!memcmp(p + 8, "AIFF", 4) || !memcmp(p + 8, "AIFC", 4)))
+			? parse_aiff(map, p, end)
+			: false;
+
+	if (!ok || !map->n_frames) {
+		wf_audio_map_unref(map);
+		return NULL;
+	}
+
+	dbg(1, "channels=%i bits=%i frames=%"PRIu64" %s", map->n_channels, map->bytes_per_sample * 8, map->n_frames, filename);
+
+	return map;
+}
+
+
+WfAudioMap*
+wf_audio_map_ref (WfAudioMap* map)
+{
+	if (map) g_atomic_int_inc(&map->ref_count);
+	return map;
+}
+
+
+/*
+ *  Can be called from any thread.
+ */
+void
+wf_audio_map_unref (WfAudioMap* map)
+{
+	if (map && g_atomic_int_dec_and_test(&map->ref_count)) {
+		munmap(map->addr, map->len);
+		g_free(map);
+	}
+}
+
+
+bool
+wf_audio_map_contains (WfAudioMap* map, const void* p)
+{
+	return map && (const guchar*)p >= (const guchar*)map->addr && (const guchar*)p < (const guchar*)map->addr + map->len;
+}
+
+
+/*
+ *  Take the most significant 16 bits of each sample for one channel.
+ *  The sample layout is passed in so that the compiler can vectorise a single loop for all formats.
+ */
+static void
+deinterleave (short* restrict out, const guchar* restrict in, int frame_bytes, int hi, int lo, uint64_t n_frames)
+{
+	for (uint64_t i=0;i<n_frames;i++) {
+		const guchar* s = in + i * frame_bytes;
+		out[i] = (short)(s[hi] << 8 | s[lo]);
+	}
+}
+
+
+/*
+ *  Fill @buf with audio starting at @start_frame.
+ *
+ *  If @zero_copy is set on return, buf->buf[WF_LEFT] points into the
+ *  mapping and must not be freed. Otherwise the channel buffers were
+ *  allocated with wf_pool_alloc.
+ *
+ *  Can be called from the worker thread.
+ */
+bool
+wf_audio_map_load_block (WfAudioMap* map, WfBuf16* buf, uint64_t start_frame, int n_chans, bool* zero_copy)
+{
+	*zero_copy = false;
+
+	if (start_frame >= map->n_frames) return false;
+
+	uint64_t n_frames = MIN(buf->size, map->n_frames - start_frame);
+	int bps = map->bytes_per_sample;
+	int frame_bytes = map->n_channels * bps;
+	const guchar* src = map->data + start_frame * frame_bytes;
+
+	if (map->n_channels == 1 && bps == 2 && !map->big_endian && n_frames == buf->size && !((uintptr_t)src & 1)) {
+		buf->buf[WF_LEFT] = (short*)src;
+		*zero_copy = true;
+		return true;
+	}
+
+	int hi = map->big_endian ? 0 : bps - 1;
+	int lo = map->big_endian ? 1 : bps - 2;
+
+	for (int c=0;c<MIN(n_chans, map->n_channels);c++) {
+		buf->buf[c] = wf_pool_alloc(sizeof(short) * buf->size);
+		deinterleave(buf->buf[c], src + c * bps, frame_bytes, hi, lo, n_frames);
+		memset(buf->buf[c] + n_frames, 0, (buf->size - n_frames) * sizeof(short));
+	}
+
+	return true;
+}
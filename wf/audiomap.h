@@ -0,0 +1,25 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#pragma once
+
+#include "wf/waveform.h"
+
+#ifdef __wf_private__
+typedef struct _WfAudioMap WfAudioMap;
+
+WfAudioMap* wf_audio_map_new        (const char* filename);
+WfAudioMap* wf_audio_map_ref        (WfAudioMap*);
+void        wf_audio_map_unref      (WfAudioMap*);
+bool        wf_audio_map_load_block (WfAudioMap*, WfBuf16*, uint64_t start_frame, int n_chans, bool* zero_copy);
+bool        wf_audio_map_contains   (WfAudioMap*, const void*);
+#endif
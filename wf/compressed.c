@@ -0,0 +1,399 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Compressed second tier for the hi-res audio cache.                   |
+ |                                                                      |
+ | When a block is evicted from the audio cache it is compressed and    |
+ | held here so that it can be restored without decoding the file       |
+ | again. Blocks are removed from this cache when restored.             |
+ |                                                                      |
+ | The codec is lossless: each sample is stored as the difference from  |
+ | the previous sample, and each run of 64 differences is bit-packed at |
+ | the width of the largest one. Audio is dominated by low frequency    |
+ | content, so the differences are normally much smaller than the       |
+ | samples, and the fixed width allows decompression without branches.  |
+ |                                                                      |
+ | The cache is disabled by default. It is not used for files that are  |
+ | memory mapped, as those can be read without decoding.                |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define __wf_private__
+
+#include "config.h"
+#include <string.h>
+#include <glib.h>
+#include "wf/debug.h"
+#include "wf/waveform.h"
+#include "wf/pool.h"
+#include "wf/compressed.h"
+
+#define CHUNK_SIZE  64
+#define WIDTH_BITS  5
+
+enum {
+	FORMAT_PACKED = 0,
+	FORMAT_RAW,
+};
+
+typedef struct {
+	Waveform* waveform;
+	int       block;
+	int       generation;    // of the file that the audio was read from
+	int       n_chans;
+	guint     size;          // frames
+	guchar*   data[WF_STEREO];
+	size_t    len[WF_STEREO];
+	GList*    link;          // position in the lru queue
+} Entry;
+
+static struct {
+	GMutex                 mutex;
+	GHashTable*            entries;
+	GQueue                 lru;  // least recently added at the head
+	WfCompressedCacheStats stats;
+} cache;
+
+
+/*
+ *  Bit packing
+ */
+
+typedef struct {
+	guchar*  p;
+	uint64_t acc;
+	int      n;
+} BitWriter;
+
+typedef struct {
+	const guchar* p;
+	const guchar* end;
+	uint64_t      acc;
+	int           n;
+} BitReader;
+
+
+static inline void
+bit_put (BitWriter* w, uint32_t value, int n_bits)
+{
+	w->acc |= (uint64_t)value << w->n;
+	w->n += n_bits;
+	while (w->n >= 8) {
+		*w->p++ = w->acc;
+		w->acc >>= 8;
+		w->n -= 8;
+	}
+}
+
+
+static inline void
+bit_flush (BitWriter* w)
+{
+	if (w->n) *w->p++ = w->acc;
+	w->n = 0;
+}
+
+
+static inline uint32_t
+bit_get (BitReader* r, int n_bits)
+{
+	while (r->n < n_bits) {
+		r->acc |= (uint64_t)(r->p < r->end ? *r->p++ : 0) << r->n;
+		r->n += 8;
+	}
+	uint32_t value = r->acc & ((1u << n_bits) - 1);
+	r->acc >>= n_bits;
+	r->n -= n_bits;
+
+	return value;
+}
+
+
+/*
+ *  @out must have space for WF_COMPRESSED_MAX_SIZE(n_frames) bytes.
+ *  Returns the number of bytes used.
+ */
+size_t
+wf_compress_block (const short* in, int n_frames, guchar* out)
+{
+	BitWriter w = {.p = out + 1};
+	out[0] = FORMAT_PACKED;
+
+	int32_t prev = 0;
+	for (int i=0;i<n_frames;i+=CHUNK_SIZE) {
+		int n = MIN(CHUNK_SIZE, n_frames - i);
+
+		uint32_t zz[CHUNK_SIZE];
+		uint32_t all = 0;
+		for (int j=0;j<n;j++) {
+			int32_t d = in[i + j] - prev;
+			prev = in[i + j];
+			zz[j] = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31); // zigzag so that small negative values have few bits
+			all |= zz[j];
+		}
+
+		int width = all ? 32 - __builtin_clz(all) : 0;
+		bit_put(&w, width, WIDTH_BITS);
+		for (int j=0;j<n;j++) {
+			bit_put(&w, zz[j], width);
+		}
+	}
+	bit_flush(&w);
+
+	size_t len = w.p - out;
+	size_t raw = n_frames * sizeof(short);
+	if (len > raw + 1) {
+		// incompressible, eg white noise
+		out[0] = FORMAT_RAW;
+		memcpy(out + 1, in, raw);
+		len = raw + 1;
+	}
+
+	return len;
+}
+
+
+bool
+wf_decompress_block (const guchar* in, size_t len, short* out, int n_frames)
+{
+	g_return_val_if_fail(len, false);
+
+	if (in[0] == FORMAT_RAW) {
+		g_return_val_if_fail(len == n_frames * sizeof(short) + 1, false);
+		memcpy(out, in + 1, n_frames * sizeof(short));
+		return true;
+	}
+
+	BitReader r = {.p = in + 1, .end = in + len};
+
+	int32_t prev = 0;
+	for (int i=0;i<n_frames;i+=CHUNK_SIZE) {
+		int n = MIN(CHUNK_SIZE, n_frames - i);
+		int width = bit_get(&r, WIDTH_BITS);
+		if (width > 17) return false;
+
+		for (int j=0;j<n;j++) {
+			uint32_t zz = bit_get(&r, width);
+			prev += (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1);
+			out[i + j] = prev;
+		}
+	}
+
+	return r.p <= r.end;
+}
+
+
+/*
+ *  Cache
+ */
+
+static guint
+entry_hash (gconstpointer key)
+{
+	const Entry* e = key;
+	return g_direct_hash(e->waveform) ^ (e->block * 2654435761u);
+}
+
+
+static gboolean
+entry_equal (gconstpointer a, gconstpointer b)
+{
+	const Entry* e1 = a;
+	const Entry* e2 = b;
+	return e1->waveform == e2->waveform && e1->block == e2->block;
+}
+
+
+static void
+entry_free (Entry* e)
+{
+	for (int c=0;c<WF_STEREO;c++) {
+		cache.stats.size -= e->len[c];
+		g_free(e->data[c]);
+	}
+	cache.stats.raw_size -= e->n_chans * e->size * sizeof(short);
+	cache.stats.n_blocks--;
+
+	g_free(e);
+}
+
+
+/*
+ *  Must be called with the mutex held.
+ */
+static void
+entry_remove (Entry* e)
+{
+	g_hash_table_remove(cache.entries, e);
+	g_queue_delete_link(&cache.lru, e->link);
+	entry_free(e);
+}
+
+
+/*
+ *  Set the maximum number of bytes of compressed audio to retain.
+ *  A value of zero disables the cache.
+ */
+void
+wf_compressed_cache_set_max_size (size_t bytes)
+{
+	g_mutex_lock(&cache.mutex);
+
+	cache.stats.max_size = bytes;
+
+	Entry* e;
+	while (cache.stats.size > bytes && (e = g_queue_peek_head(&cache.lru))) {
+		entry_remove(e);
+		cache.stats.n_dropped++;
+	}
+
+	g_mutex_unlock(&cache.mutex);
+}
+
+
+WfCompressedCacheStats
+wf_compressed_cache_get_stats ()
+{
+	g_mutex_lock(&cache.mutex);
+	WfCompressedCacheStats stats = cache.stats;
+	g_mutex_unlock(&cache.mutex);
+
+	return stats;
+}
+
+
+/*
+ *  Called from the audio worker for blocks evicted from the audio cache.
+ *  The contents of @buf are copied.
+ */
+void
+wf_compressed_cache_add (Waveform* waveform, int block, WfBuf16* buf, int generation)
+{
+	if (!cache.stats.max_size || !buf->buf[WF_LEFT]) return;
+
+	Entry* e = WF_NEW(Entry,
+		.waveform = waveform,
+		.block = block,
+		.generation = generation,
+		.size = buf->size
+	);
+
+	for (int c=0;c<WF_STEREO && buf->buf[c];c++) {
+		e->data[c] = g_malloc(WF_COMPRESSED_MAX_SIZE(buf->size));
+		e->len[c] = wf_compress_block(buf->buf[c], buf->size, e->data[c]);
+		e->data[c] = g_realloc(e->data[c], e->len[c]);
+		e->n_chans++;
+	}
+
+	dbg(2, "block=%i ratio=%.2f", block, (double)(e->n_chans * e->size * sizeof(short)) / (e->len[0] + e->len[1]));
+
+	g_mutex_lock(&cache.mutex);
+
+	if (!cache.entries) cache.entries = g_hash_table_new(entry_hash, entry_equal);
+
+	Entry* existing = g_hash_table_lookup(cache.entries, e);
+	if (existing) entry_remove(existing);
+
+	g_hash_table_add(cache.entries, e);
+	g_queue_push_tail(&cache.lru, e);
+	e->link = cache.lru.tail;
+
+	cache.stats.size += e->len[0] + e->len[1];
+	cache.stats.raw_size += e->n_chans * e->size * sizeof(short);
+	cache.stats.n_blocks++;
+
+	Entry* oldest;
+	while (cache.stats.size > cache.stats.max_size && (oldest = g_queue_peek_head(&cache.lru))) {
+		entry_remove(oldest);
+		cache.stats.n_dropped++;
+	}
+
+	g_mutex_unlock(&cache.mutex);
+}
+
+
+/*
+ *  If the block is present, its channel buffers are allocated from the
+ *  pool and filled, and the block is removed from the cache.
+ *  A block added before the file was changed is discarded.
+ *
+ *  Can be called from the worker thread.
+ */
+bool
+wf_compressed_cache_take (Waveform* waveform, int block, WfBuf16* buf, int n_chans, int generation)
+{
+	if (!cache.stats.max_size) return false;
+
+	g_mutex_lock(&cache.mutex);
+
+	Entry* e = cache.entries ? g_hash_table_lookup(cache.entries, &(Entry){.waveform = waveform, .block = block}) : NULL;
+	if (e && e->generation != generation) {
+		entry_remove(e);
+		e = NULL;
+	}
+	if (e) {
+		g_hash_table_remove(cache.entries, e);
+		g_queue_delete_link(&cache.lru, e->link);
+		cache.stats.n_hits++;
+	} else {
+		cache.stats.n_misses++;
+	}
+
+	g_mutex_unlock(&cache.mutex);
+
+	if (!e) return false;
+
+	bool ok = e->size == buf->size && e->n_chans >= n_chans;
+	for (int c=0;c<n_chans && ok;c++) {
+		buf->buf[c] = wf_pool_alloc(sizeof(short) * buf->size);
+		ok = wf_decompress_block(e->data[c], e->len[c], buf->buf[c], buf->size);
+	}
+	if (!ok) {
+		pwarn("failed to restore block %i", block);
+		for (int c=0;c<n_chans;c++) {
+			wf_pool_free(buf->buf[c], sizeof(short) * buf->size);
+			buf->buf[c] = NULL;
+		}
+	}
+
+	g_mutex_lock(&cache.mutex);
+	entry_free(e);
+	g_mutex_unlock(&cache.mutex);
+
+	return ok;
+}
+
+
+/*
+ *  Remove all blocks belonging to @waveform
+ */
+void
+wf_compressed_cache_remove (Waveform* waveform)
+{
+	if (!cache.entries) return;
+
+	g_mutex_lock(&cache.mutex);
+
+	GHashTableIter iter;
+	gpointer key;
+	g_hash_table_iter_init (&iter, cache.entries);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		Entry* e = key;
+		if (e->waveform == waveform) {
+			g_hash_table_iter_remove(&iter);
+			g_queue_delete_link(&cache.lru, e->link);
+			entry_free(e);
+		}
+	}
+
+	g_mutex_unlock(&cache.mutex);
+}
@@ -0,0 +1,39 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#pragma once
+
+#include "wf/waveform.h"
+
+typedef struct {
+	size_t   max_size;      // bytes. zero if the cache is disabled
+	size_t   size;          // compressed bytes currently held
+	size_t   raw_size;      // bytes that the held blocks occupy when uncompressed
+	int      n_blocks;
+	uint64_t n_hits;
+	uint64_t n_misses;
+	uint64_t n_dropped;     // blocks discarded to stay within max_size
+} WfCompressedCacheStats;
+
+void                   wf_compressed_cache_set_max_size (size_t bytes);
+WfCompressedCacheStats wf_compressed_cache_get_stats    ();
+
+#ifdef __wf_private__
+#define WF_COMPRESSED_MAX_SIZE(N_FRAMES) (1 + (N_FRAMES) * 17 / 8 + (N_FRAMES) / 64 + 8)
+
+void   wf_compressed_cache_add    (Waveform*, int block, WfBuf16*, int generation);
+bool   wf_compressed_cache_take   (Waveform*, int block, WfBuf16*, int n_chans, int generation);
+void   wf_compressed_cache_remove (Waveform*);
+
+size_t wf_compress_block          (const short*, int n_frames, guchar* out);
+bool   wf_decompress_block        (const guchar*, size_t, short* out, int n_frames);
+#endif
@@ -0,0 +1,337 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | On-disk cache of decoded hi-res audio blocks.                        |
+ |                                                                      |
+ | For compressed sources, loading a hi-res block requires opening the  |
+ | file, seeking and decoding. Decoded blocks are saved in a directory  |
+ | alongside the peak files so that a block that has been evicted from  |
+ | the audio cache can be reloaded with a single sequential read.       |
+ |                                                                      |
+ | Each block is a separate file named using a hash of the source path, |
+ | size and modification time, so entries for modified files are        |
+ | never used. When the size budget is exceeded the least recently      |
+ | used files are deleted.                                              |
+ |                                                                      |
+ | The cache is disabled by default.                                    |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define __wf_private__
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "wf/debug.h"
+#include "wf/waveform.h"
+#include "wf/peakgen.h"
+#include "wf/pool.h"
+#include "wf/diskcache.h"
+
+#define BLOCK_DIR "blocks"
+#define SUFFIX    ".wfb"
+#define MAGIC     "wfbk"
+#define VERSION   1
+
+typedef struct {
+	char     magic[4];
+	uint32_t version;
+	uint32_t n_chans;
+	uint32_t size;       // frames per channel
+} Header;
+
+typedef struct {
+	char*    path;
+	time_t   mtime;
+	size_t   size;
+} Item;
+
+static struct {
+	GMutex           mutex;
+	GMutex           trim_mutex;
+	bool             scanned;
+	WfDiskCacheStats stats;
+} cache;
+
+
+static char*
+block_dir ()
+{
+	g_autofree char* cache_dir = wf_get_cache_dir();
+	return g_build_filename(cache_dir, BLOCK_DIR, NULL);
+}
+
+
+static char*
+block_path (const char* key, int block)
+{
+	g_autofree char* dir = block_dir();
+	g_autofree char* leaf = g_strdup_printf("%s-%i%s", key, block, SUFFIX);
+	return g_build_filename(dir, leaf, NULL);
+}
+
+
+/*
+ *  Returns the total size of the cache files.
+ *  If @items is given, an Item is appended for each file.
+ */
+static size_t
+scan (GArray* items)
+{
+	g_autofree char* dir_name = block_dir();
+	GDir* d = g_dir_open(dir_name, 0, NULL);
+	if (!d) return 0;
+
+	size_t total = 0;
+	const char* leaf;
+	while ((leaf = g_dir_read_name(d))) {
+		if (g_str_has_suffix(leaf, SUFFIX)) {
+			char* path = g_build_filename(dir_name, leaf, NULL);
+			GStatBuf info;
+			if (!g_stat(path, &info)) {
+				total += info.st_size;
+				if (items) {
+					g_array_append_val(items, ((Item){path, info.st_mtime, info.st_size}));
+					continue;
+				}
+			}
+			g_free(path);
+		}
+	}
+	g_dir_close(d);
+
+	return total;
+}
+
+
+static gint
+compare_mtime (gconstpointer a, gconstpointer b)
+{
+	const Item* i1 = a;
+	const Item* i2 = b;
+	return i1->mtime < i2->mtime ? -1 : i1->mtime > i2->mtime;
+}
+
+
+/*
+ *  Delete the least recently used files until the cache is at 3/4 of its budget,
+ *  so that the directory does not need to be scanned after every write.
+ */
+static void
+trim ()
+{
+	g_mutex_lock(&cache.trim_mutex);
+
+	GArray* items = g_array_new(false, false, sizeof(Item));
+	size_t total = scan(items);
+	g_array_sort(items, compare_mtime);
+
+	size_t target = cache.stats.max_size / 4 * 3;
+	int n_deleted = 0;
+	for (int i=0;i<items->len;i++) {
+		Item* item = &g_array_index(items, Item, i);
+		if (total > target && !g_unlink(item->path)) {
+			total -= item->size;
+			n_deleted++;
+		}
+		g_free(item->path);
+	}
+	g_array_free(items, true);
+
+	dbg(1, "deleted=%i size=%zu", n_deleted, total);
+
+	g_mutex_lock(&cache.mutex);
+	cache.stats.size = total;
+	cache.stats.n_deleted += n_deleted;
+	g_mutex_unlock(&cache.mutex);
+
+	g_mutex_unlock(&cache.trim_mutex);
+}
+
+
+/*
+ *  Set the maximum disk space used by the cache.
+ *  A value of zero disables the cache. Existing files are not removed.
+ */
+void
+wf_disk_cache_set_max_size (size_t bytes)
+{
+	g_mutex_lock(&cache.mutex);
+	cache.stats.max_size = bytes;
+	bool need_scan = bytes && !cache.scanned;
+	cache.scanned |= need_scan;
+	g_mutex_unlock(&cache.mutex);
+
+	if (need_scan) {
+		size_t size = scan(NULL);
+		g_mutex_lock(&cache.mutex);
+		cache.stats.size = size;
+		g_mutex_unlock(&cache.mutex);
+	}
+
+	if (bytes && cache.stats.size > bytes) trim();
+}
+
+
+WfDiskCacheStats
+wf_disk_cache_get_stats ()
+{
+	g_mutex_lock(&cache.mutex);
+	WfDiskCacheStats stats = cache.stats;
+	g_mutex_unlock(&cache.mutex);
+
+	return stats;
+}
+
+
+/*
+ *  Delete all cached blocks
+ */
+void
+wf_disk_cache_clear ()
+{
+	g_mutex_lock(&cache.trim_mutex);
+
+	GArray* items = g_array_new(false, false, sizeof(Item));
+	scan(items);
+	for (int i=0;i<items->len;i++) {
+		Item* item = &g_array_index(items, Item, i);
+		g_unlink(item->path);
+		g_free(item->path);
+	}
+	g_array_free(items, true);
+
+	g_mutex_lock(&cache.mutex);
+	cache.stats.size = 0;
+	g_mutex_unlock(&cache.mutex);
+
+	g_mutex_unlock(&cache.trim_mutex);
+}
+
+
+/*
+ *  Returns an identifier for the current contents of @filename, or NULL if it cannot be accessed.
+ *  The caller must g_free the returned value.
+ */
+char*
+wf_disk_cache_key (const char* filename)
+{
+	g_return_val_if_fail(filename, NULL);
+
+	GStatBuf info;
+	if (g_stat(filename, &info)) return NULL;
+
+	g_autofree char* id = g_strdup_printf("%s:%"PRIi64":%"PRIi64, filename, (int64_t)info.st_size, (int64_t)info.st_mtime);
+
+	return g_compute_checksum_for_string(G_CHECKSUM_MD5, id, -1);
+}
+
+
+/*
+ *  If the block is present, its channel buffers are allocated from the pool and filled.
+ *
+ *  Can be called from the worker thread.
+ */
+bool
+wf_disk_cache_read (const char* key, int block, WfBuf16* buf, int n_chans)
+{
+	if (!cache.stats.max_size) return false;
+
+	g_autofree char* path = block_path(key, block);
+
+	bool ok = false;
+	FILE* f = fopen(path, "rb");
+	if (f) {
+		Header header;
+		ok = fread(&header, sizeof(Header), 1, f) == 1
+			&& !memcmp(header.magic, MAGIC, 4)
+			&& header.version == VERSION
+			&& header.size == buf->size
+			&& header.n_chans >= n_chans;
+
+		for (int c=0;c<n_chans && ok;c++) {
+			buf->buf[c] = wf_pool_alloc(sizeof(short) * buf->size);
+			ok = fread(buf->buf[c], sizeof(short), buf->size, f) == buf->size;
+		}
+		fclose(f);
+
+		if (ok) {
+			utimes(path, NULL); // mark as recently used
+		} else {
+			pwarn("invalid cache file: %s", path);
+			for (int c=0;c<n_chans;c++) {
+				wf_pool_free(buf->buf[c], sizeof(short) * buf->size);
+				buf->buf[c] = NULL;
+			}
+			g_unlink(path);
+		}
+	}
+
+	g_mutex_lock(&cache.mutex);
+	if (ok) cache.stats.n_hits++; else cache.stats.n_misses++;
+	g_mutex_unlock(&cache.mutex);
+
+	return ok;
+}
+
+
+/*
+ *  Can be called from the worker thread.
+ */
+void
+wf_disk_cache_write (const char* key, int block, WfBuf16* buf, int n_chans)
+{
+	if (!cache.stats.max_size) return;
+
+	g_autofree char* dir = block_dir();
+	if (g_mkdir_with_parents(dir, S_IRUSR | S_IWUSR | S_IXUSR)) {
+		pwarn("cannot access cache dir: %s", dir);
+		return;
+	}
+
+	// written to a temporary file first so that a partial block is never visible
+	g_autofree char* path = block_path(key, block);
+	g_autofree char* tmp = g_strdup_printf("%s.%p.tmp", path, (void*)g_thread_self());
+
+	FILE* f = fopen(tmp, "wb");
+	if (!f) return;
+
+	Header header = {
+		.magic = MAGIC,
+		.version = VERSION,
+		.n_chans = n_chans,
+		.size = buf->size
+	};
+	bool ok = fwrite(&header, sizeof(Header), 1, f) == 1;
+	for (int c=0;c<n_chans && ok;c++) {
+		ok = fwrite(buf->buf[c], sizeof(short), buf->size, f) == buf->size;
+	}
+	ok = !fclose(f) && ok;
+
+	if (!ok || g_rename(tmp, path)) {
+		pwarn("failed to write cache file: %s", path);
+		g_unlink(tmp);
+		return;
+	}
+
+	g_mutex_lock(&cache.mutex);
+	cache.stats.size += sizeof(Header) + n_chans * buf->size * sizeof(short);
+	cache.stats.n_writes++;
+	bool over = cache.stats.size > cache.stats.max_size;
+	g_mutex_unlock(&cache.mutex);
+
+	if (over) trim();
+}
@@ -0,0 +1,34 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#pragma once
+
+#include "wf/waveform.h"
+
+typedef struct {
+	size_t   max_size;      // bytes. zero if the cache is disabled
+	size_t   size;          // bytes currently on disk
+	uint64_t n_hits;
+	uint64_t n_misses;
+	uint64_t n_writes;
+	uint64_t n_deleted;     // files removed to stay within max_size
+} WfDiskCacheStats;
+
+void             wf_disk_cache_set_max_size (size_t bytes);
+WfDiskCacheStats wf_disk_cache_get_stats    ();
+void             wf_disk_cache_clear        ();
+
+#ifdef __wf_private__
+char*            wf_disk_cache_key          (const char* filename);
+bool             wf_disk_cache_read         (const char* key, int block, WfBuf16*, int n_chans);
+void             wf_disk_cache_write        (const char* key, int block, WfBuf16*, int n_chans);
+#endif
@@ -26,6 +26,7 @@ wf_get_instance ()
 			.domain = "Libwaveform",
 			.peak_cache = g_hash_table_new(g_direct_hash, g_direct_equal),
 			.audio.cache = g_hash_table_new(g_direct_hash, g_direct_equal),
+			.registry = g_hash_table_new(g_str_hash, g_str_equal),
 			.load_peak = wf_load_riff_peak, //set the default loader
 		);
 	}
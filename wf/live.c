@@ -0,0 +1,443 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Waveforms fed from memory, eg while recording.                       |
+ |                                                                      |
+ | The application writes 16 bit audio from a single producer thread    |
+ | into a lock-free ring. The ring is emptied by the main loop, which   |
+ | extends the peak data, the hi-res audio blocks and their peakbufs,   |
+ | and the block summary. Only the values that include the new frames  |
+ | are calculated, so the cost is proportional to the input rate and    |
+ | not to the length of the Waveform.                                   |
+ |                                                                      |
+ | The "frames-appended" signal is emitted with the range of the new    |
+ | frames so that only the affected blocks need to be re-rendered.      |
+ |                                                                      |
+ | The audio blocks are owned by the Waveform and are not added to the  |
+ | audio cache, as there is no file to reload them from.                |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define __wf_private__
+
+#include "config.h"
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <glib.h>
+#include "wf/debug.h"
+#include "wf/waveform.h"
+#include "wf/peakgen.h"
+#include "wf/pool.h"
+#include "wf/live.h"
+
+#define RING_SIZE      (1 << 18) // frames. about 6 seconds at 44.1kHz. must be a power of two
+#define DRAIN_INTERVAL 16        // msecs
+#define HI_RATIO       16        // frames per value in the hi-res peakbufs, as produced by waveform_peakbuf_regen()
+
+typedef struct _WfLive WfLive;
+
+typedef struct {
+	double   sum_sq;
+	uint64_t n_samples;
+} Sums;
+
+struct _WfLive {
+	struct {
+		short*   buf[WF_STEREO];
+		guint    size;           // frames
+		gint     head;           // frames written. only modified by the producer
+		gint     tail;           // frames read. only modified by the main thread
+	}            ring;
+	gint         finished;
+	gint         n_dropped;      // modified by the producer
+	int          peak_capacity;  // the number of peaks allocated in the WfPeakBuf
+	GArray*      sums;           // Sums, one per texture block, for the rms values
+	Sums         total;
+	guint        timer;
+	WfLiveStats  stats;
+};
+
+static gboolean waveform_live_on_timeout (gpointer);
+
+
+/*
+ *  Create a Waveform that is not backed by a file.
+ *  Audio is added using waveform_live_write().
+ *
+ *  Returns: (transfer full): waveform
+ */
+Waveform*
+waveform_new_live (int n_channels, int samplerate)
+{
+	g_return_val_if_fail(n_channels == WF_MONO || n_channels == WF_STEREO, NULL);
+	g_return_val_if_fail(samplerate > 0, NULL);
+
+	Waveform* w = waveform_construct(TYPE_WAVEFORM);
+	w->n_channels = n_channels;
+	w->samplerate = samplerate;
+	w->renderable = true;
+
+	WaveformPrivate* _w = w->priv;
+	WfLive* live = _w->live = WF_NEW(WfLive,
+		.ring = {
+			.size = RING_SIZE
+		},
+		.sums = g_array_new(false, true, sizeof(Sums))
+	);
+	for(int c=0;c<n_channels;c++){
+		live->ring.buf[c] = g_new(short, RING_SIZE);
+	}
+
+	// there is no peakfile to wait for
+	_w->peaks = am_promise_new(w);
+	am_promise_resolve(_w->peaks, NULL);
+
+	live->timer = g_timeout_add(DRAIN_INTERVAL, waveform_live_on_timeout, w);
+
+	return w;
+}
+
+
+/*
+ *  Called when the Waveform is finalized
+ */
+void
+waveform_live_free (Waveform* w)
+{
+	WfLive* live = w->priv->live;
+	g_return_if_fail(live);
+
+	if(live->timer) g_source_remove(live->timer);
+
+	for(int c=0;c<WF_STEREO;c++){
+		g_free(live->ring.buf[c]);
+	}
+	g_array_free(live->sums, true);
+
+	g_clear_pointer(&w->priv->live, g_free);
+}
+
+
+/*
+ *  Add audio to the end of the Waveform. @buf contains an array of @n_frames for each channel.
+ *
+ *  This does not block, so it can be called from an audio thread, but all calls must be made
+ *  from the same thread. The frames are added to the Waveform later by the main loop.
+ *
+ *  Returns false if there is not enough space for the frames, in which case none are written.
+ */
+bool
+waveform_live_write (Waveform* w, const short* buf[], int n_frames)
+{
+	g_return_val_if_fail(w && w->priv->live, false);
+	g_return_val_if_fail(n_frames >= 0, false);
+
+	WfLive* live = w->priv->live;
+
+	if(g_atomic_int_get(&live->finished)) return false;
+
+	guint head = live->ring.head;
+	guint tail = g_atomic_int_get(&live->ring.tail);
+	if(n_frames > live->ring.size - (head - tail)){
+		g_atomic_int_add(&live->n_dropped, n_frames);
+		return false;
+	}
+
+	guint pos = head & (live->ring.size - 1);
+	int n = MIN(n_frames, live->ring.size - pos);
+	for(int c=0;c<w->n_channels;c++){
+		memcpy(live->ring.buf[c] + pos, buf[c], n * sizeof(short));
+		memcpy(live->ring.buf[c], buf[c] + n, (n_frames - n) * sizeof(short));
+	}
+
+	// the data must be visible to the main thread before the new head
+	g_atomic_int_set(&live->ring.head, head + n_frames);
+
+	return true;
+}
+
+
+/*
+ *  Allocate the peaks, audio blocks and summary entries for a Waveform of length @n_frames
+ */
+static void
+waveform_live_ensure_space (Waveform* w, uint64_t n_frames)
+{
+	WaveformPrivate* _w = w->priv;
+	WfLive* live = _w->live;
+	WfAudioData* audio = &_w->audio;
+
+	int n_peaks = n_frames / WF_PEAK_RATIO + (n_frames % WF_PEAK_RATIO ? 1 : 0);
+	if(n_peaks > live->peak_capacity){
+		int capacity = MAX(n_peaks, MAX(WF_TEXTURE_VISIBLE_SIZE, 2 * live->peak_capacity));
+		for(int c=0;c<w->n_channels;c++){
+			_w->peak.buf[c] = g_renew(short, _w->peak.buf[c], capacity * WF_PEAK_VALUES_PER_SAMPLE);
+		}
+		wf->peak_mem_size += (capacity - live->peak_capacity) * WF_PEAK_VALUES_PER_SAMPLE * sizeof(short) * w->n_channels;
+		if(!live->peak_capacity) g_hash_table_insert(wf->peak_cache, w, w); // is removed in __finalize()
+		live->peak_capacity = capacity;
+	}
+
+	int n_blocks = n_frames / WF_SAMPLES_PER_TEXTURE + (n_frames % WF_SAMPLES_PER_TEXTURE ? 1 : 0);
+	if(n_blocks > audio->n_blocks){
+		audio->buf16 = g_renew(WfBuf16*, audio->buf16, n_blocks);
+		_w->summary = g_renew(WfBlockSummary, _w->summary, n_blocks + 1);
+		if(!audio->n_blocks) _w->summary[0] = (WfBlockSummary){.silent = true};
+		g_array_set_size(live->sums, n_blocks);
+
+		for(int b=audio->n_blocks;b<n_blocks;b++){
+			WfBuf16* buf16 = audio->buf16[b] = WF_NEW(WfBuf16, .size = WF_PEAK_BLOCK_SIZE);
+			Peakbuf* peakbuf = WF_NEW(Peakbuf,
+				.block_num = b,
+				.size = WF_PEAK_BLOCK_SIZE * WF_PEAK_VALUES_PER_SAMPLE / HI_RATIO,
+				.resolution = HI_RATIO
+			);
+			// the unused part of the last block must be silent
+			for(int c=0;c<w->n_channels;c++){
+				buf16->buf[c] = wf_pool_alloc0(sizeof(short) * buf16->size);
+				peakbuf->buf[c] = wf_pool_alloc0(sizeof(short) * peakbuf->size);
+			}
+			waveform_peakbuf_assign(w, b, peakbuf);
+
+			_w->summary[b + 1] = (WfBlockSummary){.silent = true};
+		}
+		audio->n_blocks = n_blocks;
+	}
+}
+
+
+/*
+ *  Recalculate the values of the hi-res peakbuf for the given range of frames within block @b
+ */
+static void
+waveform_live_update_peakbuf (Waveform* w, int b, int from, int to)
+{
+	WfBuf16* buf16 = w->priv->audio.buf16[b];
+	Peakbuf* peakbuf = g_ptr_array_index(w->priv->hires_peaks, b);
+
+	for(int c=0;c<w->n_channels;c++){
+		short* out = peakbuf->buf[c];
+		for(int i=from/HI_RATIO;i<(to + HI_RATIO - 1) / HI_RATIO;i++){
+			short* d = &buf16->buf[c][i * HI_RATIO];
+			short max = 0;
+			short min = 0;
+			for(int k=0;k<HI_RATIO;k++){
+				max = MAX(max, d[k]);
+				min = MIN(min, d[k]);
+			}
+			out[2 * i    ] = max;
+			out[2 * i + 1] = min;
+			peakbuf->maxlevel = MAX(peakbuf->maxlevel, MAX(max, -min));
+		}
+	}
+}
+
+
+static void
+waveform_live_append (Waveform* w, const short* src[], int n_frames)
+{
+	WaveformPrivate* _w = w->priv;
+	WfLive* live = _w->live;
+	WfAudioData* audio = &_w->audio;
+	int n_chans = w->n_channels;
+
+	uint64_t start = w->n_frames;
+	uint64_t end = start + n_frames;
+
+	waveform_live_ensure_space(w, end);
+
+	// the last peak is updated in place until it is complete
+	for(int c=0;c<n_chans;c++){
+		short* peaks = _w->peak.buf[c];
+		for(uint64_t f=start;f<end;f++){
+			short val = src[c][f - start];
+			int p = 2 * (f / WF_PEAK_RATIO);
+			if(!(f % WF_PEAK_RATIO)) peaks[p] = peaks[p + 1] = 0;
+			peaks[p    ] = MAX(peaks[p], val);
+			peaks[p + 1] = MIN(peaks[p + 1], MAX(val, -32767)); // see peakgen
+		}
+	}
+
+	// block summary. The values for all channels are combined.
+	WfBlockSummary* total = &_w->summary[0];
+	for(uint64_t f=start;f<end;){
+		int b = f / WF_SAMPLES_PER_TEXTURE;
+		uint64_t next = MIN(end, (uint64_t)(b + 1) * WF_SAMPLES_PER_TEXTURE);
+
+		WfBlockSummary* block = &_w->summary[b + 1];
+		Sums* sums = &g_array_index(live->sums, Sums, b);
+		double sum_sq = 0;
+		for(int c=0;c<n_chans;c++){
+			for(uint64_t i=f;i<next;i++){
+				short val = src[c][i - start];
+				block->max = MAX(block->max, val);
+				block->min = MIN(block->min, MAX(val, -32767));
+				block->n_clipped += (val >= 32767 || val <= -32767);
+				sum_sq += (double)val * val;
+			}
+		}
+		sums->sum_sq += sum_sq;
+		sums->n_samples += (next - f) * n_chans;
+		live->total.sum_sq += sum_sq;
+		live->total.n_samples += (next - f) * n_chans;
+
+		block->rms = MIN(sqrt(sums->sum_sq / sums->n_samples), G_MAXINT16);
+		block->silent = MAX(block->max, -block->min) < WF_SILENCE_LEVEL;
+
+		total->max = MAX(total->max, block->max);
+		total->min = MIN(total->min, block->min);
+
+		f = next;
+	}
+	total->n_clipped = 0;
+	for(int b=1;b<=audio->n_blocks;b++) total->n_clipped += _w->summary[b].n_clipped;
+	total->rms = MIN(sqrt(live->total.sum_sq / live->total.n_samples), G_MAXINT16);
+	total->silent = MAX(total->max, -total->min) < WF_SILENCE_LEVEL;
+	_w->max_db = -1;
+
+	// hi-res blocks overlap, so a frame can be in two blocks
+	int first = start < WF_PEAK_BLOCK_SIZE ? 0 : (start - WF_PEAK_BLOCK_SIZE) / WF_SAMPLES_PER_TEXTURE + 1;
+	int last = (end - 1) / WF_SAMPLES_PER_TEXTURE;
+	for(int b=first;b<=last;b++){
+		WfBuf16* buf16 = audio->buf16[b];
+		uint64_t block_start = (uint64_t)b * WF_SAMPLES_PER_TEXTURE;
+		uint64_t from = MAX(start, block_start);
+		uint64_t to = MIN(end, block_start + WF_PEAK_BLOCK_SIZE);
+		if(from >= to) continue;
+
+		for(int c=0;c<n_chans;c++){
+			memcpy(&buf16->buf[c][from - block_start], src[c] + (from - start), (to - from) * sizeof(short));
+		}
+		waveform_live_update_peakbuf(w, b, from - block_start, to - block_start);
+	}
+
+	_w->num_peaks = end / WF_PEAK_RATIO + (end % WF_PEAK_RATIO ? 1 : 0);
+	_w->peak.size = _w->num_peaks * WF_PEAK_VALUES_PER_SAMPLE; // the used size. The allocation can be larger.
+	_w->n_blocks = audio->n_blocks;
+	N_FRAMES_SET(w, end); // last, as other threads use it to see that the other properties are set
+}
+
+
+/*
+ *  Move all frames from the ring into the Waveform.
+ *  Runs in the main thread.
+ */
+static void
+waveform_live_drain (Waveform* w)
+{
+	WfLive* live = w->priv->live;
+
+	guint tail = live->ring.tail;
+	guint head = g_atomic_int_get(&live->ring.head);
+	if(head == tail) return;
+
+	WfFrRange range = {w->n_frames, w->n_frames + (head - tail)};
+
+	while(tail != head){
+		guint pos = tail & (live->ring.size - 1);
+		int n = MIN(head - tail, live->ring.size - pos);
+		const short* src[WF_STEREO] = {
+			live->ring.buf[WF_LEFT] + pos,
+			live->ring.buf[WF_RIGHT] ? live->ring.buf[WF_RIGHT] + pos : NULL
+		};
+		waveform_live_append(w, src, n);
+		tail += n;
+	}
+
+	// the space can now be reused by the producer
+	g_atomic_int_set(&live->ring.tail, tail);
+
+	live->stats.n_frames += range.end - range.start;
+	live->stats.n_drains++;
+
+	dbg(2, "%"PRIi64" --> %"PRIi64, range.start, range.end);
+
+	g_signal_emit_by_name(w, "frames-appended", &range);
+}
+
+
+static gboolean
+waveform_live_on_timeout (gpointer w)
+{
+	waveform_live_drain((Waveform*)w);
+
+	return G_SOURCE_CONTINUE;
+}
+
+
+/*
+ *  Add any pending frames to the Waveform now instead of waiting for the main loop.
+ *  Must be called from the main thread.
+ */
+void
+waveform_live_flush (Waveform* w)
+{
+	g_return_if_fail(w && w->priv->live);
+
+	waveform_live_drain(w);
+}
+
+
+/*
+ *  Stop accepting input. The producer must have stopped writing before this is called.
+ *  Pending frames are added, and the Waveform remains valid.
+ *
+ *  If @filename is given, it should be the file to which the application has saved the
+ *  same audio. The peak data is saved as the peakfile for that file, so that it does
+ *  not need to be generated when the file is loaded.
+ *
+ *  Returns false if the peakfile could not be written.
+ */
+bool
+waveform_live_finish (Waveform* w, const char* filename)
+{
+	g_return_val_if_fail(w && w->priv->live, false);
+	WfLive* live = w->priv->live;
+
+	g_atomic_int_set(&live->finished, true);
+
+	if(live->timer){
+		g_source_remove(live->timer);
+		live->timer = 0;
+	}
+
+	g_object_ref(w);
+	waveform_live_drain(w);
+
+	bool ok = true;
+	if(filename){
+		if(w->n_frames){
+			ok = wf_peakfile_write(w, filename);
+		}else{
+			pwarn("no audio");
+			ok = false;
+		}
+	}
+	g_object_unref(w);
+
+	return ok;
+}
+
+
+WfLiveStats
+waveform_live_get_stats (Waveform* w)
+{
+	g_return_val_if_fail(w && w->priv->live, (WfLiveStats){0,});
+	WfLive* live = w->priv->live;
+
+	WfLiveStats stats = live->stats;
+	stats.n_dropped = g_atomic_int_get(&live->n_dropped);
+	stats.n_pending = (guint)g_atomic_int_get(&live->ring.head) - (guint)live->ring.tail;
+
+	return stats;
+}
@@ -0,0 +1,32 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#pragma once
+
+#include "wf/waveform.h"
+
+typedef struct {
+	uint64_t n_frames;       // frames added to the Waveform
+	uint64_t n_dropped;      // frames rejected because the ring was full
+	uint64_t n_drains;       // number of times the ring has been emptied into the Waveform
+	int      n_pending;      // frames written but not yet added
+} WfLiveStats;
+
+Waveform*   waveform_new_live       (int n_channels, int samplerate);
+bool        waveform_live_write     (Waveform*, const short* buf[], int n_frames);
+void        waveform_live_flush     (Waveform*);
+bool        waveform_live_finish    (Waveform*, const char* filename);
+WfLiveStats waveform_live_get_stats (Waveform*);
+
+#ifdef __wf_private__
+void        waveform_live_free      (Waveform*);
+#endif
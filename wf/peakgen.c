@@ -23,6 +23,11 @@
   - peak files are expired after 90 days
   - there is no size limit to the cache directory
   - split stereo files (denoted by %L and %R in the filename) will have a single peakfile
+  - a 'wfmd' chunk after the peak data records the source file metadata (frames, channels,
+    rate, size, mtime) so that a Waveform with a current peakfile does not need to open the
+    source file until the audio itself is needed.
+  - a 'wfsm' chunk holds a summary (level, rms, clipping) of each texture block
+    so that level queries and silence detection do not need to scan the peak data.
 
   todo:
   - what is maximum file size?
@@ -32,6 +37,8 @@
 #define __wf_private__
 
 #include "config.h"
+#include <math.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -54,25 +61,57 @@
 #include "wf/worker.h"
 #include "wf/loaders/ardour.h"
 #include "wf/peakgen.h"
+#include "wf/pool.h"
+#include "wf/profile.h"
 
 #define BUFFER_LEN 256 // length of the buffer to hold audio during processing. currently must be same as WF_PEAK_RATIO
 #define MAX_CHANNELS 2
 
 #define DEFAULT_USER_CACHE_DIR ".cache/peak"
 
+#define META_CHUNK_ID   "wfmd"
+#define META_VERSION    1
+#define META_CHUNK_SIZE 40 // bytes, excluding the chunk header
+#define MAX_RIFF_CHUNKS 16
+
+#define SUMMARY_CHUNK_ID   "wfsm"
+#define SUMMARY_VERSION    1
+#define SUMMARY_ENTRY_SIZE 12
+
+typedef struct {
+	GArray*          blocks;         // WfBlockSummary, one per texture block
+	double           sum_sq;         // for the current block
+	uint64_t         n_samples;
+	double           total_sum_sq;
+	uint64_t         total_samples;
+} Summary;
+
 static int           peak_mem_size = 0;
 static bool          need_file_cache_check = true;
 
 static inline void   process_data        (short* data, int count, int channels, short max[], short min[]);
-static bool          wf_file_is_newer    (const char*, const char*);
-static bool          wf_create_cache_dir ();
-static char*         get_cache_dir       ();
+static bool          source_file_stat    (const char* audio_file, uint64_t* size, int64_t* mtime);
+static WfPeakMeta    peakfile_make_meta  (const char* audio_file, WfAudioInfo*, uint64_t n_frames);
+static bool          peakfile_write_meta (const char* peak_file, WfPeakMeta*);
+static void          summary_add         (Summary*, int peak_index, WfPeakSample, double sum_sq, int n_samples, int n_clipped);
+static bool          peakfile_write_summary (const char* peak_file, Summary*);
+static bool          peakfile_write_summary_entries (const char* peak_file, const WfBlockSummary* total, const WfBlockSummary*, int n_blocks);
 static void          maintain_file_cache ();
 
+/*
+ *  Chunk fields are little endian and are not necessarily aligned.
+ */
+static inline uint16_t get_le16 (const guchar* p) { uint16_t v; memcpy(&v, p, 2); return GUINT16_FROM_LE(v); }
+static inline uint32_t get_le32 (const guchar* p) { uint32_t v; memcpy(&v, p, 4); return GUINT32_FROM_LE(v); }
+static inline uint64_t get_le64 (const guchar* p) { uint64_t v; memcpy(&v, p, 8); return GUINT64_FROM_LE(v); }
+static inline void     put_le16 (guchar* p, uint16_t v) { v = GUINT16_TO_LE(v); memcpy(p, &v, 2); }
+static inline void     put_le32 (guchar* p, uint32_t v) { v = GUINT32_TO_LE(v); memcpy(p, &v, 4); }
+static inline void     put_le64 (guchar* p, uint64_t v) { v = GUINT64_TO_LE(v); memcpy(p, &v, 8); }
+
 static WfWorker peakgen = {0,};
 
 
-static char*
+char*
 waveform_get_peak_filename (const char* filename)
 {
 	// filename should be absolute.
@@ -95,7 +134,7 @@ waveform_get_peak_filename (const char* filename)
 	g_free(uri);
 	gchar* peak_basename = g_strdup_printf("%s.peak", md5);
 	g_free(md5);
-	char* cache_dir = get_cache_dir();
+	char* cache_dir = wf_get_cache_dir();
 	gchar* peak_filename = g_build_filename(cache_dir, peak_basename, NULL);
 	g_free(cache_dir);
 	dbg(1, "peak_filename=%s", peak_filename);
@@ -105,24 +144,43 @@ waveform_get_peak_filename (const char* filename)
 }
 
 
+/*
+ *  If the peakfile has a metadata chunk, @meta is filled and the source
+ *  file is checked with a single stat. Otherwise fall back to comparing
+ *  modification times, in which case @meta->version is left at zero.
+ */
 static bool
-peakfile_is_current (const char* audio_file, const char* peak_file)
+peakfile_is_current (const char* audio_file, const char* peak_file, WfPeakMeta* meta)
 {
 	/*
-	note that this test will fail to detect a modified file, if an older file is now stored at this location.
+	note that for peakfiles without metadata, this test will fail to detect a modified file, if an older file is now stored at this location.
 
 	The freedesktop thumbnailer spec identifies modifications by comparing with both url and mtime stored in the thumbnail.
-	This will mostly work, but strictly speaking still won't identify a changed file in all cases.
-
-	One relatively simple improvement would be to match the sizes.
+	The metadata chunk stores both the size and the mtime of the source file.
 	*/
 
-	if(!g_file_test(peak_file, G_FILE_TEST_EXISTS)){
+	uint64_t size;
+	int64_t mtime;
+
+	if(wf_peakfile_read_meta(peak_file, meta)){
+		if(!source_file_stat(audio_file, &size, &mtime)){
+			dbg(1, "cannot stat source. using existing peakfile");
+			return true;
+		}
+		if(size != meta->size || mtime != meta->mtime){
+			dbg(1, "source file has changed");
+			return false;
+		}
+		return true;
+	}
+
+	GStatBuf info;
+	if(g_stat(peak_file, &info)){
 		dbg(1, "peakfile does not exist: %s", peak_file);
 		return false;
 	}
 
-	if(wf_file_is_newer(audio_file, peak_file)){
+	if(source_file_stat(audio_file, &size, &mtime) && mtime > info.st_mtime){
 		dbg(1, "peakfile is too old");
 		return false;
 	}
@@ -131,6 +189,344 @@ peakfile_is_current (const char* audio_file, const char* peak_file)
 }
 
 
+/*
+ *  The source file is identified by its size and mtime. For a split stereo
+ *  pair ("%L" in the filename) both halves are included: the sizes are added
+ *  and the later of the two mtimes is used.
+ */
+static bool
+source_file_stat (const char* audio_file, uint64_t* size, int64_t* mtime)
+{
+	GStatBuf s;
+	if(g_stat(audio_file, &s)) return false;
+
+	*size = s.st_size;
+	*mtime = s.st_mtime;
+
+	char* split = g_strrstr(audio_file, "%L");
+	if(split){
+		g_autofree char* rhs = g_strdup(audio_file);
+		rhs[split - audio_file + 1] = 'R';
+
+		GStatBuf r;
+		if(!g_stat(rhs, &r)){
+			*size += r.st_size;
+			*mtime = MAX(*mtime, (int64_t)r.st_mtime);
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ *  Position @fp at the start of the data of the chunk with the given id.
+ */
+static bool
+peakfile_find_chunk (FILE* fp, const char* id, uint32_t* size)
+{
+	guchar header[12];
+	if(fread(header, 1, 12, fp) == 12 && !memcmp(header, "RIFF", 4) && !memcmp(header + 8, "WAVE", 4)){
+		guchar chunk[8];
+		for(int i=0;i<MAX_RIFF_CHUNKS && fread(chunk, 1, 8, fp) == 8;i++){
+			*size = get_le32(chunk + 4);
+			if(!memcmp(chunk, id, 4)) return true;
+			if(fseeko(fp, *size + (*size & 1), SEEK_CUR)) break;
+		}
+	}
+	return false;
+}
+
+
+/*
+ *  Read the source file metadata stored in the peakfile without opening a decoder.
+ *  Returns false if the file does not exist or was created by an older version.
+ */
+bool
+wf_peakfile_read_meta (const char* peak_file, WfPeakMeta* meta)
+{
+	FILE* fp = fopen(peak_file, "rb");
+	if(!fp) return false;
+
+	bool found = false;
+	uint32_t size;
+	if(peakfile_find_chunk(fp, META_CHUNK_ID, &size)){
+		guchar d[META_CHUNK_SIZE];
+		if(size >= META_CHUNK_SIZE && fread(d, 1, META_CHUNK_SIZE, fp) == META_CHUNK_SIZE){
+			*meta = (WfPeakMeta){
+				.version    = get_le32(d + 0),
+				.n_channels = get_le32(d + 4),
+				.samplerate = get_le32(d + 8),
+				.bit_depth  = get_le32(d + 12),
+				.n_frames   = get_le64(d + 16),
+				.size       = get_le64(d + 24),
+				.mtime      = (int64_t)get_le64(d + 32),
+			};
+			found = meta->version == META_VERSION;
+		}
+	}
+
+	fclose(fp);
+
+	return found;
+}
+
+
+/*
+ *  Returns the per-block summary stored in the peakfile, or NULL if not present.
+ *  The first entry is the summary for the whole file. The caller must g_free the result.
+ */
+WfBlockSummary*
+wf_peakfile_read_summary (const char* peak_file, int* n_blocks)
+{
+	FILE* fp = fopen(peak_file, "rb");
+	if(!fp) return NULL;
+
+	WfBlockSummary* summary = NULL;
+	uint32_t size;
+	guchar header[8];
+	if(peakfile_find_chunk(fp, SUMMARY_CHUNK_ID, &size) && size >= 8 && fread(header, 1, 8, fp) == 8){
+		uint32_t version = get_le32(header + 0);
+		uint32_t n = get_le32(header + 4);
+		if(version == SUMMARY_VERSION && n < size / SUMMARY_ENTRY_SIZE && size >= 8 + (n + 1) * SUMMARY_ENTRY_SIZE){
+			guchar* d = g_malloc((n + 1) * SUMMARY_ENTRY_SIZE);
+			if(fread(d, SUMMARY_ENTRY_SIZE, n + 1, fp) == n + 1){
+				summary = g_new(WfBlockSummary, n + 1);
+				for(int i=0;i<=n;i++){
+					guchar* e = d + i * SUMMARY_ENTRY_SIZE;
+					summary[i] = (WfBlockSummary){
+						.max       = (int16_t)get_le16(e + 0),
+						.min       = (int16_t)get_le16(e + 2),
+						.rms       = (int16_t)get_le16(e + 4),
+						.silent    = get_le16(e + 6) & 1,
+						.n_clipped = get_le32(e + 8),
+					};
+				}
+				*n_blocks = n;
+			}
+			g_free(d);
+		}
+	}
+
+	fclose(fp);
+
+	return summary;
+}
+
+
+/*
+ *  Returns the interleaved peak data, in the same layout as the data chunk of the peakfile.
+ *  @size is set to the number of values per channel. The caller must g_free the result.
+ */
+short*
+wf_peakfile_read_data (const char* peak_file, int* n_channels, int* size)
+{
+	FILE* fp = fopen(peak_file, "rb");
+	if(!fp) return NULL;
+
+	// the whole file is needed so start reading it all now
+	posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_WILLNEED);
+
+	short* data = NULL;
+	uint32_t chunk_size;
+	guchar fmt[16];
+	if(peakfile_find_chunk(fp, "fmt ", &chunk_size) && chunk_size >= 16 && fread(fmt, 1, 16, fp) == 16){
+		int channels = get_le16(fmt + 2);
+		int bits = get_le16(fmt + 14);
+		if(channels < 1 || channels > WF_STEREO || bits != 16){
+			pwarn("unexpected peakfile format: channels=%i bits=%i", channels, bits);
+			goto out;
+		}
+
+		rewind(fp);
+		if(peakfile_find_chunk(fp, "data", &chunk_size)){
+			int n = chunk_size / (sizeof(short) * channels);
+			data = g_malloc(n * channels * sizeof(short));
+			if(fread(data, sizeof(short) * channels, n, fp) != n){
+				pwarn("short read: %s", peak_file);
+				g_clear_pointer(&data, g_free);
+				goto out;
+			}
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+			for(int i=0;i<n*channels;i++) data[i] = GINT16_FROM_LE(data[i]);
+#endif
+			*n_channels = channels;
+			*size = n;
+		}
+	}
+
+  out:
+	fclose(fp);
+
+	return data;
+}
+
+
+static WfPeakMeta
+peakfile_make_meta (const char* audio_file, WfAudioInfo* info, uint64_t n_frames)
+{
+	uint64_t size = 0;
+	int64_t mtime = 0;
+	if(!source_file_stat(audio_file, &size, &mtime)) pwarn("cannot stat %s", audio_file);
+
+	return (WfPeakMeta){
+		.version    = META_VERSION,
+		.n_channels = info->channels,
+		.samplerate = info->sample_rate,
+		.bit_depth  = info->bit_depth,
+		.n_frames   = n_frames, // the number actually read. For some formats info->frames is only an estimate.
+		.size       = size,
+		.mtime      = mtime,
+	};
+}
+
+
+/*
+ *  Append a chunk to a completed peakfile.
+ *  Decoders will skip over the unknown chunk.
+ *  @chunk must start with 8 bytes of space for the chunk header. @size does not include the header.
+ */
+static bool
+peakfile_append_chunk (const char* peak_file, const char* id, guchar* chunk, uint32_t size)
+{
+	FILE* fp = fopen(peak_file, "r+b");
+	if(!fp) return false;
+
+	bool ok = false;
+	guchar header[12];
+	if(fread(header, 1, 12, fp) == 12 && !memcmp(header, "RIFF", 4) && !memcmp(header + 8, "WAVE", 4)){
+		memcpy(chunk, id, 4);
+		put_le32(chunk + 4, size);
+
+		uint32_t riff_size = GUINT32_TO_LE(get_le32(header + 4) + 8 + size);
+
+		ok = !fseeko(fp, 0, SEEK_END)
+			&& fwrite(chunk, 1, 8 + size, fp) == 8 + size
+			&& !fseeko(fp, 4, SEEK_SET)
+			&& fwrite(&riff_size, 1, 4, fp) == 4;
+	}
+
+	if(fclose(fp)) ok = false;
+	if(!ok) pwarn("failed to write %s chunk: %s", id, peak_file);
+
+	return ok;
+}
+
+
+static bool
+peakfile_write_meta (const char* peak_file, WfPeakMeta* meta)
+{
+	guchar chunk[8 + META_CHUNK_SIZE];
+	put_le32(chunk + 8,  meta->version);
+	put_le32(chunk + 12, meta->n_channels);
+	put_le32(chunk + 16, meta->samplerate);
+	put_le32(chunk + 20, meta->bit_depth);
+	put_le64(chunk + 24, meta->n_frames);
+	put_le64(chunk + 32, meta->size);
+	put_le64(chunk + 40, meta->mtime);
+
+	return peakfile_append_chunk(peak_file, META_CHUNK_ID, chunk, META_CHUNK_SIZE);
+}
+
+
+static void
+summary_end_block (Summary* s)
+{
+	if(!s->blocks->len) return;
+
+	WfBlockSummary* block = &g_array_index(s->blocks, WfBlockSummary, s->blocks->len - 1);
+	block->rms = s->n_samples ? MIN(sqrt(s->sum_sq / s->n_samples), G_MAXINT16) : 0;
+	block->silent = MAX(block->max, -block->min) < WF_SILENCE_LEVEL;
+
+	s->total_sum_sq += s->sum_sq;
+	s->total_samples += s->n_samples;
+	s->sum_sq = 0;
+	s->n_samples = 0;
+}
+
+
+/*
+ *  Peaks must be added in order. The values for all channels are combined.
+ */
+static void
+summary_add (Summary* s, int peak_index, WfPeakSample peak, double sum_sq, int n_samples, int n_clipped)
+{
+	int b = peak_index / WF_TEXTURE_VISIBLE_SIZE;
+	if(b >= s->blocks->len){
+		summary_end_block(s);
+		g_array_set_size(s->blocks, b + 1);
+	}
+
+	WfBlockSummary* block = &g_array_index(s->blocks, WfBlockSummary, b);
+	block->max = MAX(block->max, peak.positive);
+	block->min = MIN(block->min, peak.negative);
+	block->n_clipped += n_clipped;
+
+	s->sum_sq += sum_sq;
+	s->n_samples += n_samples;
+}
+
+
+static bool
+peakfile_write_summary (const char* peak_file, Summary* s)
+{
+	summary_end_block(s);
+
+	WfBlockSummary total = {
+		.rms = s->total_samples ? MIN(sqrt(s->total_sum_sq / s->total_samples), G_MAXINT16) : 0,
+	};
+	for(int b=0;b<s->blocks->len;b++){
+		WfBlockSummary* block = &g_array_index(s->blocks, WfBlockSummary, b);
+		total.max = MAX(total.max, block->max);
+		total.min = MIN(total.min, block->min);
+		total.n_clipped += block->n_clipped;
+	}
+	total.silent = MAX(total.max, -total.min) < WF_SILENCE_LEVEL;
+
+	return peakfile_write_summary_entries(peak_file, &total, (WfBlockSummary*)s->blocks->data, s->blocks->len);
+}
+
+
+/*
+ *  @total is the summary for the whole file, followed by @n_blocks entries in @blocks.
+ */
+static bool
+peakfile_write_summary_entries (const char* peak_file, const WfBlockSummary* total, const WfBlockSummary* blocks, int n_blocks)
+{
+	uint32_t size = 8 + (n_blocks + 1) * SUMMARY_ENTRY_SIZE;
+	guchar* chunk = g_malloc(8 + size);
+	put_le32(chunk + 8,  SUMMARY_VERSION);
+	put_le32(chunk + 12, n_blocks);
+
+	for(int i=0;i<=n_blocks;i++){
+		const WfBlockSummary* block = i ? &blocks[i - 1] : total;
+		guchar* e = chunk + 16 + i * SUMMARY_ENTRY_SIZE;
+		put_le16(e + 0, block->max);
+		put_le16(e + 2, block->min);
+		put_le16(e + 4, block->rms);
+		put_le16(e + 6, block->silent ? 1 : 0);
+		put_le32(e + 8, block->n_clipped);
+	}
+
+	bool ok = peakfile_append_chunk(peak_file, SUMMARY_CHUNK_ID, chunk, size);
+	g_free(chunk);
+
+	return ok;
+}
+
+
+/*
+ *  Initialise the Waveform from the peakfile metadata so that the source file does not need to be opened.
+ */
+void
+waveform_set_meta (Waveform* w, WfPeakMeta* meta)
+{
+	if(meta->version != META_VERSION) return;
+
+	waveform_set_sf_data(w, meta->n_frames, meta->n_channels, meta->samplerate);
+}
+
+
 	typedef struct {
 		Waveform*          waveform;
 		WfPeakfileCallback callback;
@@ -146,6 +542,11 @@ peakfile_is_current (const char* audio_file, const char* peak_file)
 			w->priv->peaks->error = error;
 		}
 
+		WfPeakMeta meta;
+		if (!error && c->filename && wf_peakfile_read_meta(c->filename, &meta)) {
+			waveform_set_meta(w, &meta);
+		}
+
 		if (c->callback)
 			c->callback(c->waveform, c->filename, c->user_data);
 		else
@@ -171,10 +572,14 @@ waveform_ensure_peakfile (Waveform* w, WfPeakfileCallback callback, gpointer use
 		goto out;
 	}
 
-	if (w->offline || peakfile_is_current(filename, peak_filename)) {
+	WfPeakMeta meta = {0,};
+	if (w->offline || peakfile_is_current(filename, peak_filename, &meta)) {
+		WF_PROFILE_ADD(peak_cache_hits, 1);
+		waveform_set_meta(w, &meta);
 		callback(w, peak_filename, user_data);
 		goto out;
 	}
+	WF_PROFILE_ADD(peak_cache_misses, 1);
 
 	waveform_peakgen(w, peak_filename, waveform_ensure_peakfile_done, WF_NEW(C,
 		.waveform = g_object_ref(w),
@@ -205,16 +610,19 @@ waveform_ensure_peakfile__sync (Waveform* w)
 	gchar* peak_filename = waveform_get_peak_filename(filename);
 	if(!peak_filename) goto out;
 
+	WfPeakMeta meta = {0,};
 	if(g_file_test(peak_filename, G_FILE_TEST_EXISTS)){
 		dbg (1, "peak file exists. (%s)", peak_filename);
 
-		/*
-		note that this test will fail to detect a modified file, if an older file is now stored at this location.
+		if(w->offline){
+			if(wf_peakfile_read_meta(peak_filename, &meta)) waveform_set_meta(w, &meta);
+			goto out;
+		}
 
-		The freedesktop thumbnailer spec identifies modifications by comparing with both url and mtime stored in the thumbnail.
-		This will mostly work, but strictly speaking still won't identify a changed file in all cases.
-		*/
-		if(w->offline || wf_file_is_newer(peak_filename, filename)) goto out;
+		if(peakfile_is_current(filename, peak_filename, &meta)){
+			waveform_set_meta(w, &meta);
+			goto out;
+		}
 
 		dbg(1, "peakfile is too old");
 	}else{
@@ -226,6 +634,8 @@ waveform_ensure_peakfile__sync (Waveform* w)
 
 	if(!wf_peakgen__sync(filename, peak_filename, NULL)){ g_free0(peak_filename); goto out; }
 
+	if(wf_peakfile_read_meta(peak_filename, &meta)) waveform_set_meta(w, &meta);
+
   out:
 	g_free(filename);
 
@@ -233,6 +643,133 @@ waveform_ensure_peakfile__sync (Waveform* w)
 }
 
 
+/*
+ *  Returns the name of the peakfile for @filename if it exists and is current, otherwise NULL.
+ *  Can be called from any thread. @filename must be absolute.
+ */
+char*
+wf_peakfile_lookup (const char* filename, WfPeakMeta* meta)
+{
+	gchar* peak_filename = waveform_get_peak_filename(filename);
+
+	*meta = (WfPeakMeta){0,};
+	if(peak_filename && !peakfile_is_current(filename, peak_filename, meta)){
+		g_clear_pointer(&peak_filename, g_free);
+	}
+
+	return peak_filename;
+}
+
+
+/*
+ *  Waveform-less version of waveform_ensure_peakfile__sync() for the peak service and bulk loading.
+ *  Can be called from any thread. The cache dir must already have been created with wf_create_cache_dir().
+ *  @filename must be absolute. Caller must g_free the returned filename.
+ */
+char*
+wf_peakfile_ensure__sync (const char* filename, WfPeakMeta* meta)
+{
+	gchar* peak_filename = waveform_get_peak_filename(filename);
+	if(!peak_filename) return NULL;
+
+	*meta = (WfPeakMeta){0,};
+	if(!peakfile_is_current(filename, peak_filename, meta)){
+		if(!wf_peakgen__sync(filename, peak_filename, NULL)){
+			g_free(peak_filename);
+			return NULL;
+		}
+		wf_peakfile_read_meta(peak_filename, meta);
+	}
+
+	return peak_filename;
+}
+
+
+/*
+ *  Save the peak data held in memory as the peakfile for @filename.
+ *  This is for Waveforms that are not loaded from a file, eg see waveform_new_live(),
+ *  where the application has separately saved the audio to @filename.
+ */
+bool
+wf_peakfile_write (Waveform* w, const char* filename)
+{
+	g_return_val_if_fail(w && filename, false);
+	WaveformPrivate* _w = w->priv;
+	g_return_val_if_fail(_w->peak.buf[WF_LEFT], false);
+
+	if(!wf_create_cache_dir()) return false;
+
+	g_autofree char* cwd = g_get_current_dir();
+	g_autofree char* path = g_path_is_absolute(filename) ? g_strdup(filename) : g_build_filename(cwd, filename, NULL);
+	g_autofree char* peak_filename = waveform_get_peak_filename(path);
+	if(!peak_filename) return false;
+
+	g_autofree char* basename = g_path_get_basename(peak_filename);
+	g_autofree char* tmp_path = g_build_filename(g_get_tmp_dir(), basename, NULL);
+
+	FILE* fp = fopen(tmp_path, "wb");
+	if(!fp){
+		pwarn("cannot open %s", tmp_path);
+		return false;
+	}
+
+	int n_chans = waveform_get_n_channels(w);
+	uint32_t data_size = _w->num_peaks * n_chans * WF_PEAK_VALUES_PER_SAMPLE * sizeof(short);
+
+	guchar header[44];
+	memcpy(header, "RIFF", 4);
+	put_le32(header + 4, 36 + data_size);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_le32(header + 16, 16);
+	put_le16(header + 20, 1); // pcm
+	put_le16(header + 22, n_chans);
+	put_le32(header + 24, w->samplerate);
+	put_le32(header + 28, w->samplerate * n_chans * sizeof(short));
+	put_le16(header + 32, n_chans * sizeof(short));
+	put_le16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	put_le32(header + 40, data_size);
+
+	bool ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header);
+
+	// each peak is written as two frames, the positive values followed by the negative values
+	for(int i=0;i<_w->num_peaks && ok;i++){
+		short frame[WF_STEREO * WF_PEAK_VALUES_PER_SAMPLE];
+		for(int c=0;c<n_chans;c++){
+			frame[2 * c    ] = GINT16_TO_LE(_w->peak.buf[c][2 * i    ]);
+			frame[2 * c + 1] = GINT16_TO_LE(_w->peak.buf[c][2 * i + 1]);
+		}
+		ok = fwrite(frame, sizeof(short), 2 * n_chans, fp) == 2 * n_chans;
+	}
+
+	if(fclose(fp)) ok = false;
+
+	if(ok){
+		WfPeakMeta meta = peakfile_make_meta(path, &(WfAudioInfo){.channels = n_chans, .sample_rate = w->samplerate, .bit_depth = 16}, w->n_frames);
+		const WfBlockSummary* total = waveform_get_block_summary(w, -1);
+		ok = peakfile_write_meta(tmp_path, &meta)
+			&& total && peakfile_write_summary_entries(tmp_path, total, total + 1, _w->n_blocks);
+	}
+
+	if(ok){
+		GError* error = NULL;
+		GFile* tmp_file = g_file_new_for_path(tmp_path);
+		GFile* peak_file = g_file_new_for_path(peak_filename);
+		if(!g_file_move(tmp_file, peak_file, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, &error)){
+			pwarn("could not move peak file to %s: %s", peak_filename, error->message);
+			g_error_free(error);
+			ok = false;
+		}
+		g_object_unref(tmp_file);
+		g_object_unref(peak_file);
+	}
+
+	if(!ok) g_unlink(tmp_path);
+
+	return ok;
+}
+
+
 #ifdef USE_FFMPEG
 #include "libavformat/avformat.h"
 #include "libavformat/avio.h"
@@ -453,6 +990,9 @@ wf_ff_peakgen (const char* infilename, const char* peak_filename)
 		.size = n_blocks * WF_PEAK_RATIO
 	};
 
+	Summary summary = {.blocks = g_array_new(false, true, sizeof(WfBlockSummary))};
+	int n_peaks = 0;
+
 	int readcount;
 	int total_readcount = 0;
 	while ((readcount = ad_read_short(&f, &buf))) {
@@ -466,6 +1006,9 @@ wf_ff_peakgen (const char* infilename, const char* peak_filename)
 			WfPeakSample w[N_CHANNELS];
 
 			memset(peak, 0, sizeof(WfPeakSample) * N_CHANNELS);
+			double sum_sq = 0;
+			int n_samples = 0;
+			int n_clipped = 0;
 
 			for (int k = 0; k < MIN(remaining, WF_PEAK_RATIO); k += N_CHANNELS) {
 				int c; for(c=0;c<N_CHANNELS;c++){
@@ -474,7 +1017,10 @@ wf_ff_peakgen (const char* infilename, const char* peak_filename)
 						MAX(peak[c].positive, val),
 						MIN(peak[c].negative, MAX(val, -32767)), // TODO value of SHRT_MAX messes up the rendering - why?
 					};
+					sum_sq += (double)val * val;
+					n_clipped += (val >= 32767 || val <= -32767);
 				}
+				n_samples += N_CHANNELS;
 			};
 			remaining -= WF_PEAK_RATIO;
 			int c; for(c=0;c<N_CHANNELS;c++){
@@ -483,7 +1029,9 @@ wf_ff_peakgen (const char* infilename, const char* peak_filename)
 					MAX(total[c].positive, w[c].positive),
 					MIN(total[c].negative, w[c].negative),
 				};
+				summary_add(&summary, n_peaks, w[c], c ? 0 : sum_sq, c ? 0 : n_samples, c ? 0 : n_clipped);
 			}
+			n_peaks++;
 
 #ifdef USE_FFMPEG
 			/*
@@ -525,6 +1073,8 @@ wf_ff_peakgen (const char* infilename, const char* peak_filename)
 	}
 #endif
 
+	WfPeakMeta meta = peakfile_make_meta(infilename, &f.info, total_readcount);
+
 	if (total_frames_written / WF_PEAK_VALUES_PER_SAMPLE != f.info.frames / WF_PEAK_RATIO + (f.info.frames % WF_PEAK_RATIO ? 1 : 0)) {
 		if (total_frames_written) {
 			pwarn("unexpected number of frames written: wrote %i, expected %"PRIu64,
@@ -558,6 +1108,10 @@ wf_ff_peakgen (const char* infilename, const char* peak_filename)
 #endif
 
 	if (total_readcount) {
+		peakfile_write_meta(tmp_path, &meta);
+		peakfile_write_summary(tmp_path, &summary);
+		g_array_free(summary.blocks, true);
+
 		GError* err = NULL;
 		GFile* tmp_file = g_file_new_for_path(tmp_path);
 		GFile* peak_file = g_file_new_for_path(peak_filename);
@@ -572,6 +1126,7 @@ wf_ff_peakgen (const char* infilename, const char* peak_filename)
 		}
 	} else {
 		pwarn("failed to read from file %s", infilename);
+		g_array_free(summary.blocks, true);
 #ifdef USE_FFMPEG
 		ad_close(&f);
 		ad_free_nfo(&f.info);
@@ -585,286 +1140,6 @@ wf_ff_peakgen (const char* infilename, const char* peak_filename)
 }
 
 
-static bool
-wf_ff_peakgen_split_stereo (const char* infilename, const char* peak_filename)
-{
-#if defined(USE_FFMPEG) || defined(USE_SNDFILE)
-	WfDecoder f = {{0,}};
-	WfDecoder f2 = {{0,}};
-
-	char infilename2[256] = {0,};
-	waveform_get_rhs(infilename, infilename2);
-
-	if (!ad_open(&f, infilename)) return false;
-	if (!ad_open(&f2, infilename2)) return false;
-
-	gchar* basename = g_path_get_basename(peak_filename);
-	gchar* tmp_path = g_build_filename(g_get_tmp_dir(), basename, NULL);
-	g_free(basename);
-
-#ifdef USE_FFMPEG
-	OutputStream output_stream = {0,};
-
-	AVFormatContext* format_context;
-	avformat_alloc_output_context2(&format_context, av_guess_format("wav", NULL, "audio/x-wav"), NULL, NULL);
-
-	avio_open(&format_context->pb, tmp_path, AVIO_FLAG_READ_WRITE);
-	if (!format_context->pb) {
-		FAIL("could not open for writing");
-	}
-
-	const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_PCM_S16LE);
-	if (!codec) {
-		pwarn("codec not found");
-		return false;
-	}
-
-	AVStream* stream = avformat_new_stream(format_context, NULL);
-	if (!stream) {
-		pwarn("could not alloc stream");
-		return false;
-	}
-
-	//av_dump_format(format_context, 0, tmp_file, 1);
-
-	AVCodecContext* c = output_stream.encoder = avcodec_alloc_context3(codec);
-	if (!c) {
-		pwarn("Could not alloc an encoding context");
-		return false;
-	}
-
-#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(61, 13, 0)
-	const int* formats;
-	avcodec_get_supported_config(c, codec, AV_CODEC_CONFIG_SAMPLE_FORMAT, 0, (const void**)&formats, NULL);
-	if (formats && formats[0]) {
-		c->sample_fmt = formats[0];
-	}
-#else
-	c->sample_fmt  = codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_S16;
-#endif
-	c->sample_rate = f.info.sample_rate;
-#ifdef HAVE_FFMPEG_60
-	av_channel_layout_default(&c->ch_layout, WF_STEREO);
-#else
-	c->channel_layout = AV_CH_LAYOUT_STEREO;
-	c->channels       = 2;
-#endif
-	c->bit_rate    = f.info.sample_rate * 16 * f.info.channels;
-
-	stream->time_base = (AVRational){ 1, c->sample_rate };
-
-	// some formats want stream headers to be separate
-	if (format_context->oformat->flags & AVFMT_GLOBALHEADER)
-		c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-
-	open_audio2(c, stream, &output_stream);
-
-	AVDictionary** options = NULL;
-	if (avformat_write_header(format_context, options)) {
-		pwarn("could not write header");
-		return false;
-	}
-#else
-	SNDFILE* outfile;
-	SF_INFO sfinfo = {
-		.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16,
-		.channels = f.info.channels,
-		.samplerate = f.info.sample_rate,
-	};
-
-	if (!(outfile = sf_open(tmp_path, SFM_WRITE, &sfinfo))) {
-		printf ("Not able to open output file %s.\n", tmp_path);
-		puts(sf_strerror(NULL));
-		return false;
-	}
-#endif
-
-	int total_frames_written = 0;
-#ifdef USE_FFMPEG
-	WfPeakSample total[WF_STEREO] = {0,};
-	WfPeakSample total2[WF_STEREO] = {0,};
-#else
-	WfPeakSample total[sfinfo.channels]; memset(total, 0, sizeof(WfPeakSample) * sfinfo.channels);
-	WfPeakSample total2[sfinfo.channels]; memset(total2, 0, sizeof(WfPeakSample) * sfinfo.channels);
-#endif
-
-	#define n_blocks 8
-	int read_len = WF_PEAK_RATIO * n_blocks;
-
-	int16_t data[f.info.channels][read_len];
-	WfBuf16 buf = {
-		.buf = {
-			data[0], data[1]
-		},
-		.size = n_blocks * WF_PEAK_RATIO
-	};
-	int16_t data2[f2.info.channels][read_len];
-	WfBuf16 buf2 = {
-		.buf = {
-			data2[0], data2[1]
-		},
-		.size = n_blocks * WF_PEAK_RATIO
-	};
-
-	int readcount;
-	int total_readcount = 0;
-	while ((readcount = ad_read_short(&f, &buf))) {
-				ad_read_short(&f2, &buf2);
-		total_readcount += readcount;
-		int remaining = readcount;
-
-		WfPeakSample peak[N_CHANNELS];
-		WfPeakSample peak2[N_CHANNELS];
-
-		int n = MIN(n_blocks, readcount / WF_PEAK_RATIO + (readcount % WF_PEAK_RATIO ? 1 : 0));
-		int j = 0; for(;j<n;j++){
-			WfPeakSample w[N_CHANNELS];
-			WfPeakSample w2[N_CHANNELS];
-
-			memset(peak, 0, sizeof(WfPeakSample) * N_CHANNELS);
-			memset(peak2, 0, sizeof(WfPeakSample) * N_CHANNELS);
-
-			int k; for (k = 0; k < MIN(remaining, WF_PEAK_RATIO); k += N_CHANNELS){
-				int c; for(c=0;c<N_CHANNELS;c++){
-					int16_t val = buf.buf[c][WF_PEAK_RATIO * j + k];
-					int16_t val2= buf2.buf[c][WF_PEAK_RATIO * j + k];
-					peak[c] = (WfPeakSample){
-						MAX(peak[c].positive, val),
-						MIN(peak[c].negative, MAX(val, -32767)), // TODO value of SHRT_MAX messes up the rendering - why?
-					};
-					peak2[c] = (WfPeakSample){
-						MAX(peak2[c].positive, val2),
-						MIN(peak2[c].negative, MAX(val2, -32767)), // TODO value of SHRT_MAX messes up the rendering - why?
-					};
-				}
-			};
-			remaining -= WF_PEAK_RATIO;
-			int c; for(c=0;c<N_CHANNELS;c++){
-				w[c] = peak[c];
-				w2[c] = peak2[c];
-				total[c] = (WfPeakSample){
-					MAX(total[c].positive, w[c].positive),
-					MIN(total[c].negative, w[c].negative),
-				};
-				total2[c] = (WfPeakSample){
-					MAX(total2[c].positive, w2[c].positive),
-					MIN(total2[c].negative, w2[c].negative),
-				};
-			}
-
-#ifdef USE_FFMPEG
-			/*
-			if(av_frame_make_writable(frame) < 0){
-				fprintf(stderr, "Could not make frame writable\n");
-				return false;
-			}
-			short* data = (short*)frame->data[0];
-			for(int f=0; f<frame->nb_samples; f++){
-				;
-			}
-			c = 0;
-			data[0] = w[c].positive; //TODO
-			if(!wf_ff_encode(cx, frame, pkt, fp))
-				break;
-			// flush the encoder
-			wf_ff_encode(cx, NULL, pkt, fp);
-			*/
-#endif
-
-#ifdef USE_FFMPEG
-			avio_write(format_context->pb, (unsigned char*)w, WF_PEAK_VALUES_PER_SAMPLE * f.info.channels * sizeof(short));
-													// TODO check this
-			avio_write(format_context->pb, (unsigned char*)w2, WF_PEAK_VALUES_PER_SAMPLE * f.info.channels * sizeof(short));
-			total_frames_written += WF_PEAK_VALUES_PER_SAMPLE;
-#else
-			total_frames_written += sf_writef_short (outfile, (short*)w, WF_PEAK_VALUES_PER_SAMPLE);
-#endif
-		}
-	}
-
-#if 0
-	if(f.info.channels > 1) dbg(0, "max=%i,%i min=%i,%i", total[0].positive, total[1].positive, total[0].negative, total[1].negative);
-	else dbg(0, "max=%i min=%i", total[0].positive, total[0].negative);
-#endif
-
-#ifdef DEBUG
-	if(g_str_has_suffix(infilename, ".mp3")){
-		dbg(1, "mp3");
-		f.info.frames = total_readcount; // update the estimate with the real frame count.
-	}
-#endif
-
-	if(total_frames_written / WF_PEAK_VALUES_PER_SAMPLE != f.info.frames / WF_PEAK_RATIO + (f.info.frames % WF_PEAK_RATIO ? 1 : 0)){
-		pwarn("unexpected number of frames written: wrote %i, expected %"PRIu64,
-			total_frames_written / WF_PEAK_VALUES_PER_SAMPLE,
-			f.info.frames / WF_PEAK_RATIO + (f.info.frames % WF_PEAK_RATIO ? 1 : 0)
-		);
-
-#ifdef USE_FFMPEG
-		unsigned char w[WF_PEAK_VALUES_PER_SAMPLE * WF_STEREO * sizeof(short)] = {0,};
-		while(total_frames_written / WF_PEAK_VALUES_PER_SAMPLE < f.info.frames / WF_PEAK_RATIO){
-			avio_write(format_context->pb, w, WF_PEAK_VALUES_PER_SAMPLE * f.info.channels * sizeof(short));
-			total_frames_written += WF_PEAK_VALUES_PER_SAMPLE * f.info.channels * sizeof(short);
-		}
-#endif
-	}
-
-	ad_close(&f);
-	ad_close(&f2);
-
-#ifdef USE_FFMPEG
-	av_write_trailer(format_context);
-
-	avcodec_free_context(&output_stream.encoder);
-	av_frame_free(&output_stream.frame);
-	avio_close(format_context->pb);
-	avformat_free_context(format_context);
-
-	ad_free_nfo(&f.info);
-	ad_free_nfo(&f2.info);
-#else
-	sf_close (outfile);
-#endif
-
-	if(total_readcount){
-		GError* err = NULL;
-		GFile* tmp_file = g_file_new_for_path(tmp_path);
-		GFile* peak_file = g_file_new_for_path(peak_filename);
-		g_file_move(tmp_file, peak_file, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, &err);
-		g_object_unref(tmp_file);
-		g_object_unref(peak_file);
-		g_free(tmp_path);
-
-		if(err != NULL){
-			printf("Could not move peak file to %s: %s\n", peak_filename, err->message);
-			g_error_free(err);
-			return false;
-		}
-	}else{
-		pwarn("failed to read from file %s", infilename);
-		if(!g_unlink(tmp_path)){
-			pwarn("delete failed");
-		}
-#ifdef USE_FFMPEG
-		goto f1;
-#endif
-	}
-
-	return true;
-
-#ifdef USE_FFMPEG
-f1:
-	g_free(tmp_path);
-	ad_close(&f);
-	ad_close(&f2);
-	ad_free_nfo(&f.info);
-	ad_free_nfo(&f2.info);
-	return false;
-#endif
-#endif
-}
-
-
 typedef struct {
 	char*         infilename;
 	const char*   peak_filename;
@@ -941,10 +1216,8 @@ wf_peakgen__sync (const char* infilename, const char* peak_filename, GError** er
 	g_return_val_if_fail(infilename, false);
 	PF;
 
-	bool (*fn) (const char* infilename, const char* peak_filename) = wf_ff_peakgen;
-	if (g_strrstr(infilename, "%L")) fn = wf_ff_peakgen_split_stereo;
-
-	if (!fn(infilename, peak_filename)) {
+	// split stereo files are opened by the decoder as a single stereo pair
+	if (!wf_ff_peakgen(infilename, peak_filename)) {
 		if (wf_debug) {
 #ifdef USE_SNDFILE
 			printf("peakgen: not able to open input file %s: %s\n", infilename, sf_strerror(NULL));
@@ -995,10 +1268,10 @@ process_data (short* data, int data_size_frames, int n_channels, short max[], sh
 }
 
 
-static bool
+bool
 wf_create_cache_dir ()
 {
-	gchar* path = get_cache_dir();
+	gchar* path = wf_get_cache_dir();
 	gboolean ret  = !g_mkdir_with_parents(path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP);
 	if(!ret) pwarn("cannot access cache dir: %s", path);
 	g_free(path);
@@ -1012,7 +1285,8 @@ peakbuf_allocate (Peakbuf* peakbuf, int c)
 	g_return_val_if_fail(c < WF_STEREO, NULL);
 	if(peakbuf->buf[c]){ pwarn("buffer already allocated. c=%i", c); return NULL; }
 
-	peakbuf->buf[c] = g_malloc0(sizeof(short) * peakbuf->size);
+	// not initialised. waveform_peakbuf_regen writes the whole buffer.
+	peakbuf->buf[c] = wf_pool_alloc(sizeof(short) * peakbuf->size);
 	peak_mem_size += (peakbuf->size * sizeof(short));
 
 	dbg(2, "c=%i b=%i: size=%i tot_peak_mem=%ikB", c, peakbuf->block_num, peakbuf->size, peak_mem_size / 1024);
@@ -1024,7 +1298,7 @@ void
 waveform_peakbuf_free (Peakbuf* p)
 {
 	if(p){
-		int c; for(c=0;c<WF_STEREO;c++) if(p->buf[c]) g_free0(p->buf[c]);
+		int c; for(c=0;c<WF_STEREO;c++) if(p->buf[c]) wf_pool_free(p->buf[c], sizeof(short) * p->size);
 		g_free(p);
 	}
 }
@@ -1113,6 +1387,9 @@ waveform_peakbuf_regen (Waveform* waveform, WfBuf16* audiobuf, Peakbuf* peakbuf,
 
 	*/
 
+	// the channel count is taken from the audio, not the waveform, whose file can be changed while this runs in the worker
+	int n_chans = audiobuf->buf[WF_RIGHT] ? WF_STEREO : WF_MONO;
+
 	short* buf = peakbuf->buf[WF_LEFT];
 	dbg(3, "peakbuf=%p buf0=%p", peakbuf, peakbuf->buf);
 	if(!buf){
@@ -1120,7 +1397,7 @@ waveform_peakbuf_regen (Waveform* waveform, WfBuf16* audiobuf, Peakbuf* peakbuf,
 		//peakbuf->size = wf_peakbuf_get_max_size(output_tiers);
 		peakbuf->size = audiobuf->size * WF_PEAK_VALUES_PER_SAMPLE / io_ratio;
 		dbg(2, "buf->size=%i blocksize=%i", peakbuf->size, WF_PEAK_BLOCK_SIZE * WF_PEAK_VALUES_PER_SAMPLE / io_ratio);
-		int c; for(c=0;c<waveform_get_n_channels(waveform);c++){
+		int c; for(c=0;c<n_chans;c++){
 			buf = peakbuf_allocate(peakbuf, c);
 		}
 	}
@@ -1130,12 +1407,11 @@ waveform_peakbuf_regen (Waveform* waveform, WfBuf16* audiobuf, Peakbuf* peakbuf,
 	short totplus = 0;
 	short totmin  = 0;
 
-	int n_chans = waveform_get_n_channels(waveform);
 	int c; for(c=0;c<n_chans;c++){
 		short* buf = peakbuf->buf[c];
 		WfBuf16* audio_buf = audiobuf;
 									g_return_if_fail(peakbuf->size >= WF_PEAK_BLOCK_SIZE * WF_PEAK_VALUES_PER_SAMPLE / io_ratio);
-		audio_buf->stamp = ++wf->audio.access_counter;
+		wf_audio_touch(audio_buf);
 		int i, p; for(i=0, p=0; p<WF_PEAK_BLOCK_SIZE; i++, p+= io_ratio){
 
 			process_data(&audio_buf->buf[c][p], io_ratio, 1, (short*)&maxplus, (short*)&maxmin);
@@ -1168,25 +1444,12 @@ waveform_peakbuf_regen (Waveform* waveform, WfBuf16* audiobuf, Peakbuf* peakbuf,
 }
 
 
-static bool
-wf_file_is_newer (const char* file1, const char* file2)
-{
-	//return TRUE if file1 date is newer than file2 date.
-
-	struct stat info1;
-	struct stat info2;
-	if(stat(file1, &info1)) return false;
-	if(stat(file2, &info2)) return false;
-	if(info1.st_mtime < info2.st_mtime) dbg(2, "%li %li %lu", info1.st_mtime, info2.st_mtime, sizeof(time_t));
-	return (info1.st_mtime > info2.st_mtime);
-}
-
 
-static char*
-get_cache_dir ()
+char*
+wf_get_cache_dir ()
 {
+	// this is called for each disk cache block so must not print anything
 	const gchar* env = g_getenv("XDG_CACHE_HOME");
-	if(env) dbg(0, "cache_dir=%s", env);
 	if(env) return g_strdup(env);
 
 	gchar* dir_name = g_build_filename(g_get_home_dir(), DEFAULT_USER_CACHE_DIR, NULL);
@@ -1199,7 +1462,7 @@ get_cache_dir ()
 static gboolean
 _maintain_file_cache (void* _)
 {
-	char* dir_name = get_cache_dir();
+	char* dir_name = wf_get_cache_dir();
 	dbg(2, "dir=%s", dir_name);
 	GError* error = NULL;
 	GDir* d = g_dir_open(dir_name, 0, &error);
@@ -1212,7 +1475,7 @@ _maintain_file_cache (void* _)
 	struct stat info;
 	const char* leaf;
 	while ((leaf = g_dir_read_name(d))) {
-		if (g_str_has_suffix(leaf, ".peak")) {
+		if (g_str_has_suffix(leaf, ".peak") || g_str_has_suffix(leaf, ".spec")) {
 			gchar* filename = g_build_filename(dir_name, leaf, NULL);
 			if(!stat(filename, &info)){
 				time_t days_old = (now - info.st_mtime) / (60 * 60 * 24);
@@ -1226,7 +1489,7 @@ _maintain_file_cache (void* _)
 			g_free(filename);
 		}
 	}
-	dbg(1, "peak files deleted: %i", n_deleted);
+	dbg(1, "cache files deleted: %i", n_deleted);
 
 	g_dir_close(d);
 	g_free(dir_name);
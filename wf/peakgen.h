@@ -19,4 +19,28 @@ void   waveform_peakgen_cancel        (Waveform*);
 
 bool   wf_peakgen__sync               (const char* wav, const char* peakfile, GError**);
 
+#ifdef __wf_private__
+typedef struct {
+	uint32_t version;
+	uint32_t n_channels;
+	uint32_t samplerate;
+	uint32_t bit_depth;
+	uint64_t n_frames;   // exact frame count, even for vbr files
+	uint64_t size;       // size in bytes of the source file. for a split stereo pair, the sum of both halves.
+	int64_t  mtime;      // modification time of the source file. for a split stereo pair, the later of the two.
+} WfPeakMeta;
+
+bool   wf_peakfile_read_meta          (const char* peakfile, WfPeakMeta*);
+WfBlockSummary*
+       wf_peakfile_read_summary       (const char* peakfile, int* n_blocks);
+char*  wf_get_cache_dir               ();
+bool   wf_create_cache_dir            ();
+char*  waveform_get_peak_filename     (const char* absolute_path);
+char*  wf_peakfile_lookup             (const char* absolute_path, WfPeakMeta*);
+char*  wf_peakfile_ensure__sync       (const char* absolute_path, WfPeakMeta*);
+short* wf_peakfile_read_data          (const char* peakfile, int* n_channels, int* size);
+void   waveform_set_meta              (Waveform*, WfPeakMeta*);
+bool   wf_peakfile_write              (Waveform*, const char* filename);
+#endif
+
 #endif
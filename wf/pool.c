@@ -0,0 +1,261 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Pool allocator for the fixed size buffers used for hi-res audio      |
+ | blocks and peakbufs.                                                 |
+ |                                                                      |
+ | These are allocated in the worker thread and freed in the main       |
+ | thread whenever the audio cache evicts a block, so during scrolling  |
+ | the same few sizes are continually churned. Freed buffers are kept   |
+ | on a free list for each size and reused. Memory is not zeroed unless |
+ | requested.                                                           |
+ |                                                                      |
+ | Optionally buffers can be carved from 2MB slabs that are advised to  |
+ | use transparent huge pages. Slab memory is never returned.           |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define __wf_private__
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <glib.h>
+#include "wf/debug.h"
+#include "wf/pool.h"
+
+#define MAX_CLASSES      8
+#define MIN_POOLED_SIZE  4096         // smaller allocations are passed straight to malloc
+#define SLAB_SIZE        (2 << 20)    // the size of a huge page
+#define DEFAULT_MAX_FREE (32 << 20)   // bytes of non-slab memory to retain
+
+typedef struct {
+	size_t size;
+	void*  free;                      // intrusive list. the first word of each free block points to the next
+	char*  slab_pos;                  // unused part of the current slab
+	char*  slab_end;
+} SizeClass;
+
+typedef struct {
+	char*  start;
+} Slab;
+
+static struct {
+	GMutex      mutex;
+	SizeClass   classes[MAX_CLASSES];
+	GArray*     slabs;
+	size_t      max_free;
+	size_t      heap_free;                // free bytes that are not part of a slab
+	bool        huge_pages;
+	WfPoolStats stats;
+} pool = {
+	.max_free = DEFAULT_MAX_FREE,
+};
+
+
+static SizeClass*
+get_class (size_t size)
+{
+	for (int i=0;i<pool.stats.n_classes;i++) {
+		if (pool.classes[i].size == size) return &pool.classes[i];
+	}
+	if (pool.stats.n_classes < MAX_CLASSES) {
+		SizeClass* c = &pool.classes[pool.stats.n_classes++];
+		*c = (SizeClass){.size = size};
+		return c;
+	}
+	return NULL;
+}
+
+
+static bool
+is_slab (void* p)
+{
+	if (pool.slabs) {
+		for (int i=0;i<pool.slabs->len;i++) {
+			char* start = g_array_index(pool.slabs, Slab, i).start;
+			if ((char*)p >= start && (char*)p < start + SLAB_SIZE) return true;
+		}
+	}
+	return false;
+}
+
+
+static void*
+slab_alloc (SizeClass* c)
+{
+	if (c->slab_pos + c->size > c->slab_end) {
+		void* mem;
+		if (posix_memalign(&mem, SLAB_SIZE, SLAB_SIZE)) {
+			pwarn("slab allocation failed");
+			return NULL;
+		}
+#ifdef MADV_HUGEPAGE
+		madvise(mem, SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+		if (!pool.slabs) pool.slabs = g_array_new(false, false, sizeof(Slab));
+		g_array_append_val(pool.slabs, ((Slab){mem}));
+		pool.stats.slab += SLAB_SIZE;
+
+		c->slab_pos = mem;
+		c->slab_end = c->slab_pos + (SLAB_SIZE / c->size) * c->size;
+	}
+
+	void* p = c->slab_pos;
+	c->slab_pos += c->size;
+
+	return p;
+}
+
+
+/*
+ *  The returned memory is not initialised.
+ */
+void*
+wf_pool_alloc (size_t size)
+{
+	if (size < MIN_POOLED_SIZE) return g_malloc(size);
+
+	void* p = NULL;
+
+	g_mutex_lock(&pool.mutex);
+
+	pool.stats.n_allocs++;
+	pool.stats.in_use += size;
+
+	SizeClass* c = get_class(size);
+	if (c) {
+		if ((p = c->free)) {
+			c->free = *(void**)p;
+			pool.stats.free -= size;
+			if (!is_slab(p)) pool.heap_free -= size;
+			pool.stats.n_reused++;
+		} else if (pool.huge_pages && size <= SLAB_SIZE / 2) {
+			p = slab_alloc(c);
+		}
+	}
+
+	g_mutex_unlock(&pool.mutex);
+
+	return p ? p : g_malloc(size);
+}
+
+
+void*
+wf_pool_alloc0 (size_t size)
+{
+	return memset(wf_pool_alloc(size), 0, size);
+}
+
+
+/*
+ *  @size must be the same as when the memory was allocated.
+ */
+void
+wf_pool_free (void* p, size_t size)
+{
+	if (!p) return;
+	if (size < MIN_POOLED_SIZE) {
+		g_free(p);
+		return;
+	}
+
+	g_mutex_lock(&pool.mutex);
+
+	pool.stats.in_use -= size;
+
+	SizeClass* c = get_class(size);
+	bool slab = is_slab(p);
+	bool keep = c && (slab || pool.heap_free + size <= pool.max_free);
+	if (keep) {
+		*(void**)p = c->free;
+		c->free = p;
+		pool.stats.free += size;
+		if (!slab) pool.heap_free += size;
+	}
+
+	g_mutex_unlock(&pool.mutex);
+
+	if (!keep) g_free(p);
+}
+
+
+static void
+pool_trim (size_t max)
+{
+	g_mutex_lock(&pool.mutex);
+
+	for (int i=0;i<pool.stats.n_classes && pool.heap_free > max;i++) {
+		SizeClass* c = &pool.classes[i];
+		void** prev = &c->free;
+		for (void* p = c->free; p && pool.heap_free > max;) {
+			void* next = *(void**)p;
+			if (is_slab(p)) {
+				prev = (void**)p;
+			} else {
+				*prev = next;
+				pool.stats.free -= c->size;
+				pool.heap_free -= c->size;
+				g_free(p);
+			}
+			p = next;
+		}
+	}
+
+	g_mutex_unlock(&pool.mutex);
+}
+
+
+/*
+ *  Set the maximum amount of freed memory that is kept for reuse.
+ *  This does not include memory in huge page slabs.
+ */
+void
+wf_pool_set_max_free (size_t bytes)
+{
+	pool.max_free = bytes;
+	pool_trim(bytes);
+}
+
+
+/*
+ *  If enabled, subsequent buffers are taken from 2MB slabs advised to use
+ *  transparent huge pages. This reduces tlb misses when scanning large amounts
+ *  of audio, but the memory is held by the pool for the life of the process.
+ */
+void
+wf_pool_set_huge_pages (bool enable)
+{
+	pool.huge_pages = enable;
+}
+
+
+WfPoolStats
+wf_pool_get_stats ()
+{
+	g_mutex_lock(&pool.mutex);
+	WfPoolStats stats = pool.stats;
+	g_mutex_unlock(&pool.mutex);
+
+	return stats;
+}
+
+
+/*
+ *  Release all retained memory that is not part of a slab.
+ */
+void
+wf_pool_trim ()
+{
+	pool_trim(0);
+}
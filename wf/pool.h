@@ -0,0 +1,37 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+
+typedef struct {
+	size_t   in_use;        // bytes currently allocated from the pool
+	size_t   free;          // bytes held by the pool for reuse
+	size_t   slab;          // bytes allocated as huge page slabs
+	uint64_t n_allocs;      // total number of allocation requests
+	uint64_t n_reused;      // number of allocations satisfied from the free lists
+	int      n_classes;     // number of distinct block sizes seen
+} WfPoolStats;
+
+void        wf_pool_set_max_free   (size_t bytes);
+void        wf_pool_set_huge_pages (bool);
+WfPoolStats wf_pool_get_stats      ();
+void        wf_pool_trim           ();
+
+#ifdef __wf_private__
+void*       wf_pool_alloc          (size_t);
+void*       wf_pool_alloc0         (size_t);
+void        wf_pool_free           (void*, size_t);
+#endif
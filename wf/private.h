@@ -30,6 +30,7 @@
 #define WF_SAMPLES_PER_TEXTURE (WF_PEAK_RATIO * (WF_PEAK_TEXTURE_SIZE - 2 * TEX_BORDER))
 #define WF_MAX_AUDIO_BLOCKS (ULLONG_MAX / WF_SAMPLES_PER_TEXTURE)
 #define WF_MAX_BLOCK_RANGE 512 // to prevent performance and resource consumption issues caused by rendering too many blocks simultaneously.
+#define WF_SILENCE_LEVEL 4 // blocks with a lower peak level are considered silent (about -78dBFS)
 
 #define WF_TEXTURE0 GL_TEXTURE1 //0 is not used
 #define WF_TEXTURE1 GL_TEXTURE2
@@ -39,6 +40,10 @@
 #define TEX_BORDER 2
 #define TEX_BORDER_HI (TEX_BORDER * 16.0) // HI has a different border size in order to preserve block boundaries between changes in resolution.
 
+// n_frames can be read in any thread. It is set last so that readers can see that the other file properties are set.
+#define N_FRAMES_GET(W) __atomic_load_n(&(W)->n_frames, __ATOMIC_ACQUIRE)
+#define N_FRAMES_SET(W, N) __atomic_store_n(&(W)->n_frames, (N), __ATOMIC_RELEASE)
+
 #define TIERS_TO_RESOLUTION(T) (256 / (1 << T))
 #define RESOLUTION_TO_TIERS(R) (8 - (int)floor(log2(R)))
 
@@ -90,6 +95,13 @@ struct _WfAudioData {
 	int                n_blocks;          // the size of the buf array
 	WfBuf16**          buf16;             // pointers to arrays of blocks, one per block.
 	int                n_tiers_present;
+	struct _WfAudioMap* map;              // set if the file is uncompressed pcm that can be read directly.
+	char*              disk_key;          // identifies the file in the disk cache.
+	bool               map_tried;
+	GArray*            ready;             // blocks loaded since the last "blocks-ready" signal.
+	WfAudioBlock**     blocks;            // snapshots published for other threads. see waveform_get_audio_block()
+	int                n_published;       // the size of the blocks array. both are only changed while holding all the block locks.
+	int                generation;        // incremented when the file is changed so that results for the old file can be dropped.
 };
 
 struct _WaveformPrivate
@@ -106,16 +118,23 @@ struct _WaveformPrivate
 	int             num_peaks;      // peak_buflen / PEAK_VALUES_PER_SAMPLE
 	int             n_blocks;
 	short           max_db;         // TODO should be in db?
+	WfBlockSummary* summary;        // the whole file followed by each texture block. n_blocks + 1 items.
 
 	                                // render_data is owned, managed, and shared by all the WfActor's using this waveform.
 	WaveformModeRender* render_data[N_MODES];
 
 	WaveformState   state : 4;
+	gint            peaks_published; // the peak buffers can be read from other threads
+
+	char*           registry_key;   // set if the Waveform is shared. see waveform_new_shared()
+	struct _WfLive* live;           // set if the Waveform is fed from memory. see waveform_new_live()
+	struct _WfSpectrogram* spectrogram; // see waveform_load_spectrogram()
 };
 
 struct _WfWorker {
     GAsyncQueue*  msg_queue;
     GList*        jobs;
+    gpointer      done;           // completed jobs waiting for the main thread. lock-free stack
 };
 
 struct _wf
@@ -123,6 +142,7 @@ struct _wf
 	const char*     domain;
 	int             peak_mem_size;
 	GHashTable*     peak_cache;
+	GHashTable*     registry;       // shared Waveforms keyed by file identity
 	PeakLoader      load_peak;
 
 	struct
@@ -201,10 +221,12 @@ Peakbuf*       waveform_get_peakbuf_n      (Waveform*, int);
 void           waveform_peakbuf_assign     (Waveform*, int block_num, Peakbuf*);
 void           waveform_peakbuf_regen      (Waveform*, WfBuf16*, Peakbuf*, int block_num, int min_output_resolution);
 void           waveform_peakbuf_free       (Peakbuf*);
+void           waveform_set_sf_data        (Waveform*, uint64_t n_frames, int n_channels, int samplerate);
 int            waveform_get_n_audio_blocks (Waveform*);
 void           waveform_print_blocks       (Waveform*);
 
 void           waveform_audio_free         (Waveform*);
+void           waveform_audio_free_blocks  (Waveform*);
 
 void           waveform_get_rhs            (const char* left, char* right);
 
@@ -0,0 +1,238 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Per-frame render statistics.                                         |
+ |                                                                      |
+ | Counters are accumulated into the current frame until                |
+ | wf_profile_frame_end() is called, after which the frame is moved     |
+ | into a fixed size history. Phase timings are also kept as individual |
+ | spans, the most recent of which are kept so that they can be         |
+ | exported as a Chrome trace.                                          |
+ |                                                                      |
+ | Profiling is disabled by default and when disabled the cost is a     |
+ | single test per counter.                                             |
+ |                                                                      |
+ | The stats are not locked. They are only counted in the thread that   |
+ | called wf_profile_enable(), normally the main thread that renders.   |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define __wf_private__
+
+#include "config.h"
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "wf/debug.h"
+#include "wf/waveform.h"
+#include "wf/profile.h"
+
+#define WF_PROFILE_MAX_SPANS 65536
+
+G_STATIC_ASSERT(WF_PROFILE_N_MODES == N_MODES);
+
+bool         wf_profile_enabled = false;
+GThread*     wf_profile_thread  = NULL;
+WfFrameStats wf_profile_frame   = {0,};
+
+typedef struct {
+	WfProfilePhase phase;
+	int64_t        start;
+	int64_t        duration;
+} Span;
+
+static struct {
+	WfFrameStats frames[WF_PROFILE_MAX_FRAMES]; // ring buffer
+	uint64_t     n_frames;                      // total number of frames completed
+	GArray*      spans;                         // ring buffer once full
+	uint64_t     n_spans;                       // total number of spans added
+} profile;
+
+static const char* phase_names[] = {"calc_render_info", "render", "load_block", "upload"};
+static const char* mode_names[] = {"V_LOW", "LOW", "MED", "HI", "V_HI"};
+
+
+void
+wf_profile_enable (bool enable)
+{
+	if (enable && !wf_profile_enabled) {
+		wf_profile_reset();
+	}
+	wf_profile_thread = g_thread_self();
+	wf_profile_enabled = enable;
+}
+
+
+void
+wf_profile_reset ()
+{
+	profile.n_frames = 0;
+	profile.n_spans = 0;
+	if (profile.spans) g_array_set_size(profile.spans, 0);
+	wf_profile_frame = (WfFrameStats){
+		.start_time = g_get_monotonic_time()
+	};
+}
+
+
+/*
+ *  Close the current frame. This is called automatically by WaveformContext
+ *  when it is not using a frame clock, otherwise the application must call
+ *  it once after each frame has been drawn.
+ */
+void
+wf_profile_frame_end ()
+{
+	if (!wf_profile_enabled) return;
+
+	int64_t now = g_get_monotonic_time();
+
+	wf_profile_frame.frame = profile.n_frames;
+	wf_profile_frame.end_time = now;
+	profile.frames[profile.n_frames++ % WF_PROFILE_MAX_FRAMES] = wf_profile_frame;
+
+	wf_profile_frame = (WfFrameStats){
+		.start_time = now
+	};
+}
+
+
+void
+wf_profile_phase_add (WfProfilePhase phase, int64_t start)
+{
+	int64_t duration = g_get_monotonic_time() - start;
+
+	wf_profile_frame.phase_time[phase] += duration;
+
+	if (!profile.spans) profile.spans = g_array_new(false, false, sizeof(Span));
+	Span span = {phase, start, duration};
+	if (profile.spans->len < WF_PROFILE_MAX_SPANS) {
+		g_array_append_val(profile.spans, span);
+	} else {
+		// the oldest span is replaced
+		g_array_index(profile.spans, Span, profile.n_spans % WF_PROFILE_MAX_SPANS) = span;
+	}
+	profile.n_spans++;
+}
+
+
+/*
+ *  Returns the number of completed frames available in the history.
+ */
+int
+wf_profile_get_n_frames ()
+{
+	return MIN(profile.n_frames, WF_PROFILE_MAX_FRAMES);
+}
+
+
+/*
+ *  Index 0 is the most recently completed frame.
+ */
+const WfFrameStats*
+wf_profile_get_frame (int i)
+{
+	g_return_val_if_fail(i >= 0 && i < wf_profile_get_n_frames(), NULL);
+
+	return &profile.frames[(profile.n_frames - 1 - i) % WF_PROFILE_MAX_FRAMES];
+}
+
+
+static void
+append_frame_json (GString* s, const WfFrameStats* f)
+{
+	g_string_append_printf(s,
+		"{\"frame\": %"G_GUINT64_FORMAT", \"time\": %"G_GINT64_FORMAT", \"duration\": %"G_GINT64_FORMAT", "
+		"\"draw_calls\": %i, \"texture_binds\": %i, \"bytes_uploaded\": %zu, "
+		"\"fall_throughs\": %i, \"render_info_invalidations\": %i, \"render_info_hits\": %i, \"actor_paints\": %i, "
+		"\"audio_cache_hits\": %i, \"audio_cache_misses\": %i, \"peak_cache_hits\": %i, \"peak_cache_misses\": %i, ",
+		f->frame, f->start_time, f->end_time - f->start_time,
+		f->draw_calls, f->texture_binds, f->bytes_uploaded,
+		f->fall_throughs, f->render_info_invalidations, f->render_info_hits, f->actor_paints,
+		f->audio_cache_hits, f->audio_cache_misses, f->peak_cache_hits, f->peak_cache_misses
+	);
+
+	g_string_append(s, "\"blocks\": {");
+	for (int m=0;m<WF_PROFILE_N_MODES;m++) {
+		g_string_append_printf(s, "%s\"%s\": %i", m ? ", " : "", mode_names[m], f->blocks[m]);
+	}
+	g_string_append(s, "}, \"phases\": {");
+	for (int p=0;p<WF_PROFILE_N_PHASES;p++) {
+		g_string_append_printf(s, "%s\"%s\": %"G_GINT64_FORMAT, p ? ", " : "", phase_names[p], f->phase_time[p]);
+	}
+	g_string_append(s, "}}");
+}
+
+
+/*
+ *  Returns the frame history, oldest first, as a JSON array.
+ *  Caller must g_free the result.
+ */
+char*
+wf_profile_to_json ()
+{
+	GString* s = g_string_new("[");
+
+	int n = wf_profile_get_n_frames();
+	for (int i=n-1;i>=0;i--) {
+		append_frame_json(s, wf_profile_get_frame(i));
+		if (i) g_string_append(s, ",\n");
+	}
+	g_string_append(s, "]\n");
+
+	return g_string_free(s, false);
+}
+
+
+/*
+ *  Write the frame history in the Chrome trace event format,
+ *  for viewing with chrome://tracing or Perfetto.
+ */
+bool
+wf_profile_write_chrome_trace (const char* filename, GError** error)
+{
+	GString* s = g_string_new("{\"traceEvents\": [\n");
+
+	int n = wf_profile_get_n_frames();
+	for (int i=n-1;i>=0;i--) {
+		const WfFrameStats* f = wf_profile_get_frame(i);
+
+		g_string_append_printf(s,
+			"{\"name\": \"frame %"G_GUINT64_FORMAT"\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %"G_GINT64_FORMAT", \"dur\": %"G_GINT64_FORMAT"},\n",
+			f->frame, f->start_time, f->end_time - f->start_time
+		);
+		g_string_append_printf(s,
+			"{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"ts\": %"G_GINT64_FORMAT", \"args\": "
+			"{\"draw_calls\": %i, \"texture_binds\": %i, \"bytes_uploaded\": %zu, \"fall_throughs\": %i, \"invalidations\": %i}},\n",
+			f->start_time, f->draw_calls, f->texture_binds, f->bytes_uploaded, f->fall_throughs, f->render_info_invalidations
+		);
+	}
+
+	if (profile.spans && profile.spans->len) {
+		// oldest first
+		int first = profile.n_spans % profile.spans->len;
+		for (int i=0;i<profile.spans->len;i++) {
+			Span* span = &g_array_index(profile.spans, Span, (first + i) % profile.spans->len);
+			g_string_append_printf(s,
+				"{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 2, \"ts\": %"G_GINT64_FORMAT", \"dur\": %"G_GINT64_FORMAT"},\n",
+				phase_names[span->phase], span->start, span->duration
+			);
+		}
+	}
+
+	// the trailing comma is not permitted so end with a metadata event
+	g_string_append(s, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"libwaveform\"}}\n]}\n");
+
+	bool ok = g_file_set_contents(filename, s->str, s->len, error);
+	g_string_free(s, true);
+
+	return ok;
+}
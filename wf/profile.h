@@ -0,0 +1,71 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+
+#define WF_PROFILE_N_MODES    5   // must match N_MODES
+#define WF_PROFILE_MAX_FRAMES 256 // size of the frame history
+
+typedef enum {
+	WF_PHASE_CALC_RENDER_INFO = 0,
+	WF_PHASE_RENDER,
+	WF_PHASE_LOAD_BLOCK,
+	WF_PHASE_UPLOAD,
+	WF_PROFILE_N_PHASES
+} WfProfilePhase;
+
+typedef struct {
+	uint64_t frame;
+	int64_t  start_time;                       // usecs (monotonic)
+	int64_t  end_time;
+
+	int      draw_calls;
+	int      texture_binds;                    // waveform, spectrogram and text textures. textures that are created once, eg fbo backgrounds, are not included
+	size_t   bytes_uploaded;                   // as for texture_binds
+	int      blocks[WF_PROFILE_N_MODES];       // number of blocks rendered for each mode
+	int      fall_throughs;                    // number of times a block was retried with a lower mode
+	int      render_info_invalidations;        // calc_render_info was needed
+	int      render_info_hits;                 // the existing RenderInfo was used
+	int      actor_paints;                     // WaveformActors painted, ie not composited from a cache
+	int      audio_cache_hits;
+	int      audio_cache_misses;
+	int      peak_cache_hits;                  // peakfile was current
+	int      peak_cache_misses;                // peakfile had to be generated
+
+	int64_t  phase_time[WF_PROFILE_N_PHASES];  // usecs
+} WfFrameStats;
+
+void                wf_profile_enable             (bool);
+void                wf_profile_reset              ();
+void                wf_profile_frame_end          ();
+int                 wf_profile_get_n_frames       ();
+const WfFrameStats* wf_profile_get_frame          (int);
+char*               wf_profile_to_json            ();
+bool                wf_profile_write_chrome_trace (const char* filename, GError**);
+
+#ifdef __wf_private__
+extern bool         wf_profile_enabled;
+extern GThread*     wf_profile_thread;
+extern WfFrameStats wf_profile_frame;
+
+void                wf_profile_phase_add          (WfProfilePhase, int64_t start);
+
+// the frame stats are only counted in the thread that enabled profiling. Work done in other threads, eg batch exports, is not included.
+#define WF_PROFILE_ON() (wf_profile_enabled && g_thread_self() == wf_profile_thread)
+#define WF_PROFILE_ADD(FIELD, N) G_STMT_START{ if (WF_PROFILE_ON()) wf_profile_frame.FIELD += (N); }G_STMT_END
+#define WF_PROFILE_PHASE_START(P) int64_t _profile_##P = WF_PROFILE_ON() ? g_get_monotonic_time() : 0
+#define WF_PROFILE_PHASE_END(P) G_STMT_START{ if (wf_profile_enabled && _profile_##P) wf_profile_phase_add(P, _profile_##P); }G_STMT_END
+#endif
@@ -0,0 +1,987 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Shared peak service.                                                 |
+ |                                                                      |
+ | When several processes show the same files, the peaks and hi-res     |
+ | audio blocks can be loaded once by a service and shared with each    |
+ | client as memfd segments over a Unix socket. Clients map the         |
+ | segments directly so that the data is not copied.                    |
+ |                                                                      |
+ | The service is optional. Any process can host it by calling          |
+ | wf_service_start(). Clients opt in with wf_service_connect(). If no  |
+ | service is connected, or a request fails, the normal in-process      |
+ | loading is used.                                                     |
+ |                                                                      |
+ | Peak segments are held until the last client that was sent them     |
+ | disconnects. Block segments are held in a small lru cache. Clients   |
+ | keep their mappings after a segment is dropped by the service.       |
+ | Segments are sealed so that they cannot be modified once shared.     |
+ |                                                                      |
+ | Split stereo files are not handled by the service.                   |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define _GNU_SOURCE
+#define __wf_private__
+#include "config.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "decoder/ad.h"
+#include "wf/debug.h"
+#include "wf/waveform.h"
+#include "wf/worker.h"
+#include "wf/peakgen.h"
+#include "wf/service.h"
+
+#define MAX_BLOCK_SEGMENTS 64 // 16MB for stereo files
+
+typedef enum {
+	REQUEST_PEAKS = 1,
+	REQUEST_BLOCK,
+} RequestType;
+
+typedef struct {
+	uint32_t   type;
+	int32_t    block;
+	uint32_t   filename_len;   // the filename follows
+} Request;
+
+typedef struct {
+	int32_t    ok;
+	uint32_t   n_channels;
+	uint32_t   size;           // values per channel
+	uint32_t   stride;         // bytes from the start of one channel to the next
+	WfPeakMeta meta;
+	uint32_t   path_len;       // the peakfile name follows. The segment is attached
+} Reply;
+
+typedef struct {
+	int        fd;
+	Reply      reply;
+	char*      peakfile;
+	char*      key;            // peak segments only. Owned by the hash table
+	int        n_clients;      // peak segments only
+	bool       ready;          // segments are added to the table before they are generated
+} Segment;
+
+typedef struct {
+	WfService* service;
+	int        fd;
+	GPtrArray* peaks;          // the peak segments sent to the client
+} Client;
+
+struct _WfService {
+	char*          path;
+	int            fd;
+	GThread*       thread;        // accepts new clients. Each client has its own thread
+	GMutex         lock;          // protects the client list
+	GCond          cond;
+	GPtrArray*     clients;
+	bool           stopping;
+	struct {
+		GMutex      lock;
+		GCond       cond;         // signalled when a segment is ready, so that each file is only processed once
+		GHashTable* segments;
+	}              peaks;
+	struct {
+		GMutex      lock;
+		GCond       cond;         // signalled when a block is ready, so that each block is only decoded once
+		GHashTable* segments;
+		GQueue      lru;          // keys owned by the hash table, most recent first. Blocks being decoded are not included.
+	}              blocks;
+	WfServiceStats stats;         // updated atomically as the counters are incremented under different locks
+};
+
+typedef struct {
+	void*      data;
+	size_t     size;
+	int        n_refs;            // one for each channel buffer
+} Mapping;
+
+static struct {
+	int         fd;
+	GMutex      lock;             // one request at a time
+	GMutex      segments_lock;
+	GHashTable* segments;         // channel buffer -> Mapping
+	WfWorker    worker;
+} client = {.fd = -1};
+
+
+static bool
+write_all (int fd, const void* buf, size_t len)
+{
+	while(len){
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+
+static bool
+read_all (int fd, void* buf, size_t len)
+{
+	while(len){
+		ssize_t n = recv(fd, buf, len, 0);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+
+static size_t
+page_align (size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	return (size + page - 1) & ~(page - 1);
+}
+
+
+static bool
+send_reply (int fd, const Reply* reply, const char* path, int segment)
+{
+	union {
+		char           buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+
+	struct iovec iov = {(void*)reply, sizeof(Reply)};
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+
+	if(segment > -1){
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &segment, sizeof(int));
+	}
+
+	ssize_t n;
+	while((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+	if(n < 0) return false;
+	if(n < sizeof(Reply) && !write_all(fd, (char*)reply + n, sizeof(Reply) - n)) return false;
+
+	return !reply->path_len || write_all(fd, path, reply->path_len);
+}
+
+
+static bool
+recv_reply (int fd, Reply* reply, char** path, int* segment)
+{
+	union {
+		char           buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+
+	struct iovec iov = {reply, sizeof(Reply)};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf)
+	};
+
+	*segment = -1;
+	*path = NULL;
+
+	ssize_t n;
+	while((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+	if(n <= 0) return false;
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+		memcpy(segment, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	if(n < sizeof(Reply) && !read_all(fd, (char*)reply + n, sizeof(Reply) - n)) goto fail;
+
+	if(reply->path_len){
+		if(reply->path_len > PATH_MAX) goto fail;
+		*path = g_malloc0(reply->path_len + 1);
+		if(!read_all(fd, *path, reply->path_len)) goto fail;
+	}
+
+	return true;
+
+  fail:
+	if(*segment > -1) close(*segment);
+	*segment = -1;
+	g_clear_pointer(path, g_free);
+	return false;
+}
+
+
+static char*
+absolute_filename (const char* filename)
+{
+	if(g_path_is_absolute(filename)) return g_strdup(filename);
+
+	g_autofree char* cwd = g_get_current_dir();
+	return g_build_filename(cwd, filename, NULL);
+}
+
+
+/*
+ *  The key includes the size and modification time so that modified files are reloaded.
+ */
+static char*
+file_key (const char* filename)
+{
+	GStatBuf info;
+	if(g_stat(filename, &info)) return NULL;
+
+	return g_strdup_printf("%s:%"PRIi64":%"PRIi64, filename, (int64_t)info.st_size, (int64_t)info.st_mtime);
+}
+
+
+//------------------------------------------------------------------------
+// service
+
+static int
+segment_new (const char* name, size_t size, void** data)
+{
+	int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(fd < 0){
+		pwarn("memfd_create failed: %s", g_strerror(errno));
+		return -1;
+	}
+
+	if(ftruncate(fd, size) || (*data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED){
+		pwarn("failed to create segment: %s", g_strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/*
+ *  Once filled, the segment is unmapped and sealed. Clients can then rely on it not changing.
+ */
+static void
+segment_seal (int fd, void* data, size_t size)
+{
+	munmap(data, size);
+
+	if(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)){
+		pwarn("failed to seal segment: %s", g_strerror(errno));
+	}
+}
+
+
+static void
+segment_free (gpointer _segment)
+{
+	Segment* segment = _segment;
+
+	if(segment->fd > -1) close(segment->fd);
+	g_free(segment->peakfile);
+	g_free(segment);
+}
+
+
+/*
+ *  Returns the peak segment for the file, generating the peakfile if needed.
+ *  The segment is held for the client until it disconnects.
+ *
+ *  The lock is only held to look up and add segments so that files can be
+ *  processed in parallel. A request for a file that is already being processed
+ *  waits for it to be ready.
+ */
+static Segment*
+service_get_peaks (WfService* service, Client* c, const char* filename)
+{
+	char* key = file_key(filename);
+	if(!key) return NULL;
+
+	void add_client (Segment* segment)
+	{
+		if(!g_ptr_array_find(c->peaks, segment, NULL)){
+			g_ptr_array_add(c->peaks, segment);
+			segment->n_clients++;
+		}
+	}
+
+	g_mutex_lock(&service->peaks.lock);
+
+	Segment* segment = g_hash_table_lookup(service->peaks.segments, key);
+	if(segment){
+		// the segment is removed if the peaks cannot be loaded, so is looked up again after waiting
+		while(segment && !segment->ready){
+			g_cond_wait(&service->peaks.cond, &service->peaks.lock);
+			segment = g_hash_table_lookup(service->peaks.segments, key);
+		}
+		if(segment){
+			__atomic_fetch_add(&service->stats.n_hits, 1, __ATOMIC_RELAXED);
+			add_client(segment);
+		}
+		g_mutex_unlock(&service->peaks.lock);
+		g_free(key);
+		return segment;
+	}
+
+	segment = WF_NEW(Segment, .fd = -1, .key = key);
+	g_hash_table_insert(service->peaks.segments, key, segment);
+
+	g_mutex_unlock(&service->peaks.lock);
+
+	WfPeakMeta meta;
+	char* peakfile = wf_peakfile_ensure__sync(filename, &meta);
+	int n_channels, size;
+	short* data = peakfile ? wf_peakfile_read_data(peakfile, &n_channels, &size) : NULL;
+
+	size_t stride = 0;
+	if(data){
+		stride = page_align(size * sizeof(short));
+		void* mem;
+		if((segment->fd = segment_new("wf-peaks", stride * n_channels, &mem)) > -1){
+			// de-interleave. Each peak is stored as the positive and negative values for each channel in turn.
+			for(int ch=0;ch<n_channels;ch++){
+				short* buf = mem + ch * stride;
+				for(int i=0;i<size/2;i++){
+					int src = 2 * (i * n_channels + ch);
+					buf[2 * i    ] = data[src    ];
+					buf[2 * i + 1] = data[src + 1];
+				}
+			}
+			segment_seal(segment->fd, mem, stride * n_channels);
+		}
+		g_free(data);
+	}
+
+	g_mutex_lock(&service->peaks.lock);
+
+	if(segment->fd > -1){
+		segment->peakfile = peakfile;
+		segment->reply = (Reply){
+			.ok = true,
+			.n_channels = n_channels,
+			.size = size,
+			.stride = stride,
+			.meta = meta,
+			.path_len = strlen(peakfile)
+		};
+		segment->ready = true;
+		__atomic_fetch_add(&service->stats.n_peak_loads, 1, __ATOMIC_RELAXED);
+		add_client(segment);
+	}else{
+		g_free(peakfile);
+		g_hash_table_remove(service->peaks.segments, key);
+		segment = NULL;
+	}
+	g_cond_broadcast(&service->peaks.cond);
+
+	g_mutex_unlock(&service->peaks.lock);
+
+	return segment;
+}
+
+
+/*
+ *  Called when the client disconnects. Peak segments that no other client holds are freed.
+ */
+static void
+service_release_peaks (WfService* service, Client* c)
+{
+	g_mutex_lock(&service->peaks.lock);
+	for(int i=0;i<c->peaks->len;i++){
+		Segment* segment = g_ptr_array_index(c->peaks, i);
+		if(!--segment->n_clients){
+			g_hash_table_remove(service->peaks.segments, segment->key);
+		}
+	}
+	g_ptr_array_set_size(c->peaks, 0);
+	g_mutex_unlock(&service->peaks.lock);
+}
+
+
+/*
+ *  Returns the reply for the block, and a duplicate of the segment fd that the caller must close.
+ *
+ *  As with the peaks, the lock is not held while the block is decoded. A
+ *  request for a block that is already being decoded waits for it. Blocks
+ *  being decoded are not in the lru list so they are not evicted.
+ */
+static int
+service_get_block (WfService* service, const char* filename, int block_num, Reply* reply)
+{
+	g_autofree char* file = file_key(filename);
+	if(!file || block_num < 0) return -1;
+
+	char* key = g_strdup_printf("%s:%i", file, block_num);
+
+	int dup_segment (Segment* segment)
+	{
+		*reply = segment->reply;
+		return dup(segment->fd);
+	}
+
+	g_mutex_lock(&service->blocks.lock);
+
+	gpointer orig_key;
+	Segment* segment;
+	if(g_hash_table_lookup_extended(service->blocks.segments, key, &orig_key, (gpointer*)&segment)){
+		while(segment && !segment->ready){
+			g_cond_wait(&service->blocks.cond, &service->blocks.lock);
+			if(!g_hash_table_lookup_extended(service->blocks.segments, key, &orig_key, (gpointer*)&segment)) segment = NULL;
+		}
+		int fd = -1;
+		if(segment){
+			g_queue_remove(&service->blocks.lru, orig_key);
+			g_queue_push_head(&service->blocks.lru, orig_key);
+			__atomic_fetch_add(&service->stats.n_hits, 1, __ATOMIC_RELAXED);
+			fd = dup_segment(segment);
+		}
+		g_mutex_unlock(&service->blocks.lock);
+		g_free(key);
+		return fd;
+	}
+
+	segment = WF_NEW(Segment, .fd = -1);
+	g_hash_table_insert(service->blocks.segments, key, segment);
+
+	g_mutex_unlock(&service->blocks.lock);
+
+	WfDecoder f = {{0,}};
+	if(ad_open(&f, filename)){
+		int n_channels = MIN(WF_STEREO, f.info.channels);
+		size_t stride = page_align(WF_PEAK_BLOCK_SIZE * sizeof(short));
+		void* mem;
+
+		if(ad_seek(&f, block_num * (WF_PEAK_BLOCK_SIZE - 2 * TEX_BORDER * 256)) > -1 && (segment->fd = segment_new("wf-block", stride * n_channels, &mem)) > -1){
+			WfBuf16 buf = {.size = WF_PEAK_BLOCK_SIZE};
+			for(int c=0;c<n_channels;c++){
+				buf.buf[c] = mem + c * stride;
+			}
+			// memfd segments are zero filled so the end of the file does not need to be cleared
+			ad_read_short(&f, &buf);
+			segment_seal(segment->fd, mem, stride * n_channels);
+
+			segment->reply = (Reply){
+				.ok = true,
+				.n_channels = n_channels,
+				.size = WF_PEAK_BLOCK_SIZE,
+				.stride = stride,
+			};
+		}
+		ad_close(&f);
+	}else{
+		pwarn("not able to open input file %s.", filename);
+	}
+
+	g_mutex_lock(&service->blocks.lock);
+
+	int fd = -1;
+	if(segment->fd > -1){
+		if(g_queue_get_length(&service->blocks.lru) >= MAX_BLOCK_SEGMENTS){
+			g_hash_table_remove(service->blocks.segments, g_queue_pop_tail(&service->blocks.lru));
+		}
+		segment->ready = true;
+		g_queue_push_head(&service->blocks.lru, key);
+		__atomic_fetch_add(&service->stats.n_blocks_decoded, 1, __ATOMIC_RELAXED);
+		fd = dup_segment(segment);
+	}else{
+		g_hash_table_remove(service->blocks.segments, key);
+	}
+	g_cond_broadcast(&service->blocks.cond);
+
+	g_mutex_unlock(&service->blocks.lock);
+
+	return fd;
+}
+
+
+static gpointer
+service_client_thread (gpointer _client)
+{
+	Client* c = _client;
+	WfService* service = c->service;
+
+	Request request;
+	while(read_all(c->fd, &request, sizeof(Request))){
+		if(request.filename_len > PATH_MAX) break;
+
+		char filename[request.filename_len + 1];
+		if(!read_all(c->fd, filename, request.filename_len)) break;
+		filename[request.filename_len] = '\0';
+
+		__atomic_fetch_add(&service->stats.n_requests, 1, __ATOMIC_RELAXED);
+
+		static const Reply failed = {0,};
+		bool sent = false;
+		Segment* segment;
+		Reply reply;
+		int fd;
+		switch(request.type){
+			case REQUEST_PEAKS:
+				segment = service_get_peaks(service, c, filename);
+				sent = segment
+					? send_reply(c->fd, &segment->reply, segment->peakfile, segment->fd)
+					: send_reply(c->fd, &failed, NULL, -1);
+				break;
+			case REQUEST_BLOCK:
+				fd = service_get_block(service, filename, request.block, &reply);
+				sent = fd > -1
+					? send_reply(c->fd, &reply, NULL, fd)
+					: send_reply(c->fd, &failed, NULL, -1);
+				if(fd > -1) close(fd);
+				break;
+			default:
+				pwarn("unknown request: %u", request.type);
+				break;
+		}
+		if(!sent) break;
+	}
+
+	service_release_peaks(service, c);
+
+	g_mutex_lock(&service->lock);
+	g_ptr_array_remove(service->clients, c);
+	close(c->fd);
+	g_ptr_array_free(c->peaks, true);
+	g_free(c);
+	g_cond_signal(&service->cond);
+	g_mutex_unlock(&service->lock);
+
+	return NULL;
+}
+
+
+static gpointer
+service_accept_thread (gpointer _service)
+{
+	WfService* service = _service;
+
+	int fd;
+	while((fd = accept4(service->fd, NULL, NULL, SOCK_CLOEXEC)) > -1 || errno == EINTR){
+		if(fd < 0) continue;
+
+		g_mutex_lock(&service->lock);
+		if(service->stopping){
+			g_mutex_unlock(&service->lock);
+			close(fd);
+			break;
+		}
+		Client* c = WF_NEW(Client, .service = service, .fd = fd, .peaks = g_ptr_array_new());
+		g_ptr_array_add(service->clients, c);
+		g_mutex_unlock(&service->lock);
+
+		g_thread_unref(g_thread_new("peak service client", service_client_thread, c));
+	}
+
+	return NULL;
+}
+
+
+char*
+wf_service_default_path ()
+{
+	return g_build_filename(g_get_user_runtime_dir(), "libwaveform", "peaks.sock", NULL);
+}
+
+
+/*
+ *  Start serving peaks and audio blocks on the given socket.
+ *  If @socket_path is NULL, the default path is used.
+ *  The service runs in its own threads so it can be hosted by any process,
+ *  including one that is also a client.
+ */
+WfService*
+wf_service_start (const char* socket_path)
+{
+	wf_get_instance();
+
+	g_autofree char* path = socket_path ? g_strdup(socket_path) : wf_service_default_path();
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		pwarn("socket path too long: %s", path);
+		return NULL;
+	}
+	strcpy(addr.sun_path, path);
+
+	if(!wf_create_cache_dir()) return NULL;
+
+	g_autofree char* dir = g_path_get_dirname(path);
+	if(g_mkdir_with_parents(dir, S_IRWXU)){
+		pwarn("cannot create socket dir: %s", dir);
+		return NULL;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0) return NULL;
+
+	// remove any socket left by a service that did not exit cleanly
+	g_unlink(path);
+
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 16)){
+		pwarn("failed to listen on %s: %s", path, g_strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	WfService* service = WF_NEW(WfService,
+		.path = g_steal_pointer(&path),
+		.fd = fd,
+		.clients = g_ptr_array_new(),
+		.peaks = {
+			.segments = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, segment_free)
+		},
+		.blocks = {
+			.segments = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, segment_free)
+		},
+	);
+	g_mutex_init(&service->lock);
+	g_cond_init(&service->cond);
+	g_mutex_init(&service->peaks.lock);
+	g_cond_init(&service->peaks.cond);
+	g_mutex_init(&service->blocks.lock);
+	g_cond_init(&service->blocks.cond);
+	g_queue_init(&service->blocks.lru);
+
+	service->thread = g_thread_new("peak service", service_accept_thread, service);
+
+	return service;
+}
+
+
+/*
+ *  Connected clients are disconnected. Segments that they have already mapped remain valid.
+ */
+void
+wf_service_stop (WfService* service)
+{
+	g_return_if_fail(service);
+
+	g_mutex_lock(&service->lock);
+	service->stopping = true;
+	g_mutex_unlock(&service->lock);
+
+	shutdown(service->fd, SHUT_RDWR);
+	g_thread_join(service->thread);
+	close(service->fd);
+	g_unlink(service->path);
+
+	g_mutex_lock(&service->lock);
+	for(int i=0;i<service->clients->len;i++){
+		shutdown(((Client*)g_ptr_array_index(service->clients, i))->fd, SHUT_RDWR);
+	}
+	while(service->clients->len){
+		g_cond_wait(&service->cond, &service->lock);
+	}
+	g_mutex_unlock(&service->lock);
+
+	g_ptr_array_free(service->clients, true);
+	g_hash_table_destroy(service->peaks.segments);
+	g_hash_table_destroy(service->blocks.segments);
+	g_queue_clear(&service->blocks.lru);
+	g_mutex_clear(&service->lock);
+	g_cond_clear(&service->cond);
+	g_mutex_clear(&service->peaks.lock);
+	g_cond_clear(&service->peaks.cond);
+	g_mutex_clear(&service->blocks.lock);
+	g_cond_clear(&service->blocks.cond);
+	g_free(service->path);
+	g_free(service);
+}
+
+
+WfServiceStats
+wf_service_get_stats (WfService* service)
+{
+	g_return_val_if_fail(service, (WfServiceStats){0,});
+
+	return (WfServiceStats){
+		.n_requests       = __atomic_load_n(&service->stats.n_requests, __ATOMIC_RELAXED),
+		.n_peak_loads     = __atomic_load_n(&service->stats.n_peak_loads, __ATOMIC_RELAXED),
+		.n_blocks_decoded = __atomic_load_n(&service->stats.n_blocks_decoded, __ATOMIC_RELAXED),
+		.n_hits           = __atomic_load_n(&service->stats.n_hits, __ATOMIC_RELAXED),
+	};
+}
+
+
+//------------------------------------------------------------------------
+// client
+
+/*
+ *  Connect to a running service. If @socket_path is NULL, the default path is used.
+ *  While connected, peaks and audio blocks are requested from the service.
+ */
+bool
+wf_service_connect (const char* socket_path)
+{
+	if(client.fd > -1) return true;
+
+	g_autofree char* path = socket_path ? g_strdup(socket_path) : wf_service_default_path();
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		pwarn("socket path too long: %s", path);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0) return false;
+
+	if(connect(fd, (struct sockaddr*)&addr, sizeof(addr))){
+		dbg(1, "no service at %s", path);
+		close(fd);
+		return false;
+	}
+
+	if(!client.segments) client.segments = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	g_mutex_lock(&client.lock);
+	client.fd = fd;
+	g_mutex_unlock(&client.lock);
+
+	return true;
+}
+
+
+/*
+ *  Buffers already obtained from the service remain valid.
+ */
+void
+wf_service_disconnect ()
+{
+	g_mutex_lock(&client.lock);
+	if(client.fd > -1) close(client.fd);
+	client.fd = -1;
+	g_mutex_unlock(&client.lock);
+}
+
+
+bool
+wf_service_is_connected ()
+{
+	return client.fd > -1;
+}
+
+
+/*
+ *  Returns the mapped segment, or NULL if the request failed.
+ *  Each channel buffer in the segment is registered so that it can be released with wf_service_release().
+ *  If the connection fails it is dropped, so that subsequent loads use the in-process path.
+ */
+static void*
+service_request (RequestType type, const char* filename, int block_num, Reply* reply, char** peakfile)
+{
+	Request request = {.type = type, .block = block_num, .filename_len = strlen(filename)};
+	char* path = NULL;
+	int segment = -1;
+	bool ok = false;
+
+	g_mutex_lock(&client.lock);
+	if(client.fd > -1){
+		ok = write_all(client.fd, &request, sizeof(Request))
+			&& write_all(client.fd, filename, request.filename_len)
+			&& recv_reply(client.fd, reply, &path, &segment);
+		if(!ok){
+			pwarn("lost connection to peak service");
+			close(client.fd);
+			client.fd = -1;
+		}
+	}
+	g_mutex_unlock(&client.lock);
+
+	void* data = NULL;
+
+	if(ok && reply->ok && segment > -1){
+		if(reply->n_channels < 1 || reply->n_channels > WF_STEREO || reply->stride < reply->size * sizeof(short)){
+			pwarn("bad reply");
+			goto out;
+		}
+
+		size_t size = reply->stride * reply->n_channels;
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, segment, 0); // copy on write
+		if(data == MAP_FAILED){
+			pwarn("failed to map segment: %s", g_strerror(errno));
+			data = NULL;
+			goto out;
+		}
+
+		Mapping* mapping = WF_NEW(Mapping, .data = data, .size = size, .n_refs = reply->n_channels);
+
+		g_mutex_lock(&client.segments_lock);
+		for(int c=0;c<reply->n_channels;c++){
+			g_hash_table_insert(client.segments, data + c * reply->stride, mapping);
+		}
+		g_mutex_unlock(&client.segments_lock);
+	}
+
+  out:
+	if(segment > -1) close(segment);
+
+	if(peakfile && data)
+		*peakfile = path;
+	else
+		g_free(path);
+
+	return data;
+}
+
+
+/*
+ *  Release a buffer obtained from the service.
+ *  Returns false if the buffer did not come from the service, in which case the caller must free it.
+ */
+bool
+wf_service_release (void* buf)
+{
+	if(!client.segments || !buf) return false;
+
+	g_mutex_lock(&client.segments_lock);
+
+	Mapping* mapping = g_hash_table_lookup(client.segments, buf);
+	if(mapping){
+		g_hash_table_remove(client.segments, buf);
+		if(!--mapping->n_refs){
+			munmap(mapping->data, mapping->size);
+			g_free(mapping);
+		}
+	}
+
+	g_mutex_unlock(&client.segments_lock);
+
+	return !!mapping;
+}
+
+
+	typedef struct {
+		WfPeakfileCallback callback;
+		gpointer           user_data;
+		char*              filename;
+		Reply              reply;
+		void*              data;
+		char*              peakfile;
+	} PeaksJob;
+
+	static void service_load_peaks_run (Waveform* waveform, gpointer _job)
+	{
+		// runs in the worker thread
+
+		PeaksJob* job = _job;
+
+		job->data = service_request(REQUEST_PEAKS, job->filename, 0, &job->reply, &job->peakfile);
+	}
+
+	static void service_load_peaks_done (Waveform* waveform, GError* error, gpointer _job)
+	{
+		PeaksJob* job = _job;
+
+		if(!waveform) return;
+
+		WaveformPrivate* _w = waveform->priv;
+
+		if(!job->data || _w->peak.buf[WF_LEFT]){
+			dbg(1, "using local peak loading");
+			waveform_ensure_peakfile(waveform, job->callback, job->user_data);
+			return;
+		}
+
+		for(int c=0;c<job->reply.n_channels;c++){
+			_w->peak.buf[c] = job->data + c * job->reply.stride;
+		}
+		_w->peak.size = job->reply.size;
+		job->data = NULL;
+
+		g_hash_table_insert(wf_get_instance()->peak_cache, waveform, waveform); // is removed in __finalize()
+
+		waveform_set_meta(waveform, &job->reply.meta);
+
+		job->callback(waveform, g_steal_pointer(&job->peakfile), job->user_data);
+	}
+
+	static void service_load_peaks_free (gpointer _job)
+	{
+		PeaksJob* job = _job;
+
+		if(job->data){
+			for(int c=0;c<job->reply.n_channels;c++){
+				wf_service_release(job->data + c * job->reply.stride);
+			}
+		}
+		g_free(job->peakfile);
+		g_free(job->filename);
+		g_free(job);
+	}
+
+/*
+ *  Asynchronously obtain the peak data from the service.
+ *  The peak buffers are set before @callback is called with the peakfile name,
+ *  so that waveform_load_peak() only needs to complete the initialisation.
+ *  If the service cannot provide the peaks, waveform_ensure_peakfile() is used instead.
+ */
+void
+wf_service_load_peaks (Waveform* waveform, WfPeakfileCallback callback, gpointer user_data)
+{
+	g_return_if_fail(callback);
+
+	if(!client.worker.msg_queue) wf_worker_init(&client.worker);
+
+	wf_worker_push_job(
+		&client.worker,
+		waveform,
+		service_load_peaks_run,
+		service_load_peaks_done,
+		service_load_peaks_free,
+		WF_NEW(PeaksJob,
+			.callback = callback,
+			.user_data = user_data,
+			.filename = absolute_filename(waveform->filename)
+		)
+	);
+}
+
+
+/*
+ *  Called by the audio worker. Split files are not supported.
+ *  On success the buffers in @buf16 are owned by the service mapping and must be freed with wf_service_release().
+ */
+bool
+wf_service_load_block (const char* _filename, WfBuf16* buf16, int block_num)
+{
+	if(client.fd < 0 || !_filename) return false;
+
+	g_autofree char* filename = absolute_filename(_filename);
+
+	Reply reply;
+	void* data = service_request(REQUEST_BLOCK, filename, block_num, &reply, NULL);
+	if(!data) return false;
+
+	for(int c=0;c<reply.n_channels;c++){
+		buf16->buf[c] = data + c * reply.stride;
+	}
+	buf16->size = reply.size;
+
+	return true;
+}
@@ -0,0 +1,39 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#pragma once
+
+#include "wf/waveform.h"
+
+typedef struct _WfService WfService;
+
+typedef struct {
+	uint64_t n_requests;
+	uint64_t n_peak_loads;     // peakfiles loaded, and generated if needed
+	uint64_t n_blocks_decoded;
+	uint64_t n_hits;           // requests answered from segments already held
+} WfServiceStats;
+
+WfService*     wf_service_start        (const char* socket_path);
+void           wf_service_stop         (WfService*);
+WfServiceStats wf_service_get_stats    (WfService*);
+char*          wf_service_default_path ();
+
+bool           wf_service_connect      (const char* socket_path);
+void           wf_service_disconnect   ();
+bool           wf_service_is_connected ();
+
+#ifdef __wf_private__
+void           wf_service_load_peaks   (Waveform*, WfPeakfileCallback, gpointer);
+bool           wf_service_load_block   (const char* filename, WfBuf16*, int block_num);
+bool           wf_service_release      (void*);
+#endif
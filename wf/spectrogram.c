@@ -0,0 +1,699 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |                                                                      |
+ | Spectrogram tiles.                                                   |
+ |                                                                      |
+ | A tile contains the short time fourier transform of a fixed number   |
+ | of texture blocks, as 8 bit log magnitudes. There are several levels |
+ | with different time and frequency resolutions. The number of blocks  |
+ | in a tile at each level matches the block size of one of the actor  |
+ | modes, so that tiles can be selected using the zoom.                 |
+ |                                                                      |
+ | Tiles are computed by worker threads using a radix-2 fft on split    |
+ | real and imaginary arrays, with unit stride inner loops that can be  |
+ | vectorised by the compiler. The real input is packed into a complex  |
+ | sequence of half the length.                                         |
+ |                                                                      |
+ | Tiles are kept in memory up to a size limit, after which the least   |
+ | recently used are freed. Optionally they are also saved alongside    |
+ | the peakfile.                                                        |
+ |                                                                      |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#define __wf_private__
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "decoder/ad.h"
+#include "wf/debug.h"
+#include "wf/waveform.h"
+#include "wf/peakgen.h"
+#include "wf/worker.h"
+#include "wf/spectrogram.h"
+
+#define N_WORKERS        2
+#define DEFAULT_MAX_SIZE (32 * 1024 * 1024)
+#define FLOOR_DB         -100.0
+#define SUFFIX           ".spec"
+#define MAGIC            "wfsp"
+#define VERSION          1
+
+typedef struct {
+	int fft_size;
+	int hop;          // frames between columns
+	int n_blocks;     // texture blocks per tile
+} Level;
+
+static const Level levels[WF_SPECTROGRAM_N_LEVELS] = {
+	{ 256, WF_PEAK_RATIO / 4,                 1                }, // 1008 x 128. MODE_HI
+	{1024, WF_PEAK_RATIO,                     1                }, //  252 x 512. MODE_MED
+	{1024, WF_PEAK_RATIO * WF_PEAK_STD_TO_LO, WF_PEAK_STD_TO_LO}, //  252 x 512. MODE_LOW
+	{1024, WF_PEAK_RATIO * WF_MED_TO_V_LOW,   WF_MED_TO_V_LOW  }, //  252 x 512. MODE_V_LOW
+};
+
+typedef struct {
+	int     n;            // the complex fft size. half the frame size
+	int*    bitrev;
+	float*  twiddle_re;   // the twiddles for each stage are contiguous
+	float*  twiddle_im;
+	float*  post_re;      // for separating the packed real transform
+	float*  post_im;
+	float*  window;
+} Plan;
+
+typedef struct {
+	WfSpectrogramTile tile;
+	Waveform*         waveform;
+	GList             link;         // position in the lru list. only used while the tile has data
+	bool              pending;
+	bool              failed;
+} Tile;
+
+typedef struct _WfSpectrogram WfSpectrogram;
+
+struct _WfSpectrogram {
+	char*       filename;           // absolute path of the file the tiles were made from
+	GHashTable* tiles;              // Tile*, keyed by level and index
+};
+
+typedef struct {
+	int         level;
+	int         tile;
+	char*       filename;
+	guchar*     buf;                // the result
+	bool        from_disk;
+} Job;
+
+typedef struct {
+	char        magic[4];
+	uint32_t    version;
+	uint32_t    width;
+	uint32_t    height;
+	uint64_t    size;               // of the source file
+	int64_t     mtime;
+} Header;
+
+#define KEY(LEVEL, TILE) GINT_TO_POINTER(((TILE) << 2) | (LEVEL))
+
+static struct {
+	WfSpectrogramStats stats;
+	GQueue             lru;         // Tile, most recently used first
+	bool               use_disk;
+	WfWorker           workers[N_WORKERS];
+	int                next_worker;
+} spectrogram = {
+	.stats = {.max_size = DEFAULT_MAX_SIZE}
+};
+
+static Plan plans[WF_SPECTROGRAM_N_LEVELS];
+
+
+static inline int
+tile_width (int level)
+{
+	return wf_spectrogram_get_tile_frames(level) / levels[level].hop;
+}
+
+
+/*
+ *  Returns the number of audio frames in each tile at the given level
+ */
+int
+wf_spectrogram_get_tile_frames (int level)
+{
+	g_return_val_if_fail(level >= 0 && level < WF_SPECTROGRAM_N_LEVELS, 0);
+
+	return WF_SAMPLES_PER_TEXTURE * levels[level].n_blocks;
+}
+
+
+int
+wf_spectrogram_get_n_tiles (Waveform* w, int level)
+{
+	g_return_val_if_fail(w, 0);
+	g_return_val_if_fail(level >= 0 && level < WF_SPECTROGRAM_N_LEVELS, 0);
+
+	int n_blocks = waveform_get_n_audio_blocks(w);
+	int n = levels[level].n_blocks;
+
+	return n_blocks / n + (n_blocks % n ? 1 : 0);
+}
+
+
+static void
+plan_init (Plan* plan, int fft_size)
+{
+	int n = plan->n = fft_size / 2;
+
+	int bits = 0;
+	while ((1 << bits) < n) bits++;
+	plan->bitrev = g_new(int, n);
+	for (int i=0;i<n;i++) {
+		int r = 0;
+		for (int b=0;b<bits;b++) if (i & (1 << b)) r |= 1 << (bits - 1 - b);
+		plan->bitrev[i] = r;
+	}
+
+	// the stage with butterflies of span h uses n[h - 1 ... 2h - 2]
+	plan->twiddle_re = g_new(float, n);
+	plan->twiddle_im = g_new(float, n);
+	for (int h=1;h<n;h*=2) {
+		for (int k=0;k<h;k++) {
+			plan->twiddle_re[h - 1 + k] = cos(-M_PI * k / h);
+			plan->twiddle_im[h - 1 + k] = sin(-M_PI * k / h);
+		}
+	}
+
+	plan->post_re = g_new(float, n);
+	plan->post_im = g_new(float, n);
+	for (int k=0;k<n;k++) {
+		plan->post_re[k] = cos(-M_PI * k / n);
+		plan->post_im[k] = sin(-M_PI * k / n);
+	}
+
+	// hann
+	plan->window = g_new(float, fft_size);
+	for (int i=0;i<fft_size;i++) {
+		plan->window[i] = 0.5 * (1.0 - cos(2.0 * M_PI * i / fft_size));
+	}
+}
+
+
+static const Plan*
+get_plan (int level)
+{
+	static gsize done = 0;
+	if (g_once_init_enter(&done)) {
+		for (int l=0;l<WF_SPECTROGRAM_N_LEVELS;l++) {
+			plan_init(&plans[l], levels[l].fft_size);
+		}
+		g_once_init_leave(&done, 1);
+	}
+
+	return &plans[level];
+}
+
+
+static void
+fft (const Plan* plan, float* restrict re, float* restrict im)
+{
+	const int n = plan->n;
+
+	for (int i=0;i<n;i++) {
+		int j = plan->bitrev[i];
+		if (j > i) {
+			float t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	for (int h=1;h<n;h*=2) {
+		const float* restrict wr = plan->twiddle_re + h - 1;
+		const float* restrict wi = plan->twiddle_im + h - 1;
+		for (int i=0;i<n;i+=2*h) {
+			float* restrict r0 = re + i;
+			float* restrict i0 = im + i;
+			float* restrict r1 = r0 + h;
+			float* restrict i1 = i0 + h;
+			for (int k=0;k<h;k++) {
+				float tr = wr[k] * r1[k] - wi[k] * i1[k];
+				float ti = wr[k] * i1[k] + wi[k] * r1[k];
+				r1[k] = r0[k] - tr;
+				i1[k] = i0[k] - ti;
+				r0[k] += tr;
+				i0[k] += ti;
+			}
+		}
+	}
+}
+
+
+/*
+ *  Calculate one column of a tile from fft_size frames.
+ *  The magnitude of each bin is written to @out, with @stride between bins.
+ *
+ *  Can be called from any thread.
+ */
+void
+wf_spectrogram_column (int level, const double* frames, guchar* out, int stride)
+{
+	const Plan* plan = get_plan(level);
+	const int n = plan->n;
+
+	float re[n];
+	float im[n];
+	for (int i=0;i<n;i++) {
+		re[i] = frames[2 * i    ] * plan->window[2 * i    ];
+		im[i] = frames[2 * i + 1] * plan->window[2 * i + 1];
+	}
+
+	fft(plan, re, im);
+
+	// a full scale sine has a magnitude of fft_size / 4 when using a hann window
+	const float scale = 2.0 / n;
+
+	for (int k=0;k<n;k++) {
+		int j = (n - k) % n;
+		float e_re = (re[k] + re[j]) / 2;
+		float e_im = (im[k] - im[j]) / 2;
+		float o_re = (im[k] + im[j]) / 2;
+		float o_im = (re[j] - re[k]) / 2;
+		float x_re = e_re + plan->post_re[k] * o_re - plan->post_im[k] * o_im;
+		float x_im = e_im + plan->post_re[k] * o_im + plan->post_im[k] * o_re;
+
+		float db = 20.0 * log10f(sqrtf(x_re * x_re + x_im * x_im) * scale + 1e-10f);
+		out[k * stride] = CLAMP((db - FLOOR_DB) * 255.0 / -FLOOR_DB, 0.0, 255.0);
+	}
+}
+
+
+static void
+read_frames (WfDecoder* d, double* frames, int len)
+{
+	for (int n=0;n<len;) {
+		ssize_t r = ad_read_mono_dbl(d, frames + n, len - n);
+		if (r <= 0) break;
+		n += r;
+	}
+}
+
+
+/*
+ *  Can be called from the worker thread
+ */
+static guchar*
+spectrogram_compute (const char* filename, int level, int tile)
+{
+	g_auto(WfDecoder) d = {{0,}};
+	if (!ad_open(&d, filename)) return NULL;
+
+	const Level* l = &levels[level];
+	const int width = tile_width(level);
+	const int64_t start = (int64_t)tile * wf_spectrogram_get_tile_frames(level);
+	const int pad = (l->fft_size - l->hop) / 2; // the windows are centred on the columns
+
+	guchar* out = g_malloc0(width * l->fft_size / 2);
+
+	if (l->hop <= l->fft_size) {
+		// the windows overlap so the frames for the whole tile are read together
+		int len = (width - 1) * l->hop + l->fft_size;
+		double* frames = g_new0(double, len);
+		int64_t f0 = start - pad;
+		int offset = f0 < 0 ? -f0 : 0;
+		if (ad_seek(&d, f0 + offset) >= 0) {
+			read_frames(&d, frames + offset, len - offset);
+		}
+		for (int x=0;x<width;x++) {
+			wf_spectrogram_column(level, frames + x * l->hop, out + x, width);
+		}
+		g_free(frames);
+	} else {
+		// only the frames under each window are read
+		double frames[l->fft_size];
+		for (int x=0;x<width;x++) {
+			memset(frames, 0, sizeof(frames));
+			if (ad_seek(&d, start + x * l->hop - pad) < 0) break;
+			read_frames(&d, frames, l->fft_size);
+			wf_spectrogram_column(level, frames, out + x, width);
+		}
+	}
+
+	return out;
+}
+
+
+static char*
+tile_path (const char* filename, int level, int tile)
+{
+	g_autofree char* peak_filename = waveform_get_peak_filename(filename);
+	if (!peak_filename || !g_str_has_suffix(peak_filename, ".peak")) return NULL;
+
+	g_autofree char* base = g_strndup(peak_filename, strlen(peak_filename) - strlen(".peak"));
+
+	return g_strdup_printf("%s-%i-%i%s", base, level, tile, SUFFIX);
+}
+
+
+/*
+ *  Can be called from the worker thread
+ */
+static guchar*
+disk_read (const char* filename, int level, int tile)
+{
+	g_autofree char* path = tile_path(filename, level, tile);
+	if (!path) return NULL;
+
+	GStatBuf info;
+	if (g_stat(filename, &info)) return NULL;
+
+	FILE* f = fopen(path, "rb");
+	if (!f) return NULL;
+
+	const int width = tile_width(level);
+	const int height = levels[level].fft_size / 2;
+
+	Header header;
+	bool ok = fread(&header, sizeof(Header), 1, f) == 1
+		&& !memcmp(header.magic, MAGIC, 4)
+		&& header.version == VERSION
+		&& header.width == width
+		&& header.height == height
+		&& header.size == info.st_size
+		&& header.mtime == info.st_mtime;
+
+	guchar* buf = NULL;
+	if (ok) {
+		buf = g_malloc(width * height);
+		if (fread(buf, width, height, f) != height) {
+			pwarn("invalid cache file: %s", path);
+			g_clear_pointer(&buf, g_free);
+		}
+	}
+	fclose(f);
+
+	if (!buf) g_unlink(path); // out of date or corrupt
+
+	return buf;
+}
+
+
+/*
+ *  Can be called from the worker thread
+ */
+static void
+disk_write (const char* filename, int level, int tile, guchar* buf)
+{
+	g_autofree char* path = tile_path(filename, level, tile);
+	if (!path) return;
+
+	GStatBuf info;
+	if (g_stat(filename, &info)) return;
+
+	g_autofree char* dir = g_path_get_dirname(path);
+	if (g_mkdir_with_parents(dir, S_IRUSR | S_IWUSR | S_IXUSR)) {
+		pwarn("cannot access cache dir: %s", dir);
+		return;
+	}
+
+	// written to a temporary file first so that a partial tile is never visible
+	g_autofree char* tmp = g_strdup_printf("%s.%p.tmp", path, (void*)g_thread_self());
+
+	FILE* f = fopen(tmp, "wb");
+	if (!f) return;
+
+	Header header = {
+		.magic = MAGIC,
+		.version = VERSION,
+		.width = tile_width(level),
+		.height = levels[level].fft_size / 2,
+		.size = info.st_size,
+		.mtime = info.st_mtime
+	};
+	bool ok = fwrite(&header, sizeof(Header), 1, f) == 1
+		&& fwrite(buf, header.width, header.height, f) == header.height;
+	ok = !fclose(f) && ok;
+
+	if (!ok || g_rename(tmp, path)) {
+		pwarn("failed to write cache file: %s", path);
+		g_unlink(tmp);
+	}
+}
+
+
+static void
+tile_free (gpointer _tile)
+{
+	Tile* t = _tile;
+
+	if (t->tile.buf) {
+		g_queue_unlink(&spectrogram.lru, &t->link);
+		spectrogram.stats.size -= t->tile.width * t->tile.height;
+		g_free(t->tile.buf);
+	}
+	g_free(t);
+}
+
+
+static Tile*
+spectrogram_lookup (Waveform* w, int level, int tile)
+{
+	WfSpectrogram* s = w->priv->spectrogram;
+
+	return s ? g_hash_table_lookup(s->tiles, KEY(level, tile)) : NULL;
+}
+
+
+static Tile*
+spectrogram_add (Waveform* w, int level, int tile)
+{
+	WaveformPrivate* _w = w->priv;
+
+	if (!_w->spectrogram) {
+		char* filename = g_path_is_absolute(w->filename)
+			? g_strdup(w->filename)
+			: ({ g_autofree char* cwd = g_get_current_dir(); g_build_filename(cwd, w->filename, NULL); });
+
+		_w->spectrogram = WF_NEW(WfSpectrogram,
+			.filename = filename,
+			.tiles = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, tile_free)
+		);
+	}
+
+	Tile* t = WF_NEW(Tile,
+		.tile = {
+			.level = level,
+			.tile = tile,
+			.width = tile_width(level),
+			.height = levels[level].fft_size / 2
+		},
+		.waveform = w
+	);
+	t->link.data = t;
+
+	g_hash_table_insert(_w->spectrogram->tiles, KEY(level, tile), t);
+
+	return t;
+}
+
+
+static void
+spectrogram_evict ()
+{
+	// the most recent tile is always kept
+	while (spectrogram.stats.size > spectrogram.stats.max_size && spectrogram.lru.length > 1) {
+		Tile* t = g_queue_peek_tail(&spectrogram.lru);
+		dbg(2, "%i:%i", t->tile.level, t->tile.tile);
+		g_hash_table_remove(t->waveform->priv->spectrogram->tiles, KEY(t->tile.level, t->tile.tile));
+		spectrogram.stats.n_evicted++;
+	}
+}
+
+
+static void
+spectrogram_set_data (Tile* t, guchar* buf)
+{
+	t->pending = false;
+
+	if (!buf) {
+		pwarn("failed to create spectrogram: %s", t->waveform->filename);
+		t->failed = true;
+		return;
+	}
+
+	t->tile.buf = buf;
+	spectrogram.stats.size += t->tile.width * t->tile.height;
+	g_queue_push_head_link(&spectrogram.lru, &t->link);
+
+	spectrogram_evict();
+
+	g_signal_emit_by_name(t->waveform, "spectrogram_ready", &t->tile);
+}
+
+
+	static void spectrogram_work (Waveform* waveform, gpointer _job)
+	{
+		// worker thread. The Waveform is not accessed.
+
+		Job* job = _job;
+
+		if (spectrogram.use_disk) {
+			job->buf = disk_read(job->filename, job->level, job->tile);
+			job->from_disk = !!job->buf;
+		}
+
+		if (!job->buf) {
+			job->buf = spectrogram_compute(job->filename, job->level, job->tile);
+			if (job->buf && spectrogram.use_disk) disk_write(job->filename, job->level, job->tile, job->buf);
+		}
+	}
+
+	static void spectrogram_done (Waveform* waveform, GError* error, gpointer _job)
+	{
+		Job* job = _job;
+
+		if (!waveform) return;
+
+		// the file may have been changed since the job was queued
+		WfSpectrogram* s = waveform->priv->spectrogram;
+		if (!s || strcmp(s->filename, job->filename)) return;
+
+		Tile* t = spectrogram_lookup(waveform, job->level, job->tile);
+		if (!t || !t->pending) return;
+
+		if (job->buf) {
+			if (job->from_disk) spectrogram.stats.n_disk_hits++; else spectrogram.stats.n_computed++;
+		}
+
+		spectrogram_set_data(t, g_steal_pointer(&job->buf));
+	}
+
+	static void spectrogram_job_free (gpointer _job)
+	{
+		Job* job = _job;
+
+		g_free(job->buf);
+		g_free(job->filename);
+		g_free(job);
+	}
+
+/*
+ *  Request that a tile is created in the background.
+ *  The "spectrogram_ready" signal is emitted when it is available.
+ */
+void
+waveform_load_spectrogram (Waveform* w, int level, int tile)
+{
+	g_return_if_fail(w && w->filename);
+	g_return_if_fail(level >= 0 && level < WF_SPECTROGRAM_N_LEVELS);
+	g_return_if_fail(tile >= 0 && tile < wf_spectrogram_get_n_tiles(w, level));
+
+	if (spectrogram_lookup(w, level, tile)) return; // already loaded, queued, or failed
+
+	Tile* t = spectrogram_add(w, level, tile);
+	t->pending = true;
+
+	WfWorker* worker = &spectrogram.workers[spectrogram.next_worker++ % N_WORKERS];
+	if (!worker->msg_queue) wf_worker_init(worker);
+
+	wf_worker_push_job(worker, w, spectrogram_work, spectrogram_done, spectrogram_job_free, WF_NEW(Job,
+		.level = level,
+		.tile = tile,
+		.filename = g_strdup(w->priv->spectrogram->filename)
+	));
+}
+
+
+/*
+ *  Returns the tile, creating it in the calling thread if it is not already loaded.
+ */
+WfSpectrogramTile*
+waveform_load_spectrogram_sync (Waveform* w, int level, int tile)
+{
+	g_return_val_if_fail(w && w->filename, NULL);
+	g_return_val_if_fail(level >= 0 && level < WF_SPECTROGRAM_N_LEVELS, NULL);
+	g_return_val_if_fail(tile >= 0 && tile < wf_spectrogram_get_n_tiles(w, level), NULL);
+
+	WfSpectrogramTile* loaded = waveform_get_spectrogram_tile(w, level, tile);
+	if (loaded) return loaded;
+
+	Tile* t = spectrogram_lookup(w, level, tile);
+	if (t && t->failed) return NULL;
+	if (!t) t = spectrogram_add(w, level, tile);
+
+	Job job = {
+		.level = level,
+		.tile = tile,
+		.filename = w->priv->spectrogram->filename
+	};
+	spectrogram_work(w, &job);
+
+	if (job.buf) {
+		if (job.from_disk) spectrogram.stats.n_disk_hits++; else spectrogram.stats.n_computed++;
+	}
+
+	// an outstanding async request for the tile will be ignored
+	spectrogram_set_data(t, job.buf);
+
+	return t->tile.buf ? &t->tile : NULL;
+}
+
+
+/*
+ *  Returns NULL if the tile is not loaded
+ */
+WfSpectrogramTile*
+waveform_get_spectrogram_tile (Waveform* w, int level, int tile)
+{
+	g_return_val_if_fail(w, NULL);
+
+	Tile* t = spectrogram_lookup(w, level, tile);
+	if (!t || !t->tile.buf) return NULL;
+
+	g_queue_unlink(&spectrogram.lru, &t->link);
+	g_queue_push_head_link(&spectrogram.lru, &t->link);
+
+	return &t->tile;
+}
+
+
+/*
+ *  Called when the Waveform is finalized or its file is changed.
+ *  The textures made from the tiles are released by Waveform.free_render_data
+ */
+void
+waveform_spectrogram_free (Waveform* w)
+{
+	WaveformPrivate* _w = w->priv;
+	if (!_w->spectrogram) return;
+
+	for (int i=0;i<N_WORKERS;i++) {
+		if (spectrogram.workers[i].msg_queue) wf_worker_cancel_jobs(&spectrogram.workers[i], w);
+	}
+
+	g_hash_table_destroy(_w->spectrogram->tiles);
+	g_free(_w->spectrogram->filename);
+	g_clear_pointer(&_w->spectrogram, g_free);
+}
+
+
+/*
+ *  Set the maximum memory used by tiles for all Waveforms
+ */
+void
+wf_spectrogram_set_max_size (size_t bytes)
+{
+	spectrogram.stats.max_size = bytes;
+
+	spectrogram_evict();
+}
+
+
+/*
+ *  If enabled, tiles are saved in the cache directory alongside the peakfiles. Default is disabled.
+ */
+void
+wf_spectrogram_set_disk_cache (bool enable)
+{
+	spectrogram.use_disk = enable;
+}
+
+
+WfSpectrogramStats
+wf_spectrogram_get_stats ()
+{
+	return spectrogram.stats;
+}
@@ -0,0 +1,49 @@
+/*
+ +----------------------------------------------------------------------+
+ | This file is part of libwaveform https://github.com/ayyi/libwaveform |
+ | copyright (C) 2012-2025 Tim Orford <tim@orford.org>                  |
+ +----------------------------------------------------------------------+
+ | This program is free software; you can redistribute it and/or modify |
+ | it under the terms of the GNU General Public License version 3       |
+ | as published by the Free Software Foundation.                        |
+ +----------------------------------------------------------------------+
+ |
+ */
+
+#pragma once
+
+#include "wf/waveform.h"
+
+#define WF_SPECTROGRAM_N_LEVELS 4 // level 0 has the highest time resolution
+
+typedef struct {
+	int      level;
+	int      tile;        // index of the tile within its level
+	int      width;       // columns. one per fft frame
+	int      height;      // frequency bins, lowest frequency first
+	guchar*  buf;         // log magnitude, row major. 0 is -100dB or less, 255 is full scale
+} WfSpectrogramTile;
+
+typedef struct {
+	size_t   max_size;    // bytes of tile data held in memory
+	size_t   size;
+	uint64_t n_computed;
+	uint64_t n_disk_hits;
+	uint64_t n_evicted;
+} WfSpectrogramStats;
+
+int                wf_spectrogram_get_tile_frames (int level);
+int                wf_spectrogram_get_n_tiles     (Waveform*, int level);
+
+void               waveform_load_spectrogram      (Waveform*, int level, int tile);
+WfSpectrogramTile* waveform_load_spectrogram_sync (Waveform*, int level, int tile);
+WfSpectrogramTile* waveform_get_spectrogram_tile  (Waveform*, int level, int tile);
+
+void               wf_spectrogram_set_max_size    (size_t bytes);
+void               wf_spectrogram_set_disk_cache  (bool);
+WfSpectrogramStats wf_spectrogram_get_stats       ();
+
+#ifdef __wf_private__
+void               waveform_spectrogram_free      (Waveform*);
+void               wf_spectrogram_column          (int level, const double* frames, guchar* out, int stride);
+#endif
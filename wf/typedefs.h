@@ -20,6 +20,7 @@ typedef struct _WfPeakBuf           WfPeakBuf;
 typedef struct _Peakbuf             Peakbuf;
 typedef struct _buf                 RmsBuf;
 typedef struct _WfAudioData         WfAudioData;
+typedef struct _WfAudioBlock        WfAudioBlock;
 typedef struct _WfWorker            WfWorker;
 typedef struct _texture_hi          WfTextureHi;
 typedef struct _wf_texture_list     WfGlBlock;
@@ -13,12 +13,14 @@
 #define __waveform_peak_c__
 #define __wf_private__
 #include "config.h"
+#include <stdlib.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #ifdef USE_SNDFILE
 #include <sndfile.h>
 #endif
 #include <glib.h>
+#include <glib/gstdio.h>
 #include "inttypes.h"
 #include "decoder/ad.h"
 #include "wf/debug.h"
@@ -26,7 +28,11 @@
 #include "wf/loaders/ardour.h"
 #include "wf/loaders/riff.h"
 #include "wf/audio.h"
+#include "wf/compressed.h"
 #include "wf/peakgen.h"
+#include "wf/live.h"
+#include "wf/spectrogram.h"
+#include "wf/service.h"
 #include "wf/worker.h"
 #include "wf/utils.h"
 
@@ -44,6 +50,7 @@ guint peak_idle = 0;
 
 static void  waveform_finalize      (GObject*);
 static void _waveform_get_property  (GObject*, guint property_id, GValue*, GParamSpec*);
+static void  waveform_peak_init     (Waveform*, const char* peak_file, int ch_num, WfBlockSummary*, int n_summary_blocks);
 
 
 Waveform*
@@ -72,6 +79,21 @@ waveform_load_new(const char* filename)
 }
 
 
+/*
+ *  True if @filename is the lhs of a split stereo pair and the rhs is present.
+ */
+static bool
+waveform_is_split (const char* filename)
+{
+	if(!filename || !g_strrstr(filename, "%L")) return false;
+
+	char rhs[256] = {0};
+	waveform_get_rhs(filename, rhs);
+
+	return g_file_test(rhs, G_FILE_TEST_EXISTS);
+}
+
+
 /**
  *  waveform_new
  *
@@ -82,11 +104,76 @@ waveform_new (const char* filename)
 {
 	Waveform* w = waveform_construct(TYPE_WAVEFORM);
 	w->filename = g_strdup(filename);
+	w->is_split = waveform_is_split(filename);
 	w->renderable = true;
 	return w;
 }
 
 
+static char*
+waveform_get_registry_key (const char* filename)
+{
+	char* path = realpath(filename, NULL);
+	if(!path) return NULL;
+
+	GStatBuf info;
+	char* key = g_stat(path, &info)
+		? NULL
+		: g_strdup_printf("%s:%lu:%lu:%"PRIi64, path, (gulong)info.st_dev, (gulong)info.st_ino, (int64_t)info.st_mtime);
+	free(path);
+
+	return key;
+}
+
+
+static void
+waveform_unregister (Waveform* w)
+{
+	WaveformPrivate* _w = w->priv;
+
+	if(_w->registry_key){
+		g_hash_table_remove(wf->registry, _w->registry_key);
+		g_clear_pointer(&_w->registry_key, g_free);
+	}
+}
+
+
+/**
+ *  waveform_new_shared
+ *
+ *  Returns a Waveform that is shared with all other callers for the same file
+ *  so that the peak data, audio blocks and textures are only held once.
+ *
+ *  The file is identified by its canonical path together with its device, inode
+ *  and modification time, so a file that has since been modified will not share
+ *  the stale instance. Files that cannot be accessed are not shared.
+ *
+ *  Returns: (transfer full): waveform
+ */
+Waveform*
+waveform_new_shared (const char* filename)
+{
+	g_return_val_if_fail(filename, NULL);
+
+	wf_get_instance();
+
+	char* key = waveform_get_registry_key(filename);
+	if(!key) return waveform_new(filename);
+
+	Waveform* w = g_hash_table_lookup(wf->registry, key);
+	if(w){
+		g_free(key);
+		return g_object_ref(w);
+	}
+
+	w = waveform_new(filename);
+	w->priv->registry_key = key;
+	g_hash_table_insert(wf->registry, key, w);
+
+	return w;
+}
+
+
 void
 waveform_set_file (Waveform* w, const char* filename)
 {
@@ -99,7 +186,30 @@ waveform_set_file (Waveform* w, const char* filename)
 		g_free(w->filename);
 	}
 
+	// the Waveform no longer refers to the registered file
+	waveform_unregister(w);
+	waveform_spectrogram_free(w);
+
+	// the textures, including the spectrogram textures in the texture cache, are of the old file
+	if(w->free_render_data) w->free_render_data(w);
+
+	// the blocks of the old file can point into its mapping so are freed first
+	WfAudioData* audio = &w->priv->audio;
+	waveform_audio_free_blocks(w);
+	wf_audio_map_unref(audio->map);
+	audio->map = NULL;
+	audio->map_tried = false;
+	g_free0(audio->disk_key);
+	audio->n_blocks = 0;
+	g_atomic_int_inc(&audio->generation); // audio jobs already queued are for the old file
+
+	N_FRAMES_SET(w, 0);
+	w->n_channels = 0;
+	w->samplerate = 0;
+	w->offline = false;
+
 	w->filename = g_strdup(filename);
+	w->is_split = waveform_is_split(filename);
 	w->renderable = true;
 	am_promise_unref0(w->priv->peaks);
 }
@@ -114,6 +224,9 @@ waveform_class_init (WaveformClass* klass)
 	g_object_class_install_property (G_OBJECT_CLASS (klass), WAVEFORM_PROPERTY1, g_param_spec_int ("property1", "property1", "property1", G_MININT, G_MAXINT, 0, G_PARAM_STATIC_NAME | G_PARAM_STATIC_NICK | G_PARAM_STATIC_BLURB | G_PARAM_READABLE));
 	g_signal_new ("peakdata_ready", TYPE_WAVEFORM, G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
 	g_signal_new ("hires_ready", TYPE_WAVEFORM, G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__INT, G_TYPE_NONE, 1, G_TYPE_INT);
+	g_signal_new ("blocks_ready", TYPE_WAVEFORM, G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__POINTER, G_TYPE_NONE, 1, G_TYPE_POINTER);
+	g_signal_new ("frames_appended", TYPE_WAVEFORM, G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__POINTER, G_TYPE_NONE, 1, G_TYPE_POINTER);
+	g_signal_new ("spectrogram_ready", TYPE_WAVEFORM, G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_VOID__POINTER, G_TYPE_NONE, 1, G_TYPE_POINTER);
 }
 
 
@@ -136,12 +249,17 @@ waveform_finalize (GObject* obj)
 	waveform_peakgen_cancel(w);
 #endif
 
+	waveform_unregister(w);
+	if(_w->live) waveform_live_free(w);
+	if(_w->spectrogram) waveform_spectrogram_free(w);
+
 	// the warning below occurs when the waveform is created and destroyed very quickly.
 	if(g_hash_table_size(wf->peak_cache) && !g_hash_table_remove(wf->peak_cache, w) && wf_debug) pwarn("failed to remove waveform from peak_cache");
 
 	int c; for(c=0;c<WF_MAX_CH;c++){
-		if(_w->peak.buf[c]) g_free(_w->peak.buf[c]);
+		if(_w->peak.buf[c] && !wf_service_release(_w->peak.buf[c])) g_free(_w->peak.buf[c]);
 	}
+	g_free(_w->summary);
 
 	if(_w->peaks){
 		if(!_w->peaks->is_resolved){
@@ -229,12 +347,8 @@ waveform_load (Waveform* w, WfCallback3 callback, gpointer user_data)
 {
 	WaveformPrivate* _w = w->priv;
 
-	if(g_strrstr(w->filename, "%L")){
-		char rhs[256] = {0};
-		waveform_get_rhs(w->filename, rhs);
-		if(g_file_test(rhs, G_FILE_TEST_EXISTS)){
-			w->n_channels = 2;
-		}
+	if(w->is_split){
+		w->n_channels = 2;
 	}
 
 	if(!_w->peaks){
@@ -247,13 +361,16 @@ waveform_load (Waveform* w, WfCallback3 callback, gpointer user_data)
 		WF_NEW(C, .callback = callback, .user_data = user_data)
 	);
 
-	if(_w->peak.buf[0] || _w->state & WAVEFORM_LOADING){
+	if(_w->peak.buf[0] || _w->state & WAVEFORM_LOADING || _w->live){
 		dbg(1, "subsequent load request");
 		return;
 	}
 
 	_w->state |= WAVEFORM_LOADING;
-	waveform_ensure_peakfile(w, waveform_load_have_peak, NULL);
+	if(wf_service_is_connected() && !w->is_split)
+		wf_service_load_peaks(w, waveform_load_have_peak, NULL);
+	else
+		waveform_ensure_peakfile(w, waveform_load_have_peak, NULL);
 }
 
 
@@ -268,6 +385,8 @@ waveform_load_sync(Waveform* w)
 		_w->peaks = am_promise_new(w);
 	}
 
+	if(_w->live) return !!_w->peak.buf[WF_LEFT];
+
 	char* peakfile = waveform_ensure_peakfile__sync(w);
 	if(peakfile){
 		bool loaded = waveform_load_peak(w, peakfile, 0);
@@ -278,19 +397,190 @@ waveform_load_sync(Waveform* w)
 }
 
 
+#define BULK_MAX_THREADS 8 // the threads mostly wait for the disk
+
+	typedef struct {
+		Waveform*       waveform;
+		char*           filename;         // absolute
+		char*           peakfile;
+		WfPeakMeta      meta;
+		short*          data;             // interleaved, as stored in the peakfile
+		int             n_channels;
+		int             size;
+		WfBlockSummary* summary;
+		int             n_summary_blocks;
+	} BulkItem;
+
+	static struct {
+		GThreadPool* pool;
+		GAsyncQueue* done;
+		gint         scheduled;
+	} bulk;
+
+	static void waveform_bulk_install (BulkItem* item)
+	{
+		Waveform* w = item->waveform;
+		WaveformPrivate* _w = w->priv;
+
+		if(!item->data || !_w->peaks || _w->peaks->error || _w->peak.buf[WF_LEFT]){
+			// the normal path handles peakgen, offline files, and errors
+			waveform_ensure_peakfile(w, waveform_load_have_peak, NULL);
+			return;
+		}
+
+		waveform_set_meta(w, &item->meta);
+
+		short* buf[WF_STEREO] = {NULL,};
+		for(int c=0;c<item->n_channels;c++){
+			buf[c] = waveform_peakbuf_malloc(w, c, item->size);
+		}
+		// de-interleave. Each peak is stored as the positive and negative values for each channel in turn.
+		for(int i=0;i<item->size/2;i++){
+			for(int c=0;c<item->n_channels;c++){
+				int src = 2 * (i * item->n_channels + c);
+				buf[c][2 * i    ] = item->data[src    ];
+				buf[c][2 * i + 1] = item->data[src + 1];
+			}
+		}
+
+		waveform_peak_init(w, item->peakfile, 0, g_steal_pointer(&item->summary), item->n_summary_blocks);
+
+		waveform_load_have_peak(w, g_steal_pointer(&item->peakfile), NULL);
+	}
+
+	static gboolean waveform_bulk_drain (gpointer _)
+	{
+		g_atomic_int_set(&bulk.scheduled, 0);
+
+		BulkItem* item;
+		while((item = g_async_queue_try_pop(bulk.done))){
+			waveform_bulk_install(item);
+
+			g_object_unref(item->waveform);
+			g_free(item->filename);
+			g_free(item->peakfile);
+			g_free(item->data);
+			g_free(item->summary);
+			g_free(item);
+		}
+
+		return G_SOURCE_REMOVE;
+	}
+
+	static void waveform_bulk_run (gpointer _item, gpointer _)
+	{
+		// runs in a pool thread. The Waveform is not accessed.
+
+		BulkItem* item = _item;
+
+		if((item->peakfile = wf_peakfile_lookup(item->filename, &item->meta))){
+			item->data = wf_peakfile_read_data(item->peakfile, &item->n_channels, &item->size);
+			item->summary = wf_peakfile_read_summary(item->peakfile, &item->n_summary_blocks);
+		}
+
+		// completed items are installed together in the main thread
+		g_async_queue_push(bulk.done, item);
+		if(g_atomic_int_compare_and_exchange(&bulk.scheduled, 0, 1)) g_idle_add(waveform_bulk_drain, NULL);
+	}
+
+/*
+ *  Load the peakdata for many Waveforms, eg when opening a session.
+ *
+ *  The cache dir is checked once, and the peakfile lookups and reads are
+ *  done concurrently by a pool of threads so that a cold load is limited
+ *  by the disk throughput rather than the latency of each request.
+ *
+ *  @callback is called for each Waveform once it has loaded, as for waveform_load().
+ *  Files that do not yet have a current peakfile are passed to the peak generator.
+ */
+void
+waveform_load_many (Waveform** waveforms, int n_waveforms, WfCallback3 callback, gpointer user_data)
+{
+	bool have_cache_dir = wf_create_cache_dir();
+	g_autofree char* cwd = g_get_current_dir();
+
+	if(!bulk.pool){
+		bulk.pool = g_thread_pool_new(waveform_bulk_run, NULL, BULK_MAX_THREADS, false, NULL);
+		bulk.done = g_async_queue_new();
+	}
+
+	for(int i=0;i<n_waveforms;i++){
+		Waveform* w = waveforms[i];
+		WaveformPrivate* _w = w->priv;
+
+		bool can_batch = have_cache_dir
+			&& w->filename
+			&& !g_strrstr(w->filename, "%L")
+			&& !_w->live
+			&& !_w->peak.buf[WF_LEFT]
+			&& !(_w->state & WAVEFORM_LOADING)
+			&& wf->load_peak == wf_load_riff_peak
+			&& !wf_service_is_connected();
+
+		if(!can_batch){
+			waveform_load(w, callback, user_data);
+			continue;
+		}
+
+		if(!_w->peaks){
+			_w->peaks = am_promise_new(w);
+		}
+
+		am_promise_add_callback(
+			_w->peaks,
+			waveform_load_done,
+			WF_NEW(C, .callback = callback, .user_data = user_data)
+		);
+
+		_w->state |= WAVEFORM_LOADING;
+
+		g_thread_pool_push(bulk.pool, WF_NEW(BulkItem,
+			.waveform = g_object_ref(w),
+			.filename = g_path_is_absolute(w->filename) ? g_strdup(w->filename) : g_build_filename(cwd, w->filename, NULL)
+		), NULL);
+	}
+}
+
+
+/*
+ *  The properties are read from the file when first needed, which can be in any thread.
+ *  n_frames is set last, with a release barrier, as other threads use it to see that
+ *  the other properties are set.
+ */
+static GRecMutex sf_lock;
+
+
+/*
+ *  Set the properties if they are not already set, eg from the peakfile metadata.
+ */
+void
+waveform_set_sf_data (Waveform* w, uint64_t n_frames, int n_channels, int samplerate)
+{
+	g_rec_mutex_lock(&sf_lock);
+	if(!w->n_frames){
+		w->n_channels = w->n_channels ? w->n_channels : n_channels; // already set for split stereo files
+		w->samplerate = samplerate;
+		N_FRAMES_SET(w, n_frames);
+	}
+	g_rec_mutex_unlock(&sf_lock);
+}
+
+
 static void
 waveform_get_sf_data(Waveform* w)
 {
-	g_return_if_fail(w->filename);
 	WaveformPrivate* _w = w->priv;
+	if(_w->live) return; // the properties are set by waveform_new_live()
+
+	g_return_if_fail(w->filename);
 
 	if(w->offline) return;
 
 	WfDecoder d = {{0,}};
 	if (ad_open(&d, w->filename)) {
-		w->n_frames = d.info.frames; // for some filetypes this will be an estimate
 		w->n_channels = w->n_channels ? w->n_channels : d.info.channels; // file info is not correct in the case of split stereo files.
 		w->samplerate = d.info.sample_rate;
+		N_FRAMES_SET(w, d.info.frames); // for some filetypes this will be an estimate
 
 		ad_clear(&d);
 	} else {
@@ -306,7 +596,7 @@ waveform_get_sf_data(Waveform* w)
 			// attempt to work with only a pre-existing peakfile in case file is temporarily unmounted
 			if(waveform_load_sync(w)){
 				w->n_channels = _w->peak.buf[1] ? 2 : 1;
-				w->n_frames = _w->num_peaks * WF_PEAK_RATIO;
+				N_FRAMES_SET(w, _w->num_peaks * WF_PEAK_RATIO);
 				dbg(1, "offline, have peakfile: n_frames=%"PRIi64" c=%i", w->n_frames, w->n_channels);
 				return;
 			}
@@ -329,12 +619,25 @@ waveform_get_sf_data(Waveform* w)
 }
 
 
+/*
+ *  The lock is recursive because an offline file falls back to loading the peakfile,
+ *  which can ask for the properties again.
+ */
+static void
+waveform_ensure_sf_data (Waveform* w)
+{
+	g_rec_mutex_lock(&sf_lock);
+	if(!w->n_frames) waveform_get_sf_data(w);
+	g_rec_mutex_unlock(&sf_lock);
+}
+
+
 uint64_t
 waveform_get_n_frames(Waveform* w)
 {
-	if(!w->n_frames) waveform_get_sf_data(w);
+	if(!N_FRAMES_GET(w)) waveform_ensure_sf_data(w);
 
-	return w->n_frames;
+	return N_FRAMES_GET(w);
 }
 
 
@@ -348,44 +651,24 @@ waveform_get_n_channels (Waveform* w)
 {
 	g_return_val_if_fail(w, 0);
 
-	if(w->n_frames) return MIN(2, w->n_channels);
+	if(N_FRAMES_GET(w)) return MIN(2, w->n_channels);
 
 	if(w->offline) return 0;
 
-	waveform_get_sf_data(w);
+	waveform_ensure_sf_data(w);
 
 	return MIN(2, w->n_channels);
 }
 
 
 /*
- *  Load the pre-existing peak file from disk into a buffer.
- *
- *  It is usually preferable to use waveform_load() instead,
- *  which will transparently manage the creation and loading of the peakfile.
- *  but this fn can be called explicitly if you have a pre-existing peakfile in
- *  a non-standard location.
- *
- *  Can be used to add an additional channel to an existing Waveform
- *  where the audio consists of split files.
- *
- *  @param ch_num - must be 0 or 1. Should be 0 unless loading rhs for split file.
+ *  Complete the initialisation of the Waveform once its peak buffers have been set.
+ *  Takes ownership of @summary. If it is NULL, the summary is read from the peakfile.
  */
-bool
-waveform_load_peak (Waveform* w, const char* peak_file, int ch_num)
+static void
+waveform_peak_init (Waveform* w, const char* peak_file, int ch_num, WfBlockSummary* summary, int n_summary_blocks)
 {
-	g_return_val_if_fail(w, false);
-	g_return_val_if_fail(ch_num <= WF_MAX_CH, false);
 	WaveformPrivate* _w = w->priv;
-	g_return_val_if_fail(!_w->peaks->error, false);
-
-	// check is not previously loaded
-	if(_w->peak.buf[ch_num]){
-		dbg(2, "using existing peak data...");
-		return true;
-	}
-
-	wf->load_peak(w, peak_file);
 
 	if(ch_num) w->n_channels = MAX(w->n_channels, ch_num + 1); // for split stereo files
 
@@ -393,8 +676,24 @@ waveform_load_peak (Waveform* w, const char* peak_file, int ch_num)
 	_w->n_blocks = _w->num_peaks / WF_TEXTURE_VISIBLE_SIZE + ((_w->num_peaks % WF_TEXTURE_VISIBLE_SIZE) ? 1 : 0);
 	dbg(1, "ch=%i num_peaks=%i", ch_num, _w->num_peaks);
 
+	// the summary in a lhs peakfile does not include the rhs, so must be recalculated
+	g_clear_pointer(&_w->summary, g_free);
+	_w->max_db = -1;
+	if(!ch_num){
+		int n_blocks = n_summary_blocks;
+		_w->summary = summary ? summary : wf_peakfile_read_summary(peak_file, &n_blocks);
+		if(_w->summary && n_blocks != _w->n_blocks){
+			dbg(1, "ignoring summary: n_blocks=%i expected=%i", n_blocks, _w->n_blocks);
+			g_clear_pointer(&_w->summary, g_free);
+		}
+	}else{
+		g_free(summary);
+	}
+
 	if(!_w->num_peaks){
 		_w->peaks->error = g_error_new(g_quark_from_static_string(wf->domain), 1, "Failed to load peak");
+	}else if(!_w->live){
+		g_atomic_int_set(&_w->peaks_published, true);
 	}
 
 #ifdef DEBUG
@@ -413,11 +712,67 @@ waveform_load_peak (Waveform* w, const char* peak_file, int ch_num)
 		}
 	}
 #endif
+}
+
+
+/*
+ *  Load the pre-existing peak file from disk into a buffer.
+ *
+ *  It is usually preferable to use waveform_load() instead,
+ *  which will transparently manage the creation and loading of the peakfile.
+ *  but this fn can be called explicitly if you have a pre-existing peakfile in
+ *  a non-standard location.
+ *
+ *  Can be used to add an additional channel to an existing Waveform
+ *  where the audio consists of split files.
+ *
+ *  @param ch_num - must be 0 or 1. Should be 0 unless loading rhs for split file.
+ */
+bool
+waveform_load_peak (Waveform* w, const char* peak_file, int ch_num)
+{
+	g_return_val_if_fail(w, false);
+	g_return_val_if_fail(ch_num <= WF_MAX_CH, false);
+	WaveformPrivate* _w = w->priv;
+	g_return_val_if_fail(!_w->peaks->error, false);
+
+	// check is not previously loaded
+	if(_w->peak.buf[ch_num] && _w->num_peaks){
+		dbg(2, "using existing peak data...");
+		return true;
+	}
+
+	// the buffers are already set if the peaks were obtained from the peak service
+	if(!_w->peak.buf[ch_num]) wf->load_peak(w, peak_file);
+
+	waveform_peak_init(w, peak_file, ch_num, NULL, 0);
 
 	return !!w->priv->peak.buf[ch_num];
 }
 
 
+/*
+ *  Get the peak data for reading from any thread. Returns false if the peaks are not loaded.
+ *  The data is not modified until the Waveform is finalized, so it can be used for as long
+ *  as a reference to the Waveform is held.
+ */
+bool
+waveform_get_peaks (Waveform* w, WfPeakView* view)
+{
+	g_return_val_if_fail(w && view, false);
+
+	WaveformPrivate* _w = w->priv;
+	if(!g_atomic_int_get(&_w->peaks_published)) return false;
+
+	*view = (WfPeakView){
+		.buf = {_w->peak.buf[WF_LEFT], _w->peak.buf[WF_RIGHT]},
+		.n_peaks = _w->num_peaks
+	};
+
+	return true;
+}
+
+
 bool
 waveform_peak_is_loaded(Waveform* w, int ch_num)
 {
@@ -661,23 +1016,90 @@ waveform_get_n_audio_blocks (Waveform* w)
 }
 
 
-short
-waveform_find_max_audio_level(Waveform* w)
+/*
+ *  For peakfiles without a summary chunk, the summary is derived from the peak data.
+ *  The rms values are not available in this case and are set to zero.
+ */
+static bool
+waveform_ensure_summary (Waveform* w)
 {
-	if(w->priv->max_db > -1) return w->priv->max_db;
+	WaveformPrivate* _w = w->priv;
+	if(_w->summary) return true;
+	if(!_w->peak.buf[WF_LEFT] || !_w->n_blocks) return false;
+
+	WfBlockSummary* summary = _w->summary = g_new0(WfBlockSummary, _w->n_blocks + 1);
 
-	int i;
-	short max_level = 0;
-	int c; for(c=0;c<2;c++){
-		short* buf = w->priv->peak.buf[c];
+	for(int c=0;c<WF_MAX_CH;c++){
+		short* buf = _w->peak.buf[c];
 		if(!buf) continue;
 
-		for(i=0;i<w->priv->peak.size;i++){
-			max_level = MAX(max_level, buf[i]);
+		for(int i=0;i<_w->num_peaks;i++){
+			WfBlockSummary* block = &summary[1 + i / WF_TEXTURE_VISIBLE_SIZE];
+			block->max = MAX(block->max, buf[2 * i]);
+			block->min = MIN(block->min, buf[2 * i + 1]);
+			block->n_clipped += (buf[2 * i] >= G_MAXINT16) + (buf[2 * i + 1] <= -G_MAXINT16);
 		}
 	}
 
-	return w->priv->max_db = max_level;
+	for(int b=1;b<=_w->n_blocks;b++){
+		summary[b].silent = MAX(summary[b].max, -summary[b].min) < WF_SILENCE_LEVEL;
+		summary[0].max = MAX(summary[0].max, summary[b].max);
+		summary[0].min = MIN(summary[0].min, summary[b].min);
+		summary[0].n_clipped += summary[b].n_clipped;
+	}
+	summary[0].silent = MAX(summary[0].max, -summary[0].min) < WF_SILENCE_LEVEL;
+
+	return true;
+}
+
+
+/*
+ *  Returns the levels for the given texture block, or NULL if the peak data is not loaded.
+ *  Block -1 returns the summary for the whole file.
+ */
+const WfBlockSummary*
+waveform_get_block_summary (Waveform* w, int block)
+{
+	g_return_val_if_fail(w, NULL);
+	g_return_val_if_fail(block >= -1, NULL);
+
+	if(!waveform_ensure_summary(w)) return NULL;
+	if(block >= w->priv->n_blocks) return NULL;
+
+	return &w->priv->summary[block + 1];
+}
+
+
+/*
+ *  Returns the largest absolute level in the range of texture blocks,
+ *  or -1 if the peak data is not loaded.
+ *  The range is clamped to the available blocks.
+ */
+short
+waveform_get_block_level (Waveform* w, int first, int last)
+{
+	g_return_val_if_fail(w, -1);
+
+	if(!waveform_ensure_summary(w)) return -1;
+
+	WfBlockSummary* summary = w->priv->summary + 1;
+	short level = 0;
+	for(int b=MAX(first, 0);b<=MIN(last, w->priv->n_blocks - 1);b++){
+		level = MAX(level, MAX(summary[b].max, -MAX(summary[b].min, -G_MAXINT16)));
+	}
+
+	return level;
+}
+
+
+short
+waveform_find_max_audio_level(Waveform* w)
+{
+	if(w->priv->max_db > -1) return w->priv->max_db;
+
+	if(!waveform_ensure_summary(w)) return 0;
+
+	return w->priv->max_db = w->priv->summary[0].max;
 }
 
 
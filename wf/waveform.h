@@ -58,6 +58,15 @@ typedef struct
 	double len;
 } WfSampleRegionf;
 
+typedef struct
+{
+	short    max;
+	short    min;
+	short    rms;
+	bool     silent;
+	uint32_t n_clipped;         // number of full scale samples
+} WfBlockSummary;               // levels for the audio in one texture block
+
 typedef struct
 {
 	float left;
@@ -80,7 +89,7 @@ struct _Waveform
 	bool               offline : 1;       // file is not currently accessible
 	bool               renderable : 1;    // false if there is a problem with the file. Note that there may be a peakfile for a file which does not exist
 
-	WfCallback4        free_render_data;  // finalize callback
+	WfCallback4        free_render_data;  // called on finalize and when the file is changed
 
 	WaveformPrivate*   priv;
 };
@@ -105,6 +114,40 @@ struct _buf
 	guint size;
 };
 
+/*
+ *  Thread-safe access
+ *
+ *  A Waveform is owned by the main thread, which is the only thread that loads
+ *  or frees its data. Other threads that hold a reference to the Waveform can use:
+ *
+ *   - waveform_get_n_frames() and waveform_get_n_channels(). The file is only read once.
+ *   - waveform_get_peaks(). Once loaded, the peak data does not change until the
+ *     Waveform is finalized.
+ *   - waveform_get_audio_block(). Returns a reference counted snapshot of a block
+ *     of audio, which remains valid after the block has been removed from the cache.
+ *
+ *  Everything else, including the hi-res peak buffers, is for the main thread only.
+ *  Live Waveforms are not supported by these functions.
+ */
+typedef struct
+{
+	const short*  buf[WF_STEREO];       // positive and negative values for each peak
+	int           n_peaks;
+} WfPeakView;
+
+struct _WfAudioBlock
+{
+	int           block_num;
+	guint         size;                 // frames. The end of the last block of a file is silence.
+	const short*  buf[WF_STEREO];
+
+	// private
+	gint          ref_count;
+	bool          zero_copy;            // buf[WF_LEFT] points into the file mapping
+	struct _WfAudioMap* map;
+	WfBuf16*      cached;               // the cache entry. Only valid while the block is published
+};
+
 //high level api
 Waveform*  waveform_load_new             (const char* filename);
 void       waveform_set_peak_loader      (PeakLoader);
@@ -114,9 +157,11 @@ int        waveform_get_n_channels       (Waveform*);
 //low level api
 GType      waveform_get_type             () G_GNUC_CONST;
 Waveform*  waveform_new                  (const char* filename);
+Waveform*  waveform_new_shared           (const char* filename);
 Waveform*  waveform_construct            (GType);
 #define    waveform_unref0(w)            (g_object_unref(w), w = NULL)
 void       waveform_load                 (Waveform*, WfCallback3, gpointer);
+void       waveform_load_many            (Waveform**, int, WfCallback3, gpointer);
 bool       waveform_load_sync            (Waveform*);
 void       waveform_set_file             (Waveform*, const char*);
 
@@ -127,6 +172,16 @@ RmsBuf*    waveform_load_rms_file        (Waveform*, int ch);
 void       waveform_load_audio           (Waveform*, int block_num, int n_tiers_needed, WfAudioCallback, gpointer);
 void       waveform_load_audio_sync      (Waveform*, int block_num, int n_tiers_needed);
 short      waveform_find_max_audio_level (Waveform*);
+const WfBlockSummary*
+           waveform_get_block_summary    (Waveform*, int block);
+short      waveform_get_block_level      (Waveform*, int first_block, int last_block);
+
+bool       waveform_get_peaks            (Waveform*, WfPeakView*);
+WfAudioBlock*
+           waveform_get_audio_block      (Waveform*, int block_num);
+WfAudioBlock*
+           wf_audio_block_ref            (WfAudioBlock*);
+void       wf_audio_block_unref          (WfAudioBlock*);
 
 int32_t    wf_get_peakbuf_len_frames     ();
 
@@ -54,19 +54,21 @@ worker_unref_waveform (gpointer _w)
 }
 
 
-typedef struct {
+typedef struct _WorkerJob WorkerJob;
+
+struct _WorkerJob {
 	WfWorker*  worker;
 	QueueItem* job;
-} WorkerJob;
+	WorkerJob* next;
+};
 
 
 /*
  *   Do clean-up and notifications in the main thread
  */
-static gboolean
-worker_post (gpointer _wj)
+static void
+worker_post (WorkerJob* wj)
 {
-	WorkerJob* wj = _wj;
 	QueueItem* job = wj->job;
 	WfWorker* w = wj->worker;
 
@@ -86,11 +88,60 @@ worker_post (gpointer _wj)
 	g_weak_ref_set(&job->ref, NULL);
 	g_free(job);
 	g_free(wj);
+}
+
+
+/*
+ *  All jobs completed since the last dispatch are handled together so that
+ *  when many blocks finish loading at once, the main loop is only woken once
+ *  and any notifications queued by the done callbacks are coalesced.
+ */
+static gboolean
+worker_drain (gpointer _w)
+{
+	WfWorker* w = _w;
+
+	WorkerJob* head;
+	do {
+		head = g_atomic_pointer_get(&w->done);
+	} while(!g_atomic_pointer_compare_and_exchange(&w->done, head, NULL));
+
+	// the stack is in reverse order of completion
+	WorkerJob* list = NULL;
+	while(head){
+		WorkerJob* next = head->next;
+		head->next = list;
+		list = head;
+		head = next;
+	}
+
+	while(list){
+		WorkerJob* next = list->next;
+		worker_post(list);
+		list = next;
+	}
 
 	return G_SOURCE_REMOVE;
 }
 
 
+/*
+ *  Can be called from any thread.
+ *  A dispatch is only scheduled if the queue was empty, the others will be included in it.
+ */
+static void
+worker_queue_post (WfWorker* w, WorkerJob* wj)
+{
+	WorkerJob* head;
+	do {
+		head = g_atomic_pointer_get(&w->done);
+		wj->next = head;
+	} while(!g_atomic_pointer_compare_and_exchange(&w->done, head, wj));
+
+	if(!head) g_timeout_add(1, worker_drain, w);
+}
+
+
 static inline void
 process_new_job (WfWorker* w, QueueItem* job)
 {
@@ -105,7 +156,7 @@ process_new_job (WfWorker* w, QueueItem* job)
 		g_idle_add(worker_unref_waveform, waveform); // release the ref added by g_weak_ref_get()
 	}
 
-	g_timeout_add(1, worker_post,
+	worker_queue_post(w,
 		WF_NEW(WorkerJob,
 			.job = job,
 			.worker = w